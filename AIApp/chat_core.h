@@ -0,0 +1,490 @@
+#ifndef AIAPP_CHAT_CORE_H
+#define AIAPP_CHAT_CORE_H
+
+#include <hiredis/hiredis.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "chat_envelope.h"
+#include "message_filter.h"
+#include "mpsc_ring.h"
+#include "redis_endpoint.h"
+#include "reply_arena.h"
+#include "shm_ring.h"
+#include "timing_wheel.h"
+
+// 接收和分发的统计数据，接收线程和分发线程写入，其他线程随时读取
+struct DispatchStats
+{
+    std::atomic<uint64_t> received{0}; // 收到的消息总数
+    std::atomic<uint64_t> dropped{0};  // 队列满时被丢弃的消息数
+    std::atomic<uint64_t> batches{0};  // 投递给 sink 的批次数
+    std::atomic<uint64_t> lastBatch{0};
+    std::atomic<uint64_t> maxBatch{0};
+    std::atomic<uint64_t> reconnects{0}; // 订阅连接断开之后重新连接成功的次数
+    std::atomic<uint64_t> filtered{0};   // 命中过滤器 Drop 规则、没有交给 sink 的消息数
+};
+
+/**
+ * 聊天客户端的接收核心，不依赖任何界面库
+ *
+ * - 接收线程：一个订阅连接，回复在 ReplyArena 上解析，解析出的正文放进无锁队列；
+ *   设置了 shmRing 时不连接 Redis，改为读取本机 shm_relay 写入的共享内存环形缓冲区 (见 shm_ring.h)，
+ *   同一台机器上的多个进程共享 relay 的一个订阅，Redis 每条消息只向这台机器发送一次
+ * - 连接保活：接收线程用 poll 等数据，心跳和空闲超时是一个时间轮 (timing_wheel.h) 上的两个定时器，每次收到数据都重新计时；
+ *   连接空闲 heartbeatInterval 发一次 PING，idleTimeout 内什么都没收到 (Redis 挂住、网络断了但是没有 RST) 就认为连接已经断开，
+ *   按指数退避重连并重新订阅，不会像阻塞的 redisGetReply 那样永远卡住
+ * - 内容过滤：设置了 filter 时，接收线程对每条消息的正文扫描一遍 (message_filter.h)，按规则计数，
+ *   命中 Drop 规则的消息不进队列
+ * - 分发线程：每帧 (frameInterval) 从队列里批量取出消息，整批交给 sink
+ *   sink 还没有处理完上一批 (没有调用 batchDone) 时继续攒着，下一帧再一起交出去，
+ *   攒着的消息最多保留 maxPending 条，更老的直接丢掉，下游卡住时内存也不会增长
+ *
+ * 发送不在这里，使用 ChatPublisher；界面 (testAppMultThread) 和无界面的压测程序 (fanout_bench) 共用这个核心
+*/
+class ChatCore
+{
+public:
+    // 在分发线程里调用，batch 可以直接移走；处理完 (可以是异步的) 之后必须调用 batchDone()
+    typedef std::function<void(std::vector<std::string>&& batch)> BatchSink;
+    // 在接收线程里对每一条解析成功的信封调用，用于统计延迟、丢失等，不能阻塞
+    typedef std::function<void(const Envelope&)> EnvelopeObserver;
+
+    struct Options
+    {
+        RedisEndpoint endpoint;
+        std::string channel = "chat";
+        size_t queueCapacity = 65536; // 接收线程和分发线程之间的队列容量
+        size_t maxBatch = 65536;      // 分发线程每一帧最多从队列里取出的消息数
+        size_t maxPending = 10000;    // 还没交给 sink 的消息最多保留的条数
+        std::chrono::milliseconds frameInterval{16}; // 分发的帧间隔，默认最多 60 Hz
+        std::string shmRing;          // 非空时从这个共享内存环读取 (由 shm_relay 订阅 channel 并写入)，endpoint 不再使用
+        std::chrono::milliseconds heartbeatInterval{5000}; // 连接空闲这么久就发一次 PING，0 表示不发
+        std::chrono::milliseconds idleTimeout{15000};      // 这么久没有收到任何数据就断开重连，0 表示不检查
+        bool reconnect = true;                             // 为 false 时连接断开后接收线程直接退出 (disconnected() 为 true)
+        std::chrono::milliseconds reconnectMin{100};       // 重连的指数退避从这里开始
+        std::chrono::milliseconds reconnectMax{10000};     // 每次重连之前最多等待这么久
+        std::shared_ptr<const MessageFilter> filter;       // 已经编译好的过滤规则，为空时不过滤
+    };
+
+    ChatCore(Options opts, BatchSink sink)
+        : m_opts(std::move(opts)), m_sink(std::move(sink)), m_queue(m_opts.queueCapacity),
+          m_subContext(NULL), m_subFd(-1), m_running(false), m_sinkBusy(false), m_connDead(false),
+          m_heartbeatTimer(onHeartbeat, this), m_idleTimer(onIdleTimeout, this)
+    {
+        if (m_opts.filter)
+        {
+            m_ruleHits.reset(new std::atomic<uint64_t>[m_opts.filter->ruleCount()]());
+        }
+    }
+
+    ~ChatCore()
+    {
+        stop();
+    }
+
+    ChatCore(const ChatCore&) = delete;
+    ChatCore& operator=(const ChatCore&) = delete;
+
+    // 需要在 start() 之前设置
+    void setObserver(EnvelopeObserver observer) { m_observer = std::move(observer); }
+
+    // 连接并订阅频道 (或者打开共享内存环)，返回时订阅已经生效，然后启动接收线程和分发线程
+    bool start()
+    {
+        if (!m_opts.shmRing.empty())
+        {
+            m_ring.reset(new ShmRingReader);
+            if (!m_ring->open(m_opts.shmRing.c_str()))
+            {
+                m_ring.reset();
+                return false;
+            }
+        }
+        else if (!subscribe())
+        {
+            return false;
+        }
+        m_running = true;
+        m_receiveThread = m_ring ? std::thread(&ChatCore::ringLoop, this) : std::thread(&ChatCore::receiveLoop, this);
+        m_dispatchThread = std::thread(&ChatCore::dispatchLoop, this);
+        return true;
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_stopMutex);
+            if (!m_running)
+            {
+                return;
+            }
+            m_running = false;
+            // 接收线程阻塞在 poll 上，关闭 socket 的读写让它醒来并退出；正在等待重连的话会被下面的 notify_all 唤醒
+            // 接收线程在这把锁下更换连接，这里拿到的 fd 不会已经被关闭
+            if (m_subFd >= 0)
+            {
+                shutdown(m_subFd, SHUT_RDWR);
+            }
+        }
+        m_stopCondVar.notify_all();
+        if (m_ring)
+        {
+            // 读环的接收线程最多睡眠 RING_WAIT_MS 就会检查一次
+            m_ringStop.store(true);
+        }
+        m_receiveThread.join();
+        m_dispatchThread.join();
+        if (m_subContext != NULL)
+        {
+            redisFree(m_subContext);
+            m_subContext = NULL;
+        }
+        m_ring.reset();
+    }
+
+    // sink 处理完一批消息之后调用，可以在任意线程里调用
+    void batchDone() { m_sinkBusy.store(false); }
+
+    const DispatchStats& stats() const { return m_stats; }
+    size_t queueDepth() const { return m_queue.sizeApprox(); }
+    // 订阅连接因为出错而断开 (而不是被 stop() 停止) 时为 true，例如订阅者太慢被服务器断开；
+    // reconnect 为 true 时重连成功后恢复为 false
+    bool disconnected() const { return m_disconnected.load(std::memory_order_relaxed); }
+    // 过滤规则 rule (编号同 MessageFilter) 命中的消息数，一条消息对同一条规则只算一次
+    uint64_t ruleHits(size_t rule) const
+    {
+        return m_ruleHits ? m_ruleHits[rule].load(std::memory_order_relaxed) : 0;
+    }
+
+private:
+    // 连接和 SUBSCRIBE 都以 idleTimeout 为上限，重连时 Redis 挂住也不会让接收线程永远卡在这里；
+    // 发送 SUBSCRIBE 之前就把 fd 交给 m_subFd，stop() 可以随时关闭它
+    bool subscribe()
+    {
+        long timeoutMs = (long)m_opts.idleTimeout.count();
+        struct timeval tv = {timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+        m_subContext = timeoutMs > 0 ? m_opts.endpoint.connect(tv) : m_opts.endpoint.connect();
+        if (m_subContext == NULL || m_subContext->err)
+        {
+            if (m_subContext)
+            {
+                std::cerr << "Error: " << m_subContext->errstr << std::endl;
+                redisFree(m_subContext);
+                m_subContext = NULL;
+            }
+            else
+            {
+                std::cerr << "Can't allocate redis context" << std::endl;
+            }
+            return false;
+        }
+        if (timeoutMs > 0)
+        {
+            redisSetTimeout(m_subContext, tv);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_stopMutex);
+            m_subFd = m_subContext->fd;
+        }
+        redisReply* reply = (redisReply*)redisCommand(m_subContext, "SUBSCRIBE %b", m_opts.channel.data(), m_opts.channel.size());
+        if (reply == NULL)
+        {
+            std::cerr << "Error: " << m_subContext->errstr << std::endl;
+            {
+                std::lock_guard<std::mutex> lock(m_stopMutex);
+                m_subFd = -1;
+            }
+            redisFree(m_subContext);
+            m_subContext = NULL;
+            return false;
+        }
+        freeReplyObject(reply);
+        return true;
+    }
+
+    void receiveLoop()
+    {
+        Backoff backoff((uint64_t)m_opts.reconnectMin.count() * 1000000ULL, (uint64_t)m_opts.reconnectMax.count() * 1000000ULL);
+        while (true)
+        {
+            readSubscription();
+
+            {
+                std::lock_guard<std::mutex> lock(m_stopMutex);
+                if (!m_running)
+                {
+                    return;
+                }
+                m_subFd = -1;
+            }
+            // 心跳写失败时 hiredis 已经记下了原因，只有空闲超时没有 err
+            std::cerr << "Subscriber error: " << (m_subContext->err ? m_subContext->errstr : "idle timeout") << std::endl;
+            m_disconnected.store(true, std::memory_order_relaxed);
+            redisFree(m_subContext);
+            m_subContext = NULL;
+            if (!m_opts.reconnect)
+            {
+                return;
+            }
+
+            // 按指数退避重连，等待期间 stop() 可以随时唤醒
+            while (m_subContext == NULL)
+            {
+                uint64_t delayNs = backoff.next();
+                {
+                    std::unique_lock<std::mutex> lock(m_stopMutex);
+                    if (m_stopCondVar.wait_for(lock, std::chrono::nanoseconds(delayNs), [this]() { return !m_running; }))
+                    {
+                        return;
+                    }
+                }
+                subscribe();
+            }
+            {
+                // subscribe() 期间 stop() 已经关闭了 fd 的话，连接由 stop() 释放
+                std::lock_guard<std::mutex> lock(m_stopMutex);
+                if (!m_running)
+                {
+                    return;
+                }
+            }
+            backoff.reset();
+            m_disconnected.store(false, std::memory_order_relaxed);
+            m_stats.reconnects.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // 读一个已经订阅好的连接，直到它不能再用 (出错、对端关闭、空闲超时，或者 stop() 关闭了 socket)
+    void readSubscription()
+    {
+        // SUBSCRIBE 的回复用默认分配器释放之后，后续的消息都在 arena 上解析，每条消息不再有 malloc/free
+        ReplyArena arena;
+        arena.attach(m_subContext);
+        TimingWheel wheel(TIMER_TICK_NS);
+        m_connDead = false;
+        rearmTimers(wheel);
+
+        while (!m_connDead)
+        {
+            // 把读缓冲区里已经完整的消息全部取完，然后整批回收 arena
+            void* reply = NULL;
+            while (redisGetReplyFromReader(m_subContext, &reply) == REDIS_OK && reply != NULL)
+            {
+                handleMessage(static_cast<ArenaReply*>(reply));
+                reply = NULL;
+            }
+            if (m_subContext->err)
+            {
+                break;
+            }
+            arena.resetIfIdle(m_subContext->reader);
+
+            // 等数据或者最近的定时器到期
+            struct pollfd pfd = {m_subContext->fd, POLLIN, 0};
+            int n = poll(&pfd, 1, wheel.pollTimeoutMs());
+            if (n < 0 && errno != EINTR)
+            {
+                break;
+            }
+            if (n > 0)
+            {
+                if (redisBufferRead(m_subContext) != REDIS_OK)
+                {
+                    break;
+                }
+                // 收到了数据说明连接是活的，心跳和空闲超时都从现在重新计时，两次 O(1) 的链表操作
+                rearmTimers(wheel);
+            }
+            wheel.advance();
+        }
+        wheel.cancel(&m_heartbeatTimer);
+        wheel.cancel(&m_idleTimer);
+    }
+
+    void rearmTimers(TimingWheel& wheel)
+    {
+        if (m_opts.heartbeatInterval.count() > 0)
+        {
+            wheel.scheduleMs(&m_heartbeatTimer, (uint64_t)m_opts.heartbeatInterval.count());
+        }
+        if (m_opts.idleTimeout.count() > 0)
+        {
+            wheel.scheduleMs(&m_idleTimer, (uint64_t)m_opts.idleTimeout.count());
+        }
+    }
+
+    // 订阅状态下 Redis 同样接受 PING，回复 ["pong", ""]，handleMessage 会忽略它；收到回复时两个定时器都会重新计时
+    static void onHeartbeat(TimingWheel* wheel, WheelTimer* timer, void* clientData)
+    {
+        ChatCore* core = static_cast<ChatCore*>(clientData);
+        redisAppendCommand(core->m_subContext, "PING");
+        int done = 0;
+        while (!done)
+        {
+            if (redisBufferWrite(core->m_subContext, &done) != REDIS_OK)
+            {
+                core->m_connDead = true;
+                return;
+            }
+        }
+        wheel->scheduleMs(timer, (uint64_t)core->m_opts.heartbeatInterval.count());
+    }
+
+    static void onIdleTimeout(TimingWheel*, WheelTimer*, void* clientData)
+    {
+        static_cast<ChatCore*>(clientData)->m_connDead = true;
+    }
+
+    void ringLoop()
+    {
+        uint64_t lost = 0;
+        while (!m_ringStop.load(std::memory_order_relaxed))
+        {
+            // 把环里已有的消息全部取完，没有新消息时在 futex 上睡眠
+            size_t n = m_ring->poll(SIZE_MAX, [this](const char* data, size_t len) {
+                handlePayload(std::string_view(data, len));
+            });
+            // 读得太慢被 relay 覆盖掉的消息与队列满一样算作丢弃
+            if (m_ring->lost() != lost)
+            {
+                m_stats.dropped.fetch_add(m_ring->lost() - lost, std::memory_order_relaxed);
+                lost = m_ring->lost();
+            }
+            if (n == 0)
+            {
+                m_ring->wait(RING_WAIT_MS);
+            }
+        }
+    }
+
+    void handleMessage(const ArenaReply* reply)
+    {
+        if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 3)
+        {
+            return;
+        }
+        handlePayload(reply->element[2]->view());
+    }
+
+    void handlePayload(std::string_view text)
+    {
+        // 直接在 arena (或者读环的缓冲区) 里解析信封，只把正文拷贝一次放进队列；不是信封格式的消息原样交出去
+        Envelope envelope;
+        if (decodeEnvelope(text.data(), text.size(), envelope))
+        {
+            text = envelope.payload;
+            if (m_observer)
+            {
+                m_observer(envelope);
+            }
+        }
+        m_stats.received.fetch_add(1, std::memory_order_relaxed);
+        if (m_opts.filter)
+        {
+            // 每个字节一次查表，没有分配；命中的规则通常只有零条或一条
+            bool drop = m_opts.filter->scan(text, m_matches);
+            m_matches.forEach([this](size_t rule) {
+                m_ruleHits[rule].fetch_add(1, std::memory_order_relaxed);
+            });
+            if (drop)
+            {
+                m_stats.filtered.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        }
+        if (!m_queue.tryPush(std::string(text)))
+        {
+            // 队列满说明下游跟不上，宁可丢消息也不阻塞接收线程
+            m_stats.dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void dispatchLoop()
+    {
+        std::vector<std::string> pending;
+
+        std::unique_lock<std::mutex> lock(m_stopMutex);
+        while (m_running)
+        {
+            m_stopCondVar.wait_for(lock, m_opts.frameInterval, [this]() { return !m_running; });
+            if (!m_running)
+            {
+                break;
+            }
+            lock.unlock();
+
+            m_queue.drain(m_opts.maxBatch, [&pending](std::string&& message) {
+                pending.push_back(std::move(message));
+            });
+            if (pending.size() > m_opts.maxPending)
+            {
+                pending.erase(pending.begin(), pending.begin() + (pending.size() - m_opts.maxPending));
+            }
+            uint64_t pendingCount = pending.size();
+
+            // 每帧最多交出一批；上一批还没处理完就继续攒着，下一帧再一起交出去
+            if (pendingCount > 0 && !m_sinkBusy.exchange(true))
+            {
+                m_stats.batches.fetch_add(1, std::memory_order_relaxed);
+                m_stats.lastBatch.store(pendingCount, std::memory_order_relaxed);
+                if (pendingCount > m_stats.maxBatch.load(std::memory_order_relaxed))
+                {
+                    m_stats.maxBatch.store(pendingCount, std::memory_order_relaxed);
+                }
+                m_sink(std::move(pending));
+                pending.clear();
+            }
+
+            lock.lock();
+        }
+    }
+
+    static const int RING_WAIT_MS = 100;
+    // 订阅连接的心跳和空闲超时都是秒级的，10ms 一个 tick 足够
+    static const uint64_t TIMER_TICK_NS = 10 * 1000 * 1000;
+
+    Options m_opts;
+    BatchSink m_sink;
+    EnvelopeObserver m_observer;
+
+    // 接收线程 (生产者) 把消息放进无锁队列，分发线程 (唯一的消费者) 每帧批量取出
+    MpscRing<std::string> m_queue;
+    // 只在接收线程里使用 (start 之前和 stop 之后除外)
+    redisContext* m_subContext;
+    // 当前订阅连接的 fd，接收线程在 m_stopMutex 下更换，stop() 用它唤醒阻塞在 poll 上的接收线程
+    int m_subFd;
+    // 从共享内存环读取时使用，与 m_subContext 二选一
+    std::unique_ptr<ShmRingReader> m_ring;
+    std::atomic<bool> m_ringStop{false};
+    std::thread m_receiveThread;
+    std::thread m_dispatchThread;
+    // 这把锁只用于让分发线程在两帧之间睡眠、以及停止时唤醒它，消息的收发路径上不加锁
+    std::mutex m_stopMutex;
+    std::condition_variable m_stopCondVar;
+    bool m_running;
+    // 上一个批次还没有被 sink 处理完时为 true，此时分发线程继续攒批
+    std::atomic<bool> m_sinkBusy;
+    std::atomic<bool> m_disconnected{false};
+    // 下面四个只在接收线程里使用
+    bool m_connDead;              // 空闲超时或者心跳写失败，当前连接需要重连
+    WheelTimer m_heartbeatTimer;
+    WheelTimer m_idleTimer;
+    FilterMatches m_matches;      // 过滤器每次扫描的结果，反复使用
+    std::unique_ptr<std::atomic<uint64_t>[]> m_ruleHits;
+    DispatchStats m_stats;
+};
+
+#endif
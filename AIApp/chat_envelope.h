@@ -0,0 +1,135 @@
+#ifndef AIAPP_CHAT_ENVELOPE_H
+#define AIAPP_CHAT_ENVELOPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+
+/**
+ * 聊天消息的二进制信封
+ *
+ * 布局：
+ *   [1 字节 魔数/版本][varint 发送者 ID][varint 序号][varint 发送时间 (单调时钟纳秒)][varint 标志位][varint 正文长度][正文]
+ *
+ * - 第一个字节高 4 位是魔数 0xC，低 4 位是版本号，普通文本消息的第一个字节几乎不可能是 0xC?，用来区分新旧格式
+ * - varint 使用 LEB128：每个字节低 7 位是数据，最高位表示后面还有字节，小数字只占 1~2 个字节
+ * - 正文是任意二进制数据，通过 hiredis 的 %b 发送，不再受 C 字符串里 '\0' 的限制
+ * - 解析时正文直接指向 redisReply 的缓冲区，不做任何拷贝
+*/
+
+static const uint8_t ENVELOPE_MAGIC = 0xC0;
+static const uint8_t ENVELOPE_VERSION = 1;
+// 头部的最大长度：1 字节版本 + 5 个最长 10 字节的 varint
+static const size_t ENVELOPE_MAX_HEADER = 1 + 5 * 10;
+
+// 标志位
+enum EnvelopeFlags
+{
+    ENVELOPE_FLAG_TEXT = 1 << 0, // 正文是 UTF-8 文本，可以直接显示
+};
+
+struct Envelope
+{
+    uint64_t senderId;
+    uint64_t seq;
+    uint64_t sendNs;
+    uint64_t flags;
+    std::string_view payload; // 解析得到的正文，指向输入缓冲区
+};
+
+static inline size_t envelopePutVarint(uint8_t* p, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static inline bool envelopeGetVarint(const uint8_t*& p, const uint8_t* end, uint64_t& out)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7)
+    {
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+        {
+            out = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+// 只编码头部，返回写入的字节数，buf 至少要有 ENVELOPE_MAX_HEADER 字节
+static inline size_t encodeEnvelopeHeader(uint8_t* buf, uint64_t senderId, uint64_t seq, uint64_t sendNs, uint64_t flags, size_t payloadLen)
+{
+    size_t n = 0;
+    buf[n++] = ENVELOPE_MAGIC | ENVELOPE_VERSION;
+    n += envelopePutVarint(buf + n, senderId);
+    n += envelopePutVarint(buf + n, seq);
+    n += envelopePutVarint(buf + n, sendNs);
+    n += envelopePutVarint(buf + n, flags);
+    n += envelopePutVarint(buf + n, payloadLen);
+    return n;
+}
+
+// 把头部和正文一起编码到调用方提供的缓冲区里，空间不够时返回 0
+static inline size_t encodeEnvelope(char* buf, size_t cap, uint64_t senderId, uint64_t seq, uint64_t sendNs, uint64_t flags,
+                                    const char* payload, size_t payloadLen)
+{
+    uint8_t header[ENVELOPE_MAX_HEADER];
+    size_t h = encodeEnvelopeHeader(header, senderId, seq, sendNs, flags, payloadLen);
+    if (h + payloadLen > cap)
+    {
+        return 0;
+    }
+    memcpy(buf, header, h);
+    memcpy(buf + h, payload, payloadLen);
+    return h + payloadLen;
+}
+
+// 编码成 std::string，用于交给发送队列之类需要持有数据的地方
+static inline std::string encodeEnvelope(uint64_t senderId, uint64_t seq, uint64_t sendNs, uint64_t flags, std::string_view payload)
+{
+    uint8_t header[ENVELOPE_MAX_HEADER];
+    size_t h = encodeEnvelopeHeader(header, senderId, seq, sendNs, flags, payload.size());
+    std::string out;
+    out.reserve(h + payload.size());
+    out.append((const char*)header, h);
+    out.append(payload.data(), payload.size());
+    return out;
+}
+
+// 解析信封，格式或版本不对时返回 false (例如旧版本客户端发来的纯文本消息)
+static inline bool decodeEnvelope(const char* data, size_t len, Envelope& out)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + len;
+    if (len == 0 || (p[0] & 0xF0) != ENVELOPE_MAGIC || (p[0] & 0x0F) != ENVELOPE_VERSION)
+    {
+        return false;
+    }
+    ++p;
+    uint64_t payloadLen;
+    if (!envelopeGetVarint(p, end, out.senderId) || !envelopeGetVarint(p, end, out.seq) ||
+        !envelopeGetVarint(p, end, out.sendNs) || !envelopeGetVarint(p, end, out.flags) ||
+        !envelopeGetVarint(p, end, payloadLen))
+    {
+        return false;
+    }
+    if (payloadLen != (uint64_t)(end - p))
+    {
+        return false;
+    }
+    out.payload = std::string_view((const char*)p, (size_t)payloadLen);
+    return true;
+}
+
+#endif
@@ -0,0 +1,291 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <random>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include "cpp-httplib/httplib.h"
+#include "latency.h"
+#include "chat_envelope.h"
+#include "chat_publisher.h"
+#include "redis_endpoint.h"
+
+// HTTP 接入网关
+// 接收 POST 过来的聊天消息 (表单字段 message=...，与 post.lua 一致)，经由一小组 ChatPublisher 发布到 Redis
+// - HTTP 请求由 httplib 的线程池处理，每个工作线程固定使用其中一个发布器，
+//   工作线程把消息交给发布器之后等待确认，再回复 200 (失败时回复 503)
+// - 每个发布器是一条独立的 pipeline 连接：积压达到 maxBatch 条立即写出，否则最多等待 linger 微秒
+//   maxBatch 默认取 "每个发布器分到的工作线程数"，也就是所有工作线程都在等待时立刻发送，linger 只是一个上限
+// - 每个请求的延迟拆成三段记录到直方图：排队 (交给发布器 -> 批次写出)、Redis (写出 -> 读到回复)、唤醒 (读到回复 -> 工作线程恢复)
+//   GET /stats 返回当前的统计，另外每隔 --report 秒在标准错误里打印一次区间统计
+//
+// 压测：wrk -t4 -c256 -d30s -s post.lua http://127.0.0.1:8080/message
+
+struct Options {
+    int port = 8080;
+    int workers = 0;          // HTTP 工作线程数，0 表示 CPU 核数的 4 倍
+    int connections = 4;      // 到 Redis 的发布连接数
+    int maxBatch = 0;         // 每个 pipeline 批次的最大消息数，0 表示按工作线程数自动计算
+    int lingerUs = 200;       // 批次没有攒满时最老的消息最多等待的时间
+    int reportSeconds = 5;    // 区间统计的打印间隔，0 表示不打印
+    const char* channel = "chat";
+    RedisEndpoint endpoint = RedisEndpoint::fromEnv(); // Redis 地址，默认取 REDIS_ENDPOINT 环境变量
+};
+
+// 一个请求在等待确认期间的状态，放在工作线程的栈上，地址作为 cookie 交给发布器
+struct PendingRequest {
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done = false;
+    PublishAck ack;
+};
+
+// 延迟统计，所有工作线程共享，每个请求只加一次锁
+class GatewayStats {
+public:
+    void record(const PublishAck& ack, uint64_t wokeNs, uint64_t startNs) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        recordInto(m_total, ack, wokeNs, startNs);
+        recordInto(m_interval, ack, wokeNs, startNs);
+    }
+
+    void reject() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ++m_total.rejected;
+        ++m_interval.rejected;
+    }
+
+    std::string totalSummary() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_total.summary(monotonicNs());
+    }
+
+    // 返回区间统计并清零
+    std::string takeInterval() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::string text = m_interval.summary(monotonicNs());
+        m_interval = Bucket();
+        return text;
+    }
+
+private:
+    struct Bucket {
+        uint64_t startNs = monotonicNs();
+        uint64_t ok = 0;
+        uint64_t failed = 0;
+        uint64_t rejected = 0;
+        uint64_t batchedMessages = 0; // 每条消息所在批次大小的总和，除以消息数得到平均批次大小
+        LatencyHistogram queue;
+        LatencyHistogram redis;
+        LatencyHistogram wake;
+        LatencyHistogram total;
+
+        std::string summary(uint64_t now) const {
+            double seconds = (now - startNs) / 1e9;
+            uint64_t done = ok + failed;
+            char head[256];
+            snprintf(head, sizeof(head), "requests: ok=%llu failed=%llu rejected=%llu rate=%.0f/s avg_batch=%.1f\n",
+                     (unsigned long long)ok, (unsigned long long)failed, (unsigned long long)rejected,
+                     seconds > 0 ? done / seconds : 0.0, done > 0 ? (double)batchedMessages / done : 0.0);
+            return head + queue.summary("queue") + redis.summary("redis") + wake.summary("wake") + total.summary("total");
+        }
+    };
+
+    static void recordInto(Bucket& b, const PublishAck& ack, uint64_t wokeNs, uint64_t startNs) {
+        if (ack.ok) {
+            ++b.ok;
+        } else {
+            ++b.failed;
+        }
+        b.batchedMessages += ack.batchSize;
+        // flushNs 为 0 说明消息根本没有发出去 (例如连接失败)，只记总延迟
+        if (ack.flushNs != 0) {
+            b.queue.record(ack.flushNs - ack.enqueueNs);
+            b.redis.record(ack.ackNs - ack.flushNs);
+        }
+        b.wake.record(wokeNs - ack.ackNs);
+        b.total.record(wokeNs - startNs);
+    }
+
+    std::mutex m_mutex;
+    Bucket m_total;
+    Bucket m_interval;
+};
+
+static httplib::Server* g_server = NULL;
+
+static void onSignal(int) {
+    if (g_server) {
+        g_server->stop();
+    }
+}
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--port N] [--workers N] [--connections N] [--max-batch N] [--linger-us N]"
+              << " [--report SECONDS] [--channel NAME] [--endpoint HOST:PORT|unix:PATH]" << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--port") == 0) {
+            opts.port = atoi(value);
+        } else if (strcmp(arg, "--workers") == 0) {
+            opts.workers = atoi(value);
+        } else if (strcmp(arg, "--connections") == 0) {
+            opts.connections = atoi(value);
+        } else if (strcmp(arg, "--max-batch") == 0) {
+            opts.maxBatch = atoi(value);
+        } else if (strcmp(arg, "--linger-us") == 0) {
+            opts.lingerUs = atoi(value);
+        } else if (strcmp(arg, "--report") == 0) {
+            opts.reportSeconds = atoi(value);
+        } else if (strcmp(arg, "--channel") == 0) {
+            opts.channel = value;
+        } else if (strcmp(arg, "--endpoint") == 0) {
+            if (!RedisEndpoint::parse(value, opts.endpoint)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    if (opts.workers <= 0) {
+        opts.workers = (int)std::max(1u, std::thread::hardware_concurrency()) * 4;
+    }
+    if (opts.connections <= 0 || opts.lingerUs < 0) {
+        return false;
+    }
+    if (opts.maxBatch <= 0) {
+        opts.maxBatch = (opts.workers + opts.connections - 1) / opts.connections;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    Monotonic::init();
+
+    // 确认回调在发布器的写线程里执行，只负责唤醒对应的工作线程
+    auto onAck = [](const PublishAck& ack) {
+        PendingRequest* pending = static_cast<PendingRequest*>(ack.cookie);
+        std::lock_guard<std::mutex> lock(pending->mutex);
+        pending->ack = ack;
+        pending->done = true;
+        pending->cond.notify_one();
+    };
+
+    std::vector<std::unique_ptr<ChatPublisher>> publishers;
+    for (int i = 0; i < opts.connections; ++i) {
+        std::unique_ptr<ChatPublisher> publisher(new ChatPublisher(opts.endpoint, onAck));
+        publisher->setMaxBatch((size_t)opts.maxBatch);
+        publisher->setLinger((uint64_t)opts.lingerUs);
+        if (!publisher->start()) {
+            return 1;
+        }
+        publishers.push_back(std::move(publisher));
+    }
+
+    // 网关自己作为一个发送者，订阅端 (latency_subscriber) 可以据此统计丢失和乱序
+    std::random_device rd;
+    const uint64_t senderId = ((uint64_t)rd() << 32) | rd();
+    std::atomic<uint64_t> nextSeq(0);
+    std::atomic<unsigned> nextPublisher(0);
+    GatewayStats stats;
+    const std::string channel = opts.channel;
+
+    httplib::Server server;
+    int workers = opts.workers;
+    server.new_task_queue = [workers] { return new httplib::ThreadPool((size_t)workers); };
+    server.set_tcp_nodelay(true);
+
+    auto handlePost = [&](const httplib::Request& req, httplib::Response& res) {
+        uint64_t startNs = monotonicNs();
+        if (!req.has_param("message")) {
+            stats.reject();
+            res.status = 400;
+            res.set_content("missing message\n", "text/plain");
+            return;
+        }
+        // 每个工作线程第一次处理请求时轮流分配一个发布器，之后一直使用它
+        // 这样每个发布器分到的工作线程数是确定的，maxBatch 的默认值才有意义
+        thread_local ChatPublisher* publisher = publishers[nextPublisher++ % publishers.size()].get();
+
+        std::string message = req.get_param_value("message");
+        PendingRequest pending;
+        publisher->publish(channel, encodeEnvelope(senderId, nextSeq++, monotonicNs(), ENVELOPE_FLAG_TEXT, message), &pending);
+        {
+            std::unique_lock<std::mutex> lock(pending.mutex);
+            pending.cond.wait(lock, [&pending] { return pending.done; });
+        }
+        stats.record(pending.ack, monotonicNs(), startNs);
+
+        if (pending.ack.ok) {
+            res.set_content("OK\n", "text/plain");
+        } else {
+            res.status = 503;
+            res.set_content(pending.ack.error + "\n", "text/plain");
+        }
+    };
+    server.Post("/", handlePost);
+    server.Post("/message", handlePost);
+    server.Get("/stats", [&](const httplib::Request&, httplib::Response& res) {
+        res.set_content(stats.totalSummary(), "text/plain");
+    });
+
+    std::mutex reportMutex;
+    std::condition_variable reportCond;
+    bool stopping = false;
+    std::thread reporter;
+    if (opts.reportSeconds > 0) {
+        reporter = std::thread([&] {
+            std::unique_lock<std::mutex> lock(reportMutex);
+            while (!reportCond.wait_for(lock, std::chrono::seconds(opts.reportSeconds), [&] { return stopping; })) {
+                std::string text = stats.takeInterval();
+                fputs(text.c_str(), stderr);
+            }
+        });
+    }
+
+    g_server = &server;
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    std::cerr << "Gateway listening on port " << opts.port << " with " << opts.workers << " workers, "
+              << opts.connections << " redis connections to " << opts.endpoint.toString() << ", max batch " << opts.maxBatch
+              << ", linger " << opts.lingerUs << "us" << std::endl;
+    bool ok = server.listen("0.0.0.0", opts.port);
+    if (!ok) {
+        std::cerr << "Failed to listen on port " << opts.port << std::endl;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(reportMutex);
+        stopping = true;
+    }
+    reportCond.notify_one();
+    if (reporter.joinable()) {
+        reporter.join();
+    }
+    // listen 返回时所有工作线程都已经结束，不会再有新的 publish
+    for (auto& publisher : publishers) {
+        publisher->stop();
+    }
+    std::string text = stats.totalSummary();
+    fputs(text.c_str(), stdout);
+    return ok ? 0 : 1;
+}
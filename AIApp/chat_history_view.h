@@ -0,0 +1,156 @@
+#ifndef AIAPP_CHAT_HISTORY_VIEW_H
+#define AIAPP_CHAT_HISTORY_VIEW_H
+
+#include <wx/wx.h>
+#include <wx/listctrl.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+/**
+ * 固定容量的消息环形缓冲区
+ *
+ * 只保留最近 capacity 条消息，满了以后新消息覆盖最老的一条，所以内存占用不会随运行时间增长
+ * 下标 0 永远是当前保留的最老的一条消息
+*/
+class MessageHistory
+{
+public:
+    explicit MessageHistory(size_t capacity) : m_messages(capacity > 0 ? capacity : 1), m_start(0), m_size(0), m_total(0) {}
+
+    void push(std::string message)
+    {
+        size_t cap = m_messages.size();
+        if (m_size < cap)
+        {
+            m_messages[(m_start + m_size) % cap] = std::move(message);
+            ++m_size;
+        }
+        else
+        {
+            // 覆盖最老的一条，std::string 的移动赋值会复用原来的缓冲区
+            m_messages[m_start] = std::move(message);
+            m_start = (m_start + 1) % cap;
+        }
+        ++m_total;
+    }
+
+    const std::string& at(size_t index) const { return m_messages[(m_start + index) % m_messages.size()]; }
+    size_t size() const { return m_size; }
+    size_t capacity() const { return m_messages.size(); }
+    bool full() const { return m_size == m_messages.size(); }
+    // 历史上一共收到过的消息数 (包括已经被覆盖掉的)
+    unsigned long long total() const { return m_total; }
+
+private:
+    std::vector<std::string> m_messages;
+    size_t m_start;
+    size_t m_size;
+    unsigned long long m_total;
+};
+
+/**
+ * 虚拟列表形式的聊天记录控件，用来代替不断 AppendText 的 wxTextCtrl
+ *
+ * wxLC_VIRTUAL 模式下控件本身不保存任何行，只在需要绘制某一行时回调 OnGetItemText 取文本，
+ * 所以每条新消息的开销只是往环形缓冲区里放一个字符串，和已经显示过多少条消息无关
+*/
+class ChatHistoryView : public wxListCtrl
+{
+public:
+    // 默认保留的消息条数，可以通过环境变量 CHAT_HISTORY_LIMIT 修改
+    static const size_t DEFAULT_CAPACITY = 10000;
+
+    ChatHistoryView(wxWindow* parent, size_t capacity)
+        : wxListCtrl(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxLC_REPORT | wxLC_VIRTUAL | wxLC_NO_HEADER | wxLC_SINGLE_SEL),
+          m_history(capacity)
+    {
+        InsertColumn(0, "Message");
+        Bind(wxEVT_SIZE, &ChatHistoryView::OnSize, this);
+    }
+
+    static size_t CapacityFromEnv()
+    {
+        const char* value = getenv("CHAT_HISTORY_LIMIT");
+        if (value != NULL)
+        {
+            long n = atol(value);
+            if (n > 0)
+            {
+                return (size_t)n;
+            }
+        }
+        return DEFAULT_CAPACITY;
+    }
+
+    // 追加一条消息，只能在 UI 线程调用
+    void Append(std::string message)
+    {
+        m_history.push(std::move(message));
+        Sync(1);
+    }
+
+    // 追加一批消息，整批只刷新一次
+    void AppendBatch(std::vector<std::string>& messages)
+    {
+        for (auto& message : messages)
+        {
+            m_history.push(std::move(message));
+        }
+        Sync(messages.size());
+    }
+
+    const MessageHistory& History() const { return m_history; }
+
+protected:
+    wxString OnGetItemText(long item, long column) const override
+    {
+        ((void)column);
+        if (item < 0 || (size_t)item >= m_history.size())
+        {
+            return wxString();
+        }
+        const std::string& message = m_history.at((size_t)item);
+        return wxString::FromUTF8(message.data(), message.size());
+    }
+
+private:
+    void Sync(size_t added)
+    {
+        if (added == 0)
+        {
+            return;
+        }
+        long count = (long)m_history.size();
+        // 用户在看最底部时才自动滚动，往上翻看历史消息时不打扰
+        long top = GetTopItem();
+        long perPage = GetCountPerPage();
+        bool atBottom = GetItemCount() == 0 || top + perPage >= GetItemCount() - 1;
+
+        if (GetItemCount() != count)
+        {
+            SetItemCount(count);
+        }
+        if (m_history.full())
+        {
+            // 缓冲区满了以后每一行的内容都会整体前移，只需要重绘当前可见的这些行
+            long last = top + perPage;
+            RefreshItems(top, last < count - 1 ? last : count - 1);
+        }
+        if (atBottom && count > 0)
+        {
+            EnsureVisible(count - 1);
+        }
+    }
+
+    void OnSize(wxSizeEvent& event)
+    {
+        // 只有一列，让它始终占满控件的宽度
+        SetColumnWidth(0, GetClientSize().GetWidth());
+        event.Skip();
+    }
+
+    MessageHistory m_history;
+};
+
+#endif
@@ -0,0 +1,321 @@
+#ifndef AIAPP_CHAT_PUBLISHER_H
+#define AIAPP_CHAT_PUBLISHER_H
+
+#include <hiredis/hiredis.h>
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "latency.h"
+#include "redis_endpoint.h"
+#include "timing_wheel.h"
+
+// 一条消息的发送结果，由写线程回调给使用者
+struct PublishAck
+{
+    uint64_t id;          // publish() 返回的编号
+    void* cookie;         // publish() 时传入的用户数据，原样带回
+    bool ok;
+    long long receivers;  // PUBLISH 的返回值：收到这条消息的订阅者数量
+    std::string error;    // ok 为 false 时的错误信息
+    // 下面几个时间点都是单调时钟的纳秒值，用来拆分一条消息的延迟
+    uint64_t enqueueNs;   // publish() 被调用的时间
+    uint64_t flushNs;     // 所在批次开始写出的时间，为 0 表示没有发出去
+    uint64_t ackNs;       // 读到回复 (或确认失败) 的时间
+    size_t batchSize;     // 所在批次的消息数
+};
+
+/**
+ * 独立写线程的消息发布器
+ *
+ * 调用方 (例如 UI 线程) 只需要 publish() 把消息放进队列，立刻返回，不会因为 Redis 的延迟而阻塞
+ * 写线程每次把队列里积累的所有消息一次取走，用 redisAppendCommand 拼成一个 pipeline，
+ * 一次写出去后再依次读回复，最后通过回调逐条报告成功或失败
+ *
+ * 攒批由两个条件控制：积压达到 maxBatch 条立即发送；否则最老的一条消息最多再等 linger 微秒
+ * linger 为 0 (默认) 时写线程一被唤醒就发送，适合交互式的客户端；网关这类高吞吐的场景可以设置一个很小的 linger，
+ * 用一点点延迟换取更大的批次
+ *
+ * 连接和每条命令都有超时 (commandTimeout)：Redis 挂住时 redisGetReply 最多等这么久就返回错误，这一批剩下的消息报告失败，
+ * 不会把写线程永远卡住；之后按指数退避重连，退避期间到达的批次直接报告失败，不会每一批都去撞一次连不上的服务器
+ *
+ * 回调在写线程里执行，如果需要更新界面，应当在回调里用 CallAfter 切回 UI 线程
+*/
+class ChatPublisher
+{
+public:
+    typedef std::function<void(const PublishAck&)> AckCallback;
+
+    // 单个 pipeline 最多包含的消息数，防止一次积压太多导致单批回复太大
+    static const size_t DEFAULT_MAX_BATCH = 1024;
+    static const int DEFAULT_COMMAND_TIMEOUT_MS = 5000;
+
+    ChatPublisher(const RedisEndpoint& endpoint, AckCallback onAck)
+        : m_endpoint(endpoint), m_onAck(std::move(onAck)), m_maxBatch(DEFAULT_MAX_BATCH), m_lingerUs(0),
+          m_commandTimeoutMs(DEFAULT_COMMAND_TIMEOUT_MS), m_context(NULL),
+          m_reconnectBackoff(RECONNECT_MIN_NS, RECONNECT_MAX_NS), m_nextConnectNs(0), m_nextId(1), m_running(false)
+    {
+    }
+
+    ~ChatPublisher()
+    {
+        stop();
+    }
+
+    ChatPublisher(const ChatPublisher&) = delete;
+    ChatPublisher& operator=(const ChatPublisher&) = delete;
+
+    // 这几个设置需要在 start() 之前调用
+    void setMaxBatch(size_t maxBatch) { m_maxBatch = maxBatch > 0 ? maxBatch : 1; }
+    void setLinger(uint64_t lingerUs) { m_lingerUs = lingerUs; }
+    // 为 0 时不设超时，连接和读写都可能一直阻塞
+    void setCommandTimeout(int timeoutMs) { m_commandTimeoutMs = timeoutMs > 0 ? timeoutMs : 0; }
+
+    // 当前积压的消息数，用于统计
+    size_t pending()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_pending.size();
+    }
+
+    // 建立连接并启动写线程，连接失败时返回 false
+    bool start()
+    {
+        if (!connect())
+        {
+            return false;
+        }
+        m_running = true;
+        m_writer = std::thread(&ChatPublisher::writerLoop, this);
+        return true;
+    }
+
+    // 停止写线程，队列里还没有发送的消息会以失败的形式回调
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_running)
+            {
+                return;
+            }
+            m_running = false;
+        }
+        m_cond.notify_one();
+        if (m_writer.joinable())
+        {
+            m_writer.join();
+        }
+        for (auto& message : m_pending)
+        {
+            reportFailure(message, "publisher stopped", 0, 0);
+        }
+        m_pending.clear();
+        if (m_context)
+        {
+            redisFree(m_context);
+            m_context = NULL;
+        }
+    }
+
+    // 线程安全，返回这条消息的编号，回调里会带回同一个编号
+    uint64_t publish(std::string channel, std::string payload, void* cookie = NULL)
+    {
+        uint64_t id;
+        bool wake;
+        uint64_t now = monotonicNs();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            id = m_nextId++;
+            m_pending.push_back(Outgoing{id, cookie, std::move(channel), std::move(payload), now});
+            // 只在队列从空变为非空 (写线程可能在等第一条消息)，或者刚好攒满一批 (写线程可能在 linger) 时唤醒
+            wake = m_pending.size() == 1 || m_pending.size() == m_maxBatch;
+        }
+        if (wake)
+        {
+            m_cond.notify_one();
+        }
+        return id;
+    }
+
+private:
+    struct Outgoing
+    {
+        uint64_t id;
+        void* cookie;
+        std::string channel;
+        std::string payload;
+        uint64_t enqueueNs;
+    };
+
+    bool connect()
+    {
+        struct timeval tv = {m_commandTimeoutMs / 1000, (m_commandTimeoutMs % 1000) * 1000};
+        m_context = m_commandTimeoutMs > 0 ? m_endpoint.connect(tv) : m_endpoint.connect();
+        // 连接超时之外再给读写设置同样的超时，Redis 挂住时 redisGetReply 会返回错误而不是一直阻塞
+        if (m_context != NULL && !m_context->err && m_commandTimeoutMs > 0)
+        {
+            redisSetTimeout(m_context, tv);
+        }
+        if (m_context == NULL || m_context->err)
+        {
+            if (m_context)
+            {
+                std::cerr << "Error: " << m_context->errstr << std::endl;
+                redisFree(m_context);
+                m_context = NULL;
+            }
+            else
+            {
+                std::cerr << "Can't allocate redis context" << std::endl;
+            }
+            return false;
+        }
+        return true;
+    }
+
+    void writerLoop()
+    {
+        std::vector<Outgoing> batch;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_cond.wait(lock, [this]() { return !m_pending.empty() || !m_running; });
+            if (!m_running)
+            {
+                return;
+            }
+            if (m_lingerUs > 0 && m_pending.size() < m_maxBatch)
+            {
+                // 最老的一条消息最多等到 enqueueNs + linger，期间攒满一批就提前发送
+                uint64_t deadline = m_pending.front().enqueueNs + m_lingerUs * 1000;
+                uint64_t now = monotonicNs();
+                if (deadline > now)
+                {
+                    m_cond.wait_for(lock, std::chrono::nanoseconds(deadline - now),
+                                    [this]() { return m_pending.size() >= m_maxBatch || !m_running; });
+                    if (!m_running)
+                    {
+                        return;
+                    }
+                }
+            }
+            // 把积压的消息整批取走，取的过程只是交换指针，锁的持有时间和消息数量无关
+            if (m_pending.size() <= m_maxBatch)
+            {
+                batch.swap(m_pending);
+            }
+            else
+            {
+                batch.assign(std::make_move_iterator(m_pending.begin()), std::make_move_iterator(m_pending.begin() + m_maxBatch));
+                m_pending.erase(m_pending.begin(), m_pending.begin() + m_maxBatch);
+            }
+            lock.unlock();
+
+            sendBatch(batch);
+            batch.clear();
+
+            lock.lock();
+        }
+    }
+
+    void sendBatch(std::vector<Outgoing>& batch)
+    {
+        // 上一次出错后连接已经被释放，退避时间到了才重新连接一次，失败就让整批消息失败
+        if (m_context == NULL)
+        {
+            uint64_t now = Monotonic::nowNs();
+            if (now < m_nextConnectNs || !connect())
+            {
+                if (now >= m_nextConnectNs)
+                {
+                    m_nextConnectNs = now + m_reconnectBackoff.next();
+                }
+                for (auto& message : batch)
+                {
+                    reportFailure(message, "not connected", 0, batch.size());
+                }
+                return;
+            }
+            m_reconnectBackoff.reset();
+        }
+
+        uint64_t flushNs = monotonicNs();
+
+        // 所有命令先追加到输出缓冲区，读第一条回复时 hiredis 会把整个缓冲区一次写出
+        for (auto& message : batch)
+        {
+            redisAppendCommand(m_context, "PUBLISH %b %b", message.channel.data(), message.channel.size(),
+                               message.payload.data(), message.payload.size());
+        }
+
+        size_t i = 0;
+        for (; i < batch.size(); ++i)
+        {
+            redisReply* reply = NULL;
+            if (redisGetReply(m_context, (void**)&reply) != REDIS_OK)
+            {
+                break;
+            }
+            PublishAck ack{batch[i].id, batch[i].cookie, true, 0, std::string(),
+                           batch[i].enqueueNs, flushNs, monotonicNs(), batch.size()};
+            if (reply->type == REDIS_REPLY_INTEGER)
+            {
+                ack.receivers = reply->integer;
+            }
+            else
+            {
+                ack.ok = false;
+                ack.error = reply->type == REDIS_REPLY_ERROR ? std::string(reply->str, reply->len) : "unexpected reply";
+            }
+            freeReplyObject(reply);
+            m_onAck(ack);
+        }
+
+        if (i < batch.size())
+        {
+            // 连接出错，剩下的消息无法确认是否送达，统一报告失败，下一批再重连
+            std::string error = m_context->errstr;
+            for (; i < batch.size(); ++i)
+            {
+                reportFailure(batch[i], error, flushNs, batch.size());
+            }
+            redisFree(m_context);
+            m_context = NULL;
+        }
+    }
+
+    void reportFailure(const Outgoing& message, const std::string& error, uint64_t flushNs, size_t batchSize)
+    {
+        m_onAck(PublishAck{message.id, message.cookie, false, 0, error, message.enqueueNs, flushNs, monotonicNs(), batchSize});
+    }
+
+    static const uint64_t RECONNECT_MIN_NS = 100ULL * 1000 * 1000;
+    static const uint64_t RECONNECT_MAX_NS = 10ULL * 1000 * 1000 * 1000;
+
+    RedisEndpoint m_endpoint;
+    AckCallback m_onAck;
+    size_t m_maxBatch;
+    uint64_t m_lingerUs;
+    int m_commandTimeoutMs;
+
+    // 只在写线程里访问 (start 和 stop 时写线程不在运行)
+    redisContext* m_context;
+    Backoff m_reconnectBackoff;
+    uint64_t m_nextConnectNs; // 连接失败之后，这个时间 (Monotonic::nowNs) 之前不再尝试
+    std::thread m_writer;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<Outgoing> m_pending;
+    uint64_t m_nextId;
+    bool m_running;
+};
+
+#endif
@@ -0,0 +1,581 @@
+#ifndef AIAPP_CHAT_STREAMS_H
+#define AIAPP_CHAT_STREAMS_H
+
+#include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "event_loop.h"
+#include "format.h"
+#include "redis_endpoint.h"
+#include "redis_event_loop.h"
+#include "room_router.h"
+#include "timing_wheel.h"
+
+/**
+ * 基于 Redis Streams 的聊天室，替代 "发出去就不管" 的 pub/sub
+ *
+ * - 发送：XADD chat:stream:<房间> MAXLEN ~ maxLen * m <消息>，服务器只保留最近的 maxLen 条左右
+ * - 接收：在一个专用连接上循环执行 XREAD BLOCK，同时等待所有已经追上进度的房间
+ * - 回填：每个房间记录最后看到的消息 ID，并保存在本地文件里
+ *   重新加入房间时从这个 ID 开始用 XRANGE 一页一页地往后读，每读完一页才请求下一页，
+ *   所以回填过程不会占住事件循环，重连的代价只是错过的那一段消息
+ *   第一次加入 (没有记录) 或者错过的消息超过 maxBackfillPages 页时，只读最新的一页 (XREVRANGE)，
+ *   启动时间不会随着历史长度增长
+ *
+ * XREAD 返回错误 (LOADING、NOGROUP、WRONGTYPE 等) 时按指数退避在时间事件里重新发起，不会对着 Redis 空转
+ *
+ * 所有接口都只能在事件循环线程里调用 (或者在循环线程启动之前调用)
+*/
+class StreamRooms
+{
+public:
+    typedef std::function<void(const RoomMessage&)> Handler;
+    // XADD 的结果：成功时 result 是新消息的 ID，失败时是错误信息
+    typedef std::function<void(bool ok, const std::string& result)> AddCallback;
+
+    struct Options
+    {
+        size_t maxLen = 100000;       // 每个房间在服务器上大约保留的消息条数
+        size_t pageSize = 200;        // 回填时每一页的条数
+        size_t maxBackfillPages = 50; // 错过的消息超过这么多页就放弃回填，直接跳到最新的一页
+        int blockMs = 5000;           // XREAD 的阻塞时长
+        std::string cursorFile;       // 保存每个房间最后看到的消息 ID 的文件，为空时不保存
+    };
+
+    StreamRooms(EventLoop& loop, const RedisEndpoint& endpoint, Options opts)
+        : m_loop(loop), m_endpoint(endpoint), m_opts(std::move(opts)),
+          m_cmdContext(NULL), m_blockContext(NULL), m_blockClientId(-1), m_readInFlight(false),
+          m_readBackoff(READ_RETRY_MIN_NS, READ_RETRY_MAX_NS), m_readRetryTimer(-1)
+    {
+        loadCursors();
+    }
+
+    ~StreamRooms()
+    {
+        close();
+    }
+
+    StreamRooms(const StreamRooms&) = delete;
+    StreamRooms& operator=(const StreamRooms&) = delete;
+
+    static std::string keyOf(const std::string& room) { return "chat:stream:" + room; }
+
+    // 建立命令连接 (XADD / XRANGE) 和阻塞读连接 (XREAD BLOCK)
+    bool connect()
+    {
+        m_cmdContext = connectAsync();
+        m_blockContext = connectAsync();
+        if (m_cmdContext == NULL || m_blockContext == NULL)
+        {
+            return false;
+        }
+        // CLIENT UNBLOCK 需要阻塞连接的 ID，加入新房间时用它打断正在进行的 XREAD
+        redisAsyncCommand(m_blockContext, &StreamRooms::OnClientId, this, "CLIENT ID");
+        return true;
+    }
+
+    // 关闭连接，关闭前把每个房间的进度写回文件
+    void close()
+    {
+        saveCursors();
+        if (m_readRetryTimer >= 0)
+        {
+            m_loop.deleteTimeEvent(m_readRetryTimer);
+            m_readRetryTimer = -1;
+        }
+        redisAsyncContext* ac = m_blockContext;
+        m_blockContext = NULL;
+        if (ac)
+        {
+            redisAsyncFree(ac);
+        }
+        ac = m_cmdContext;
+        m_cmdContext = NULL;
+        if (ac)
+        {
+            redisAsyncFree(ac);
+        }
+    }
+
+    void join(const std::string& room, Handler handler)
+    {
+        std::string key = keyOf(room);
+        auto it = m_rooms.find(key);
+        if (it != m_rooms.end())
+        {
+            it->second->handler = std::move(handler);
+            return;
+        }
+        std::unique_ptr<StreamRoom> entry(new StreamRoom);
+        entry->room = room;
+        entry->key = key;
+        entry->handler = std::move(handler);
+        entry->live = false;
+        entry->pages = 0;
+        auto cursor = m_cursors.find(key);
+        if (cursor != m_cursors.end())
+        {
+            entry->lastId = cursor->second;
+        }
+        StreamRoom* r = entry.get();
+        m_rooms.emplace(key, std::move(entry));
+
+        if (r->lastId.empty())
+        {
+            requestTail(r);
+        }
+        else
+        {
+            requestPage(r);
+        }
+    }
+
+    void leave(const std::string& room)
+    {
+        auto it = m_rooms.find(keyOf(room));
+        if (it == m_rooms.end())
+        {
+            return;
+        }
+        m_cursors[it->first] = it->second->lastId;
+        m_rooms.erase(it);
+        // 正在进行的 XREAD 里还带着这个房间，打断它，下一轮用新的房间列表
+        interruptRead();
+    }
+
+    bool publish(const std::string& room, const std::string& payload, AddCallback cb)
+    {
+        if (m_cmdContext == NULL)
+        {
+            return false;
+        }
+        std::string key = keyOf(room);
+        // 每条消息都要带上 MAXLEN，数字直接写在栈上，不经过 std::to_string
+        char maxLen[24];
+        size_t maxLenSize = formatTo(maxLen, FMT("{}"), m_opts.maxLen);
+        const char* argv[] = {"XADD", key.c_str(), "MAXLEN", "~", maxLen, "*", "m", payload.data()};
+        size_t argvlen[] = {4, key.size(), 6, 1, maxLenSize, 1, 1, payload.size()};
+        AddCallback* privdata = new AddCallback(std::move(cb));
+        if (redisAsyncCommandArgv(m_cmdContext, &StreamRooms::OnAdd, privdata, 8, argv, argvlen) != REDIS_OK)
+        {
+            delete privdata;
+            return false;
+        }
+        return true;
+    }
+
+    // 把每个房间最后看到的消息 ID 写到文件里，格式为每行 "key id"
+    void saveCursors()
+    {
+        if (m_opts.cursorFile.empty())
+        {
+            return;
+        }
+        for (auto& kv : m_rooms)
+        {
+            if (!kv.second->lastId.empty())
+            {
+                m_cursors[kv.first] = kv.second->lastId;
+            }
+        }
+        std::ofstream out(m_opts.cursorFile, std::ios::trunc);
+        for (auto& kv : m_cursors)
+        {
+            out << kv.first << ' ' << kv.second << '\n';
+        }
+    }
+
+private:
+    static const uint64_t READ_RETRY_MIN_NS = 100ULL * 1000 * 1000;
+    static const uint64_t READ_RETRY_MAX_NS = 5ULL * 1000 * 1000 * 1000;
+
+    struct StreamRoom
+    {
+        std::string room;
+        std::string key;
+        std::string lastId; // 最后看到的消息 ID，为空表示还没有任何记录
+        Handler handler;
+        bool live;          // 回填完成，已经加入 XREAD 的等待列表
+        size_t pages;       // 本次回填已经读过的页数
+    };
+
+    // 回填请求的上下文：请求返回时房间可能已经被删除，所以按 key 重新查找
+    struct PageRequest
+    {
+        StreamRooms* self;
+        std::string key;
+    };
+
+    void loadCursors()
+    {
+        if (m_opts.cursorFile.empty())
+        {
+            return;
+        }
+        std::ifstream in(m_opts.cursorFile);
+        std::string key, id;
+        while (in >> key >> id)
+        {
+            m_cursors[key] = id;
+        }
+    }
+
+    redisAsyncContext* connectAsync()
+    {
+        redisAsyncContext* ac = m_endpoint.connectAsync();
+        if (ac == NULL || ac->err)
+        {
+            if (ac)
+            {
+                std::cerr << "Error: " << ac->errstr << std::endl;
+                redisAsyncFree(ac);
+            }
+            else
+            {
+                std::cerr << "Can't allocate redis context" << std::endl;
+            }
+            return NULL;
+        }
+        ac->data = this;
+        redisEventLoopAttach(&m_loop, ac);
+        redisAsyncSetConnectCallback(ac, &StreamRooms::OnConnect);
+        redisAsyncSetDisconnectCallback(ac, &StreamRooms::OnDisconnect);
+        return ac;
+    }
+
+    // 没有进度记录时只读最新的一页，倒序返回
+    void requestTail(StreamRoom* r)
+    {
+        if (m_cmdContext == NULL)
+        {
+            return;
+        }
+        redisAsyncCommand(m_cmdContext, &StreamRooms::OnTail, new PageRequest{this, r->key},
+                          "XREVRANGE %b + - COUNT %d", r->key.data(), r->key.size(), (int)m_opts.pageSize);
+    }
+
+    // 从 lastId 之后 (不含) 读一页
+    void requestPage(StreamRoom* r)
+    {
+        if (m_cmdContext == NULL)
+        {
+            return;
+        }
+        std::string start = "(" + r->lastId;
+        redisAsyncCommand(m_cmdContext, &StreamRooms::OnPage, new PageRequest{this, r->key},
+                          "XRANGE %b %b + COUNT %d", r->key.data(), r->key.size(), start.data(), start.size(), (int)m_opts.pageSize);
+    }
+
+    // 把一个 [id, [field, value, ...]] 条目交给房间的处理函数
+    void deliver(StreamRoom* r, redisReply* entry)
+    {
+        if (entry->type != REDIS_REPLY_ARRAY || entry->elements != 2)
+        {
+            return;
+        }
+        redisReply* id = entry->element[0];
+        redisReply* fields = entry->element[1];
+        r->lastId.assign(id->str, id->len);
+        if (fields->type != REDIS_REPLY_ARRAY)
+        {
+            return;
+        }
+        for (size_t i = 0; i + 1 < fields->elements; i += 2)
+        {
+            redisReply* name = fields->element[i];
+            if (name->len == 1 && name->str[0] == 'm')
+            {
+                redisReply* value = fields->element[i + 1];
+                // 流模式下每个房间就是一个频道，channel 也填房间名
+                r->handler(RoomMessage{r->room, r->room, std::string_view(value->str, value->len)});
+                break;
+            }
+        }
+    }
+
+    void goLive(StreamRoom* r)
+    {
+        r->live = true;
+        r->pages = 0;
+        if (r->lastId.empty())
+        {
+            // 流还是空的，从头开始等
+            r->lastId = "0-0";
+        }
+        if (m_readInFlight)
+        {
+            interruptRead();
+        }
+        else
+        {
+            startRead();
+        }
+    }
+
+    // 对所有已经追上进度的房间发起一次 XREAD BLOCK
+    void startRead()
+    {
+        if (m_blockContext == NULL || m_readInFlight)
+        {
+            return;
+        }
+        std::vector<const char*> argv;
+        std::vector<size_t> argvlen;
+        char count[24];
+        char block[24];
+        formatTo(count, FMT("{}"), m_opts.pageSize);
+        formatTo(block, FMT("{}"), m_opts.blockMs);
+        const char* head[] = {"XREAD", "COUNT", count, "BLOCK", block, "STREAMS"};
+        for (const char* arg : head)
+        {
+            argv.push_back(arg);
+            argvlen.push_back(strlen(arg));
+        }
+        std::vector<StreamRoom*> live;
+        for (auto& kv : m_rooms)
+        {
+            if (kv.second->live)
+            {
+                live.push_back(kv.second.get());
+            }
+        }
+        if (live.empty())
+        {
+            return;
+        }
+        for (StreamRoom* r : live)
+        {
+            argv.push_back(r->key.data());
+            argvlen.push_back(r->key.size());
+        }
+        for (StreamRoom* r : live)
+        {
+            argv.push_back(r->lastId.data());
+            argvlen.push_back(r->lastId.size());
+        }
+        if (redisAsyncCommandArgv(m_blockContext, &StreamRooms::OnRead, this, (int)argv.size(), argv.data(), argvlen.data()) == REDIS_OK)
+        {
+            m_readInFlight = true;
+        }
+    }
+
+    // XREAD 出错之后等一段退避时间再发起，已经在等的话不重复设置
+    void scheduleRead()
+    {
+        if (m_readRetryTimer >= 0)
+        {
+            return;
+        }
+        long long ms = (long long)(m_readBackoff.next() / 1000000ULL);
+        m_readRetryTimer = m_loop.createTimeEvent(ms, &StreamRooms::OnReadRetry, this);
+    }
+
+    static int OnReadRetry(EventLoop* loop, long long id, void* clientData)
+    {
+        ((void)loop);
+        ((void)id);
+        StreamRooms* self = static_cast<StreamRooms*>(clientData);
+        self->m_readRetryTimer = -1;
+        self->startRead();
+        return EventLoop::NOMORE;
+    }
+
+    // 让阻塞中的 XREAD 立刻返回 (返回 nil)，回调里会用新的房间列表重新发起
+    void interruptRead()
+    {
+        if (m_readInFlight && m_cmdContext != NULL && m_blockClientId >= 0)
+        {
+            redisAsyncCommand(m_cmdContext, NULL, NULL, "CLIENT UNBLOCK %lld", m_blockClientId);
+        }
+    }
+
+    static void OnClientId(redisAsyncContext* ac, void* reply, void* privdata)
+    {
+        ((void)ac);
+        redisReply* r = static_cast<redisReply*>(reply);
+        if (r != NULL && r->type == REDIS_REPLY_INTEGER)
+        {
+            static_cast<StreamRooms*>(privdata)->m_blockClientId = r->integer;
+        }
+    }
+
+    static void OnAdd(redisAsyncContext* ac, void* reply, void* privdata)
+    {
+        AddCallback* cb = static_cast<AddCallback*>(privdata);
+        redisReply* r = static_cast<redisReply*>(reply);
+        if (r != NULL && r->type == REDIS_REPLY_STRING)
+        {
+            (*cb)(true, std::string(r->str, r->len));
+        }
+        else
+        {
+            (*cb)(false, r != NULL && r->type == REDIS_REPLY_ERROR ? std::string(r->str, r->len) : std::string(ac->errstr ? ac->errstr : "connection lost"));
+        }
+        delete cb;
+    }
+
+    static void OnTail(redisAsyncContext* ac, void* reply, void* privdata)
+    {
+        ((void)ac);
+        std::unique_ptr<PageRequest> req(static_cast<PageRequest*>(privdata));
+        redisReply* r = static_cast<redisReply*>(reply);
+        auto it = req->self->m_rooms.find(req->key);
+        if (r == NULL || it == req->self->m_rooms.end())
+        {
+            return;
+        }
+        StreamRoom* room = it->second.get();
+        if (r->type == REDIS_REPLY_ARRAY)
+        {
+            // XREVRANGE 是从新到旧返回的，倒过来按时间顺序交给房间
+            for (size_t i = r->elements; i > 0; --i)
+            {
+                req->self->deliver(room, r->element[i - 1]);
+            }
+        }
+        req->self->goLive(room);
+    }
+
+    static void OnPage(redisAsyncContext* ac, void* reply, void* privdata)
+    {
+        ((void)ac);
+        std::unique_ptr<PageRequest> req(static_cast<PageRequest*>(privdata));
+        StreamRooms* self = req->self;
+        redisReply* r = static_cast<redisReply*>(reply);
+        auto it = self->m_rooms.find(req->key);
+        if (r == NULL || it == self->m_rooms.end())
+        {
+            return;
+        }
+        StreamRoom* room = it->second.get();
+        if (r->type != REDIS_REPLY_ARRAY)
+        {
+            // 例如 lastId 的格式不对，放弃回填，直接从最新的一页开始
+            room->lastId.clear();
+            self->requestTail(room);
+            return;
+        }
+        for (size_t i = 0; i < r->elements; ++i)
+        {
+            self->deliver(room, r->element[i]);
+        }
+        ++room->pages;
+        if (r->elements < self->m_opts.pageSize)
+        {
+            // 最后一页不满，说明已经追上了
+            self->goLive(room);
+        }
+        else if (room->pages >= self->m_opts.maxBackfillPages)
+        {
+            // 错过的太多了，不再一页一页地追，跳到最新的一页
+            room->lastId.clear();
+            room->pages = 0;
+            self->requestTail(room);
+        }
+        else
+        {
+            self->requestPage(room);
+        }
+    }
+
+    static void OnRead(redisAsyncContext* ac, void* reply, void* privdata)
+    {
+        ((void)ac);
+        StreamRooms* self = static_cast<StreamRooms*>(privdata);
+        self->m_readInFlight = false;
+        redisReply* r = static_cast<redisReply*>(reply);
+        if (r == NULL)
+        {
+            return;
+        }
+        if (r->type == REDIS_REPLY_ERROR)
+        {
+            // 例如服务器还在加载数据 (LOADING)，或者 key 被换成了别的类型 (WRONGTYPE)，马上重发只会得到同样的错误
+            std::cerr << "XREAD failed: " << std::string(r->str, r->len) << std::endl;
+            self->scheduleRead();
+            return;
+        }
+        self->m_readBackoff.reset();
+        // 超时或者被 CLIENT UNBLOCK 打断时返回 nil，直接重新发起
+        if (r->type == REDIS_REPLY_ARRAY)
+        {
+            for (size_t i = 0; i < r->elements; ++i)
+            {
+                redisReply* stream = r->element[i];
+                if (stream->type != REDIS_REPLY_ARRAY || stream->elements != 2)
+                {
+                    continue;
+                }
+                auto it = self->m_rooms.find(std::string(stream->element[0]->str, stream->element[0]->len));
+                if (it == self->m_rooms.end())
+                {
+                    continue;
+                }
+                redisReply* entries = stream->element[1];
+                for (size_t j = 0; j < entries->elements; ++j)
+                {
+                    self->deliver(it->second.get(), entries->element[j]);
+                }
+            }
+        }
+        self->startRead();
+    }
+
+    static void OnConnect(const redisAsyncContext* ac, int status)
+    {
+        if (status != REDIS_OK)
+        {
+            std::cerr << "Error: " << ac->errstr << std::endl;
+            static_cast<StreamRooms*>(ac->data)->forget(ac);
+        }
+    }
+
+    static void OnDisconnect(const redisAsyncContext* ac, int status)
+    {
+        if (status != REDIS_OK)
+        {
+            std::cerr << "Disconnected: " << ac->errstr << std::endl;
+        }
+        static_cast<StreamRooms*>(ac->data)->forget(ac);
+    }
+
+    // 连接已经被 hiredis 释放，清掉对应的指针
+    void forget(const redisAsyncContext* ac)
+    {
+        if (m_cmdContext == ac)
+        {
+            m_cmdContext = NULL;
+        }
+        if (m_blockContext == ac)
+        {
+            m_blockContext = NULL;
+            m_readInFlight = false;
+        }
+    }
+
+    EventLoop& m_loop;
+    RedisEndpoint m_endpoint;
+    Options m_opts;
+
+    redisAsyncContext* m_cmdContext;
+    redisAsyncContext* m_blockContext;
+    long long m_blockClientId;
+    bool m_readInFlight;
+    Backoff m_readBackoff;
+    long long m_readRetryTimer; // 等待重新发起 XREAD 的时间事件，-1 表示没有
+
+    // key -> 房间
+    std::unordered_map<std::string, std::unique_ptr<StreamRoom>> m_rooms;
+    // key -> 最后看到的消息 ID，包括已经离开的房间
+    std::unordered_map<std::string, std::string> m_cursors;
+};
+
+#endif
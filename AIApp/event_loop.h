@@ -0,0 +1,440 @@
+#ifndef AIAPP_EVENT_LOOP_H
+#define AIAPP_EVENT_LOOP_H
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "rbtree.h"
+
+/**
+ * 一个基于 epoll 的单线程事件循环，思路参考 Redis 的 ae 库 (见 LearningRedis/RedisAe.md)
+ *
+ * 文件事件：和 ae 一样使用 "函数指针 + clientData" 的回调形式，按 fd 下标存放在数组里
+ *   默认水平触发，方便直接接入 hiredis 的异步接口；mask 里带上 EDGE 时改为边缘触发，
+ *   这时回调必须一直读 (写) 到 EAGAIN 为止，换来的是注册一次之后不再需要 epoll_ctl
+ * 时间事件：与 ae 相同，回调返回下一次触发的间隔 (毫秒)，返回 NOMORE 时删除；按触发时间排在一棵侵入式红黑树 (rbtree.h) 里，
+ *   最近的一个 (缓存的最左结点，O(1)) 决定 epoll_wait 的超时；周期性的事件重新排队只是摘下结点再挂回去，不分配内存
+ * 跨线程任务：其他线程通过 post() 投递任务，循环线程通过一个 eventfd 被唤醒后执行
+ * beforeSleep：和 ae 的 beforesleep 一样，每一轮进入 epoll_wait 之前调用一次，用来把这一轮攒下的输出一起写出 (见 write_coalescer.h)
+ * 停止：stop() 同样通过 eventfd 唤醒循环，所以无论循环阻塞在哪个连接上，都能在有界的时间内退出
+ *
+ * 除了 post() 和 stop() 之外，其余接口都只能在循环线程里调用
+*/
+class EventLoop
+{
+public:
+    enum
+    {
+        NONE = 0,
+        READABLE = 1,
+        WRITABLE = 2,
+        EDGE = 4 // 边缘触发，与 READABLE / WRITABLE 组合使用
+    };
+
+    // 时间事件的回调返回 NOMORE 表示不再触发
+    static const int NOMORE = -1;
+
+    typedef void FileProc(EventLoop* loop, int fd, void* clientData, int mask);
+    typedef int TimeProc(EventLoop* loop, long long id, void* clientData);
+    typedef void EventFinalizerProc(EventLoop* loop, void* clientData);
+    typedef void BeforeSleepProc(EventLoop* loop, void* clientData);
+
+    EventLoop() : m_beforeSleep(NULL), m_beforeSleepData(NULL), m_stopRequested(false), m_wakeupPending(false), m_nextTimeEventId(0), m_firingId(-1), m_firingDeleted(false), m_pollCalls(0)
+    {
+        m_epfd = epoll_create1(EPOLL_CLOEXEC);
+        m_wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_epfd >= 0 && m_wakeupFd >= 0)
+        {
+            struct epoll_event ee = {};
+            ee.events = EPOLLIN;
+            ee.data.fd = m_wakeupFd;
+            epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_wakeupFd, &ee);
+        }
+        m_events.resize(64);
+    }
+
+    ~EventLoop()
+    {
+        if (m_wakeupFd >= 0)
+        {
+            close(m_wakeupFd);
+        }
+        if (m_epfd >= 0)
+        {
+            close(m_epfd);
+        }
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    bool ok() const { return m_epfd >= 0 && m_wakeupFd >= 0; }
+
+    // 注册 (或替换) 一个文件事件，mask 为 READABLE / WRITABLE (/ EDGE) 的组合
+    bool createFileEvent(int fd, int mask, FileProc* proc, void* clientData)
+    {
+        if (fd < 0)
+        {
+            return false;
+        }
+        if ((size_t)fd >= m_files.size())
+        {
+            m_files.resize((size_t)fd + 1);
+        }
+        FileEvent& fe = m_files[fd];
+        int op = fe.proc == NULL ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        struct epoll_event ee = {};
+        ee.events = toEpoll(mask);
+        ee.data.fd = fd;
+        if (epoll_ctl(m_epfd, op, fd, &ee) == -1)
+        {
+            return false;
+        }
+        fe.mask = mask;
+        fe.proc = proc;
+        fe.clientData = clientData;
+        return true;
+    }
+
+    // 只修改关注的事件类型，回调保持不变；mask 为 NONE 时仍然保留注册，只是不再关注任何事件
+    void setFileMask(int fd, int mask)
+    {
+        FileEvent* fe = lookup(fd);
+        if (fe == NULL || fe->mask == mask)
+        {
+            return;
+        }
+        struct epoll_event ee = {};
+        ee.events = toEpoll(mask);
+        ee.data.fd = fd;
+        epoll_ctl(m_epfd, EPOLL_CTL_MOD, fd, &ee);
+        fe->mask = mask;
+    }
+
+    int getFileMask(int fd) const
+    {
+        const FileEvent* fe = lookup(fd);
+        return fe == NULL ? NONE : fe->mask;
+    }
+
+    void deleteFileEvent(int fd)
+    {
+        FileEvent* fe = lookup(fd);
+        if (fe != NULL)
+        {
+            *fe = FileEvent();
+            epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, NULL);
+        }
+    }
+
+    // 注册一个 ms 毫秒之后触发的时间事件，返回事件 ID
+    long long createTimeEvent(long long ms, TimeProc* proc, void* clientData, EventFinalizerProc* finalizer = NULL)
+    {
+        return createTimeEventNs((uint64_t)(ms > 0 ? ms : 0) * 1000000ULL, proc, clientData, finalizer);
+    }
+
+    // 同上，间隔是纳秒；触发时间是精确的，但 epoll_wait 的超时向上取整到毫秒，实际可能晚到将近 1ms
+    long long createTimeEventNs(uint64_t ns, TimeProc* proc, void* clientData, EventFinalizerProc* finalizer = NULL)
+    {
+        long long id = m_nextTimeEventId++;
+        std::unique_ptr<TimeEvent> te(new TimeEvent);
+        te->id = id;
+        te->when = nowNs() + ns;
+        te->proc = proc;
+        te->finalizer = finalizer;
+        te->clientData = clientData;
+        m_timers.insert(te.get());
+        m_timerIndex.emplace(id, std::move(te));
+        return id;
+    }
+
+    // 删除一个时间事件，可以在它自己的回调里调用；事件有 finalizer 时会被调用
+    bool deleteTimeEvent(long long id)
+    {
+        if (id == m_firingId)
+        {
+            m_firingDeleted = true;
+            return true;
+        }
+        auto it = m_timerIndex.find(id);
+        if (it == m_timerIndex.end())
+        {
+            return false;
+        }
+        std::unique_ptr<TimeEvent> te = std::move(it->second);
+        m_timerIndex.erase(it);
+        // 正在触发的这一轮里已经摘下来、还没轮到的事件不在树上
+        if (TimerTree::linked(te.get()))
+        {
+            m_timers.erase(te.get());
+        }
+        if (te->finalizer)
+        {
+            te->finalizer(this, te->clientData);
+        }
+        return true;
+    }
+
+    // 线程安全：把任务投递到循环线程执行
+    void post(std::function<void()> task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_taskMutex);
+            m_tasks.push_back(std::move(task));
+        }
+        wakeup();
+    }
+
+    // 线程安全：请求循环退出，run() 会在处理完当前这一轮事件后返回；在 run() 开始之前调用时 run() 直接返回
+    void stop()
+    {
+        m_stopRequested.store(true);
+        wakeup();
+    }
+
+    // 设置 (proc 为 NULL 时取消) 每一轮等待事件之前的回调，同一时间只有一个
+    void setBeforeSleepProc(BeforeSleepProc* proc, void* clientData)
+    {
+        m_beforeSleep = proc;
+        m_beforeSleepData = clientData;
+    }
+
+    bool inLoopThread() const { return m_loopThread == std::this_thread::get_id(); }
+
+    // 到目前为止调用 epoll_wait 的次数，用于统计每条消息的系统调用数
+    uint64_t pollCalls() const { return m_pollCalls; }
+
+    // 运行事件循环，直到 stop() 被调用
+    void run()
+    {
+        m_loopThread = std::this_thread::get_id();
+        // 不在这里清除退出请求：线程启动之前就调用了 stop() 的话，这里置位会把它覆盖掉，循环永远不会退出
+        while (!m_stopRequested.load())
+        {
+            processEvents(-1);
+        }
+        // 退出前把已经投递的任务执行完，通常是关闭连接之类的清理工作
+        runTasks();
+        // 这次退出请求已经生效，之后可以再次 run()
+        m_stopRequested.store(false);
+    }
+
+    // 处理一轮事件，timeoutMs 为 -1 时一直阻塞到有事件、被唤醒或者最近的时间事件到期
+    int processEvents(int timeoutMs)
+    {
+        // 先调用 beforeSleep，它可能新建时间事件，所以放在计算超时之前
+        if (m_beforeSleep != NULL)
+        {
+            m_beforeSleep(this, m_beforeSleepData);
+        }
+        if (!m_timers.empty())
+        {
+            uint64_t when = m_timers.first()->when;
+            uint64_t now = nowNs();
+            // 向上取整到毫秒，避免时间事件还差一点点到期时反复空转
+            int untilMs = when > now ? (int)((when - now + 999999) / 1000000) : 0;
+            if (timeoutMs < 0 || untilMs < timeoutMs)
+            {
+                timeoutMs = untilMs;
+            }
+        }
+        ++m_pollCalls;
+        int n = epoll_wait(m_epfd, m_events.data(), (int)m_events.size(), timeoutMs);
+        for (int i = 0; i < n; ++i)
+        {
+            int fd = m_events[i].data.fd;
+            uint32_t ev = m_events[i].events;
+            if (fd == m_wakeupFd)
+            {
+                uint64_t value;
+                while (read(m_wakeupFd, &value, sizeof(value)) > 0)
+                {
+                }
+                continue;
+            }
+            // 和 ae 一样先处理读事件再处理写事件
+            // 读回调里可能删掉了这个 fd 的注册 (例如连接出错被释放)，所以写之前要重新查一次
+            FileEvent* fe = lookup(fd);
+            if (fe != NULL && (fe->mask & READABLE) && (ev & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP)))
+            {
+                fe->proc(this, fd, fe->clientData, READABLE);
+                fe = lookup(fd);
+            }
+            if (fe != NULL && (fe->mask & WRITABLE) && (ev & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+            {
+                fe->proc(this, fd, fe->clientData, WRITABLE);
+            }
+        }
+        if (n == (int)m_events.size())
+        {
+            m_events.resize(m_events.size() * 2);
+        }
+        processTimeEvents();
+        runTasks();
+        return n;
+    }
+
+private:
+    struct FileEvent
+    {
+        int mask = NONE;
+        FileProc* proc = NULL; // 为 NULL 表示这个 fd 没有注册
+        void* clientData = NULL;
+    };
+
+    struct TimeEvent
+    {
+        RbNode node;
+        uint64_t when;
+        long long id;
+        TimeProc* proc;
+        EventFinalizerProc* finalizer;
+        void* clientData;
+    };
+
+    // 按 (触发时间, ID) 排序，同一时刻到期的事件按创建顺序触发
+    struct TimeEventLess
+    {
+        bool operator()(const TimeEvent& a, const TimeEvent& b) const
+        {
+            return a.when < b.when || (a.when == b.when && a.id < b.id);
+        }
+    };
+
+    typedef RbTree<TimeEvent, &TimeEvent::node, TimeEventLess> TimerTree;
+
+    static uint64_t nowNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    }
+
+    static uint32_t toEpoll(int mask)
+    {
+        uint32_t events = 0;
+        if (mask & READABLE)
+        {
+            events |= EPOLLIN | EPOLLRDHUP;
+        }
+        if (mask & WRITABLE)
+        {
+            events |= EPOLLOUT;
+        }
+        if (mask & EDGE)
+        {
+            events |= EPOLLET;
+        }
+        return events;
+    }
+
+    FileEvent* lookup(int fd)
+    {
+        return fd >= 0 && (size_t)fd < m_files.size() && m_files[fd].proc != NULL ? &m_files[fd] : NULL;
+    }
+
+    const FileEvent* lookup(int fd) const
+    {
+        return const_cast<EventLoop*>(this)->lookup(fd);
+    }
+
+    // 只触发这一轮开始时已经到期的事件，回调里新建的、或者间隔为 0 重新排队的事件留到下一轮
+    void processTimeEvents()
+    {
+        if (m_timers.empty())
+        {
+            return;
+        }
+        // 先把到期的事件全部从树上摘下来，再逐个触发；m_due 复用，稳定之后这里不分配内存
+        uint64_t now = nowNs();
+        m_due.clear();
+        for (TimeEvent* te = m_timers.first(); te != NULL && te->when <= now; te = m_timers.first())
+        {
+            m_timers.erase(te);
+            m_due.push_back(te->id);
+        }
+        for (long long id : m_due)
+        {
+            // 前面的回调可能已经删掉了这个事件
+            auto it = m_timerIndex.find(id);
+            if (it == m_timerIndex.end())
+            {
+                continue;
+            }
+            TimeEvent* te = it->second.get();
+            m_firingId = id;
+            m_firingDeleted = false;
+            int next = te->proc(this, id, te->clientData);
+            m_firingId = -1;
+            if (next < 0 || m_firingDeleted)
+            {
+                std::unique_ptr<TimeEvent> owned = std::move(it->second);
+                m_timerIndex.erase(it);
+                if (owned->finalizer)
+                {
+                    owned->finalizer(this, owned->clientData);
+                }
+                continue;
+            }
+            te->when = nowNs() + (uint64_t)next * 1000000ULL;
+            m_timers.insert(te);
+        }
+    }
+
+    // 已经有一次唤醒在路上时就不用再写 eventfd 了，减少一次系统调用
+    void wakeup()
+    {
+        if (!m_wakeupPending.exchange(true))
+        {
+            uint64_t one = 1;
+            ssize_t ignored = write(m_wakeupFd, &one, sizeof(one));
+            (void)ignored;
+        }
+    }
+
+    void runTasks()
+    {
+        m_wakeupPending.store(false);
+        std::vector<std::function<void()>> tasks;
+        {
+            std::lock_guard<std::mutex> lock(m_taskMutex);
+            tasks.swap(m_tasks);
+        }
+        for (auto& task : tasks)
+        {
+            task();
+        }
+    }
+
+    int m_epfd;
+    int m_wakeupFd;
+    BeforeSleepProc* m_beforeSleep;
+    void* m_beforeSleepData;
+    std::atomic<bool> m_stopRequested;
+    std::atomic<bool> m_wakeupPending;
+    std::thread::id m_loopThread;
+    std::vector<FileEvent> m_files; // 按 fd 下标
+    // 时间事件挂在按触发时间排序的红黑树上，事件本身由 m_timerIndex 按 ID 持有，用于删除
+    TimerTree m_timers;
+    std::unordered_map<long long, std::unique_ptr<TimeEvent>> m_timerIndex;
+    std::vector<long long> m_due; // processTimeEvents 里这一轮到期的事件
+    long long m_nextTimeEventId;
+    long long m_firingId;  // 正在执行回调的时间事件
+    bool m_firingDeleted;  // 正在执行的时间事件在回调里删除了自己
+    uint64_t m_pollCalls;
+    std::vector<struct epoll_event> m_events;
+    std::mutex m_taskMutex;
+    std::vector<std::function<void()>> m_tasks;
+};
+
+#endif
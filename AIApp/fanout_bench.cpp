@@ -0,0 +1,344 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/resource.h>
+#include <hiredis/hiredis.h>
+#include "latency.h"
+#include "chat_envelope.h"
+#include "chat_core.h"
+#include "message_filter.h"
+#include "redis_endpoint.h"
+
+// 无界面的订阅扇出压测
+// 对 --subscribers 里的每一个 N：启动 N 个 ChatCore (与 testAppMultThread 相同的接收/队列/分发逻辑)，
+// 再启动 M 个发布线程按 --rate 的总速率发送 --duration 秒，等所有订阅者收完 (或者 --drain-ms 内没有新消息) 后统计：
+// - 扇出吞吐：所有订阅者收到的消息总数 / 耗时
+// - 每条消息的 CPU：本进程 (订阅者 + 发布者) 的 user+sys 时间 / 收到的消息总数，不包括 Redis 服务器
+// - 丢失：应收 (发送数 x N) 减去实收；队列满丢弃的、被服务器断开的订阅者单独列出
+// - received 是接收线程收到的条数，delivered 是分发线程实际交给 sink 的条数，两者之差就是过滤器和分发队列丢掉的
+// - 发布到订阅线程收到的延迟
+//
+// N 很大时需要足够的文件描述符，启动时会把软限制提高到硬限制
+//
+// --shm NAME 时订阅者不连接 Redis，而是读取 shm_relay 写入的共享内存环 (需要先运行 shm_relay --channel <channel> --name NAME)，
+// 用来对比 "每个订阅者一个 Redis 连接" 和 "本机一个订阅 + 共享内存扇出" 的吞吐、CPU 和延迟
+//
+// --filter FILE 时所有订阅者共用一个编译好的 MessageFilter，在接收线程里过滤，用来看过滤对每条消息 CPU 的影响
+
+struct Options {
+    std::vector<int> subscribers{1, 10, 100, 1000}; // 依次测试的订阅者数量
+    int publishers = 4;       // 发布线程数，每个线程一个连接
+    int rate = 10000;         // 所有发布线程合计每秒发送的消息数，0 表示不限速
+    int durationSeconds = 5;  // 每一轮的发送时长
+    int payload = 32;         // 正文长度
+    int drainMs = 2000;       // 发送结束后，连续这么久没有新消息就认为收完了
+    int window = 64;          // 每个发布连接同时在途的 PUBLISH 数量
+    const char* channel = "fanout";
+    RedisEndpoint endpoint = RedisEndpoint::fromEnv(); // 订阅者和发布者都连这个地址
+    const char* shm = NULL;   // 订阅者改为读取这个共享内存环
+    std::shared_ptr<const MessageFilter> filter; // 订阅者的过滤规则，--filter 时设置
+};
+
+// 一个订阅者：ChatCore 加上只在它的接收线程里访问的统计
+// core 放在最后，先于它的线程会访问的统计数据析构
+struct Subscriber {
+    SequenceTracker tracker;
+    LatencyHistogram latency;
+    std::atomic<uint64_t> delivered{0}; // 分发线程交给 sink 的消息数
+    std::unique_ptr<ChatCore> core;
+};
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--subscribers N,N,...] [--publishers M] [--rate MSG_PER_SEC] [--duration SECONDS]"
+              << " [--payload BYTES] [--drain-ms MS] [--window N] [--channel NAME]"
+              << " [--endpoint HOST:PORT|unix:PATH] [--shm /SHM_NAME] [--filter RULES_FILE]" << std::endl;
+}
+
+static bool parseList(const char* value, std::vector<int>& out) {
+    out.clear();
+    const char* p = value;
+    while (*p) {
+        char* end;
+        long n = strtol(p, &end, 10);
+        if (end == p || n <= 0) {
+            return false;
+        }
+        out.push_back((int)n);
+        p = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            return false;
+        }
+    }
+    return !out.empty();
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--subscribers") == 0) {
+            if (!parseList(value, opts.subscribers)) {
+                return false;
+            }
+        } else if (strcmp(arg, "--publishers") == 0) {
+            opts.publishers = atoi(value);
+        } else if (strcmp(arg, "--rate") == 0) {
+            opts.rate = atoi(value);
+        } else if (strcmp(arg, "--duration") == 0) {
+            opts.durationSeconds = atoi(value);
+        } else if (strcmp(arg, "--payload") == 0) {
+            opts.payload = atoi(value);
+        } else if (strcmp(arg, "--drain-ms") == 0) {
+            opts.drainMs = atoi(value);
+        } else if (strcmp(arg, "--window") == 0) {
+            opts.window = atoi(value);
+        } else if (strcmp(arg, "--channel") == 0) {
+            opts.channel = value;
+        } else if (strcmp(arg, "--endpoint") == 0) {
+            if (!RedisEndpoint::parse(value, opts.endpoint)) {
+                return false;
+            }
+        } else if (strcmp(arg, "--shm") == 0) {
+            opts.shm = value;
+        } else if (strcmp(arg, "--filter") == 0) {
+            std::shared_ptr<MessageFilter> filter(new MessageFilter);
+            std::string error;
+            if (!filter->loadFile(value, MessageFilter::Options(), &error)) {
+                std::cerr << "Filter: " << error << std::endl;
+                return false;
+            }
+            opts.filter = filter;
+        } else {
+            return false;
+        }
+    }
+    return opts.publishers > 0 && opts.rate >= 0 && opts.durationSeconds > 0 && opts.payload >= 0 && opts.window > 0;
+}
+
+static void raiseFileLimit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static uint64_t cpuNs() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ((uint64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+           ((uint64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+// 一个发布线程：按速率生成消息，用 pipeline 保持 window 条在途，返回成功发送的条数
+static uint64_t runPublisher(int publisherId, const Options& opts, uint64_t deadlineNs) {
+    redisContext* context = opts.endpoint.connect();
+    if (context == NULL || context->err) {
+        std::cerr << "Publisher " << publisherId << " error: " << (context ? context->errstr : "can't allocate redis context") << std::endl;
+        if (context) {
+            redisFree(context);
+        }
+        return 0;
+    }
+
+    std::string body(opts.payload, 'x');
+    size_t channelLen = strlen(opts.channel);
+    double perThreadRate = opts.rate > 0 ? (double)opts.rate / opts.publishers : 0.0;
+    uint64_t startNs = monotonicNs();
+    uint64_t sent = 0;
+    uint64_t acked = 0;
+    bool ok = true;
+
+    while (ok) {
+        uint64_t now = monotonicNs();
+        if (now >= deadlineNs) {
+            break;
+        }
+        // 限速：到目前为止应该发出的条数
+        uint64_t due = perThreadRate > 0 ? (uint64_t)((now - startNs) / 1e9 * perThreadRate) + 1 : UINT64_MAX;
+        if (sent >= due) {
+            uint64_t nextNs = startNs + (uint64_t)(sent / perThreadRate * 1e9);
+            std::this_thread::sleep_for(std::chrono::nanoseconds(std::min(nextNs, deadlineNs) - now));
+            continue;
+        }
+        // 窗口满了就先读一条回复
+        if (sent - acked >= (uint64_t)opts.window) {
+            redisReply* reply = NULL;
+            if (redisGetReply(context, (void**)&reply) != REDIS_OK) {
+                ok = false;
+                break;
+            }
+            freeReplyObject(reply);
+            ++acked;
+            continue;
+        }
+        std::string message = encodeEnvelope((uint64_t)publisherId, sent, monotonicNs(), ENVELOPE_FLAG_TEXT, body);
+        redisAppendCommand(context, "PUBLISH %b %b", opts.channel, channelLen, message.data(), message.size());
+        ++sent;
+        // 限速模式下每条消息都立刻写出去，不在输出缓冲区里攒着，否则延迟的统计就不准了
+        if (perThreadRate > 0) {
+            int done = 0;
+            while (!done) {
+                if (redisBufferWrite(context, &done) != REDIS_OK) {
+                    ok = false;
+                    break;
+                }
+            }
+        }
+    }
+    while (ok && acked < sent) {
+        redisReply* reply = NULL;
+        if (redisGetReply(context, (void**)&reply) != REDIS_OK) {
+            ok = false;
+            break;
+        }
+        freeReplyObject(reply);
+        ++acked;
+    }
+    if (!ok) {
+        std::cerr << "Publisher " << publisherId << " error: " << context->errstr << std::endl;
+    }
+    redisFree(context);
+    return acked;
+}
+
+static uint64_t totalReceived(const std::vector<std::unique_ptr<Subscriber>>& subs) {
+    uint64_t total = 0;
+    for (auto& sub : subs) {
+        total += sub->core->stats().received.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+// 跑一轮 N 个订阅者的测试，打印一行结果
+static bool runRound(int n, const Options& opts) {
+    std::vector<std::unique_ptr<Subscriber>> subs;
+    for (int i = 0; i < n; ++i) {
+        std::unique_ptr<Subscriber> sub(new Subscriber);
+        Subscriber* raw = sub.get();
+        ChatCore::Options coreOpts;
+        coreOpts.endpoint = opts.endpoint;
+        coreOpts.channel = opts.channel;
+        if (opts.shm != NULL) {
+            coreOpts.shmRing = opts.shm;
+        }
+        coreOpts.filter = opts.filter;
+        // 断开就算作失败 (结果里的 disc 一列)，不自动重连
+        coreOpts.reconnect = false;
+        // 分发线程的 sink 只计数，立刻放行下一批，相当于一个永远跟得上的界面
+        sub->core.reset(new ChatCore(coreOpts, [raw](std::vector<std::string>&& batch) {
+            raw->delivered.fetch_add(batch.size(), std::memory_order_relaxed);
+            raw->core->batchDone();
+        }));
+        sub->core->setObserver([raw](const Envelope& envelope) {
+            uint64_t now = monotonicNs();
+            raw->latency.record(now > envelope.sendNs ? now - envelope.sendNs : 0);
+            raw->tracker.observe(envelope.senderId, envelope.seq);
+        });
+        if (!sub->core->start()) {
+            std::cerr << "Failed to start subscriber " << i << " of " << n << std::endl;
+            for (auto& started : subs) {
+                started->core->stop();
+            }
+            return false;
+        }
+        subs.push_back(std::move(sub));
+    }
+
+    uint64_t cpuStart = cpuNs();
+    uint64_t startNs = monotonicNs();
+    uint64_t deadlineNs = startNs + (uint64_t)opts.durationSeconds * 1000000000ULL;
+
+    std::vector<uint64_t> sentBy(opts.publishers, 0);
+    std::vector<std::thread> publishers;
+    for (int p = 0; p < opts.publishers; ++p) {
+        publishers.emplace_back([p, &opts, deadlineNs, &sentBy]() {
+            sentBy[p] = runPublisher(p + 1, opts, deadlineNs);
+        });
+    }
+    for (auto& t : publishers) {
+        t.join();
+    }
+    uint64_t sent = 0;
+    for (uint64_t s : sentBy) {
+        sent += s;
+    }
+    uint64_t expected = sent * (uint64_t)n;
+
+    // 等订阅者收完：全部收到，或者连续 drainMs 没有进展
+    uint64_t lastReceived = totalReceived(subs);
+    uint64_t lastProgressNs = monotonicNs();
+    uint64_t endNs = lastProgressNs;
+    while (lastReceived < expected && monotonicNs() - lastProgressNs < (uint64_t)opts.drainMs * 1000000ULL) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        uint64_t received = totalReceived(subs);
+        if (received != lastReceived) {
+            lastReceived = received;
+            lastProgressNs = endNs = monotonicNs();
+        }
+    }
+    uint64_t cpu = cpuNs() - cpuStart;
+
+    uint64_t received = 0;
+    uint64_t delivered = 0;
+    uint64_t queueDropped = 0;
+    uint64_t filtered = 0;
+    uint64_t reordered = 0;
+    int disconnected = 0;
+    LatencyHistogram latency;
+    for (auto& sub : subs) {
+        sub->core->stop();
+        received += sub->core->stats().received.load();
+        delivered += sub->delivered.load();
+        queueDropped += sub->core->stats().dropped.load();
+        filtered += sub->core->stats().filtered.load();
+        reordered += sub->tracker.reordered() + sub->tracker.duplicates();
+        disconnected += sub->core->disconnected() ? 1 : 0;
+        latency.merge(sub->latency);
+    }
+
+    double seconds = (endNs - startNs) / 1e9;
+    printf("%6d %10llu %12llu %12llu %12.0f %10.3f %10.1f %10.1f %10llu %10llu %10llu %6d %10llu\n",
+           n, (unsigned long long)sent, (unsigned long long)received, (unsigned long long)delivered, seconds > 0 ? received / seconds : 0.0,
+           received > 0 ? cpu / 1000.0 / received : 0.0, latency.percentile(0.50) / 1000.0, latency.percentile(0.99) / 1000.0,
+           (unsigned long long)(expected > received ? expected - received : 0), (unsigned long long)queueDropped,
+           (unsigned long long)reordered, disconnected, (unsigned long long)filtered);
+    fflush(stdout);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    raiseFileLimit();
+    Monotonic::init();
+
+    std::cout << "publishers=" << opts.publishers << " rate=" << (opts.rate > 0 ? std::to_string(opts.rate) : "unlimited")
+              << " duration=" << opts.durationSeconds << "s payload=" << opts.payload << " channel=" << opts.channel
+              << " endpoint=" << opts.endpoint.toString() << (opts.shm != NULL ? std::string(" shm=") + opts.shm : "")
+              << (opts.filter ? " filter=" + std::to_string(opts.filter->ruleCount()) + " rules/" + opts.filter->prefilterName() : "")
+              << std::endl;
+    printf("%6s %10s %12s %12s %12s %10s %10s %10s %10s %10s %10s %6s %10s\n",
+           "subs", "sent", "received", "delivered", "fanout/s", "cpu_us/msg", "p50_us", "p99_us", "lost", "q_dropped", "reordered", "disc",
+           "filtered");
+
+    for (int n : opts.subscribers) {
+        if (!runRound(n, opts)) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,279 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <regex.h>
+#include "latency.h"
+#include "message_filter.h"
+
+// 接收端内容过滤的微基准：MessageFilter (一个 DFA，每条消息扫描一遍) vs 每条规则一个 regcomp，每条消息对每条规则调用 regexec
+// 两组规则，都不区分大小写：
+// 1. moderation：几十个关键词加十个常见的审核/路由正则，能唤醒 DFA 的字符很多，MessageFilter 不用预过滤
+// 2. triggers：几条以少见字符开头的正则 (数字、@、!、://)，普通文本大部分被 SIMD 预过滤直接跳过
+// 消息是随机拼出来的聊天文本，一部分混入关键词和正则能匹配的片段
+// 正则只用 POSIX ERE 也支持的写法，两边逐条比较每条消息命中的规则集合，不一致时报错退出
+// MessageFilter 分别测 SIMD 预过滤打开和关闭两种情况
+
+struct Options {
+    int messages = 200000;  // 消息条数
+    int keywords = 48;      // 关键词规则数，不超过内置的词表
+    int hitPercent = 5;     // 混入关键词或正则片段的消息比例
+    int rounds = 3;         // 每种方式重复的次数，取最快的一次
+};
+
+static const char* const KEYWORDS[] = {
+    "casino", "jackpot", "viagra", "crypto giveaway", "wire transfer", "gift card", "click here", "limited offer",
+    "act now", "winner", "lottery", "bitcoin doubler", "nigerian prince", "password reset", "verify your account",
+    "onlyfans", "escort", "payday loan", "refinance", "weight loss", "miracle cure", "no prescription", "cheap pills",
+    "forex signal", "pump and dump", "airdrop", "seed phrase", "private key", "telegram me", "whatsapp me", "dm me",
+    "follow for follow", "sub4sub", "free followers", "hack account", "cracked", "keygen", "warez", "torrent link",
+    "idiot", "moron", "loser", "stupid", "shut up", "kill yourself", "scam", "spam", "phishing",
+};
+
+// POSIX ERE 子集：regcomp 和 MessageFilter 都按同样的意思理解
+static const char* const PATTERNS[] = {
+    "https?://[a-z0-9.-]+",
+    "[0-9]{3}-[0-9]{3,4}-[0-9]{4}",
+    "[a-z0-9._]+@[a-z0-9-]+[.][a-z]+",
+    "^/[a-z]+",
+    "!{3,}",
+    "(buy|sell) +[0-9]+ +(btc|eth)",
+    "free +(money|gift|coins)",
+    "[0-9]{16}",
+    "bye$",
+    "f(u|[*])+ck",
+};
+
+// 只在少见字符上离开空闲状态的规则
+static const char* const TRIGGERS[] = {
+    "://[a-z0-9.-]+",
+    "[0-9]{3}-[0-9]{3,4}-[0-9]{4}",
+    "@[a-z0-9-]+[.][a-z]+",
+    "!{3,}",
+    "[0-9]{16}",
+};
+
+// 混入消息的片段，前半部分命中正则，后半部分是关键词表里没有的普通词
+static const char* const INSERTS[] = {
+    "see https://example.com/x", "call 555-123-4567", "mail bob.smith@example.org", "/join", "wow!!!!",
+    "buy 10 btc", "free  coins", "4111111111111111", "f**ck", "FUUUCK",
+};
+
+static const char* const WORDS[] = {
+    "hello", "world", "the", "meeting", "is", "at", "noon", "tomorrow", "can", "you", "send", "me", "report", "please",
+    "thanks", "lunch", "ok", "sure", "sounds", "good", "what", "about", "friday", "deploy", "build", "failed", "again",
+    "redis", "latency", "is", "fine", "now", "class", "assignment", "passed", "review", "merged", "channel", "room",
+    "message", "server", "restart", "weekend", "coffee", "later", "lol", "nice", "great", "idea", "ticket",
+};
+
+template <typename T, size_t N>
+static size_t countOf(const T (&)[N]) {
+    return N;
+}
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--messages N] [--keywords N] [--hit-percent P] [--rounds N]" << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        int value = atoi(argv[++i]);
+        if (strcmp(arg, "--messages") == 0) {
+            opts.messages = value;
+        } else if (strcmp(arg, "--keywords") == 0) {
+            opts.keywords = value;
+        } else if (strcmp(arg, "--hit-percent") == 0) {
+            opts.hitPercent = value;
+        } else if (strcmp(arg, "--rounds") == 0) {
+            opts.rounds = value;
+        } else {
+            return false;
+        }
+    }
+    return opts.messages > 0 && opts.keywords >= 0 && opts.keywords <= (int)countOf(KEYWORDS) && opts.hitPercent >= 0
+           && opts.hitPercent <= 100 && opts.rounds > 0;
+}
+
+// 20 ~ 200 字节的聊天文本，hitPercent 的消息在随机位置混入一个关键词或者正则片段
+static std::vector<std::string> makeMessages(const Options& opts) {
+    std::mt19937_64 rng(1);
+    std::vector<std::string> messages(opts.messages);
+    for (auto& m : messages) {
+        size_t target = 20 + rng() % 181;
+        while (m.size() < target) {
+            if (!m.empty()) {
+                m += ' ';
+            }
+            m += WORDS[rng() % countOf(WORDS)];
+        }
+        if ((int)(rng() % 100) < opts.hitPercent) {
+            const char* insert = opts.keywords > 0 && rng() % 2 == 0 ? KEYWORDS[rng() % opts.keywords]
+                                                                   : INSERTS[rng() % countOf(INSERTS)];
+            size_t at = m.find(' ', rng() % m.size());
+            if (rng() % 4 == 0 || at == std::string::npos) {
+                m += ' ';
+                m += insert;
+            } else {
+                m.insert(at + 1, std::string(insert) + ' ');
+            }
+        }
+    }
+    return messages;
+}
+
+// 关键词按字面匹配，regcomp 之前把 ERE 的元字符转义
+static std::string escapeLiteral(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (strchr(".[]{}()\\*+?^$|", c) != NULL) {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+struct RunResult {
+    double seconds = 0.0;
+    uint64_t hits = 0;     // 命中规则的总次数
+    uint64_t matched = 0;  // 至少命中一条规则的消息数
+};
+
+template <typename F>
+static RunResult best(int rounds, F run) {
+    RunResult result;
+    for (int round = 0; round < rounds; ++round) {
+        RunResult r = run();
+        if (round == 0 || r.seconds < result.seconds) {
+            result = r;
+        }
+    }
+    return result;
+}
+
+static RunResult runFilter(const MessageFilter& filter, const std::vector<std::string>& messages) {
+    RunResult r;
+    FilterMatches matches;
+    uint64_t start = monotonicNs();
+    for (const auto& m : messages) {
+        filter.scan(m, matches);
+        r.hits += matches.count();
+        r.matched += matches.any() ? 1 : 0;
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    return r;
+}
+
+static RunResult runRegex(const std::vector<regex_t>& regexes, const std::vector<std::string>& messages) {
+    RunResult r;
+    uint64_t start = monotonicNs();
+    for (const auto& m : messages) {
+        uint64_t hits = 0;
+        for (const regex_t& regex : regexes) {
+            hits += regexec(&regex, m.c_str(), 0, NULL, 0) == 0 ? 1 : 0;
+        }
+        r.hits += hits;
+        r.matched += hits > 0 ? 1 : 0;
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    return r;
+}
+
+static void report(const char* name, const RunResult& r, const std::vector<std::string>& messages, uint64_t bytes) {
+    printf("  %-28s msgs/s=%12.0f ns/msg=%8.1f MB/s=%8.1f matched=%llu hits=%llu\n", name, messages.size() / r.seconds,
+           r.seconds * 1e9 / messages.size(), bytes / r.seconds / 1e6, (unsigned long long)r.matched,
+           (unsigned long long)r.hits);
+}
+
+// 编译一组规则，与 regexec 逐条比较命中结果，然后分别计时
+static bool runSuite(const char* name, const std::vector<MessageFilter::Rule>& rules, const std::vector<std::string>& messages,
+                     uint64_t bytes, int rounds) {
+    MessageFilter::Options filterOpts;
+    MessageFilter filter;
+    std::string error;
+    if (!filter.compile(rules, filterOpts, &error)) {
+        std::cerr << "MessageFilter: " << error << std::endl;
+        return false;
+    }
+    filterOpts.prefilter = false;
+    MessageFilter plain;
+    plain.compile(rules, filterOpts, NULL);
+
+    std::vector<regex_t> regexes(rules.size());
+    for (size_t i = 0; i < rules.size(); ++i) {
+        std::string text = rules[i].kind == MessageFilter::Kind::Literal ? escapeLiteral(rules[i].text) : rules[i].text;
+        if (regcomp(&regexes[i], text.c_str(), REG_EXTENDED | REG_ICASE | REG_NOSUB) != 0) {
+            std::cerr << "regcomp failed: " << text << std::endl;
+            for (size_t k = 0; k < i; ++k) {
+                regfree(&regexes[k]);
+            }
+            return false;
+        }
+    }
+
+    bool ok = true;
+    FilterMatches matches;
+    for (size_t i = 0; i < messages.size() && ok; ++i) {
+        filter.scan(messages[i], matches);
+        for (size_t r = 0; r < rules.size(); ++r) {
+            bool expect = regexec(&regexes[r], messages[i].c_str(), 0, NULL, 0) == 0;
+            if (matches.test(r) != expect) {
+                std::cerr << "rule " << rules[r].text << (expect ? " missed: " : " false match: ") << messages[i] << std::endl;
+                ok = false;
+            }
+        }
+    }
+
+    std::cout << name << ": " << rules.size() << " rules, " << filter.stateCount() << " DFA states, " << filter.classCount()
+              << " byte classes, prefilter " << filter.prefilterName() << std::endl;
+    report("MessageFilter", best(rounds, [&]() { return runFilter(filter, messages); }), messages, bytes);
+    report("MessageFilter (no prefilter)", best(rounds, [&]() { return runFilter(plain, messages); }), messages, bytes);
+    report("regexec per rule", best(rounds, [&]() { return runRegex(regexes, messages); }), messages, bytes);
+
+    for (auto& regex : regexes) {
+        regfree(&regex);
+    }
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<MessageFilter::Rule> moderation;
+    for (int i = 0; i < opts.keywords; ++i) {
+        moderation.push_back({MessageFilter::Kind::Literal, MessageFilter::Action::Count, KEYWORDS[i]});
+    }
+    for (const char* pattern : PATTERNS) {
+        moderation.push_back({MessageFilter::Kind::Pattern, MessageFilter::Action::Count, pattern});
+    }
+    std::vector<MessageFilter::Rule> triggers;
+    for (const char* pattern : TRIGGERS) {
+        triggers.push_back({MessageFilter::Kind::Pattern, MessageFilter::Action::Count, pattern});
+    }
+
+    std::vector<std::string> messages = makeMessages(opts);
+    uint64_t bytes = 0;
+    for (const auto& m : messages) {
+        bytes += m.size();
+    }
+    std::cout << messages.size() << " messages, " << bytes / messages.size() << " bytes avg, " << opts.hitPercent
+              << "% with an inserted hit" << std::endl;
+
+    bool ok = runSuite("moderation", moderation, messages, bytes, opts.rounds);
+    ok = runSuite("triggers", triggers, messages, bytes, opts.rounds) && ok;
+    if (!ok) {
+        std::cerr << "Match mismatch" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,616 @@
+#ifndef AIAPP_FORMAT_H
+#define AIAPP_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+
+/**
+ * 编译期解析格式串、写进调用方缓冲区的格式化，用来代替热路径上的 snprintf 和 std::to_string + operator+
+ *
+ *     char buf[64];
+ *     size_t len = formatTo(buf, sizeof(buf), FMT("Client {} Message {}"), clientId, i);
+ *
+ * 格式串的写法与 std::format 的子集相同：{} 是一个参数，{{ 和 }} 是字面的花括号，{:说明} 的说明部分为
+ *     [<|>][0][宽度][.精度][类型]
+ * 类型：整数 d x X，浮点 f e g，字符 c，字符串 s，指针 p；不写类型时整数十进制、浮点最短往返、字符串原样
+ * - 格式串通过 FMT 宏成为类型的一部分，在编译期拆成 "字面量 / 参数" 片段：花括号不配对、说明写错、
+ *   占位符个数与参数个数不一致、说明与参数类型不符 (比如对字符串用 x) 都是编译错误，运行时不再解析
+ * - 整数每次转换两位 (与 Redis util.c 的 ull2string 相同)；浮点用 std::to_chars，不写精度时输出能原样读回的最短表示
+ * - 不分配内存，不依赖 locale；返回值与 snprintf 相同，是完整输出的长度 (不含 \0)，大于等于 size 说明被截断了，
+ *   size 大于 0 时总是以 \0 结尾
+*/
+
+namespace fmtdetail
+{
+
+// FMT 生成的类型都继承它，formatTo 据此区分格式串和普通参数
+struct FormatTag
+{
+};
+
+enum class ArgKind : uint8_t
+{
+    Int,
+    Uint,
+    Bool,
+    Char,
+    Float,
+    Double,
+    String,
+    Pointer
+};
+
+struct Spec
+{
+    char type = 0;        // 0 表示默认
+    char align = 0;       // '<'、'>'，0 表示默认 (数字右对齐，其余左对齐)
+    bool zero = false;    // 宽度以 0 开头：数字在符号之后补 0
+    uint8_t width = 0;
+    int8_t precision = -1;
+};
+
+// 格式串的一个片段：字面量 fmt[begin, begin + len)，或者第 arg 个参数
+struct Piece
+{
+    uint16_t begin = 0;
+    uint16_t len = 0;
+    int16_t arg = -1;
+    Spec spec;
+};
+
+static const size_t npos = (size_t)-1;
+static const int MAX_WIDTH = 255;
+static const int MAX_PRECISION = 30;
+
+// 解析 fmt[pos] 处 '{' 开始的占位符，返回 '}' 的下标，格式不对时返回 npos
+constexpr size_t parsePlaceholder(std::string_view fmt, size_t pos, Spec& spec)
+{
+    size_t i = pos + 1;
+    if (i < fmt.size() && fmt[i] == ':')
+    {
+        ++i;
+        if (i < fmt.size() && (fmt[i] == '<' || fmt[i] == '>'))
+        {
+            spec.align = fmt[i++];
+        }
+        if (i < fmt.size() && fmt[i] == '0')
+        {
+            spec.zero = true;
+            ++i;
+        }
+        int width = 0;
+        while (i < fmt.size() && fmt[i] >= '0' && fmt[i] <= '9')
+        {
+            width = width * 10 + (fmt[i++] - '0');
+            if (width > MAX_WIDTH)
+            {
+                return npos;
+            }
+        }
+        spec.width = (uint8_t)width;
+        if (i < fmt.size() && fmt[i] == '.')
+        {
+            ++i;
+            int precision = 0;
+            bool digits = false;
+            while (i < fmt.size() && fmt[i] >= '0' && fmt[i] <= '9')
+            {
+                precision = precision * 10 + (fmt[i++] - '0');
+                digits = true;
+                if (precision > MAX_PRECISION)
+                {
+                    return npos;
+                }
+            }
+            if (!digits)
+            {
+                return npos;
+            }
+            spec.precision = (int8_t)precision;
+        }
+        if (i < fmt.size() && fmt[i] != '}')
+        {
+            char t = fmt[i++];
+            if (t != 'd' && t != 'x' && t != 'X' && t != 'f' && t != 'e' && t != 'g' && t != 'c' && t != 's' && t != 'p')
+            {
+                return npos;
+            }
+            spec.type = t;
+        }
+    }
+    return i < fmt.size() && fmt[i] == '}' ? i : npos;
+}
+
+// 遍历格式串，依次交给 onLiteral(begin, len) 和 onArg(spec)；格式串有错时返回 false
+template <typename OnLiteral, typename OnArg>
+constexpr bool walk(std::string_view fmt, OnLiteral&& onLiteral, OnArg&& onArg)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < fmt.size(); ++i)
+    {
+        char c = fmt[i];
+        if (c != '{' && c != '}')
+        {
+            continue;
+        }
+        if (i + 1 < fmt.size() && fmt[i + 1] == c)
+        {
+            // {{ 或 }}：字面量包含第一个花括号，跳过第二个
+            onLiteral(start, i + 1 - start);
+            start = ++i + 1;
+            continue;
+        }
+        if (c == '}')
+        {
+            return false;
+        }
+        Spec spec;
+        size_t end = parsePlaceholder(fmt, i, spec);
+        if (end == npos)
+        {
+            return false;
+        }
+        onLiteral(start, i - start);
+        onArg(spec);
+        i = end;
+        start = end + 1;
+    }
+    onLiteral(start, fmt.size() - start);
+    return true;
+}
+
+constexpr bool valid(std::string_view fmt)
+{
+    return fmt.size() <= UINT16_MAX && walk(fmt, [](size_t, size_t) {}, [](const Spec&) {});
+}
+
+// 占位符个数
+constexpr int countArgs(std::string_view fmt)
+{
+    int count = 0;
+    walk(fmt, [](size_t, size_t) {}, [&count](const Spec&) { ++count; });
+    return count;
+}
+
+// 片段个数，空的字面量不算
+constexpr size_t countPieces(std::string_view fmt)
+{
+    size_t count = 0;
+    walk(fmt, [&count](size_t, size_t len) { count += len > 0 ? 1 : 0; }, [&count](const Spec&) { ++count; });
+    return count;
+}
+
+// 片段数组，N 为 0 时也至少有一个元素
+template <size_t N>
+struct Pieces
+{
+    Piece items[N > 0 ? N : 1];
+};
+
+template <size_t N>
+constexpr Pieces<N> parse(std::string_view fmt)
+{
+    Pieces<N> pieces{};
+    size_t n = 0;
+    int16_t arg = 0;
+    walk(
+        fmt,
+        [&](size_t begin, size_t len) {
+            if (len > 0 && n < N)
+            {
+                pieces.items[n].begin = (uint16_t)begin;
+                pieces.items[n].len = (uint16_t)len;
+                ++n;
+            }
+        },
+        [&](const Spec& spec) {
+            if (n < N)
+            {
+                pieces.items[n].arg = arg;
+                pieces.items[n].spec = spec;
+                ++n;
+            }
+            ++arg;
+        });
+    return pieces;
+}
+
+template <typename T>
+struct AlwaysFalse : std::false_type
+{
+};
+
+template <typename T>
+constexpr ArgKind kindOf()
+{
+    using U = std::remove_cv_t<std::remove_reference_t<T>>;
+    if constexpr (std::is_same_v<U, bool>)
+    {
+        return ArgKind::Bool;
+    }
+    else if constexpr (std::is_same_v<U, char>)
+    {
+        return ArgKind::Char;
+    }
+    else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>)
+    {
+        return ArgKind::Int;
+    }
+    else if constexpr (std::is_integral_v<U>)
+    {
+        return ArgKind::Uint;
+    }
+    else if constexpr (std::is_same_v<U, float>)
+    {
+        return ArgKind::Float;
+    }
+    else if constexpr (std::is_floating_point_v<U>)
+    {
+        return ArgKind::Double;
+    }
+    else if constexpr (std::is_convertible_v<const U&, std::string_view>)
+    {
+        // const char*、字符数组、std::string、std::string_view、Sds
+        return ArgKind::String;
+    }
+    else if constexpr (std::is_pointer_v<U>)
+    {
+        return ArgKind::Pointer;
+    }
+    else
+    {
+        static_assert(AlwaysFalse<U>::value, "format: unsupported argument type");
+        return ArgKind::Int;
+    }
+}
+
+// 说明能不能用于这种参数
+constexpr bool accepts(const Spec& spec, ArgKind kind)
+{
+    switch (kind)
+    {
+        case ArgKind::Int:
+        case ArgKind::Uint:
+            return (spec.type == 0 || spec.type == 'd' || spec.type == 'x' || spec.type == 'X') && spec.precision < 0;
+        case ArgKind::Float:
+        case ArgKind::Double:
+            return spec.type == 0 || spec.type == 'f' || spec.type == 'e' || spec.type == 'g';
+        case ArgKind::Bool:
+            return (spec.type == 0 || spec.type == 's') && spec.precision < 0 && !spec.zero;
+        case ArgKind::Char:
+            return (spec.type == 0 || spec.type == 'c') && spec.precision < 0 && !spec.zero;
+        case ArgKind::String:
+            return (spec.type == 0 || spec.type == 's') && !spec.zero;
+        case ArgKind::Pointer:
+            return (spec.type == 0 || spec.type == 'p') && spec.precision < 0;
+    }
+    return false;
+}
+
+template <size_t N, typename... Args>
+constexpr bool typesMatch(const Pieces<N>& pieces)
+{
+    constexpr ArgKind kinds[sizeof...(Args) + 1] = {kindOf<Args>()..., ArgKind::Int};
+    for (size_t i = 0; i < N; ++i)
+    {
+        const Piece& piece = pieces.items[i];
+        if (piece.arg >= 0 && !accepts(piece.spec, kinds[piece.arg]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 类型擦除后的参数，格式化时按片段里的下标取
+struct Arg
+{
+    ArgKind kind;
+    union
+    {
+        long long i;
+        unsigned long long u;
+        double d;
+        float f;
+        char c;
+        bool b;
+        const void* p;
+        struct
+        {
+            const char* data;
+            size_t size;
+        } s;
+    };
+};
+
+template <typename T>
+inline Arg makeArg(const T& value)
+{
+    Arg arg;
+    arg.kind = kindOf<T>();
+    if constexpr (kindOf<T>() == ArgKind::Int)
+    {
+        arg.i = (long long)value;
+    }
+    else if constexpr (kindOf<T>() == ArgKind::Uint)
+    {
+        arg.u = (unsigned long long)value;
+    }
+    else if constexpr (kindOf<T>() == ArgKind::Bool)
+    {
+        arg.b = value;
+    }
+    else if constexpr (kindOf<T>() == ArgKind::Char)
+    {
+        arg.c = value;
+    }
+    else if constexpr (kindOf<T>() == ArgKind::Float)
+    {
+        arg.f = value;
+    }
+    else if constexpr (kindOf<T>() == ArgKind::Double)
+    {
+        arg.d = (double)value;
+    }
+    else if constexpr (kindOf<T>() == ArgKind::String)
+    {
+        std::string_view view;
+        if constexpr (std::is_pointer_v<T>)
+        {
+            view = value != NULL ? std::string_view(value) : std::string_view("(null)");
+        }
+        else
+        {
+            view = value;
+        }
+        arg.s.data = view.data();
+        arg.s.size = view.size();
+    }
+    else
+    {
+        arg.p = (const void*)value;
+    }
+    return arg;
+}
+
+// 输出到 [p, end)，超出的部分只计数不写，total 是完整输出的长度
+struct Writer
+{
+    char* p;
+    char* end;
+    size_t total;
+
+    void put(const char* data, size_t len)
+    {
+        size_t room = (size_t)(end - p);
+        size_t n = len < room ? len : room;
+        memcpy(p, data, n);
+        p += n;
+        total += len;
+    }
+
+    void fill(char c, size_t len)
+    {
+        size_t room = (size_t)(end - p);
+        size_t n = len < room ? len : room;
+        memset(p, c, n);
+        p += n;
+        total += len;
+    }
+};
+
+// 从 end 往前写 v 的十进制，返回开头
+inline char* writeDecimal(char* end, unsigned long long v)
+{
+    static const char DIGITS[] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    while (v >= 100)
+    {
+        unsigned idx = (unsigned)(v % 100) * 2;
+        v /= 100;
+        *--end = DIGITS[idx + 1];
+        *--end = DIGITS[idx];
+    }
+    if (v < 10)
+    {
+        *--end = (char)('0' + v);
+    }
+    else
+    {
+        unsigned idx = (unsigned)v * 2;
+        *--end = DIGITS[idx + 1];
+        *--end = DIGITS[idx];
+    }
+    return end;
+}
+
+inline char* writeHex(char* end, unsigned long long v, bool upper)
+{
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do
+    {
+        *--end = digits[v & 0xF];
+        v >>= 4;
+    } while (v != 0);
+    return end;
+}
+
+// 按宽度和对齐输出 [begin, begin + len)；zero 时在符号 (以及 0x) 之后补 0
+inline void pad(Writer& w, const Spec& spec, const char* begin, size_t len, bool numeric)
+{
+    size_t width = spec.width;
+    if (len >= width)
+    {
+        w.put(begin, len);
+        return;
+    }
+    size_t padding = width - len;
+    if (numeric && spec.zero && spec.align == 0)
+    {
+        size_t prefix = 0;
+        if (len > 0 && (begin[0] == '-' || begin[0] == '+'))
+        {
+            prefix = 1;
+        }
+        if (len >= prefix + 2 && begin[prefix] == '0' && (begin[prefix + 1] == 'x' || begin[prefix + 1] == 'X'))
+        {
+            prefix += 2;
+        }
+        w.put(begin, prefix);
+        w.fill('0', padding);
+        w.put(begin + prefix, len - prefix);
+        return;
+    }
+    bool left = spec.align == '<' || (spec.align == 0 && !numeric);
+    if (!left)
+    {
+        w.fill(' ', padding);
+    }
+    w.put(begin, len);
+    if (left)
+    {
+        w.fill(' ', padding);
+    }
+}
+
+template <typename F>
+inline size_t writeFloat(char* buf, char* end, F value, const Spec& spec)
+{
+    std::to_chars_result r;
+    if (spec.type == 0 && spec.precision < 0)
+    {
+        r = std::to_chars(buf, end, value);
+    }
+    else
+    {
+        std::chars_format format = spec.type == 'e' ? std::chars_format::scientific
+                                   : spec.type == 'f' ? std::chars_format::fixed
+                                                      : std::chars_format::general;
+        r = std::to_chars(buf, end, value, format, spec.precision >= 0 ? spec.precision : 6);
+    }
+    return r.ec == std::errc() ? (size_t)(r.ptr - buf) : 0;
+}
+
+inline void writeArg(Writer& w, const Spec& spec, const Arg& arg)
+{
+    // 最长的是 1e308 按 {:.30f} 输出，309 位整数加上 31 位小数
+    char buf[352];
+    char* end = buf + sizeof(buf);
+    switch (arg.kind)
+    {
+        case ArgKind::Int:
+        case ArgKind::Uint:
+        {
+            bool negative = arg.kind == ArgKind::Int && arg.i < 0;
+            unsigned long long v = negative ? 0ULL - arg.u : arg.u;
+            char* p;
+            if (spec.type == 'x' || spec.type == 'X')
+            {
+                p = writeHex(end, v, spec.type == 'X');
+            }
+            else
+            {
+                p = writeDecimal(end, v);
+            }
+            if (negative)
+            {
+                *--p = '-';
+            }
+            pad(w, spec, p, (size_t)(end - p), true);
+            break;
+        }
+        case ArgKind::Float:
+            pad(w, spec, buf, writeFloat(buf, end, arg.f, spec), true);
+            break;
+        case ArgKind::Double:
+            pad(w, spec, buf, writeFloat(buf, end, arg.d, spec), true);
+            break;
+        case ArgKind::Bool:
+            pad(w, spec, arg.b ? "true" : "false", arg.b ? 4 : 5, false);
+            break;
+        case ArgKind::Char:
+            pad(w, spec, &arg.c, 1, false);
+            break;
+        case ArgKind::String:
+        {
+            size_t len = arg.s.size;
+            if (spec.precision >= 0 && (size_t)spec.precision < len)
+            {
+                len = (size_t)spec.precision;
+            }
+            pad(w, spec, arg.s.data, len, false);
+            break;
+        }
+        case ArgKind::Pointer:
+        {
+            char* p = writeHex(end, (unsigned long long)(uintptr_t)arg.p, false);
+            *--p = 'x';
+            *--p = '0';
+            pad(w, spec, p, (size_t)(end - p), true);
+            break;
+        }
+    }
+}
+
+} // namespace fmtdetail
+
+// 把字符串字面量包装成一个类型，格式串由此成为模板参数，可以在编译期检查和拆分
+#define FMT(s)                                                           \
+    ([] {                                                                \
+        struct FormatString : fmtdetail::FormatTag                       \
+        {                                                                \
+            static constexpr std::string_view value() { return s; }     \
+        };                                                               \
+        return FormatString{};                                           \
+    }())
+
+template <typename Format, typename... Args,
+          typename = std::enable_if_t<std::is_base_of_v<fmtdetail::FormatTag, Format>>>
+inline size_t formatTo(char* buf, size_t size, Format, const Args&... args)
+{
+    constexpr std::string_view fmt = Format::value();
+    static_assert(fmtdetail::valid(fmt), "format: unmatched brace or malformed {} spec");
+    static_assert(fmtdetail::countArgs(fmt) == (int)sizeof...(Args),
+                  "format: number of {} placeholders does not match number of arguments");
+    constexpr size_t N = fmtdetail::countPieces(fmt);
+    static constexpr fmtdetail::Pieces<N> pieces = fmtdetail::parse<N>(fmt);
+    static_assert(fmtdetail::typesMatch<N, Args...>(pieces), "format: {} spec does not match argument type");
+
+    const fmtdetail::Arg argv[sizeof...(Args) + 1] = {fmtdetail::makeArg(args)..., fmtdetail::Arg()};
+    fmtdetail::Writer w = {buf, size > 0 ? buf + size - 1 : buf, 0};
+    for (size_t i = 0; i < N; ++i)
+    {
+        const fmtdetail::Piece& piece = pieces.items[i];
+        if (piece.arg < 0)
+        {
+            w.put(fmt.data() + piece.begin, piece.len);
+        }
+        else
+        {
+            fmtdetail::writeArg(w, piece.spec, argv[piece.arg]);
+        }
+    }
+    if (size > 0)
+    {
+        *w.p = '\0';
+    }
+    return w.total;
+}
+
+// 写进字符数组，大小由编译器推导
+template <size_t Size, typename Format, typename... Args,
+          typename = std::enable_if_t<std::is_base_of_v<fmtdetail::FormatTag, Format>>>
+inline size_t formatTo(char (&buf)[Size], Format format, const Args&... args)
+{
+    return formatTo(buf, Size, format, args...);
+}
+
+#endif
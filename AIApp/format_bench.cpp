@@ -0,0 +1,287 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include "latency.h"
+#include "format.h"
+
+// format.h 与 snprintf、std::ostringstream、std::to_string + operator+ 的对比，三种负载：
+// 1. chat：simulate_clients 的消息正文 "Client {} Message {}"
+// 2. stats：chat_gateway 的统计行，三个整数加两个定点小数
+// 3. double：随机 double 按能读回原值的方式输出，format.h 用最短表示，snprintf / iostream 用 17 位有效数字
+// chat 和 stats 的输出逐条与 snprintf 比较，double 检查 strtod 读回来是否与原值相等
+// 分配次数通过替换全局 operator new 统计
+
+static uint64_t g_allocs = 0;
+
+void* operator new(size_t size) {
+    ++g_allocs;
+    void* p = malloc(size ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+struct Options {
+    int ops = 2000000;  // 每种写法格式化的次数
+    int rounds = 3;     // 每种写法重复的次数，取最快的一次
+};
+
+struct RunResult {
+    double seconds = 0.0;
+    uint64_t allocs = 0;
+    uint64_t bytes = 0;  // 输出的总长度，防止编译器把格式化优化掉
+};
+
+struct Stats {
+    unsigned long long ok;
+    unsigned long long failed;
+    unsigned long long rejected;
+    double rate;
+    double avgBatch;
+};
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--ops N] [--rounds N]" << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        int value = atoi(argv[++i]);
+        if (strcmp(arg, "--ops") == 0) {
+            opts.ops = value;
+        } else if (strcmp(arg, "--rounds") == 0) {
+            opts.rounds = value;
+        } else {
+            return false;
+        }
+    }
+    return opts.ops > 0 && opts.rounds > 0;
+}
+
+enum class Method {
+    Format,
+    Snprintf,
+    Stream,
+    Concat
+};
+
+static const char* methodName(Method method) {
+    switch (method) {
+        case Method::Format: return "format.h";
+        case Method::Snprintf: return "snprintf";
+        case Method::Stream: return "ostringstream";
+        case Method::Concat: return "to_string + operator+";
+    }
+    return "unknown";
+}
+
+// ---- 三种负载，每个函数把第 i 条写进 buf，返回长度 ----
+
+static size_t chatMessage(Method method, char* buf, size_t size, int clientId, int i) {
+    switch (method) {
+        case Method::Format:
+            return formatTo(buf, size, FMT("Client {} Message {}"), clientId, i);
+        case Method::Snprintf:
+            return (size_t)snprintf(buf, size, "Client %d Message %d", clientId, i);
+        case Method::Stream: {
+            std::ostringstream out;
+            out << "Client " << clientId << " Message " << i;
+            std::string s = out.str();
+            memcpy(buf, s.c_str(), s.size() + 1);
+            return s.size();
+        }
+        case Method::Concat: {
+            std::string s = "Client " + std::to_string(clientId) + " Message " + std::to_string(i);
+            memcpy(buf, s.c_str(), s.size() + 1);
+            return s.size();
+        }
+    }
+    return 0;
+}
+
+static size_t statsLine(Method method, char* buf, size_t size, const Stats& s) {
+    switch (method) {
+        case Method::Format:
+            return formatTo(buf, size, FMT("requests: ok={} failed={} rejected={} rate={:.0f}/s avg_batch={:.1f}\n"),
+                            s.ok, s.failed, s.rejected, s.rate, s.avgBatch);
+        case Method::Snprintf:
+            return (size_t)snprintf(buf, size, "requests: ok=%llu failed=%llu rejected=%llu rate=%.0f/s avg_batch=%.1f\n",
+                                    s.ok, s.failed, s.rejected, s.rate, s.avgBatch);
+        case Method::Stream:
+        case Method::Concat: {
+            // to_string 对 double 固定输出 6 位小数，没法指定精度，两种写法都用 iostream
+            std::ostringstream out;
+            out << "requests: ok=" << s.ok << " failed=" << s.failed << " rejected=" << s.rejected << std::fixed
+                << std::setprecision(0) << " rate=" << s.rate << "/s" << std::setprecision(1) << " avg_batch=" << s.avgBatch
+                << "\n";
+            std::string str = out.str();
+            memcpy(buf, str.c_str(), str.size() + 1);
+            return str.size();
+        }
+    }
+    return 0;
+}
+
+static size_t doubleValue(Method method, char* buf, size_t size, double d) {
+    switch (method) {
+        case Method::Format:
+            return formatTo(buf, size, FMT("{}"), d);
+        case Method::Snprintf:
+            return (size_t)snprintf(buf, size, "%.17g", d);
+        case Method::Stream:
+        case Method::Concat: {
+            // to_string 只有 6 位小数，读不回原值，两种写法都用 iostream
+            std::ostringstream out;
+            out << std::setprecision(17) << d;
+            std::string str = out.str();
+            memcpy(buf, str.c_str(), str.size() + 1);
+            return str.size();
+        }
+    }
+    return 0;
+}
+
+template <typename F>
+static RunResult run(int ops, F build) {
+    RunResult r;
+    char buf[256];
+    uint64_t allocs = g_allocs;
+    uint64_t start = monotonicNs();
+    for (int i = 0; i < ops; ++i) {
+        r.bytes += build(buf, sizeof(buf), i);
+        asm volatile("" : : "r"(buf) : "memory");
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    r.allocs = g_allocs - allocs;
+    return r;
+}
+
+template <typename F>
+static RunResult best(int rounds, F run) {
+    RunResult result;
+    for (int round = 0; round < rounds; ++round) {
+        RunResult r = run();
+        if (round == 0 || r.seconds < result.seconds) {
+            result = r;
+        }
+    }
+    return result;
+}
+
+static void report(Method method, const RunResult& r, int ops) {
+    printf("  %-22s ns/op=%.1f allocs/op=%.2f bytes/op=%.1f\n", methodName(method), r.seconds * 1e9 / ops,
+           (double)r.allocs / ops, (double)r.bytes / ops);
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    bool ok = true;
+
+    std::mt19937_64 rng(1);
+    std::vector<Stats> stats(1024);
+    for (auto& s : stats) {
+        s.ok = rng() % 100000000;
+        s.failed = rng() % 1000;
+        s.rejected = rng() % 100;
+        s.rate = (double)(rng() % 10000000) / 7.0;
+        s.avgBatch = (double)(rng() % 100000) / 1000.0;
+    }
+    std::vector<double> doubles(1024);
+    for (auto& d : doubles) {
+        // 随机的位模式，覆盖整个指数范围
+        do {
+            uint64_t bits = rng();
+            memcpy(&d, &bits, sizeof(d));
+        } while (!(d == d) || d - d != 0.0);
+    }
+
+    const Method all[] = {Method::Format, Method::Snprintf, Method::Stream, Method::Concat};
+
+    // 先检查输出是否一致
+    for (int i = 0; i < 100000 && ok; ++i) {
+        char expect[256];
+        char got[256];
+        chatMessage(Method::Snprintf, expect, sizeof(expect), i % 1000, i);
+        statsLine(Method::Snprintf, expect + 64, sizeof(expect) - 64, stats[i % stats.size()]);
+        for (Method method : all) {
+            chatMessage(method, got, sizeof(got), i % 1000, i);
+            statsLine(method, got + 64, sizeof(got) - 64, stats[i % stats.size()]);
+            if (strcmp(expect, got) != 0 || strcmp(expect + 64, got + 64) != 0) {
+                std::cerr << methodName(method) << " differs from snprintf: " << got << " / " << got + 64 << std::endl;
+                ok = false;
+            }
+        }
+        for (Method method : all) {
+            double d = doubles[i % doubles.size()];
+            doubleValue(method, got, sizeof(got), d);
+            if (strtod(got, NULL) != d) {
+                std::cerr << methodName(method) << " does not round-trip: " << got << std::endl;
+                ok = false;
+            }
+        }
+    }
+
+    std::cout << "chat: \"Client {} Message {}\", " << opts.ops << " messages" << std::endl;
+    for (Method method : all) {
+        RunResult r = best(opts.rounds, [&]() {
+            return run(opts.ops, [&](char* buf, size_t size, int i) { return chatMessage(method, buf, size, i % 1000, i); });
+        });
+        report(method, r, opts.ops);
+    }
+
+    std::cout << "stats: 3 integers + 2 fixed-point doubles, " << opts.ops << " lines" << std::endl;
+    for (Method method : all) {
+        if (method == Method::Concat) {
+            continue;
+        }
+        RunResult r = best(opts.rounds, [&]() {
+            return run(opts.ops, [&](char* buf, size_t size, int i) {
+                return statsLine(method, buf, size, stats[(size_t)i % stats.size()]);
+            });
+        });
+        report(method, r, opts.ops);
+    }
+
+    std::cout << "double: random bit patterns, round-trip output (format.h shortest, others %.17g), " << opts.ops
+              << " values" << std::endl;
+    for (Method method : all) {
+        if (method == Method::Concat) {
+            continue;
+        }
+        RunResult r = best(opts.rounds, [&]() {
+            return run(opts.ops, [&](char* buf, size_t size, int i) {
+                return doubleValue(method, buf, size, doubles[(size_t)i % doubles.size()]);
+            });
+        });
+        report(method, r, opts.ops);
+    }
+
+    if (!ok) {
+        std::cerr << "Output mismatch" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
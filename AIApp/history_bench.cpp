@@ -0,0 +1,325 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <ftw.h>
+#include "latency.h"
+#include "crc64.h"
+#include "rio.h"
+#include "history_store.h"
+
+// 本地聊天记录 (history_store.h) 的基准：
+// 1. 写入：--messages 条消息按 --batch 一批追加进日志 (与分发线程一样每批 flush，每秒 fsync)，中途按默认策略自动压缩，
+//    压缩在后台进行，记下单次 append 最长的耗时，看分发线程会不会被压缩卡住
+// 2. 压缩：最后手动压缩一次，全部消息进入快照
+// 3. 启动：重新打开并取最近 --tail 条 (testAppMultThread 启动时渲染的量)，快照 mmap + 索引，与一共存了多少条无关；
+//    再追加 --log 条不压缩，看日志需要回放时的启动时间
+// 4. 对比：把快照里的消息全部读成 std::string (启动时加载全部历史的做法)，以及 verify() 读整个快照核对校验和
+// 另外检查 crc64 的标准测试值，以及三种 rio 后端写同样的数据得到的运行校验和一致；
+// 以及日志中间有坏记录时的压缩：校验和不对的那条被跳过，后面的历史一条不少；长度坏了的放弃压缩，日志原样保留
+//
+// 页缓存是热的：文件刚写完，冷启动时读快照尾部还要加上几次缺页的磁盘读取
+
+struct Options {
+    int messages = 2000000;  // 写入的消息条数
+    int payload = 80;        // 平均正文长度
+    int batch = 100;         // 每批追加的条数
+    int tail = 10000;        // 启动时取最近的条数
+    int log = 100000;        // 压缩之后再追加、留在日志里的条数
+    const char* dir = NULL;  // 默认在 /tmp 下建临时目录，结束时删除
+};
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--messages N] [--payload BYTES] [--batch N] [--tail N] [--log N] [--dir PATH]"
+              << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--messages") == 0) {
+            opts.messages = atoi(value);
+        } else if (strcmp(arg, "--payload") == 0) {
+            opts.payload = atoi(value);
+        } else if (strcmp(arg, "--batch") == 0) {
+            opts.batch = atoi(value);
+        } else if (strcmp(arg, "--tail") == 0) {
+            opts.tail = atoi(value);
+        } else if (strcmp(arg, "--log") == 0) {
+            opts.log = atoi(value);
+        } else if (strcmp(arg, "--dir") == 0) {
+            opts.dir = value;
+        } else {
+            return false;
+        }
+    }
+    return opts.messages > 0 && opts.payload > 0 && opts.batch > 0 && opts.tail >= 0 && opts.log >= 0;
+}
+
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*) {
+    return remove(path);
+}
+
+// 第 i 条消息，长度在 payload 上下浮动，内容可以由 i 重新生成，用来检查读回来的数据
+static std::string makeMessage(uint64_t i, int payload) {
+    std::string message = "msg " + std::to_string(i) + " ";
+    size_t len = (size_t)payload / 2 + (i * 2654435761ULL) % (size_t)payload;
+    while (message.size() < len) {
+        message += (char)('a' + (i + message.size()) % 26);
+    }
+    return message;
+}
+
+// maxStallNs 不为空时记下单次 append 最长的耗时
+static bool appendRange(HistoryStore& store, uint64_t from, uint64_t to, const Options& opts,
+                        uint64_t* maxStallNs = NULL) {
+    std::vector<std::string> batch;
+    for (uint64_t i = from; i < to;) {
+        batch.clear();
+        for (int k = 0; k < opts.batch && i < to; ++k, ++i) {
+            batch.push_back(makeMessage(i, opts.payload));
+        }
+        uint64_t start = monotonicNs();
+        if (!store.append(batch)) {
+            return false;
+        }
+        if (maxStallNs != NULL) {
+            *maxStallNs = std::max(*maxStallNs, monotonicNs() - start);
+        }
+    }
+    return true;
+}
+
+// 日志里第 index 条记录的偏移 (头部 24 字节之后一条条 [u32 长度][正文][u64 校验和])
+static off_t logRecordOffset(uint64_t index, int payload) {
+    off_t offset = 24;
+    for (uint64_t i = 0; i < index; ++i) {
+        offset += sizeof(uint32_t) + makeMessage(i, payload).size() + sizeof(uint64_t);
+    }
+    return offset;
+}
+
+static bool patchFile(const std::string& path, off_t offset, const void* data, size_t len) {
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    bool ok = fd >= 0 && pwrite(fd, data, len, offset) == (ssize_t)len;
+    if (fd >= 0) {
+        close(fd);
+    }
+    return ok;
+}
+
+// 100 条消息，第 50 条的正文坏了一个字节：压缩只丢这一条；再把第 80 条的长度改坏：压缩放弃，日志原样保留
+static bool checkCorruptCompaction(const std::string& dir) {
+    const uint64_t count = 100;
+    Options opts;
+    opts.batch = 10;
+    HistoryStore::Options storeOpts;
+    storeOpts.dir = dir;
+    storeOpts.compactMinBytes = SIZE_MAX;
+    HistoryStore store;
+    std::string error;
+    if (!store.open(storeOpts, &error) || !appendRange(store, 0, count, opts)) {
+        std::cerr << "corrupt check: " << error << std::endl;
+        return false;
+    }
+    store.close();
+    std::string logPath = dir + "/history.log";
+    char flip = '#';
+    if (!patchFile(logPath, logRecordOffset(50, opts.payload) + sizeof(uint32_t) + 2, &flip, 1)
+        || !store.open(storeOpts, &error)) {
+        std::cerr << "corrupt check: " << error << std::endl;
+        return false;
+    }
+    if (!store.compact(&error) || store.size() != count - 1 || store.compactSkipped() != 1) {
+        std::cerr << "corrupt check: compact kept " << store.size() << " of " << count - 1 << ", skipped "
+                  << store.compactSkipped() << " " << error << std::endl;
+        return false;
+    }
+    std::vector<std::string> shown;
+    store.tail(count, [&shown](std::string_view message) { shown.emplace_back(message); });
+    for (uint64_t i = 0, k = 0; i < count; ++i) {
+        if (i != 50 && (k >= shown.size() || shown[k++] != makeMessage(i, opts.payload))) {
+            std::cerr << "corrupt check: message " << i << " lost after compaction" << std::endl;
+            return false;
+        }
+    }
+
+    // 新日志里追加 count 条，把其中第 80 条的长度改成超过上限，压缩走不过去
+    if (!appendRange(store, 0, count, opts)) {
+        return false;
+    }
+    uint32_t badLen = UINT32_MAX;
+    size_t before = store.size();
+    if (!patchFile(logPath, logRecordOffset(80, opts.payload), &badLen, sizeof(badLen))) {
+        return false;
+    }
+    if (store.compact(&error) || store.compactFailures() != 1 || store.size() != before) {
+        std::cerr << "corrupt check: compaction over a bad length should be abandoned" << std::endl;
+        return false;
+    }
+    // 旧日志还在，继续追加
+    if (!appendRange(store, count, count + 10, opts) || store.size() != before + 10) {
+        std::cerr << "corrupt check: append after abandoned compaction failed" << std::endl;
+        return false;
+    }
+    printf("corrupt record: 1 of %llu skipped by compaction; bad length: compaction abandoned (%s)\n",
+           (unsigned long long)count, store.lastError().c_str());
+    store.close();
+    return true;
+}
+
+// 重新打开，取最近 tail 条并逐条核对内容，返回从 open 到取完的耗时
+static bool reopen(HistoryStore& store, const HistoryStore::Options& storeOpts, const Options& opts, uint64_t total,
+                   double& ms) {
+    store.close();
+    std::string error;
+    uint64_t start = monotonicNs();
+    if (!store.open(storeOpts, &error)) {
+        std::cerr << "open: " << error << std::endl;
+        return false;
+    }
+    std::vector<std::string> shown;
+    shown.reserve(opts.tail);
+    store.tail(opts.tail, [&shown](std::string_view message) { shown.emplace_back(message); });
+    ms = (monotonicNs() - start) / 1e6;
+
+    uint64_t expectCount = std::min<uint64_t>(total, opts.tail);
+    if (store.size() != total || shown.size() != expectCount) {
+        std::cerr << "reopen: stored " << store.size() << " of " << total << ", tail " << shown.size() << std::endl;
+        return false;
+    }
+    for (size_t k = 0; k < shown.size(); ++k) {
+        if (shown[k] != makeMessage(total - expectCount + k, opts.payload)) {
+            std::cerr << "reopen: message " << total - expectCount + k << " differs" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool checkRio() {
+    if (Crc64::update(0, "123456789", 9) != 0xe9c6d914c4b8d9caULL) {
+        std::cerr << "crc64 test vector failed" << std::endl;
+        return false;
+    }
+    std::string data;
+    for (int i = 0; i < 100000; ++i) {
+        data += makeMessage(i, 80);
+    }
+    RioBuffer buffer;
+    FILE* fp = tmpfile();
+    RioFile file(fp, 64 * 1024);
+    RioFd fd(fileno(fp));
+    Rio* rios[] = {&buffer, &file, &fd};
+    for (Rio* rio : rios) {
+        rio->enableChecksum(true);
+        rio->setMaxProcessingChunk(4096);
+        // 大小不一的写入，覆盖缓冲区攒着、直接写出和拆块几种情况
+        for (size_t pos = 0, step = 1; pos < data.size(); pos += step, step = step * 3 % 100003 + 1) {
+            rio->write(data.data() + pos, std::min(step, data.size() - pos));
+        }
+        if (!rio->flush() || rio->checksum() != Crc64::update(0, data.data(), data.size())
+            || rio->processedBytes() != data.size()) {
+            std::cerr << "rio backend checksum mismatch" << std::endl;
+            fclose(fp);
+            return false;
+        }
+    }
+    // 内存缓冲区读回来的校验和也要一样
+    RioBuffer reader(buffer.buffer().view());
+    reader.enableChecksum(true);
+    std::string back(data.size(), '\0');
+    bool ok = reader.read(&back[0], back.size()) && back == data && reader.checksum() == buffer.checksum()
+              && !reader.read(&back[0], 1);
+    fclose(fp);
+    if (!ok) {
+        std::cerr << "rio buffer read mismatch" << std::endl;
+    }
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (!checkRio()) {
+        return 1;
+    }
+
+    char tmpl[] = "/tmp/history_bench.XXXXXX";
+    std::string dir = opts.dir != NULL ? opts.dir : "";
+    if (opts.dir == NULL && mkdtemp(tmpl) != NULL) {
+        dir = tmpl;
+    }
+    if (dir.empty()) {
+        std::cerr << "mkdtemp failed" << std::endl;
+        return 1;
+    }
+    HistoryStore::Options storeOpts;
+    storeOpts.dir = dir;
+    storeOpts.keep = (size_t)opts.messages + (size_t)opts.log;
+
+    bool ok = true;
+    HistoryStore store;
+    std::string error;
+    if (!store.open(storeOpts, &error)) {
+        std::cerr << "open: " << error << std::endl;
+        return 1;
+    }
+
+    uint64_t start = monotonicNs();
+    uint64_t maxStallNs = 0;
+    ok = appendRange(store, 0, (uint64_t)opts.messages, opts, &maxStallNs);
+    double appendSec = (monotonicNs() - start) / 1e9;
+    size_t autoCompactions = store.compactions();
+    start = monotonicNs();
+    ok = ok && store.compact(&error);
+    double compactMs = (monotonicNs() - start) / 1e6;
+    if (!ok) {
+        std::cerr << "append/compact failed: " << error << std::endl;
+    }
+    printf("append:  %d messages, %.0f msgs/s, %zu background compactions, longest append %.2f ms\n", opts.messages,
+           opts.messages / appendSec, autoCompactions, maxStallNs / 1e6);
+    printf("compact: %zu messages, %.1f MB snapshot, %.1f ms\n", store.snapshotCount(), store.snapshotBytes() / 1e6,
+           compactMs);
+
+    double openMs = 0.0;
+    ok = ok && reopen(store, storeOpts, opts, (uint64_t)opts.messages, openMs);
+    printf("startup, snapshot only:  open + tail %d = %.2f ms\n", opts.tail, openMs);
+
+    ok = ok && appendRange(store, (uint64_t)opts.messages, (uint64_t)opts.messages + opts.log, opts);
+    ok = ok && reopen(store, storeOpts, opts, (uint64_t)opts.messages + opts.log, openMs);
+    printf("startup, + %d in log:   open + tail %d = %.2f ms\n", opts.log, opts.tail, openMs);
+
+    // 对比：全部读成 std::string，相当于启动时把历史整个加载进来
+    start = monotonicNs();
+    std::vector<std::string> all;
+    all.reserve(store.size());
+    store.tail(store.size(), [&all](std::string_view message) { all.emplace_back(message); });
+    double loadAllMs = (monotonicNs() - start) / 1e6;
+    printf("load all %zu messages into memory: %.1f ms\n", all.size(), loadAllMs);
+
+    start = monotonicNs();
+    bool verified = store.verify();
+    printf("verify snapshot checksum: %s, %.1f ms\n", verified ? "ok" : "FAILED", (monotonicNs() - start) / 1e6);
+    ok = ok && verified && store.corrupt() == 0 && store.compactFailures() == 0;
+
+    store.close();
+    ok = checkCorruptCompaction(dir + "/corrupt") && ok;
+    if (opts.dir == NULL) {
+        nftw(dir.c_str(), removeEntry, 8, FTW_DEPTH | FTW_PHYS);
+    }
+    if (!ok) {
+        std::cerr << "History check failed" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,737 @@
+#ifndef AIAPP_HISTORY_STORE_H
+#define AIAPP_HISTORY_STORE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "crc64.h"
+#include "latency.h"
+#include "rio.h"
+
+/**
+ * 聊天记录的本地持久化：一个只追加的日志加上定期压缩出来的快照，思路与 Redis 的 AOF + RDB 相同
+ *
+ * 目录里有两个文件：
+ * - history.log：[头部 magic | version | generation] 之后是一条条记录 [u32 长度][正文][u64 CRC-64(长度 + 正文)]，
+ *   通过 RioFd 缓冲写入，每批 flush 一次，每 fsyncIntervalMs 落盘一次 (相当于 appendfsync everysec)
+ * - history.snap：[头部 magic | version | 条数 | 索引偏移 | 已经并入的日志 generation | 并入到这个日志的哪个偏移]
+ *   [u32 长度][正文]... [u64 偏移 x 条数] [u64 CRC-64]，末尾的校验和是 rio 写整个文件时累积的运行校验和，与 RDB 一样
+ *   (version 1 的快照头部没有最后一项，表示整个日志都已经并入)
+ *
+ * 压缩：日志超过 compactMinBytes 并且达到快照大小的 compactPercent% 时 (auto-aof-rewrite-min-size / percentage)，
+ * 和 BGREWRITEAOF 一样在后台进行，不阻塞追加：
+ * 1. 追加的线程把日志落盘，记下此刻日志的末尾，启动一个后台线程
+ * 2. 后台线程把旧快照和日志里到这个末尾为止的记录中最近的 keep 条写成新快照，rename 替换；
+ *    日志逐条核对校验和，长度合理而校验和不对的记录按长度跳过并计数；长度不合理 (走不到记下的末尾) 时放弃这次压缩，
+ *    旧快照和日志原样保留 —— 压缩永远不会因为一条坏记录丢掉它后面的历史
+ * 3. 之后的某次追加发现后台完成了，把压缩期间追加的记录 (末尾之后的部分) 拷进一个 generation + 1 的新日志，rename 替换
+ * 在两次 rename 之间崩溃时，快照里记着已经并入的 generation 和偏移，打开时跳过日志里已经并入的部分，消息不会重复
+ *
+ * 启动：快照只做 mmap 和头部检查，需要哪几条就从末尾的索引直接找到哪几条，和快照里一共有多少条无关；
+ * 日志 (大小受压缩策略限制) 只沿着长度走一遍建索引，检查最后一条的校验和，写了一半的尾部截掉
+ * 完整的校验和检查 (verify) 要读整个快照，不在启动路径上；tail 交出去的每一条都会单独检查
+ *
+ * 不是线程安全的，所有调用都应该在同一个线程里 (testAppMultThread 里是 ChatCore 的分发线程)；
+ * 后台压缩线程只读取旧快照的映射和日志的一个前缀，压缩进行期间这些都不会被修改
+*/
+class HistoryStore
+{
+public:
+    struct Options
+    {
+        std::string dir;                        // 存放两个文件的目录，不存在时创建
+        size_t keep = 1000000;                  // 压缩时快照最多保留的条数
+        size_t compactMinBytes = 4 * 1024 * 1024;
+        int compactPercent = 100;               // 日志达到快照大小的这个百分比才压缩
+        uint64_t fsyncIntervalMs = 1000;        // 日志落盘的间隔，0 表示每批都落盘
+        size_t autosyncBytes = 4 * 1024 * 1024; // 写快照时每写这么多字节 fdatasync 一次
+    };
+
+    HistoryStore() = default;
+    ~HistoryStore() { close(); }
+
+    HistoryStore(const HistoryStore&) = delete;
+    HistoryStore& operator=(const HistoryStore&) = delete;
+
+    bool open(const Options& opts, std::string* error)
+    {
+        close();
+        m_opts = opts;
+        if (mkdir(m_opts.dir.c_str(), 0700) != 0 && errno != EEXIST)
+        {
+            return fail(error, "mkdir " + m_opts.dir);
+        }
+        if (!mapSnapshot(error) || !openLog(error))
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        // 等后台压缩结束，把它期间追加的记录也换进新日志
+        if (m_job)
+        {
+            finishCompaction(NULL);
+        }
+        if (m_logRio)
+        {
+            m_logRio->sync();
+            m_logRio.reset();
+        }
+        if (m_logFd >= 0)
+        {
+            ::close(m_logFd);
+            m_logFd = -1;
+        }
+        m_log.unmap();
+        m_logOffsets.clear();
+        m_snap.unmap();
+        m_snapCount = 0;
+        m_logCount = 0;
+        m_logBytes = 0;
+        m_logBase = 0;
+        m_compactRetryAt = 0;
+    }
+
+    // 快照加日志一共保存的条数
+    size_t size() const { return m_snapCount + m_logCount; }
+    size_t snapshotCount() const { return m_snapCount; }
+    size_t logCount() const { return m_logCount; }
+    size_t snapshotBytes() const { return m_snap.size; }
+    size_t logBytes() const { return m_logBytes; }
+    // tail 时校验和不对、被跳过的条数
+    size_t corrupt() const { return m_corrupt; }
+    // 压缩时校验和不对、没有进入快照的条数
+    size_t compactSkipped() const { return m_compactSkipped; }
+    // 放弃了的压缩次数和最近一次的原因，放弃时日志原样保留
+    size_t compactFailures() const { return m_compactFailures; }
+    const std::string& lastError() const { return m_lastError; }
+    bool compacting() const { return m_job != nullptr; }
+
+    /**
+     * 按从旧到新的顺序交出最近的 n 条，f(std::string_view)，数据直接指向 mmap，只在这次调用期间有效
+     * 只覆盖 open 时已经在磁盘上的记录，应该在 append 之前调用 (启动时渲染最近的历史)
+    */
+    template <typename F>
+    size_t tail(size_t n, F f)
+    {
+        size_t fromLog = std::min(n, m_logOffsets.size());
+        size_t fromSnap = std::min(n - fromLog, m_snapCount);
+        size_t delivered = 0;
+        for (size_t i = m_snapCount - fromSnap; i < m_snapCount; ++i)
+        {
+            std::string_view message;
+            if (snapshotRecord(i, message))
+            {
+                f(message);
+                ++delivered;
+            }
+            else
+            {
+                ++m_corrupt;
+            }
+        }
+        for (size_t i = m_logOffsets.size() - fromLog; i < m_logOffsets.size(); ++i)
+        {
+            std::string_view message;
+            if (logRecord(m_log, m_logOffsets[i], m_log.size, true, message))
+            {
+                f(message);
+                ++delivered;
+            }
+            else
+            {
+                ++m_corrupt;
+            }
+        }
+        return delivered;
+    }
+
+    // 追加一批消息 (空消息不保存)，整批只 flush 一次；到了间隔就落盘，到了阈值就启动后台压缩
+    // 只有日志写不进去时返回 false；压缩失败不影响追加，记在 compactFailures / lastError 里
+    bool append(const std::vector<std::string>& batch)
+    {
+        if (!m_logRio)
+        {
+            return false;
+        }
+        for (const std::string& message : batch)
+        {
+            if (message.empty() || message.size() > MAX_MESSAGE)
+            {
+                continue;
+            }
+            uint32_t len = (uint32_t)message.size();
+            // 每条记录单独求校验和：先清零，写完长度和正文之后取出来写在后面
+            m_logRio->setChecksum(0);
+            m_logRio->enableChecksum(true);
+            m_logRio->writeValue(len);
+            m_logRio->write(message);
+            m_logRio->enableChecksum(false);
+            m_logRio->writeValue(m_logRio->checksum());
+            ++m_logCount;
+        }
+        m_logBytes = (size_t)m_logRio->tell();
+        uint64_t now = monotonicNs();
+        bool due = now - m_lastSyncNs >= m_opts.fsyncIntervalMs * 1000000ULL;
+        if (!(due ? m_logRio->sync() : m_logRio->flush()))
+        {
+            return false;
+        }
+        if (due)
+        {
+            m_lastSyncNs = now;
+        }
+        if (m_job && m_job->done.load(std::memory_order_acquire))
+        {
+            finishCompaction(NULL);
+        }
+        size_t unmerged = m_logBytes - (size_t)m_logBase;
+        if (!m_job && m_logRio && m_logBytes >= m_compactRetryAt && unmerged >= m_opts.compactMinBytes
+            && unmerged * 100 >= m_snap.size * (size_t)m_opts.compactPercent)
+        {
+            startCompaction(NULL);
+        }
+        return m_logRio != nullptr;
+    }
+
+    /**
+     * 同步压缩：等正在进行的后台压缩结束，再把快照和日志里最近的 keep 条写成新快照，换一个新日志
+     * 日志里长度合理而校验和不对的记录被跳过；日志走不到末尾时放弃，返回 false，快照和日志原样保留
+    */
+    bool compact(std::string* error)
+    {
+        if (m_job && !finishCompaction(error) && !m_logRio)
+        {
+            return false;
+        }
+        return startCompaction(error) && finishCompaction(error);
+    }
+
+    // 读整个快照检查末尾的校验和
+    bool verify() const
+    {
+        if (m_snap.data == NULL)
+        {
+            return true;
+        }
+        uint64_t stored;
+        memcpy(&stored, m_snap.data + m_snap.size - sizeof(uint64_t), sizeof(stored));
+        return Crc64::update(0, m_snap.data, m_snap.size - sizeof(uint64_t)) == stored;
+    }
+
+    size_t compactions() const { return m_compactions; }
+
+private:
+    static const uint64_t SNAP_MAGIC = 0x3150414e53494843ULL; // "CHISNAP1"
+    static const uint64_t LOG_MAGIC = 0x3130474f4c494843ULL;  // "CHILOG01"
+    static const uint32_t SNAP_VERSION = 2;
+    static const uint32_t LOG_VERSION = 1;
+    static const size_t MAX_MESSAGE = 64 * 1024 * 1024;
+
+    struct SnapHeader
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t count;
+        uint64_t indexOffset;
+        uint64_t logGeneration; // 已经并入这个快照的日志 generation
+        uint64_t logMerged;     // 这个日志并入到哪个偏移为止，version 1 没有这一项
+    };
+
+    static const size_t SNAP_HEADER_V1 = offsetof(SnapHeader, logMerged);
+
+    struct LogHeader
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t generation;
+    };
+
+    // 只读映射整个文件
+    struct MappedFile
+    {
+        const char* data = NULL;
+        size_t size = 0;
+
+        ~MappedFile() { unmap(); }
+
+        bool map(const std::string& path)
+        {
+            unmap();
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+            {
+                return false;
+            }
+            struct stat st;
+            bool ok = fstat(fd, &st) == 0;
+            if (ok && st.st_size > 0)
+            {
+                void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                ok = p != MAP_FAILED;
+                if (ok)
+                {
+                    data = static_cast<const char*>(p);
+                    size = (size_t)st.st_size;
+                }
+            }
+            ::close(fd);
+            return ok;
+        }
+
+        void unmap()
+        {
+            if (data != NULL)
+            {
+                munmap(const_cast<char*>(data), size);
+                data = NULL;
+                size = 0;
+            }
+        }
+    };
+
+    // 一次后台压缩：日志的 [begin, end) 和旧快照一起写成新快照
+    struct CompactJob
+    {
+        MappedFile log;
+        uint64_t generation = 0;
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        size_t logCount = 0; // 启动时日志里的条数，完成后减掉，剩下的是压缩期间追加的
+        size_t skipped = 0;
+        bool ok = false;
+        std::string error;
+        std::atomic<bool> done{false};
+        std::thread thread;
+    };
+
+    std::string snapPath() const { return m_opts.dir + "/history.snap"; }
+    std::string logPath() const { return m_opts.dir + "/history.log"; }
+
+    static bool fail(std::string* error, const std::string& what)
+    {
+        if (error != NULL)
+        {
+            *error = what + ": " + strerror(errno);
+        }
+        return false;
+    }
+
+    static bool corruptFile(std::string* error, const std::string& path)
+    {
+        if (error != NULL)
+        {
+            *error = path + ": bad header or size";
+        }
+        return false;
+    }
+
+    void syncDir() const
+    {
+        int fd = ::open(m_opts.dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            fsync(fd);
+            ::close(fd);
+        }
+    }
+
+    // 没有快照不是错误；有快照时只检查头部和文件大小是否对得上，O(1)
+    bool mapSnapshot(std::string* error)
+    {
+        m_snapCount = 0;
+        m_snapLogGen = 0;
+        m_snapLogMerged = 0;
+        if (access(snapPath().c_str(), F_OK) != 0)
+        {
+            return true;
+        }
+        if (!m_snap.map(snapPath()))
+        {
+            return fail(error, "mmap " + snapPath());
+        }
+        SnapHeader header;
+        if (m_snap.size < SNAP_HEADER_V1 + sizeof(uint64_t))
+        {
+            return corruptFile(error, snapPath());
+        }
+        memcpy(&header, m_snap.data, SNAP_HEADER_V1);
+        size_t headerSize = SNAP_HEADER_V1;
+        header.logMerged = UINT64_MAX;
+        if (header.version == SNAP_VERSION && m_snap.size >= sizeof(header) + sizeof(uint64_t))
+        {
+            memcpy(&header, m_snap.data, sizeof(header));
+            headerSize = sizeof(header);
+        }
+        else if (header.version != 1)
+        {
+            return corruptFile(error, snapPath());
+        }
+        if (header.magic != SNAP_MAGIC || header.indexOffset < headerSize
+            || header.indexOffset > m_snap.size || (m_snap.size - header.indexOffset) / sizeof(uint64_t) != header.count + 1
+            || (m_snap.size - header.indexOffset) % sizeof(uint64_t) != 0)
+        {
+            return corruptFile(error, snapPath());
+        }
+        // 只会从末尾的索引里挑几条来读
+        madvise(const_cast<char*>(m_snap.data), m_snap.size, MADV_RANDOM);
+        m_snapCount = (size_t)header.count;
+        m_snapIndex = header.indexOffset;
+        m_snapLogGen = header.logGeneration;
+        m_snapLogMerged = header.logMerged;
+        m_snapDataStart = headerSize;
+        return true;
+    }
+
+    bool snapshotRecord(size_t i, std::string_view& message) const
+    {
+        uint64_t offset;
+        memcpy(&offset, m_snap.data + m_snapIndex + i * sizeof(uint64_t), sizeof(offset));
+        uint32_t len;
+        if (offset < m_snapDataStart || offset + sizeof(len) > m_snapIndex)
+        {
+            return false;
+        }
+        memcpy(&len, m_snap.data + offset, sizeof(len));
+        if (len > m_snapIndex - offset - sizeof(len))
+        {
+            return false;
+        }
+        message = std::string_view(m_snap.data + offset + sizeof(len), len);
+        return true;
+    }
+
+    // 从 offset 读一条不超过 end 的日志记录，checkCrc 时还要核对校验和
+    static bool logRecord(const MappedFile& log, uint64_t offset, uint64_t end, bool checkCrc, std::string_view& message)
+    {
+        uint32_t len;
+        if (offset + sizeof(len) > end)
+        {
+            return false;
+        }
+        memcpy(&len, log.data + offset, sizeof(len));
+        if (len == 0 || len > MAX_MESSAGE || len + sizeof(uint64_t) > end - offset - sizeof(len))
+        {
+            return false;
+        }
+        if (checkCrc)
+        {
+            uint64_t stored;
+            memcpy(&stored, log.data + offset + sizeof(len) + len, sizeof(stored));
+            if (Crc64::update(0, log.data + offset, sizeof(len) + len) != stored)
+            {
+                return false;
+            }
+        }
+        message = std::string_view(log.data + offset + sizeof(len), len);
+        return true;
+    }
+
+    static size_t recordSize(std::string_view message) { return sizeof(uint32_t) + message.size() + sizeof(uint64_t); }
+
+    static bool logHeader(const MappedFile& log, uint64_t& generation)
+    {
+        LogHeader header;
+        if (log.size < sizeof(header))
+        {
+            return false;
+        }
+        memcpy(&header, log.data, sizeof(header));
+        generation = header.generation;
+        return header.magic == LOG_MAGIC && header.version == LOG_VERSION;
+    }
+
+    // 从 begin 沿着长度走到 end，返回走到的位置：长度不合理 (为 0、超过上限、超出 end) 的地方就走不下去了
+    // 空消息不会被写入，全零的区域不会被当成记录
+    // verifyAll 时每条都核对校验和 (压缩时)，长度合理而校验和不对的记录按长度跳过，计入 *skipped，不放进 offsets
+    static uint64_t walkLog(const MappedFile& log, uint64_t begin, uint64_t end, bool verifyAll,
+                            std::vector<uint64_t>& offsets, size_t* skipped)
+    {
+        uint64_t offset = begin;
+        std::string_view message;
+        while (logRecord(log, offset, end, false, message))
+        {
+            uint64_t size = recordSize(message);
+            if (verifyAll && !logRecord(log, offset, end, true, message))
+            {
+                ++*skipped;
+            }
+            else
+            {
+                offsets.push_back(offset);
+            }
+            offset += size;
+        }
+        return offset;
+    }
+
+    bool openLog(std::string* error)
+    {
+        if (access(logPath().c_str(), F_OK) != 0)
+        {
+            return createLog(m_snapLogGen + 1, NULL, 0, error);
+        }
+        if (!m_log.map(logPath()))
+        {
+            return fail(error, "mmap " + logPath());
+        }
+        // 压缩在两次 rename 之间中断时，日志的 generation 等于快照里记的，前面一部分已经并入快照
+        uint64_t generation = 0;
+        bool valid = logHeader(m_log, generation);
+        uint64_t begin = sizeof(LogHeader);
+        if (valid && generation == m_snapLogGen)
+        {
+            begin = m_snapLogMerged;
+        }
+        if (!valid || generation < m_snapLogGen || begin < sizeof(LogHeader) || begin > m_log.size)
+        {
+            // 头部坏了，或者是整个已经并入快照的旧日志
+            m_log.unmap();
+            return createLog(m_snapLogGen + 1, NULL, 0, error);
+        }
+        m_logGen = generation;
+        m_logBase = begin;
+        // 启动时只核对最后一条的校验和，写了一半的尾部截掉
+        m_logValid = walkLog(m_log, begin, m_log.size, false, m_logOffsets, NULL);
+        std::string_view message;
+        while (!m_logOffsets.empty() && !logRecord(m_log, m_logOffsets.back(), m_log.size, true, message))
+        {
+            m_logValid = m_logOffsets.back();
+            m_logOffsets.pop_back();
+        }
+        m_logCount = m_logOffsets.size();
+        m_logFd = ::open(logPath().c_str(), O_WRONLY | O_CLOEXEC);
+        // 截掉写了一半的尾部，新记录接在最后一条完整记录后面
+        if (m_logFd < 0 || ftruncate(m_logFd, (off_t)m_logValid) != 0 || lseek(m_logFd, (off_t)m_logValid, SEEK_SET) < 0)
+        {
+            return fail(error, "open " + logPath());
+        }
+        m_logRio.reset(new RioFd(m_logFd));
+        m_logBytes = m_logValid;
+        m_lastSyncNs = monotonicNs();
+        return true;
+    }
+
+    // 先写临时文件再 rename，替换时不会出现半个头部；tail 是接在头部后面的记录 (压缩期间追加的)
+    bool createLog(uint64_t generation, const char* tail, size_t tailLen, std::string* error)
+    {
+        std::string tmp = logPath() + ".tmp";
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0)
+        {
+            return fail(error, "create " + tmp);
+        }
+        LogHeader header = {LOG_MAGIC, LOG_VERSION, 0, generation};
+        std::unique_ptr<RioFd> rio(new RioFd(fd));
+        if (!rio->writeValue(header) || (tailLen > 0 && !rio->write(tail, tailLen)) || !rio->sync()
+            || rename(tmp.c_str(), logPath().c_str()) != 0)
+        {
+            ::close(fd);
+            unlink(tmp.c_str());
+            return fail(error, "write " + tmp);
+        }
+        syncDir();
+        m_logFd = fd;
+        m_logRio = std::move(rio);
+        m_logGen = generation;
+        m_logCount = 0;
+        m_logBytes = sizeof(header) + tailLen;
+        m_logBase = sizeof(header);
+        m_lastSyncNs = monotonicNs();
+        return true;
+    }
+
+    // 日志落盘，记下末尾，启动后台线程写新快照
+    bool startCompaction(std::string* error)
+    {
+        if (!m_logRio || !m_logRio->sync())
+        {
+            return fail(error, "flush " + logPath());
+        }
+        std::unique_ptr<CompactJob> job(new CompactJob);
+        if (!job->log.map(logPath()) || job->log.size < m_logBytes)
+        {
+            m_compactRetryAt = m_logBytes + m_opts.compactMinBytes;
+            return fail(error, "mmap " + logPath());
+        }
+        job->generation = m_logGen;
+        job->begin = m_logBase;
+        job->end = m_logBytes;
+        job->logCount = m_logCount;
+        CompactJob* j = job.get();
+        m_job = std::move(job);
+        j->thread = std::thread([this, j]() {
+            j->ok = writeSnapshot(*j);
+            j->done.store(true, std::memory_order_release);
+        });
+        return true;
+    }
+
+    // 在后台线程里执行：只读旧快照 (m_snap 等在压缩期间不会变) 和日志的 [begin, end)
+    bool writeSnapshot(CompactJob& job) const
+    {
+        std::vector<uint64_t> logOffsets;
+        uint64_t walked = walkLog(job.log, job.begin, job.end, true, logOffsets, &job.skipped);
+        if (walked != job.end)
+        {
+            job.error = logPath() + ": unreadable record at offset " + std::to_string(walked)
+                        + ", compaction abandoned, log kept as is";
+            return false;
+        }
+
+        size_t total = m_snapCount + logOffsets.size();
+        size_t skip = total > m_opts.keep ? total - m_opts.keep : 0;
+        // 第一遍只算条数和长度，头部里要写索引的位置
+        size_t count = 0;
+        uint64_t indexOffset = sizeof(SnapHeader);
+        forEachKept(job.log, logOffsets, skip, [&count, &indexOffset](std::string_view message) {
+            ++count;
+            indexOffset += sizeof(uint32_t) + message.size();
+        });
+
+        std::string tmp = snapPath() + ".tmp";
+        FILE* fp = fopen(tmp.c_str(), "w");
+        if (fp == NULL)
+        {
+            return fail(&job.error, "create " + tmp);
+        }
+        RioFile rio(fp, m_opts.autosyncBytes);
+        rio.enableChecksum(true);
+        SnapHeader header = {SNAP_MAGIC, SNAP_VERSION, 0, (uint64_t)count, indexOffset, job.generation, job.end};
+        rio.writeValue(header);
+        std::vector<uint64_t> offsets;
+        offsets.reserve(count);
+        forEachKept(job.log, logOffsets, skip, [&rio, &offsets](std::string_view message) {
+            offsets.push_back((uint64_t)rio.processedBytes());
+            uint32_t len = (uint32_t)message.size();
+            rio.writeValue(len);
+            rio.write(message);
+        });
+        rio.write(offsets.data(), offsets.size() * sizeof(uint64_t));
+        uint64_t crc = rio.checksum();
+        rio.enableChecksum(false);
+        rio.writeValue(crc);
+        bool ok = rio.sync();
+        ok = fclose(fp) == 0 && ok;
+        if (!ok || rename(tmp.c_str(), snapPath().c_str()) != 0)
+        {
+            unlink(tmp.c_str());
+            return fail(&job.error, "write " + tmp);
+        }
+        syncDir();
+        return true;
+    }
+
+    /**
+     * 等后台线程结束；成功时新快照已经就位，把压缩期间追加的记录拷进 generation + 1 的新日志
+     * 压缩失败时什么都不换，继续往原来的日志追加，日志再长 compactMinBytes 才重试
+     * 只有换日志失败时 m_logRio 为空，之后的 append 都会失败
+    */
+    bool finishCompaction(std::string* error)
+    {
+        m_job->thread.join();
+        std::unique_ptr<CompactJob> job = std::move(m_job);
+        m_compactSkipped += job->skipped;
+        if (!job->ok)
+        {
+            ++m_compactFailures;
+            m_lastError = job->error;
+            m_compactRetryAt = m_logBytes + m_opts.compactMinBytes;
+            if (error != NULL)
+            {
+                *error = job->error;
+            }
+            return false;
+        }
+        if (!m_logRio->flush())
+        {
+            return fail(error, "flush " + logPath());
+        }
+        MappedFile log;
+        if (m_logBytes > job->end && (!log.map(logPath()) || log.size < m_logBytes))
+        {
+            return fail(error, "mmap " + logPath());
+        }
+        size_t appended = m_logCount - job->logCount;
+        m_logRio.reset();
+        ::close(m_logFd);
+        m_logFd = -1;
+        m_log.unmap();
+        m_logOffsets.clear();
+        m_snap.unmap();
+        if (!createLog(job->generation + 1, log.data + job->end, m_logBytes - job->end, error) || !mapSnapshot(error))
+        {
+            return false;
+        }
+        m_logCount = appended;
+        m_compactRetryAt = 0;
+        ++m_compactions;
+        return true;
+    }
+
+    // 按从旧到新的顺序遍历快照和日志，跳过最老的 skip 条
+    template <typename F>
+    void forEachKept(const MappedFile& log, const std::vector<uint64_t>& logOffsets, size_t skip, F f) const
+    {
+        std::string_view message;
+        for (size_t i = skip; i < m_snapCount; ++i)
+        {
+            if (snapshotRecord(i, message))
+            {
+                f(message);
+            }
+        }
+        for (size_t i = skip > m_snapCount ? skip - m_snapCount : 0; i < logOffsets.size(); ++i)
+        {
+            logRecord(log, logOffsets[i], log.size, false, message);
+            f(message);
+        }
+    }
+
+    Options m_opts;
+    MappedFile m_snap;
+    size_t m_snapCount = 0;
+    uint64_t m_snapIndex = 0;
+    uint64_t m_snapLogGen = 0;
+    uint64_t m_snapLogMerged = 0;
+    uint64_t m_snapDataStart = 0;
+
+    // open 时日志的映射和索引，只给 tail 用；之后追加的记录不在里面
+    MappedFile m_log;
+    std::vector<uint64_t> m_logOffsets;
+    uint64_t m_logValid = 0;
+    uint64_t m_logGen = 0;
+    uint64_t m_logBase = 0; // 日志里还没有并入快照的部分从这里开始
+    int m_logFd = -1;
+    std::unique_ptr<RioFd> m_logRio;
+    size_t m_logCount = 0;
+    size_t m_logBytes = 0;
+    uint64_t m_lastSyncNs = 0;
+    size_t m_corrupt = 0;
+    size_t m_compactions = 0;
+    size_t m_compactSkipped = 0;
+    size_t m_compactFailures = 0;
+    size_t m_compactRetryAt = 0; // 压缩失败之后，日志长到这么大才重试
+    std::string m_lastError;
+    std::unique_ptr<CompactJob> m_job;
+};
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef AIAPP_LATENCY_H
+#define AIAPP_LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// 端到端延迟测量用到的几样小工具：
+// 1. 单调时钟：发布端和订阅端在同一台机器上时，CLOCK_MONOTONIC 是全系统共享的，两个进程读到的值可以直接相减
+// 2. 按发送者跟踪序号，检查丢失和乱序 (发送者 ID、序号和发送时间由 chat_envelope.h 的消息信封携带)
+// 3. 对数分桶的直方图 (HDR 风格)：固定内存，O(1) 记录，相对误差不超过 1/128
+
+// 获取当前的单调时间，单位为纳秒
+static inline uint64_t monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * 对数分桶的延迟直方图
+ *
+ * 小于 2^SUB_BITS 的值每个值一个桶；更大的值按最高位所在的数量级分组，
+ * 每个数量级再按最高位之后的 SUB_BITS 位细分成 2^SUB_BITS 个子桶
+ * 这样任何值落进的桶，宽度都不超过它自身的 1/2^SUB_BITS
+*/
+class LatencyHistogram
+{
+public:
+    static const int SUB_BITS = 7;
+    static const uint64_t SUB_COUNT = 1ULL << SUB_BITS;
+
+    LatencyHistogram() : m_counts(SUB_COUNT * (64 - SUB_BITS + 1), 0), m_total(0), m_max(0), m_min(UINT64_MAX) {}
+
+    void record(uint64_t value)
+    {
+        ++m_counts[indexOf(value)];
+        ++m_total;
+        if (value > m_max)
+        {
+            m_max = value;
+        }
+        if (value < m_min)
+        {
+            m_min = value;
+        }
+    }
+
+    // 合并另一个直方图，用于把多个线程各自的直方图汇总
+    void merge(const LatencyHistogram& other)
+    {
+        for (size_t i = 0; i < m_counts.size(); ++i)
+        {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_total += other.m_total;
+        if (other.m_max > m_max)
+        {
+            m_max = other.m_max;
+        }
+        if (other.m_min < m_min)
+        {
+            m_min = other.m_min;
+        }
+    }
+
+    void reset()
+    {
+        std::fill(m_counts.begin(), m_counts.end(), 0);
+        m_total = 0;
+        m_max = 0;
+        m_min = UINT64_MAX;
+    }
+
+    // q 取值 [0, 1]，返回对应分位点所在桶的上界 (偏保守)
+    uint64_t percentile(double q) const
+    {
+        if (m_total == 0)
+        {
+            return 0;
+        }
+        uint64_t target = (uint64_t)(q * m_total + 0.5);
+        if (target == 0)
+        {
+            target = 1;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < m_counts.size(); ++i)
+        {
+            seen += m_counts[i];
+            if (seen >= target)
+            {
+                uint64_t upper = highestEquivalent(i);
+                return upper < m_max ? upper : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    uint64_t count() const { return m_total; }
+    uint64_t max() const { return m_max; }
+    uint64_t min() const { return m_total ? m_min : 0; }
+
+    // 以微秒为单位格式化常用的分位点 (一行，带换行符)，输入的值默认是纳秒
+    std::string summary(const char* title) const
+    {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "%s: count=%llu min=%.1fus p50=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus\n",
+                 title, (unsigned long long)m_total, min() / 1000.0, percentile(0.50) / 1000.0,
+                 percentile(0.99) / 1000.0, percentile(0.999) / 1000.0, m_max / 1000.0);
+        return buf;
+    }
+
+    void print(FILE* out, const char* title) const
+    {
+        fputs(summary(title).c_str(), out);
+    }
+
+private:
+    static size_t indexOf(uint64_t v)
+    {
+        if (v < SUB_COUNT)
+        {
+            return (size_t)v;
+        }
+        int magnitude = 63 - __builtin_clzll(v);
+        int shift = magnitude - SUB_BITS;
+        uint64_t sub = (v >> shift) - SUB_COUNT;
+        return (size_t)(SUB_COUNT * (shift + 1) + sub);
+    }
+
+    static uint64_t highestEquivalent(size_t index)
+    {
+        if (index < SUB_COUNT)
+        {
+            return index;
+        }
+        int shift = (int)(index / SUB_COUNT) - 1;
+        uint64_t sub = index % SUB_COUNT;
+        return ((SUB_COUNT + sub + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> m_counts;
+    uint64_t m_total;
+    uint64_t m_max;
+    uint64_t m_min;
+};
+
+/**
+ * 按发送者跟踪序号，统计丢失和乱序
+ *
+ * 序号跳变时先把中间缺的部分记为丢失；之后如果缺的消息迟到了，再把它从丢失里扣掉并记为一次乱序
+*/
+class SequenceTracker
+{
+public:
+    SequenceTracker() : m_lost(0), m_reordered(0), m_duplicates(0) {}
+
+    void observe(uint64_t senderId, uint64_t seq)
+    {
+        auto it = m_next.find(senderId);
+        if (it == m_next.end())
+        {
+            // 第一次见到这个发送者，之前的序号也算丢失 (订阅晚于发布开始时会体现在这里)
+            m_lost += seq;
+            m_next.emplace(senderId, seq + 1);
+            return;
+        }
+        uint64_t& next = it->second;
+        if (seq == next)
+        {
+            ++next;
+        }
+        else if (seq > next)
+        {
+            m_lost += seq - next;
+            next = seq + 1;
+        }
+        else if (m_lost > 0)
+        {
+            --m_lost;
+            ++m_reordered;
+        }
+        else
+        {
+            ++m_duplicates;
+        }
+    }
+
+    // 已知每个发送者一共发了多少条时，把尾部没有到达的消息也算进丢失
+    uint64_t lostWithExpected(uint64_t perSender) const
+    {
+        uint64_t lost = m_lost;
+        for (const auto& kv : m_next)
+        {
+            if (kv.second < perSender)
+            {
+                lost += perSender - kv.second;
+            }
+        }
+        return lost;
+    }
+
+    uint64_t lost() const { return m_lost; }
+    uint64_t reordered() const { return m_reordered; }
+    uint64_t duplicates() const { return m_duplicates; }
+    size_t senders() const { return m_next.size(); }
+
+private:
+    std::unordered_map<uint64_t, uint64_t> m_next;
+    uint64_t m_lost;
+    uint64_t m_reordered;
+    uint64_t m_duplicates;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <poll.h>
+#include <hiredis/hiredis.h>
+#include "latency.h"
+#include "chat_envelope.h"
+#include "redis_endpoint.h"
+
+// 订阅端的延迟测量工具
+// 订阅 chat 频道，解析 simulate_clients 发出的消息信封 (见 chat_envelope.h)，
+// 把 发布 -> 订阅 的延迟记录进直方图，并按发送者统计丢失和乱序
+// 每秒打印一次区间内的分位点，退出时 (Ctrl-C、空闲超时或到达 --duration) 打印总的统计
+
+struct Options {
+    const char* channel = "chat";
+    int idleSeconds = 5;       // 收到过消息之后，连续这么久没有新消息就退出
+    int durationSeconds = 0;   // 0 表示不限时长
+    long long expectPerSender = 0; // 每个发送者预期发送的消息数，用于把尾部丢失也算进去
+    RedisEndpoint endpoint = RedisEndpoint::fromEnv();
+};
+
+static volatile sig_atomic_t g_stop = 0;
+
+static void onSignal(int) {
+    g_stop = 1;
+}
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--channel NAME] [--idle SECONDS] [--duration SECONDS] [--expect N]"
+              << " [--endpoint HOST:PORT|unix:PATH]" << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--channel") == 0) {
+            opts.channel = value;
+        } else if (strcmp(arg, "--idle") == 0) {
+            opts.idleSeconds = atoi(value);
+        } else if (strcmp(arg, "--duration") == 0) {
+            opts.durationSeconds = atoi(value);
+        } else if (strcmp(arg, "--expect") == 0) {
+            opts.expectPerSender = atoll(value);
+        } else if (strcmp(arg, "--endpoint") == 0) {
+            if (!RedisEndpoint::parse(value, opts.endpoint)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    redisContext* context = opts.endpoint.connect();
+    if (context == NULL || context->err) {
+        if (context) {
+            std::cerr << "Error: " << context->errstr << std::endl;
+            redisFree(context);
+        } else {
+            std::cerr << "Can't allocate redis context" << std::endl;
+        }
+        return 1;
+    }
+
+    redisReply* reply = (redisReply*)redisCommand(context, "SUBSCRIBE %s", opts.channel);
+    if (reply == NULL) {
+        std::cerr << "Error: " << context->errstr << std::endl;
+        redisFree(context);
+        return 1;
+    }
+    freeReplyObject(reply);
+    std::cerr << "Subscribed to " << opts.channel << " on " << opts.endpoint.toString() << ", waiting for messages..." << std::endl;
+
+    LatencyHistogram total;
+    LatencyHistogram interval;
+    SequenceTracker tracker;
+    uint64_t unstamped = 0;
+
+    uint64_t startNs = monotonicNs();
+    uint64_t lastMessageNs = 0;
+    uint64_t nextReportNs = startNs + 1000000000ULL;
+    bool ok = true;
+
+    while (!g_stop) {
+        // 先把读缓冲区里已经解析好的回复取完，取空了再去 poll socket
+        // 这样可以用 poll 的超时来实现定时打印和空闲退出，而不需要给 context 设置读超时 (超时会让 context 失效)
+        reply = NULL;
+        if (redisGetReplyFromReader(context, (void**)&reply) != REDIS_OK) {
+            std::cerr << "Error: " << context->errstr << std::endl;
+            ok = false;
+            break;
+        }
+        uint64_t now = monotonicNs();
+        if (reply != NULL) {
+            if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 3 && reply->element[2]->type == REDIS_REPLY_STRING) {
+                Envelope envelope;
+                if (decodeEnvelope(reply->element[2]->str, reply->element[2]->len, envelope)) {
+                    uint64_t latency = now > envelope.sendNs ? now - envelope.sendNs : 0;
+                    total.record(latency);
+                    interval.record(latency);
+                    tracker.observe(envelope.senderId, envelope.seq);
+                } else {
+                    ++unstamped;
+                }
+                lastMessageNs = now;
+            }
+            freeReplyObject(reply);
+        } else {
+            struct pollfd pfd;
+            pfd.fd = context->fd;
+            pfd.events = POLLIN;
+            int n = poll(&pfd, 1, 100);
+            if (n > 0 && redisBufferRead(context) != REDIS_OK) {
+                std::cerr << "Error: " << context->errstr << std::endl;
+                ok = false;
+                break;
+            }
+            now = monotonicNs();
+        }
+
+        if (now >= nextReportNs) {
+            if (interval.count() > 0) {
+                interval.print(stdout, "interval");
+                interval.reset();
+            }
+            nextReportNs = now + 1000000000ULL;
+        }
+        if (lastMessageNs != 0 && opts.idleSeconds > 0 && now - lastMessageNs >= (uint64_t)opts.idleSeconds * 1000000000ULL) {
+            break;
+        }
+        if (opts.durationSeconds > 0 && now - startNs >= (uint64_t)opts.durationSeconds * 1000000000ULL) {
+            break;
+        }
+    }
+
+    total.print(stdout, "publish->subscribe");
+    uint64_t lost = opts.expectPerSender > 0 ? tracker.lostWithExpected(opts.expectPerSender) : tracker.lost();
+    std::cout << "senders=" << tracker.senders() << " lost=" << lost << " reordered=" << tracker.reordered()
+              << " duplicates=" << tracker.duplicates() << " unstamped=" << unstamped << std::endl;
+
+    redisFree(context);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,202 @@
+#ifndef AIAPP_LZF_H
+#define AIAPP_LZF_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Redis 用来压缩 RDB 里长字符串 (rdbcompression yes) 的 LZF 格式，与 lzf_c.c / lzf_d.c 兼容
+ *
+ * 压缩数据是一串指令，每条指令的第一个字节 ctrl：
+ * - ctrl < 32：后面跟着 ctrl + 1 个原样拷贝的字节
+ * - 否则是一个回溯引用：长度 ctrl >> 5 (等于 7 时再加下一个字节)，加 2 才是实际长度；
+ *   距离是 (ctrl & 0x1f) << 8 加下一个字节，再加 1，最远 8KB
+*/
+class Lzf
+{
+public:
+    /**
+     * 解压到 out，返回写入的字节数，数据损坏或者 out 放不下时返回 0
+     * prefix 为 true 时 out 写满就停下并返回 outLen，用来只取开头几个字节 (例如 listpack 的头部)，不必解压整个字符串
+    */
+    static size_t decompress(const void* in, size_t inLen, void* out, size_t outLen, bool prefix = false)
+    {
+        const uint8_t* ip = static_cast<const uint8_t*>(in);
+        const uint8_t* inEnd = ip + inLen;
+        uint8_t* op = static_cast<uint8_t*>(out);
+        uint8_t* outStart = op;
+        uint8_t* outEnd = op + outLen;
+        while (ip < inEnd)
+        {
+            size_t ctrl = *ip++;
+            if (ctrl < 32)
+            {
+                size_t len = ctrl + 1;
+                if (ip + len > inEnd)
+                {
+                    return 0;
+                }
+                if (op + len > outEnd)
+                {
+                    if (!prefix)
+                    {
+                        return 0;
+                    }
+                    len = (size_t)(outEnd - op);
+                }
+                memcpy(op, ip, len);
+                op += len;
+                ip += len;
+            }
+            else
+            {
+                size_t len = ctrl >> 5;
+                if (len == 7)
+                {
+                    if (ip >= inEnd)
+                    {
+                        return 0;
+                    }
+                    len += *ip++;
+                }
+                if (ip >= inEnd)
+                {
+                    return 0;
+                }
+                size_t back = ((ctrl & 0x1f) << 8) + *ip++ + 1;
+                len += 2;
+                if (back > (size_t)(op - outStart))
+                {
+                    return 0;
+                }
+                if (op + len > outEnd)
+                {
+                    if (!prefix)
+                    {
+                        return 0;
+                    }
+                    len = (size_t)(outEnd - op);
+                }
+                // 引用与正在写的区域重叠 (距离比长度短，重复的模式) 时只能逐字节拷贝
+                const uint8_t* ref = op - back;
+                if (back >= len)
+                {
+                    memcpy(op, ref, len);
+                }
+                else if (back == 1)
+                {
+                    memset(op, *ref, len);
+                }
+                else
+                {
+                    for (size_t i = 0; i < len; ++i)
+                    {
+                        op[i] = ref[i];
+                    }
+                }
+                op += len;
+            }
+            if (prefix && op == outEnd)
+            {
+                break;
+            }
+        }
+        return (size_t)(op - outStart);
+    }
+
+    /**
+     * 压缩到 out，放不下 (数据不可压缩) 时返回 0，与 lzf_compress 相同；Redis 只在压缩后至少省下 4 个字节时才使用压缩结果
+     * 贪心匹配，3 字节哈希，每个位置只记最近一次出现
+    */
+    static size_t compress(const void* in, size_t inLen, void* out, size_t outLen)
+    {
+        const uint8_t* src = static_cast<const uint8_t*>(in);
+        uint8_t* dst = static_cast<uint8_t*>(out);
+        uint32_t table[HASH_SIZE];
+        memset(table, 0, sizeof(table));
+        size_t ip = 0;
+        size_t op = 0;
+        size_t ctrlPos = 0; // 当前字面量段的 ctrl 字节位置
+        size_t lit = 0;     // 当前字面量段的长度
+        while (ip < inLen)
+        {
+            if (ip + 2 < inLen)
+            {
+                uint32_t h = hash(src + ip);
+                size_t ref = table[h];
+                table[h] = (uint32_t)(ip + 1);
+                if (ref != 0 && ip - ref < MAX_OFFSET && memcmp(src + ref - 1, src + ip, 3) == 0)
+                {
+                    --ref;
+                    size_t maxLen = inLen - ip < MAX_REF ? inLen - ip : MAX_REF;
+                    size_t len = 3;
+                    while (len < maxLen && src[ref + len] == src[ip + len])
+                    {
+                        ++len;
+                    }
+                    if (op + 3 > outLen)
+                    {
+                        return 0;
+                    }
+                    if (lit > 0)
+                    {
+                        dst[ctrlPos] = (uint8_t)(lit - 1);
+                        lit = 0;
+                    }
+                    size_t off = ip - ref - 1;
+                    size_t code = len - 2;
+                    if (code < 7)
+                    {
+                        dst[op++] = (uint8_t)((code << 5) | (off >> 8));
+                    }
+                    else
+                    {
+                        dst[op++] = (uint8_t)((7 << 5) | (off >> 8));
+                        dst[op++] = (uint8_t)(code - 7);
+                    }
+                    dst[op++] = (uint8_t)off;
+                    ip += len;
+                    continue;
+                }
+            }
+            if (lit == 0)
+            {
+                if (op + 2 > outLen)
+                {
+                    return 0;
+                }
+                ctrlPos = op++;
+            }
+            else if (op + 1 > outLen)
+            {
+                return 0;
+            }
+            dst[op++] = src[ip++];
+            if (++lit == MAX_LIT)
+            {
+                dst[ctrlPos] = (uint8_t)(lit - 1);
+                lit = 0;
+            }
+        }
+        if (lit > 0)
+        {
+            dst[ctrlPos] = (uint8_t)(lit - 1);
+        }
+        return op;
+    }
+
+private:
+    static const size_t HASH_SIZE = 1 << 14;
+    static const size_t MAX_LIT = 32;
+    static const size_t MAX_OFFSET = 1 << 13;
+    static const size_t MAX_REF = 7 + 255 + 2;
+
+    static uint32_t hash(const uint8_t* p)
+    {
+        uint32_t v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+        return (v * 2654435761u) >> (32 - 14);
+    }
+};
+
+#endif
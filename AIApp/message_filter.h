@@ -0,0 +1,1252 @@
+#ifndef AIAPP_MESSAGE_FILTER_H
+#define AIAPP_MESSAGE_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <bitset>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AIAPP_FILTER_X86 1
+#endif
+
+/**
+ * 一次扫描的命中结果，每个接收线程一个，反复使用不分配内存
+*/
+class FilterMatches
+{
+public:
+    bool test(size_t rule) const { return rule < m_words.size() * 64 && (m_words[rule >> 6] >> (rule & 63)) & 1; }
+    bool any() const { return !m_list.empty(); }
+    size_t count() const { return m_list.size(); }
+    // 命中了动作为 Drop 的规则
+    bool drop() const { return m_drop; }
+
+    // 按命中的先后顺序遍历命中的规则编号
+    template <typename F>
+    void forEach(F&& f) const
+    {
+        for (uint32_t rule : m_list)
+        {
+            f((size_t)rule);
+        }
+    }
+
+private:
+    friend class MessageFilter;
+
+    void reset(size_t rules)
+    {
+        if (m_words.size() * 64 < rules)
+        {
+            m_words.assign((rules + 63) / 64, 0);
+            m_list.reserve(rules);
+        }
+        for (uint32_t rule : m_list)
+        {
+            m_words[rule >> 6] = 0;
+        }
+        m_list.clear();
+        m_drop = false;
+    }
+
+    void set(uint32_t rule, bool drop)
+    {
+        uint64_t bit = 1ULL << (rule & 63);
+        uint64_t& word = m_words[rule >> 6];
+        if ((word & bit) == 0)
+        {
+            word |= bit;
+            m_list.push_back(rule);
+            m_drop = m_drop || drop;
+        }
+    }
+
+    std::vector<uint64_t> m_words;
+    std::vector<uint32_t> m_list;
+    bool m_drop = false;
+};
+
+/**
+ * 接收端的多规则内容过滤：关键词和简单正则一起编译成一个 DFA，每条消息只扫描一遍，报告命中了哪些规则
+ *
+ * 用来代替 "每条消息对每条规则调用一次 regexec" (见 TestFiles/TestRegex.cc)：规则有几十条时 regexec 的开销与规则数成正比，
+ * 这里扫描的开销只与消息长度有关，每个字节一次查表
+ * - 关键词 (Literal) 建一个 Aho-Corasick 自动机：trie 加失败指针，再把失败指针展开成完整的转移表。
+ *   关键词表可以有上万条，构造是线性的
+ * - 正则 (Pattern) 支持 ERE 的常用子集：字符、. [] [^] 区间、\d \w \s (及大写)、* + ? {m} {m,} {m,n}、() 和 |、
+ *   ^ 和 $。先按 Thompson 构造 NFA，再用子集构造转成 DFA；搜索是非锚定的，相当于每个位置都重新开始一次匹配
+ * - 两个自动机从 (根, 起始) 出发按广度优先做乘积，只保留能到达的状态，合成最终的一个 DFA；
+ *   实际上两边很少同时离开起始状态，乘积的状态数大约是两边之和
+ * - 字节先映射到等价类 (所有规则都不区分的字节归为一类)，转移表每行只有几十列；不区分大小写时大小写字母落在同一类里，
+ *   扫描时不需要转换大小写
+ * - 预过滤：DFA 停在 "空闲" 状态 (什么都没匹配到一半) 时，只有少数字节能让它离开。用 SIMD 每次检查 16 个字节，
+ *   整块都不是这些字节时直接跳过：不超过 8 种时用 SSE2 逐个比较，更多时用 SSSE3 的 pshufb 按高低半字节查表 (shufti)，
+ *   CPU 不支持时退回逐字节查表。能唤醒的可打印字符太多时 (例如规则以 [a-z] 或大量关键词开头)，普通文本每一块都要停下来，
+ *   这时不用预过滤
+ *
+ * 编译之后只读，多个线程可以同时扫描 (各自使用自己的 FilterMatches)
+*/
+class MessageFilter
+{
+public:
+    enum class Kind : uint8_t
+    {
+        Literal,
+        Pattern
+    };
+
+    enum class Action : uint8_t
+    {
+        Count, // 只统计 (或者交给调用方做路由)
+        Drop   // 命中的消息不再交给界面
+    };
+
+    struct Rule
+    {
+        Kind kind;
+        Action action;
+        std::string text;
+    };
+
+    struct Options
+    {
+        bool caseInsensitive = true;  // 对所有规则生效
+        size_t maxStates = 100000;    // DFA 状态数的上限，超过时编译失败
+        bool prefilter = true;
+    };
+
+    MessageFilter() = default;
+    MessageFilter(const MessageFilter&) = delete;
+    MessageFilter& operator=(const MessageFilter&) = delete;
+
+    // 编译规则，失败时返回 false 并在 error 里说明是哪一条规则
+    bool compile(const std::vector<Rule>& rules, const Options& opts, std::string* error)
+    {
+        m_rules = rules;
+        m_opts = opts;
+        Nfa nfa;
+        for (size_t i = 0; i < rules.size(); ++i)
+        {
+            const Rule& rule = rules[i];
+            std::string why = "empty rule";
+            if (rule.text.empty() || (rule.kind == Kind::Pattern && !addPattern(nfa, rule.text, (int)i, why)))
+            {
+                if (error != NULL)
+                {
+                    *error = "rule " + std::to_string(i + 1) + " (" + rule.text + "): " + why;
+                }
+                return false;
+            }
+        }
+        buildClasses(nfa);
+        AhoCorasick ac;
+        buildAhoCorasick(ac);
+        Dfa dfa;
+        if (!buildDfa(nfa, dfa) || !buildProduct(ac, dfa))
+        {
+            if (error != NULL)
+            {
+                *error = "more than " + std::to_string(m_opts.maxStates) + " DFA states, simplify the patterns";
+            }
+            return false;
+        }
+        m_ruleDrop.resize(m_rules.size());
+        for (size_t i = 0; i < m_rules.size(); ++i)
+        {
+            m_ruleDrop[i] = m_rules[i].action == Action::Drop;
+        }
+        buildPrefilter();
+        return true;
+    }
+
+    /**
+     * 从文件读取规则，每行一条：<drop|count> <literal|regex> <内容>，内容是这一行剩下的部分 (可以包含空格)
+     * 空行和 # 开头的行忽略
+    */
+    bool loadFile(const char* path, const Options& opts, std::string* error)
+    {
+        FILE* f = fopen(path, "r");
+        if (f == NULL)
+        {
+            if (error != NULL)
+            {
+                *error = std::string("cannot open ") + path;
+            }
+            return false;
+        }
+        std::vector<Rule> rules;
+        char line[4096];
+        int lineNo = 0;
+        bool ok = true;
+        while (ok && fgets(line, sizeof(line), f) != NULL)
+        {
+            ++lineNo;
+            std::string_view text(line);
+            while (!text.empty() && (text.back() == '\n' || text.back() == '\r'))
+            {
+                text.remove_suffix(1);
+            }
+            std::string_view fields[2];
+            for (auto& field : fields)
+            {
+                size_t start = text.find_first_not_of(" \t");
+                text.remove_prefix(start == std::string_view::npos ? text.size() : start);
+                size_t end = text.find_first_of(" \t");
+                field = text.substr(0, end);
+                text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+            }
+            if (fields[0].empty() || fields[0][0] == '#')
+            {
+                continue;
+            }
+            Rule rule;
+            ok = (fields[0] == "drop" || fields[0] == "count") && (fields[1] == "literal" || fields[1] == "regex")
+                 && !text.empty();
+            rule.action = fields[0] == "drop" ? Action::Drop : Action::Count;
+            rule.kind = fields[1] == "literal" ? Kind::Literal : Kind::Pattern;
+            rule.text = std::string(text);
+            rules.push_back(std::move(rule));
+        }
+        fclose(f);
+        if (!ok)
+        {
+            if (error != NULL)
+            {
+                *error = std::string(path) + ":" + std::to_string(lineNo) + ": expected <drop|count> <literal|regex> <text>";
+            }
+            return false;
+        }
+        return compile(rules, opts, error);
+    }
+
+    /**
+     * 扫描一条消息，命中的规则记在 matches 里 (先清空)，返回是否命中了 Drop 规则
+     * 热路径：每个字节一次等价类查表和一次转移表查表；转移表里存的是目标行的偏移，最高位表示目标状态有命中
+    */
+    bool scan(std::string_view text, FilterMatches& matches) const
+    {
+        matches.reset(m_rules.size());
+        if (m_next.empty())
+        {
+            return false;
+        }
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(text.data());
+        size_t len = text.size();
+        const uint32_t* next = m_next.data();
+        uint32_t row = 0;
+        if (m_startAccepts)
+        {
+            record(0, matches);
+        }
+        size_t i = 0;
+        while (i < len)
+        {
+            if (row == m_idleRow && m_prefilterMode != PREFILTER_NONE)
+            {
+                i = skip(p, i, len);
+                if (i == len)
+                {
+                    break;
+                }
+            }
+            uint32_t entry = next[row + m_class[p[i]]];
+            row = entry & ROW_MASK;
+            if (entry & ACCEPT)
+            {
+                record(row / m_classCount, matches);
+            }
+            ++i;
+        }
+        uint32_t state = row / m_classCount;
+        for (uint32_t k = m_endBegin[state]; k < m_endBegin[state + 1]; ++k)
+        {
+            matches.set(m_endRules[k], m_ruleDrop[m_endRules[k]]);
+        }
+        return matches.drop();
+    }
+
+    size_t ruleCount() const { return m_rules.size(); }
+    const Rule& rule(size_t i) const { return m_rules[i]; }
+    size_t stateCount() const { return m_classCount > 0 ? m_next.size() / m_classCount : 0; }
+    size_t classCount() const { return m_classCount; }
+
+    const char* prefilterName() const
+    {
+        switch (m_prefilterMode)
+        {
+            case PREFILTER_SSE2: return "sse2";
+            case PREFILTER_SHUFTI: return "ssse3-shufti";
+            case PREFILTER_TABLE: return "table";
+            default: return "none";
+        }
+    }
+
+private:
+    typedef std::bitset<256> ByteSet;
+
+    static const uint32_t ACCEPT = 0x80000000u;
+    static const uint32_t ROW_MASK = 0x7fffffffu;
+    static const uint32_t NO_ROW = ROW_MASK;
+    static const int MAX_REPEAT = 100;
+    static const int MAX_WAKE_PRINTABLE = 24;
+
+    enum PrefilterMode
+    {
+        PREFILTER_NONE,
+        PREFILTER_SSE2,
+        PREFILTER_SHUFTI,
+        PREFILTER_TABLE
+    };
+
+    // ---- 正则：解析成语法树，再按 Thompson 构造 NFA ----
+
+    struct Node
+    {
+        enum Type
+        {
+            Set,
+            Concat,
+            Alt,
+            Repeat,
+            Begin,
+            End,
+            Empty
+        };
+        Type type;
+        ByteSet set;
+        std::vector<std::unique_ptr<Node>> kids;
+        int min = 0;
+        int max = 0; // -1 表示不限
+    };
+
+    struct NfaState
+    {
+        enum Type : uint8_t
+        {
+            Set,   // 输入字节在 set 里时转到 out
+            Split, // 空转移到 out 和 out1 (out1 可以为 -1)
+            Match, // 规则 rule 命中
+            Begin, // 只在输入开头空转移到 out (^)
+            End    // 只在输入结束时空转移到 out ($)
+        };
+        Type type;
+        int out = -1;
+        int out1 = -1;
+        int rule = -1;
+        ByteSet set;
+    };
+
+    struct Nfa
+    {
+        std::vector<NfaState> states;
+        std::vector<int> starts; // 每条规则的起点，非锚定搜索时每个位置都重新加入
+    };
+
+    class Parser
+    {
+    public:
+        Parser(std::string_view text, bool caseInsensitive) : m_text(text), m_pos(0), m_icase(caseInsensitive) {}
+
+        std::unique_ptr<Node> parse(std::string& error)
+        {
+            std::unique_ptr<Node> node = parseAlt();
+            if (m_error.empty() && m_pos < m_text.size())
+            {
+                m_error = m_text[m_pos] == ')' ? "unmatched )" : "unexpected character";
+            }
+            error = m_error;
+            if (!m_error.empty())
+            {
+                return nullptr;
+            }
+            return node;
+        }
+
+    private:
+        bool more() const { return m_error.empty() && m_pos < m_text.size(); }
+
+        std::unique_ptr<Node> make(Node::Type type)
+        {
+            std::unique_ptr<Node> node(new Node);
+            node->type = type;
+            return node;
+        }
+
+        std::unique_ptr<Node> parseAlt()
+        {
+            std::unique_ptr<Node> alt = make(Node::Alt);
+            alt->kids.push_back(parseConcat());
+            while (more() && m_text[m_pos] == '|')
+            {
+                ++m_pos;
+                alt->kids.push_back(parseConcat());
+            }
+            return alt->kids.size() == 1 ? std::move(alt->kids[0]) : std::move(alt);
+        }
+
+        std::unique_ptr<Node> parseConcat()
+        {
+            std::unique_ptr<Node> concat = make(Node::Concat);
+            while (more() && m_text[m_pos] != '|' && m_text[m_pos] != ')')
+            {
+                concat->kids.push_back(parseRepeat());
+            }
+            return concat;
+        }
+
+        std::unique_ptr<Node> parseRepeat()
+        {
+            std::unique_ptr<Node> atom = parseAtom();
+            while (more())
+            {
+                char c = m_text[m_pos];
+                int min, max;
+                if (c == '*')
+                {
+                    min = 0, max = -1;
+                }
+                else if (c == '+')
+                {
+                    min = 1, max = -1;
+                }
+                else if (c == '?')
+                {
+                    min = 0, max = 1;
+                }
+                else if (c == '{')
+                {
+                    if (!parseBounds(min, max))
+                    {
+                        return atom;
+                    }
+                    --m_pos;
+                }
+                else
+                {
+                    break;
+                }
+                ++m_pos;
+                std::unique_ptr<Node> repeat = make(Node::Repeat);
+                repeat->min = min;
+                repeat->max = max;
+                repeat->kids.push_back(std::move(atom));
+                atom = std::move(repeat);
+            }
+            return atom;
+        }
+
+        // {m} {m,} {m,n}，返回时 m_pos 指向 '}' 之后
+        bool parseBounds(int& min, int& max)
+        {
+            ++m_pos;
+            min = readNumber();
+            max = min;
+            if (m_pos < m_text.size() && m_text[m_pos] == ',')
+            {
+                ++m_pos;
+                max = m_pos < m_text.size() && m_text[m_pos] == '}' ? -1 : readNumber();
+            }
+            if (m_pos >= m_text.size() || m_text[m_pos] != '}' || min < 0 || (max >= 0 && max < min) || min > MAX_REPEAT
+                || max > MAX_REPEAT)
+            {
+                m_error = "bad {m,n} repeat (limit " + std::to_string(MAX_REPEAT) + ")";
+                return false;
+            }
+            ++m_pos;
+            return true;
+        }
+
+        int readNumber()
+        {
+            int n = -1;
+            while (m_pos < m_text.size() && m_text[m_pos] >= '0' && m_text[m_pos] <= '9' && n <= MAX_REPEAT)
+            {
+                n = (n < 0 ? 0 : n * 10) + (m_text[m_pos++] - '0');
+            }
+            return n;
+        }
+
+        std::unique_ptr<Node> parseAtom()
+        {
+            char c = m_text[m_pos++];
+            std::unique_ptr<Node> node = make(Node::Set);
+            switch (c)
+            {
+                case '(':
+                {
+                    node = parseAlt();
+                    if (m_error.empty() && (m_pos >= m_text.size() || m_text[m_pos] != ')'))
+                    {
+                        m_error = "missing )";
+                    }
+                    ++m_pos;
+                    return node;
+                }
+                case '[':
+                    parseClass(node->set);
+                    break;
+                case '.':
+                    node->set.set();
+                    break;
+                case '\\':
+                    parseEscape(node->set);
+                    break;
+                case '$':
+                    return make(Node::End);
+                case '^':
+                    return make(Node::Begin);
+                case '*':
+                case '+':
+                case '?':
+                case '{':
+                    m_error = "nothing to repeat";
+                    break;
+                default:
+                    node->set.set((uint8_t)c);
+                    break;
+            }
+            if (m_icase)
+            {
+                foldCase(node->set);
+            }
+            return node;
+        }
+
+        void parseEscape(ByteSet& set)
+        {
+            if (m_pos >= m_text.size())
+            {
+                m_error = "trailing \\";
+                return;
+            }
+            char c = m_text[m_pos++];
+            ByteSet cls;
+            bool negate = c == 'D' || c == 'W' || c == 'S';
+            switch (c)
+            {
+                case 'd':
+                case 'D':
+                    addRange(cls, '0', '9');
+                    break;
+                case 'w':
+                case 'W':
+                    addRange(cls, 'a', 'z');
+                    addRange(cls, 'A', 'Z');
+                    addRange(cls, '0', '9');
+                    cls.set('_');
+                    break;
+                case 's':
+                case 'S':
+                    for (char ws : std::string_view(" \t\n\r\f\v"))
+                    {
+                        cls.set((uint8_t)ws);
+                    }
+                    break;
+                case 't':
+                    cls.set('\t');
+                    break;
+                case 'n':
+                    cls.set('\n');
+                    break;
+                case 'r':
+                    cls.set('\r');
+                    break;
+                default:
+                    cls.set((uint8_t)c);
+                    break;
+            }
+            set |= negate ? ~cls : cls;
+        }
+
+        void parseClass(ByteSet& set)
+        {
+            bool negate = m_pos < m_text.size() && m_text[m_pos] == '^';
+            if (negate)
+            {
+                ++m_pos;
+            }
+            ByteSet cls;
+            bool first = true;
+            while (m_error.empty())
+            {
+                if (m_pos >= m_text.size())
+                {
+                    m_error = "missing ]";
+                    return;
+                }
+                char c = m_text[m_pos++];
+                if (c == ']' && !first)
+                {
+                    break;
+                }
+                first = false;
+                if (c == '\\')
+                {
+                    parseEscape(cls);
+                    continue;
+                }
+                if (m_pos + 1 < m_text.size() && m_text[m_pos] == '-' && m_text[m_pos + 1] != ']')
+                {
+                    char hi = m_text[m_pos + 1];
+                    m_pos += 2;
+                    if ((uint8_t)hi < (uint8_t)c)
+                    {
+                        m_error = "bad range in []";
+                        return;
+                    }
+                    addRange(cls, c, hi);
+                    continue;
+                }
+                cls.set((uint8_t)c);
+            }
+            // 取反之前先折叠大小写，[^a] 在不区分大小写时也不匹配 A
+            if (m_icase)
+            {
+                foldCase(cls);
+            }
+            set = negate ? ~cls : cls;
+        }
+
+        std::string_view m_text;
+        size_t m_pos;
+        bool m_icase;
+        std::string m_error;
+    };
+
+    static void addRange(ByteSet& set, char lo, char hi)
+    {
+        for (int b = (uint8_t)lo; b <= (uint8_t)hi; ++b)
+        {
+            set.set((size_t)b);
+        }
+    }
+
+    static void foldCase(ByteSet& set)
+    {
+        for (int b = 'a'; b <= 'z'; ++b)
+        {
+            if (set.test((size_t)b) || set.test((size_t)(b - 32)))
+            {
+                set.set((size_t)b);
+                set.set((size_t)(b - 32));
+            }
+        }
+    }
+
+    static int addState(Nfa& nfa, NfaState::Type type, int out, int out1 = -1)
+    {
+        NfaState state;
+        state.type = type;
+        state.out = out;
+        state.out1 = out1;
+        nfa.states.push_back(state);
+        return (int)nfa.states.size() - 1;
+    }
+
+    // 从后往前构造：next 是这个结点匹配完之后要去的状态，返回结点的入口状态
+    static int compileNode(Nfa& nfa, const Node& node, int next)
+    {
+        switch (node.type)
+        {
+            case Node::Set:
+            {
+                int s = addState(nfa, NfaState::Set, next);
+                nfa.states[s].set = node.set;
+                return s;
+            }
+            case Node::Begin:
+                return addState(nfa, NfaState::Begin, next);
+            case Node::End:
+                return addState(nfa, NfaState::End, next);
+            case Node::Empty:
+                return next;
+            case Node::Concat:
+                for (size_t i = node.kids.size(); i-- > 0;)
+                {
+                    next = compileNode(nfa, *node.kids[i], next);
+                }
+                return next;
+            case Node::Alt:
+            {
+                int s = compileNode(nfa, *node.kids.back(), next);
+                for (size_t i = node.kids.size() - 1; i-- > 0;)
+                {
+                    int branch = compileNode(nfa, *node.kids[i], next);
+                    s = addState(nfa, NfaState::Split, branch, s);
+                }
+                return s;
+            }
+            case Node::Repeat:
+            {
+                const Node& kid = *node.kids[0];
+                int s = next;
+                if (node.max < 0)
+                {
+                    // kid*：循环结点先占位，body 匹配完回到循环结点
+                    int loop = addState(nfa, NfaState::Split, -1, next);
+                    nfa.states[loop].out = compileNode(nfa, kid, loop);
+                    s = loop;
+                }
+                else
+                {
+                    // 可选的 max - min 份：每一份要么匹配 kid 再看下一份，要么直接跳到 next
+                    for (int i = 0; i < node.max - node.min; ++i)
+                    {
+                        s = addState(nfa, NfaState::Split, compileNode(nfa, kid, s), next);
+                    }
+                }
+                for (int i = 0; i < node.min; ++i)
+                {
+                    s = compileNode(nfa, kid, s);
+                }
+                return s;
+            }
+        }
+        return next;
+    }
+
+    bool addPattern(Nfa& nfa, std::string_view text, int rule, std::string& error)
+    {
+        Parser parser(text, m_opts.caseInsensitive);
+        std::unique_ptr<Node> root = parser.parse(error);
+        if (!root)
+        {
+            return false;
+        }
+        int match = addState(nfa, NfaState::Match, -1);
+        nfa.states[match].rule = rule;
+        int start = compileNode(nfa, *root, match);
+        nfa.starts.push_back(start);
+        return true;
+    }
+
+    // ---- 字节等价类：所有规则里出现的字节集合把 256 个字节划分成若干类 ----
+
+    void refine(const ByteSet& set, int& classes)
+    {
+        int remap[512];
+        std::fill(remap, remap + 512, -1);
+        int n = 0;
+        for (int b = 0; b < 256; ++b)
+        {
+            int key = m_class[b] * 2 + (set.test((size_t)b) ? 1 : 0);
+            if (remap[key] < 0)
+            {
+                remap[key] = n++;
+            }
+            m_class[b] = (uint8_t)remap[key];
+        }
+        classes = n;
+    }
+
+    ByteSet literalByte(uint8_t b) const
+    {
+        ByteSet set;
+        set.set(b);
+        if (m_opts.caseInsensitive)
+        {
+            foldCase(set);
+        }
+        return set;
+    }
+
+    void buildClasses(const Nfa& nfa)
+    {
+        memset(m_class, 0, sizeof(m_class));
+        int classes = 1;
+        ByteSet seen;
+        for (const Rule& rule : m_rules)
+        {
+            if (rule.kind != Kind::Literal)
+            {
+                continue;
+            }
+            for (char c : rule.text)
+            {
+                if (!seen.test((uint8_t)c))
+                {
+                    seen |= literalByte((uint8_t)c);
+                    refine(literalByte((uint8_t)c), classes);
+                }
+            }
+        }
+        for (const NfaState& state : nfa.states)
+        {
+            if (state.type == NfaState::Set && classes < 256)
+            {
+                refine(state.set, classes);
+            }
+        }
+        m_classCount = (uint32_t)classes;
+        for (int b = 255; b >= 0; --b)
+        {
+            m_classByte[m_class[b]] = (uint8_t)b;
+        }
+    }
+
+    // ---- Aho-Corasick ----
+
+    struct AhoCorasick
+    {
+        std::vector<int32_t> delta;                // nodes * classCount
+        std::vector<std::vector<uint32_t>> output; // 每个结点命中的规则，包括沿失败指针能到达的
+    };
+
+    void buildAhoCorasick(AhoCorasick& ac) const
+    {
+        const size_t C = m_classCount;
+        ac.delta.assign(C, -1);
+        ac.output.assign(1, std::vector<uint32_t>());
+        for (size_t r = 0; r < m_rules.size(); ++r)
+        {
+            if (m_rules[r].kind != Kind::Literal)
+            {
+                continue;
+            }
+            size_t node = 0;
+            for (char c : m_rules[r].text)
+            {
+                size_t cls = m_class[(uint8_t)c];
+                if (ac.delta[node * C + cls] < 0)
+                {
+                    ac.delta[node * C + cls] = (int32_t)ac.output.size();
+                    ac.delta.resize(ac.delta.size() + C, -1);
+                    ac.output.emplace_back();
+                }
+                node = (size_t)ac.delta[node * C + cls];
+            }
+            ac.output[node].push_back((uint32_t)r);
+        }
+        // 按层广度优先求失败指针，同时把缺失的边补成 "沿失败指针走到的结点的转移"
+        std::vector<int32_t> fail(ac.output.size(), 0);
+        std::vector<size_t> queue;
+        for (size_t c = 0; c < C; ++c)
+        {
+            if (ac.delta[c] < 0)
+            {
+                ac.delta[c] = 0;
+            }
+            else
+            {
+                queue.push_back((size_t)ac.delta[c]);
+            }
+        }
+        for (size_t head = 0; head < queue.size(); ++head)
+        {
+            size_t u = queue[head];
+            for (size_t c = 0; c < C; ++c)
+            {
+                int32_t v = ac.delta[u * C + c];
+                int32_t f = ac.delta[(size_t)fail[u] * C + c];
+                if (v < 0)
+                {
+                    ac.delta[u * C + c] = f;
+                    continue;
+                }
+                fail[v] = f;
+                const std::vector<uint32_t>& inherited = ac.output[f];
+                ac.output[v].insert(ac.output[v].end(), inherited.begin(), inherited.end());
+                queue.push_back((size_t)v);
+            }
+        }
+    }
+
+    // ---- 子集构造 ----
+
+    struct Dfa
+    {
+        std::vector<uint32_t> delta;               // states * classCount
+        std::vector<std::vector<uint32_t>> match;  // 进入这个状态时命中的规则
+        std::vector<std::vector<uint32_t>> endMatch; // 输入在这个状态结束时命中的规则 ($)
+        uint32_t start = 0;
+        uint32_t idle = 0; // 不在开头、也没有匹配到一半时的状态 (只有各规则的起点)
+    };
+
+    // 沿空转移求闭包，只保留 Set / Match / End 这几种 "重要" 状态
+    // atBegin 时 Begin 是空转移 (输入开头)，否则走不通；atEnd 时 End 也是空转移 (输入结束)
+    // mark 是调用方提供的访问标记，返回前清掉，下一次直接复用
+    static void closure(const Nfa& nfa, std::vector<int>& stack, std::vector<uint8_t>& mark, std::vector<int>& out,
+                        bool atBegin, bool atEnd)
+    {
+        std::vector<int> visited;
+        while (!stack.empty())
+        {
+            int s = stack.back();
+            stack.pop_back();
+            if (s < 0 || mark[s])
+            {
+                continue;
+            }
+            mark[s] = 1;
+            visited.push_back(s);
+            const NfaState& state = nfa.states[s];
+            if (state.type == NfaState::Split)
+            {
+                stack.push_back(state.out1);
+                stack.push_back(state.out);
+            }
+            else if (state.type == NfaState::Begin)
+            {
+                if (atBegin)
+                {
+                    stack.push_back(state.out);
+                }
+            }
+            else if (state.type == NfaState::End && atEnd)
+            {
+                stack.push_back(state.out);
+            }
+            else
+            {
+                out.push_back(s);
+            }
+        }
+        for (int s : visited)
+        {
+            mark[s] = 0;
+        }
+    }
+
+    bool buildDfa(const Nfa& nfa, Dfa& dfa) const
+    {
+        const size_t C = m_classCount;
+        std::map<std::vector<int>, uint32_t> ids;
+        std::vector<std::vector<int>> sets;
+        std::vector<uint8_t> mark(nfa.states.size(), 0);
+        std::vector<int> stack;
+
+        auto intern = [&](std::vector<int>& set) -> uint32_t {
+            std::sort(set.begin(), set.end());
+            auto it = ids.find(set);
+            if (it != ids.end())
+            {
+                return it->second;
+            }
+            uint32_t id = (uint32_t)sets.size();
+            ids.emplace(set, id);
+            sets.push_back(set);
+            return id;
+        };
+        std::vector<int> set;
+        stack = nfa.starts;
+        closure(nfa, stack, mark, set, true, false);
+        dfa.start = intern(set);
+        set.clear();
+        stack = nfa.starts;
+        closure(nfa, stack, mark, set, false, false);
+        dfa.idle = intern(set);
+
+        for (size_t id = 0; id < sets.size(); ++id)
+        {
+            if (sets.size() > m_opts.maxStates)
+            {
+                return false;
+            }
+            dfa.delta.resize((id + 1) * C);
+            for (size_t c = 0; c < C; ++c)
+            {
+                std::vector<int> moved;
+                stack = nfa.starts;
+                for (int s : sets[id])
+                {
+                    const NfaState& state = nfa.states[s];
+                    if (state.type == NfaState::Set && state.set.test(m_classByte[c]))
+                    {
+                        stack.push_back(state.out);
+                    }
+                }
+                closure(nfa, stack, mark, moved, false, false);
+                dfa.delta[id * C + c] = intern(moved);
+            }
+        }
+
+        dfa.match.resize(sets.size());
+        dfa.endMatch.resize(sets.size());
+        for (size_t id = 0; id < sets.size(); ++id)
+        {
+            std::vector<int> atEnd;
+            for (int s : sets[id])
+            {
+                const NfaState& state = nfa.states[s];
+                if (state.type == NfaState::Match)
+                {
+                    dfa.match[id].push_back((uint32_t)state.rule);
+                }
+                else if (state.type == NfaState::End)
+                {
+                    stack.push_back(state.out);
+                }
+            }
+            closure(nfa, stack, mark, atEnd, false, true);
+            for (int s : atEnd)
+            {
+                if (nfa.states[s].type == NfaState::Match)
+                {
+                    dfa.endMatch[id].push_back((uint32_t)nfa.states[s].rule);
+                }
+            }
+        }
+        return true;
+    }
+
+    // ---- 乘积：从 (根, 起始) 出发广度优先，只保留能到达的状态 ----
+
+    bool buildProduct(const AhoCorasick& ac, const Dfa& dfa)
+    {
+        const size_t C = m_classCount;
+        std::unordered_map<uint64_t, uint32_t> ids;
+        std::vector<std::pair<uint32_t, uint32_t>> states;
+        auto intern = [&](uint32_t a, uint32_t d) -> uint32_t {
+            uint64_t key = ((uint64_t)a << 32) | d;
+            auto it = ids.find(key);
+            if (it != ids.end())
+            {
+                return it->second;
+            }
+            uint32_t id = (uint32_t)states.size();
+            ids.emplace(key, id);
+            states.emplace_back(a, d);
+            return id;
+        };
+        intern(0, dfa.start);
+
+        std::vector<uint32_t> targets;
+        for (size_t id = 0; id < states.size(); ++id)
+        {
+            if (states.size() > m_opts.maxStates || states.size() * C >= ROW_MASK)
+            {
+                return false;
+            }
+            for (size_t c = 0; c < C; ++c)
+            {
+                targets.push_back(intern((uint32_t)ac.delta[states[id].first * C + c], dfa.delta[states[id].second * C + c]));
+            }
+        }
+
+        m_matchBegin.assign(1, 0);
+        m_matchRules.clear();
+        m_endBegin.assign(1, 0);
+        m_endRules.clear();
+        std::vector<uint32_t> rules;
+        for (const auto& state : states)
+        {
+            rules = ac.output[state.first];
+            rules.insert(rules.end(), dfa.match[state.second].begin(), dfa.match[state.second].end());
+            std::sort(rules.begin(), rules.end());
+            rules.erase(std::unique(rules.begin(), rules.end()), rules.end());
+            m_matchRules.insert(m_matchRules.end(), rules.begin(), rules.end());
+            m_matchBegin.push_back((uint32_t)m_matchRules.size());
+            const std::vector<uint32_t>& atEnd = dfa.endMatch[state.second];
+            m_endRules.insert(m_endRules.end(), atEnd.begin(), atEnd.end());
+            m_endBegin.push_back((uint32_t)m_endRules.size());
+        }
+
+        m_next.resize(targets.size());
+        for (size_t i = 0; i < targets.size(); ++i)
+        {
+            uint32_t t = targets[i];
+            m_next[i] = (uint32_t)(t * C) | (m_matchBegin[t + 1] > m_matchBegin[t] ? ACCEPT : 0);
+        }
+        m_startAccepts = m_matchBegin[1] > m_matchBegin[0];
+        auto idle = ids.find(dfa.idle); // (根, idle) 的键就是 idle
+        m_idleRow = idle != ids.end() ? (uint32_t)(idle->second * C) : NO_ROW;
+        return true;
+    }
+
+    void record(uint32_t state, FilterMatches& matches) const
+    {
+        for (uint32_t k = m_matchBegin[state]; k < m_matchBegin[state + 1]; ++k)
+        {
+            matches.set(m_matchRules[k], m_ruleDrop[m_matchRules[k]]);
+        }
+    }
+
+    // ---- SIMD 预过滤 ----
+
+    void buildPrefilter()
+    {
+        m_prefilterMode = PREFILTER_NONE;
+        if (!m_opts.prefilter || m_idleRow == NO_ROW)
+        {
+            return;
+        }
+        // 空闲状态下能让 DFA 离开 (或者命中) 的字节
+        int count = 0;
+        int printable = 0;
+        for (int b = 0; b < 256; ++b)
+        {
+            m_wake[b] = m_next[m_idleRow + m_class[b]] != m_idleRow;
+            if (m_wake[b])
+            {
+                m_wakeBytes[count < 8 ? count : 7] = (uint8_t)b;
+                ++count;
+                printable += b >= 0x20 && b < 0x7f ? 1 : 0;
+            }
+        }
+        // 可打印字符里超过四分之一能唤醒时 (例如以 [a-z] 开头的规则)，普通文本几乎每个 16 字节块都要停下来，
+        // 预过滤只是额外的开销，不如直接逐字节查转移表
+        if (count == 0 || count == 256 || printable > MAX_WAKE_PRINTABLE)
+        {
+            return;
+        }
+        m_prefilterMode = PREFILTER_TABLE;
+#ifdef AIAPP_FILTER_X86
+        if (count <= 8)
+        {
+            for (int i = count; i < 8; ++i)
+            {
+                m_wakeBytes[i] = m_wakeBytes[0];
+            }
+            m_prefilterMode = PREFILTER_SSE2;
+            return;
+        }
+        if (!__builtin_cpu_supports("ssse3"))
+        {
+            return;
+        }
+        // shufti：高半字节相同的字节按低半字节集合分组，每种不同的低半字节集合占一位，超过 8 种时合并到最后一位 (会有误报，不会漏)
+        uint16_t lowSets[16] = {0};
+        for (int b = 0; b < 256; ++b)
+        {
+            if (m_wake[b])
+            {
+                lowSets[b >> 4] |= (uint16_t)(1u << (b & 15));
+            }
+        }
+        uint16_t buckets[8] = {0};
+        int used = 0;
+        memset(m_shuftiLo, 0, sizeof(m_shuftiLo));
+        memset(m_shuftiHi, 0, sizeof(m_shuftiHi));
+        for (int hi = 0; hi < 16; ++hi)
+        {
+            if (lowSets[hi] == 0)
+            {
+                continue;
+            }
+            int bucket = 0;
+            while (bucket < used && buckets[bucket] != lowSets[hi])
+            {
+                ++bucket;
+            }
+            if (bucket == used)
+            {
+                bucket = used < 8 ? used++ : 7;
+            }
+            buckets[bucket] |= lowSets[hi];
+            m_shuftiHi[hi] |= (uint8_t)(1u << bucket);
+        }
+        for (int bucket = 0; bucket < used; ++bucket)
+        {
+            for (int lo = 0; lo < 16; ++lo)
+            {
+                if (buckets[bucket] & (1u << lo))
+                {
+                    m_shuftiLo[lo] |= (uint8_t)(1u << bucket);
+                }
+            }
+        }
+        m_prefilterMode = PREFILTER_SHUFTI;
+#endif
+    }
+
+    // 返回 i 之后第一个可能让 DFA 离开空闲状态的位置，没有时返回 len
+    size_t skip(const uint8_t* p, size_t i, size_t len) const
+    {
+#ifdef AIAPP_FILTER_X86
+        if (m_prefilterMode == PREFILTER_SSE2)
+        {
+            i = skipSse2(p, i, len);
+        }
+        else if (m_prefilterMode == PREFILTER_SHUFTI)
+        {
+            i = skipShufti(p, i, len);
+        }
+#endif
+        while (i < len && !m_wake[p[i]])
+        {
+            ++i;
+        }
+        return i;
+    }
+
+#ifdef AIAPP_FILTER_X86
+    size_t skipSse2(const uint8_t* p, size_t i, size_t len) const
+    {
+        __m128i needles[8];
+        for (int k = 0; k < 8; ++k)
+        {
+            needles[k] = _mm_set1_epi8((char)m_wakeBytes[k]);
+        }
+        for (; i + 16 <= len; i += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i hit = _mm_cmpeq_epi8(block, needles[0]);
+            for (int k = 1; k < 8; ++k)
+            {
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, needles[k]));
+            }
+            int mask = _mm_movemask_epi8(hit);
+            if (mask != 0)
+            {
+                return i + (size_t)__builtin_ctz((unsigned)mask);
+            }
+        }
+        return i;
+    }
+
+    __attribute__((target("ssse3"))) size_t skipShufti(const uint8_t* p, size_t i, size_t len) const
+    {
+        const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_shuftiLo));
+        const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m_shuftiHi));
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= len; i += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+            __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(block, nibble));
+            __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(block, 4), nibble));
+            int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h), zero)) & 0xffff;
+            if (mask != 0)
+            {
+                return i + (size_t)__builtin_ctz((unsigned)mask);
+            }
+        }
+        return i;
+    }
+#endif
+
+    std::vector<Rule> m_rules;
+    std::vector<uint8_t> m_ruleDrop;
+    Options m_opts;
+
+    uint8_t m_class[256] = {0};     // 字节 -> 等价类
+    uint8_t m_classByte[256] = {0}; // 等价类 -> 一个代表字节
+    uint32_t m_classCount = 0;
+
+    // 转移表：m_next[行偏移 + 等价类] = 目标行偏移 | ACCEPT；行偏移 = 状态号 * m_classCount，状态 0 是起始状态
+    std::vector<uint32_t> m_next;
+    std::vector<uint32_t> m_matchBegin; // 状态 s 命中的规则是 m_matchRules[m_matchBegin[s], m_matchBegin[s + 1])
+    std::vector<uint32_t> m_matchRules;
+    std::vector<uint32_t> m_endBegin;   // 同上，输入在状态 s 结束时额外命中的规则 ($)
+    std::vector<uint32_t> m_endRules;
+    bool m_startAccepts = false;
+    uint32_t m_idleRow = NO_ROW;
+
+    int m_prefilterMode = PREFILTER_NONE;
+    bool m_wake[256] = {false};
+    uint8_t m_wakeBytes[8] = {0};
+    alignas(16) uint8_t m_shuftiLo[16] = {0};
+    alignas(16) uint8_t m_shuftiHi[16] = {0};
+};
+
+#endif
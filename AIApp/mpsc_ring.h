@@ -0,0 +1,135 @@
+#ifndef AIAPP_MPSC_RING_H
+#define AIAPP_MPSC_RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+/**
+ * 有界的多生产者单消费者无锁环形队列
+ *
+ * 每个槽位带一个序号 (思路来自 Dmitry Vyukov 的有界 MPMC 队列)：
+ * - 生产者用 CAS 抢占 m_tail 上的一个位置，写入数据后把槽位序号改成 pos + 1，表示 "可读"
+ * - 唯一的消费者不需要 CAS，读到序号等于 pos + 1 的槽位就取走数据，再把序号改成 pos + capacity，表示 "可写"
+ * 队列满时 tryPush 直接返回 false，由调用方决定丢弃还是重试，生产者永远不会被消费者阻塞
+ *
+ * capacity 会被向上取整为 2 的幂
+*/
+template <typename T>
+class MpscRing
+{
+public:
+    explicit MpscRing(size_t capacity) : m_head(0), m_tail(0)
+    {
+        size_t cap = 2;
+        while (cap < capacity)
+        {
+            cap <<= 1;
+        }
+        m_mask = cap - 1;
+        m_cells = std::vector<Cell>(cap);
+        for (size_t i = 0; i < cap; ++i)
+        {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // 任意线程调用
+    bool tryPush(T&& value)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            Cell& cell = m_cells[pos & m_mask];
+            size_t seq = cell.seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::move(value);
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                // 这个槽位还没有被消费者腾出来，队列已满
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 只能由唯一的消费者线程调用
+    bool tryPop(T& out)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        Cell& cell = m_cells[head & m_mask];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        if ((intptr_t)seq - (intptr_t)(head + 1) < 0)
+        {
+            return false;
+        }
+        out = std::move(cell.value);
+        cell.seq.store(head + m_mask + 1, std::memory_order_release);
+        m_head.store(head + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 批量取出最多 max 个元素，交给 fn 处理，返回取出的数量
+    template <typename Fn>
+    size_t drain(size_t max, Fn&& fn)
+    {
+        size_t n = 0;
+        T value;
+        while (n < max && tryPop(value))
+        {
+            fn(std::move(value));
+            ++n;
+        }
+        return n;
+    }
+
+    // 近似的队列深度，任意线程都可以调用，仅用于统计
+    size_t sizeApprox() const
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq;
+        T value;
+
+        Cell() : seq(0) {}
+        Cell(Cell&& other) : seq(other.seq.load(std::memory_order_relaxed)), value(std::move(other.value)) {}
+        Cell& operator=(Cell&& other)
+        {
+            seq.store(other.seq.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            value = std::move(other.value);
+            return *this;
+        }
+    };
+
+    // 生产者和消费者各自修改的位置放在不同的缓存行上，避免伪共享
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+    alignas(64) size_t m_mask;
+    std::vector<Cell> m_cells;
+};
+
+#endif
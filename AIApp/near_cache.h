@@ -0,0 +1,585 @@
+#ifndef AIAPP_NEAR_CACHE_H
+#define AIAPP_NEAR_CACHE_H
+
+#include <hiredis/hiredis.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "latency.h"
+#include "redis_endpoint.h"
+#include "sharded_cache.h"
+#include "timing_wheel.h"
+
+/**
+ * 客户端缓存 (Redis 6 的 CLIENT TRACKING)：GET 命中进程内的缓存时不访问 Redis，key 被修改时由 Redis 主动通知失效
+ *
+ * - NearCache：一个进程一个，持有缓存 (sharded_cache.h，分片 LRU + TinyLFU 准入 + 负缓存) 和一条只接收失效通知的连接；
+ *   这条连接 SUBSCRIBE __redis__:invalidate，由监听线程读取，它的 CLIENT ID 是所有数据连接的 REDIRECT 目标
+ * - CachedRedis：与 redisContext 一样每个线程一个，同步的 GET / SET / DEL；
+ *   连接后发 CLIENT TRACKING on REDIRECT <id>，之后这条连接读过的 key 一旦被修改 (或者过期、被淘汰)，
+ *   Redis 就往监听连接发一条带 key 名的失效消息
+ *
+ * 没有用 RESP3 的 push：push 消息和回复走同一条连接，只有下一次读这条连接时才看得到，
+ * 每次命中之前都要先非阻塞地检查一下 socket，仍然是一次系统调用；REDIRECT 的通知由监听线程随时处理，
+ * 命中就是纯内存查找，同一进程的多条数据连接共享一个监听连接和一份缓存，hiredis 用 RESP2 即可
+ *
+ * 一致性：
+ * - GET 与失效的竞态：GET 之前 reserve 票据，失效先到时票据作废，GET 的结果不放进缓存
+ * - 另一个客户端刚写完、通知还在路上时读到的仍是旧值，这是客户端缓存固有的窗口 (本机通常不到 1 ms)
+ * - 监听连接断开期间的通知会丢失 (包括 Redis 因为 pubsub 输出缓冲区超限主动断开)：立刻清空缓存并停用，
+ *   重连成功后 generation 变化，每条数据连接在下一次 GET 时重新发 CLIENT TRACKING 指向新的 ID
+ * - 数据连接断开后 Redis 忘掉了它读过的 key，缓存里的条目不会再收到通知，同样清空
+ * - 监听连接空闲时每 heartbeat 发一次 PING，两个周期内没有任何回应就当作已断开 (网络断开不一定有 FIN)
+ * - FLUSHDB / FLUSHALL 时通知里的 key 列表为空，清空整个缓存
+ *
+ * BCAST 模式 (Options::bcast)：Redis 不记录每个客户端读过哪些 key，匹配 prefixes 的所有 key 的修改都会通知，
+ * 服务器端不占内存，代价是会收到与本进程无关的通知
+*/
+class NearCache
+{
+public:
+    struct Options
+    {
+        RedisEndpoint endpoint = RedisEndpoint::fromEnv();
+        ShardedCache::Options cache;
+        bool bcast = false;
+        std::vector<std::string> prefixes; // BCAST 的前缀，空表示所有 key
+        int commandTimeoutMs = 5000;
+        int heartbeatMs = 1000;
+    };
+
+    struct Stats
+    {
+        ShardedCache::Stats cache;
+        uint64_t messages = 0;   // 收到的失效通知
+        uint64_t keys = 0;       // 通知里的 key 数
+        uint64_t flushes = 0;    // FLUSHDB / FLUSHALL
+        uint64_t reconnects = 0; // 监听连接重连成功的次数
+        bool connected = false;
+    };
+
+    explicit NearCache(const Options& opts) : m_opts(opts), m_cache(opts.cache) {}
+
+    ~NearCache() { stop(); }
+
+    NearCache(const NearCache&) = delete;
+    NearCache& operator=(const NearCache&) = delete;
+
+    // 建立监听连接并启动监听线程；第一次连接失败返回 false，之后断线由监听线程按指数退避重连
+    bool start(std::string* error)
+    {
+        long long id = 0;
+        redisContext* c = connectListener(id, error);
+        if (c == NULL)
+        {
+            return false;
+        }
+        m_running = true;
+        attach(c, id);
+        m_thread = std::thread(&NearCache::listenLoop, this);
+        return true;
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_running)
+            {
+                return;
+            }
+            m_running = false;
+            // 让阻塞在 poll 上的监听线程立刻返回
+            if (m_context != NULL)
+            {
+                shutdown(m_context->fd, SHUT_RDWR);
+            }
+        }
+        m_cond.notify_all();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    ShardedCache& cache() { return m_cache; }
+    const Options& options() const { return m_opts; }
+
+    // 当前的 REDIRECT 目标和缓存的 generation，两者一起读才一致；id 为 0 表示监听连接断开，不能填充缓存
+    void trackingTarget(long long& id, uint64_t& generation)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        id = m_redirectId;
+        generation = m_cache.generation();
+    }
+
+    Stats stats()
+    {
+        Stats s;
+        s.cache = m_cache.stats();
+        s.messages = m_messages.load(std::memory_order_relaxed);
+        s.keys = m_keys.load(std::memory_order_relaxed);
+        s.flushes = m_flushes.load(std::memory_order_relaxed);
+        s.reconnects = m_reconnects.load(std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        s.connected = m_redirectId != 0;
+        return s;
+    }
+
+private:
+    static constexpr const char* CHANNEL = "__redis__:invalidate";
+    static const uint64_t RECONNECT_MIN_NS = 100ULL * 1000 * 1000;
+    static const uint64_t RECONNECT_MAX_NS = 5ULL * 1000 * 1000 * 1000;
+
+    static bool fail(std::string* error, const std::string& what)
+    {
+        if (error != NULL)
+        {
+            *error = what;
+        }
+        return false;
+    }
+
+    // 连接、取 CLIENT ID、订阅失效频道，失败时返回 NULL
+    redisContext* connectListener(long long& id, std::string* error)
+    {
+        struct timeval tv = {m_opts.commandTimeoutMs / 1000, (m_opts.commandTimeoutMs % 1000) * 1000};
+        redisContext* c = m_opts.endpoint.connect(tv);
+        if (c == NULL || c->err)
+        {
+            fail(error, c != NULL ? c->errstr : "Can't allocate redis context");
+            if (c != NULL)
+            {
+                redisFree(c);
+            }
+            return NULL;
+        }
+        redisSetTimeout(c, tv);
+        redisReply* reply = (redisReply*)redisCommand(c, "CLIENT ID");
+        bool ok = reply != NULL && reply->type == REDIS_REPLY_INTEGER;
+        if (ok)
+        {
+            id = reply->integer;
+        }
+        else
+        {
+            fail(error, reply == NULL ? c->errstr : reply->type == REDIS_REPLY_ERROR ? reply->str : "bad CLIENT ID reply");
+        }
+        if (reply != NULL)
+        {
+            freeReplyObject(reply);
+        }
+        if (ok)
+        {
+            reply = (redisReply*)redisCommand(c, "SUBSCRIBE %s", CHANNEL);
+            ok = reply != NULL && reply->type == REDIS_REPLY_ARRAY;
+            if (!ok)
+            {
+                fail(error, reply == NULL ? c->errstr : "SUBSCRIBE " + std::string(CHANNEL) + " failed");
+            }
+            if (reply != NULL)
+            {
+                freeReplyObject(reply);
+            }
+        }
+        if (!ok)
+        {
+            redisFree(c);
+            return NULL;
+        }
+        return c;
+    }
+
+    // 新的监听连接生效：先换 ID 再清空缓存 (generation 加一)，持有旧 generation 的数据连接都要重新 CLIENT TRACKING
+    void attach(redisContext* c, long long id)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_context = c;
+        m_redirectId = id;
+        m_pingSentNs = 0;
+        m_cache.clear();
+    }
+
+    void detach()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_context != NULL)
+        {
+            redisFree(m_context);
+            m_context = NULL;
+        }
+        m_redirectId = 0;
+        m_cache.clear();
+    }
+
+    void listenLoop()
+    {
+        Backoff backoff(RECONNECT_MIN_NS, RECONNECT_MAX_NS);
+        while (m_running)
+        {
+            if (m_context != NULL)
+            {
+                if (!pump())
+                {
+                    detach();
+                }
+                continue;
+            }
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait_for(lock, std::chrono::nanoseconds(backoff.next()), [this]() { return !m_running; });
+            }
+            if (!m_running)
+            {
+                break;
+            }
+            long long id = 0;
+            std::string error;
+            redisContext* c = connectListener(id, &error);
+            if (c == NULL)
+            {
+                std::cerr << "near cache: reconnect failed: " << error << std::endl;
+                continue;
+            }
+            attach(c, id);
+            backoff.reset();
+            m_reconnects.fetch_add(1, std::memory_order_relaxed);
+        }
+        detach();
+    }
+
+    // 处理已经收到的消息，再等一个 heartbeat 周期的新数据；连接已经不可用时返回 false
+    bool pump()
+    {
+        redisContext* c = m_context;
+        while (true)
+        {
+            redisReply* reply = NULL;
+            if (redisGetReplyFromReader(c, (void**)&reply) != REDIS_OK)
+            {
+                return false;
+            }
+            if (reply == NULL)
+            {
+                break;
+            }
+            handle(reply);
+            freeReplyObject(reply);
+        }
+        struct pollfd pfd = {c->fd, POLLIN, 0};
+        int n = poll(&pfd, 1, m_opts.heartbeatMs);
+        if (!m_running)
+        {
+            return false;
+        }
+        if (n < 0)
+        {
+            return errno == EINTR;
+        }
+        if (n > 0)
+        {
+            return redisBufferRead(c) == REDIS_OK;
+        }
+        // 空闲了一个周期：发 PING，上一个 PING 两个周期都没有回应就放弃这条连接
+        uint64_t now = monotonicNs();
+        if (m_pingSentNs != 0)
+        {
+            return now - m_pingSentNs < 2ULL * m_opts.heartbeatMs * 1000000;
+        }
+        if (redisAppendCommand(c, "PING") != REDIS_OK)
+        {
+            return false;
+        }
+        int done = 0;
+        while (!done)
+        {
+            if (redisBufferWrite(c, &done) != REDIS_OK)
+            {
+                return false;
+            }
+        }
+        m_pingSentNs = now;
+        return true;
+    }
+
+    // 订阅模式下 (RESP2) 的消息：["message", channel, [key...] 或 nil]，PING 的回复是 ["pong", ""]
+    void handle(redisReply* reply)
+    {
+        m_pingSentNs = 0;
+        if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 3 || reply->element[0]->type != REDIS_REPLY_STRING
+            || std::string_view(reply->element[0]->str, reply->element[0]->len) != "message")
+        {
+            return;
+        }
+        m_messages.fetch_add(1, std::memory_order_relaxed);
+        redisReply* keys = reply->element[2];
+        if (keys->type == REDIS_REPLY_ARRAY)
+        {
+            for (size_t i = 0; i < keys->elements; ++i)
+            {
+                redisReply* key = keys->element[i];
+                if (key->type == REDIS_REPLY_STRING)
+                {
+                    m_cache.invalidate(std::string_view(key->str, key->len));
+                }
+            }
+            m_keys.fetch_add(keys->elements, std::memory_order_relaxed);
+        }
+        else
+        {
+            // FLUSHDB / FLUSHALL
+            m_flushes.fetch_add(1, std::memory_order_relaxed);
+            m_cache.clear();
+        }
+    }
+
+    Options m_opts;
+    ShardedCache m_cache;
+    std::thread m_thread;
+    std::atomic<bool> m_running{false};
+    std::mutex m_mutex; // 保护 m_context 的替换、m_redirectId，以及两者与 generation 的一致
+    std::condition_variable m_cond;
+    redisContext* m_context = NULL;
+    long long m_redirectId = 0;
+    uint64_t m_pingSentNs = 0; // 只在监听线程里访问
+    std::atomic<uint64_t> m_messages{0};
+    std::atomic<uint64_t> m_keys{0};
+    std::atomic<uint64_t> m_flushes{0};
+    std::atomic<uint64_t> m_reconnects{0};
+};
+
+/**
+ * 带客户端缓存的同步连接，用法与 TryIt.cc 里的 redisCommand(c, "GET %s") 相同，只是 GET 先查缓存
+ * 不是线程安全的，每个线程一个；所有实例共享同一个 NearCache
+ * 连接断开后下一次调用自动重连，失败时返回 false 和错误信息
+*/
+class CachedRedis
+{
+public:
+    explicit CachedRedis(NearCache& cache) : m_cache(cache) {}
+
+    ~CachedRedis() { disconnect(); }
+
+    CachedRedis(const CachedRedis&) = delete;
+    CachedRedis& operator=(const CachedRedis&) = delete;
+
+    bool connect(std::string* error = NULL)
+    {
+        disconnect();
+        const NearCache::Options& opts = m_cache.options();
+        struct timeval tv = {opts.commandTimeoutMs / 1000, (opts.commandTimeoutMs % 1000) * 1000};
+        m_context = opts.endpoint.connect(tv);
+        if (m_context == NULL || m_context->err)
+        {
+            fail(error, m_context != NULL ? m_context->errstr : "Can't allocate redis context");
+            disconnect();
+            return false;
+        }
+        redisSetTimeout(m_context, tv);
+        return true;
+    }
+
+    /**
+     * found 为 false 表示 key 不存在 (可能来自负缓存)；只有出错时返回 false
+     * 命中时不访问 Redis
+    */
+    bool get(std::string_view key, std::string& value, bool& found, std::string* error = NULL)
+    {
+        ShardedCache& cache = m_cache.cache();
+        switch (cache.get(key, &value))
+        {
+            case ShardedCache::Lookup::Hit:
+                found = true;
+                return true;
+            case ShardedCache::Lookup::NegativeHit:
+                found = false;
+                return true;
+            case ShardedCache::Lookup::Miss:
+                break;
+        }
+        if (m_context == NULL && !connect(error))
+        {
+            return false;
+        }
+        uint64_t generation = 0;
+        uint64_t ticket = tracking(generation) ? cache.reserve(key, generation) : 0;
+        redisReply* reply = (redisReply*)redisCommand(m_context, "GET %b", key.data(), key.size());
+        ++m_roundTrips;
+        if (reply == NULL)
+        {
+            cache.cancel(key, ticket);
+            return connectionLost(error);
+        }
+        bool ok = true;
+        if (reply->type == REDIS_REPLY_STRING)
+        {
+            value.assign(reply->str, reply->len);
+            found = true;
+            std::string_view v(value);
+            cache.fill(key, ticket, &v);
+        }
+        else if (reply->type == REDIS_REPLY_NIL)
+        {
+            found = false;
+            cache.fill(key, ticket, NULL);
+        }
+        else
+        {
+            cache.cancel(key, ticket);
+            ok = fail(error, reply->type == REDIS_REPLY_ERROR ? reply->str : "unexpected reply to GET");
+        }
+        freeReplyObject(reply);
+        return ok;
+    }
+
+    // 写入后删掉本地的副本；Redis 也会发失效通知，这里只是不用等它
+    bool set(std::string_view key, std::string_view value, std::string* error = NULL)
+    {
+        return write(key, error, "SET %b %b", key.data(), key.size(), value.data(), value.size());
+    }
+
+    bool del(std::string_view key, std::string* error = NULL)
+    {
+        return write(key, error, "DEL %b", key.data(), key.size());
+    }
+
+    // 发给 Redis 的命令数 (GET 未命中、SET、DEL)，不含 CLIENT TRACKING
+    uint64_t roundTrips() const { return m_roundTrips; }
+
+    // 其他命令直接用这个连接；写命令需要自己调用 NearCache::cache().invalidate()
+    redisContext* context() { return m_context; }
+
+private:
+    static bool fail(std::string* error, const std::string& what)
+    {
+        if (error != NULL)
+        {
+            *error = what;
+        }
+        return false;
+    }
+
+    void disconnect()
+    {
+        if (m_context != NULL)
+        {
+            redisFree(m_context);
+            m_context = NULL;
+        }
+        m_trackedId = 0;
+        m_trackedGeneration = 0;
+    }
+
+    // 连接断了：Redis 已经忘掉这条连接读过的 key，缓存里的条目不会再收到通知，只能全部丢掉
+    bool connectionLost(std::string* error)
+    {
+        fail(error, m_context->errstr);
+        disconnect();
+        m_cache.cache().clear();
+        return false;
+    }
+
+    /**
+     * 保证这条连接的 CLIENT TRACKING 指向当前的监听连接，成功时 generation 是它生效的 generation
+     * 监听连接断开时返回 false，这次读到的值不放进缓存
+    */
+    bool tracking(uint64_t& generation)
+    {
+        long long id;
+        m_cache.trackingTarget(id, generation);
+        if (id == 0)
+        {
+            return false;
+        }
+        if (id == m_trackedId && generation == m_trackedGeneration)
+        {
+            return true;
+        }
+        // 已经打开过时先关掉，BCAST 的前缀不能在打开的状态下重新设置
+        if (m_trackedId != 0)
+        {
+            redisReply* off = (redisReply*)redisCommand(m_context, "CLIENT TRACKING off");
+            if (off == NULL)
+            {
+                return false;
+            }
+            freeReplyObject(off);
+            m_trackedId = 0;
+        }
+        const NearCache::Options& opts = m_cache.options();
+        std::string redirect = std::to_string(id);
+        std::vector<std::string_view> args = {"CLIENT", "TRACKING", "on", "REDIRECT", redirect};
+        if (opts.bcast)
+        {
+            args.push_back("BCAST");
+            for (const auto& prefix : opts.prefixes)
+            {
+                args.push_back("PREFIX");
+                args.push_back(prefix);
+            }
+        }
+        std::vector<const char*> argv;
+        std::vector<size_t> argvlen;
+        for (std::string_view arg : args)
+        {
+            argv.push_back(arg.data());
+            argvlen.push_back(arg.size());
+        }
+        redisReply* reply = (redisReply*)redisCommandArgv(m_context, (int)argv.size(), argv.data(), argvlen.data());
+        if (reply == NULL)
+        {
+            return false;
+        }
+        // 监听连接刚好断开时 Redis 回复 "ERR The client ID you want redirect to does not exist"
+        bool ok = reply->type == REDIS_REPLY_STATUS;
+        freeReplyObject(reply);
+        if (ok)
+        {
+            m_trackedId = id;
+            m_trackedGeneration = generation;
+        }
+        return ok;
+    }
+
+    template <typename... Args>
+    bool write(std::string_view key, std::string* error, const char* format, Args... args)
+    {
+        if (m_context == NULL && !connect(error))
+        {
+            return false;
+        }
+        redisReply* reply = (redisReply*)redisCommand(m_context, format, args...);
+        ++m_roundTrips;
+        // 不管成功与否都删掉本地副本：命令可能已经执行，只是回复没收到
+        m_cache.cache().invalidate(key);
+        if (reply == NULL)
+        {
+            return connectionLost(error);
+        }
+        bool ok = true;
+        if (reply->type == REDIS_REPLY_ERROR)
+        {
+            ok = fail(error, reply->str);
+        }
+        freeReplyObject(reply);
+        return ok;
+    }
+
+    NearCache& m_cache;
+    redisContext* m_context = NULL;
+    long long m_trackedId = 0;
+    uint64_t m_trackedGeneration = 0;
+    uint64_t m_roundTrips = 0;
+};
+
+#endif
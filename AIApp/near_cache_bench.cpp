@@ -0,0 +1,437 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include "latency.h"
+#include "redis_endpoint.h"
+#include "sharded_cache.h"
+#include "near_cache.h"
+
+// 客户端缓存 (near_cache.h) 的基准，key 按 Zipf 分布访问 (--skew，0.99 接近真实的热点分布)：
+// 1. 只测进程内缓存 (不需要 Redis)：
+//    - 命中率：同样的容量下普通 LRU 与 TinyLFU 准入的对比
+//    - 命中时的查找吞吐：1 到 --threads 个线程同时读，看分片锁的扩展性
+// 2. 连上 Redis 时 (--endpoint，连不上就跳过)：每个线程一个连接，
+//    - 每次 GET 都访问 Redis vs CachedRedis，比较吞吐和每次 GET 的延迟分布
+//    - CachedRedis 那一轮同时有一个写线程按 --write-rate 修改 key，每次写完测量本地副本多久被失效通知删掉
+//    - 结束后逐个核对缓存里剩下的 key 与 Redis 的值一致
+
+struct Options {
+    int keys = 100000;       // key 的数量
+    double skew = 0.99;      // Zipf 分布的参数
+    int ops = 1000000;       // 每一轮所有线程合计的 GET 次数
+    int threads = 4;         // 读线程数
+    int valueBytes = 64;     // value 的长度
+    size_t cacheMb = 4;      // 缓存容量
+    int writeRate = 500;     // Redis 那一轮每秒写入的次数，0 表示不写
+    int rounds = 3;          // 只测进程内缓存时每种方式重复的次数，取最快的一次
+    bool local = false;      // 只测进程内缓存
+    RedisEndpoint endpoint = RedisEndpoint::fromEnv();
+};
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--keys N] [--skew S] [--ops N] [--threads N] [--value-bytes N] [--cache-mb N]"
+              << " [--write-rate N] [--rounds N] [--local] [--endpoint HOST:PORT|unix:PATH]" << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--local") == 0) {
+            opts.local = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--keys") == 0) {
+            opts.keys = atoi(value);
+        } else if (strcmp(arg, "--skew") == 0) {
+            opts.skew = atof(value);
+        } else if (strcmp(arg, "--ops") == 0) {
+            opts.ops = atoi(value);
+        } else if (strcmp(arg, "--threads") == 0) {
+            opts.threads = atoi(value);
+        } else if (strcmp(arg, "--value-bytes") == 0) {
+            opts.valueBytes = atoi(value);
+        } else if (strcmp(arg, "--cache-mb") == 0) {
+            opts.cacheMb = (size_t)atol(value);
+        } else if (strcmp(arg, "--write-rate") == 0) {
+            opts.writeRate = atoi(value);
+        } else if (strcmp(arg, "--rounds") == 0) {
+            opts.rounds = atoi(value);
+        } else if (strcmp(arg, "--endpoint") == 0) {
+            if (!RedisEndpoint::parse(value, opts.endpoint)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return opts.keys > 0 && opts.skew >= 0.0 && opts.ops > 0 && opts.threads > 0 && opts.valueBytes > 0
+           && opts.cacheMb > 0 && opts.writeRate >= 0 && opts.rounds > 0;
+}
+
+// 第 i 个 key 的第 version 个值，长度固定为 valueBytes
+static std::string keyName(int i) {
+    return "nc:key:" + std::to_string(i);
+}
+
+static std::string valueOf(int i, uint64_t version, int valueBytes) {
+    std::string v = std::to_string(i) + ":" + std::to_string(version) + ":";
+    v.resize(std::max<size_t>(v.size(), (size_t)valueBytes), 'x');
+    return v;
+}
+
+// 每个线程预先生成自己的访问序列，计时里不包括抽样
+static std::vector<std::vector<int>> zipfSequences(const Options& opts) {
+    std::vector<double> cdf(opts.keys);
+    double sum = 0.0;
+    for (int i = 0; i < opts.keys; ++i) {
+        sum += 1.0 / std::pow(i + 1.0, opts.skew);
+        cdf[i] = sum;
+    }
+    // 热度的排名与 key 编号无关，打乱一次，热 key 不会都落在同一个分片
+    std::vector<int> rank(opts.keys);
+    for (int i = 0; i < opts.keys; ++i) {
+        rank[i] = i;
+    }
+    std::mt19937_64 shuffle(7);
+    std::shuffle(rank.begin(), rank.end(), shuffle);
+    std::vector<std::vector<int>> out(opts.threads);
+    for (int t = 0; t < opts.threads; ++t) {
+        std::mt19937_64 rng(1000 + t);
+        std::uniform_real_distribution<double> u(0.0, sum);
+        int n = opts.ops / opts.threads;
+        out[t].reserve(n);
+        for (int k = 0; k < n; ++k) {
+            size_t idx = std::lower_bound(cdf.begin(), cdf.end(), u(rng)) - cdf.begin();
+            out[t].push_back(rank[std::min<size_t>(idx, opts.keys - 1)]);
+        }
+    }
+    return out;
+}
+
+static ShardedCache::Options cacheOptions(const Options& opts, bool admission) {
+    ShardedCache::Options co;
+    co.capacityBytes = opts.cacheMb << 20;
+    co.admission = admission;
+    return co;
+}
+
+// ---- 1. 进程内缓存 ----
+
+// 一个线程按序列读，未命中时从 "source" (直接生成值) 填充，返回命中率
+static double hitRatio(ShardedCache& cache, const std::vector<int>& seq, int valueBytes) {
+    uint64_t hits = 0;
+    std::string value;
+    for (int i : seq) {
+        std::string key = keyName(i);
+        if (cache.get(key, &value) == ShardedCache::Lookup::Hit) {
+            ++hits;
+            continue;
+        }
+        uint64_t ticket = cache.reserve(key, cache.generation());
+        std::string v = valueOf(i, 0, valueBytes);
+        std::string_view sv(v);
+        cache.fill(key, ticket, &sv);
+    }
+    return seq.empty() ? 0.0 : (double)hits / seq.size();
+}
+
+// threads 个线程同时按各自的序列读，返回每秒的查找次数；key 提前生成好，只测 get
+static double lookupRate(ShardedCache& cache, const std::vector<std::vector<std::string>>& keys, int threads) {
+    std::vector<std::thread> workers;
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    uint64_t start = 0;
+    size_t total = 0;
+    for (int t = 0; t < threads; ++t) {
+        total += keys[t].size();
+        workers.emplace_back([&, t]() {
+            std::string value;
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) {
+            }
+            for (const auto& key : keys[t]) {
+                cache.get(key, &value);
+            }
+        });
+    }
+    while (ready.load() < threads) {
+    }
+    start = monotonicNs();
+    go.store(true, std::memory_order_release);
+    for (auto& w : workers) {
+        w.join();
+    }
+    return total / ((monotonicNs() - start) / 1e9);
+}
+
+static void localBench(const Options& opts, const std::vector<std::vector<int>>& seqs) {
+    printf("in-process cache: %d keys, skew %.2f, %zu MB, %d-byte values\n", opts.keys, opts.skew, opts.cacheMb,
+           opts.valueBytes);
+    for (bool admission : {false, true}) {
+        ShardedCache cache(cacheOptions(opts, admission));
+        // 第一遍预热，第二遍的命中率才是稳定状态
+        hitRatio(cache, seqs[0], opts.valueBytes);
+        double ratio = hitRatio(cache, seqs[0], opts.valueBytes);
+        ShardedCache::Stats s = cache.stats();
+        printf("  %-8s hit ratio %5.1f%%  entries %llu  evictions %llu  rejected %llu\n", admission ? "TinyLFU" : "LRU",
+               ratio * 100, (unsigned long long)s.entries, (unsigned long long)s.evictions,
+               (unsigned long long)s.rejected);
+    }
+
+    ShardedCache cache(cacheOptions(opts, true));
+    for (const auto& seq : seqs) {
+        hitRatio(cache, seq, opts.valueBytes);
+    }
+    std::vector<std::vector<std::string>> keys(opts.threads);
+    for (int t = 0; t < opts.threads; ++t) {
+        for (int i : seqs[t]) {
+            keys[t].push_back(keyName(i));
+        }
+    }
+    for (int threads = 1; threads <= opts.threads; threads *= 2) {
+        double best = 0.0;
+        for (int round = 0; round < opts.rounds; ++round) {
+            best = std::max(best, lookupRate(cache, keys, threads));
+        }
+        printf("  get, %d thread(s): %.2f M/s, %.0f ns per get per thread\n", threads, best / 1e6, threads * 1e9 / best);
+    }
+}
+
+// ---- 2. 连 Redis ----
+
+struct RunResult {
+    double seconds = 0.0;
+    LatencyHistogram latency;
+    uint64_t roundTrips = 0;
+    bool ok = true;
+};
+
+static bool populate(redisContext* c, const Options& opts) {
+    const int batch = 1000;
+    for (int i = 0; i < opts.keys; i += batch) {
+        int n = std::min(batch, opts.keys - i);
+        for (int k = 0; k < n; ++k) {
+            std::string key = keyName(i + k);
+            std::string value = valueOf(i + k, 0, opts.valueBytes);
+            redisAppendCommand(c, "SET %b %b", key.data(), key.size(), value.data(), value.size());
+        }
+        for (int k = 0; k < n; ++k) {
+            redisReply* reply;
+            if (redisGetReply(c, (void**)&reply) != REDIS_OK) {
+                return false;
+            }
+            freeReplyObject(reply);
+        }
+    }
+    return true;
+}
+
+template <typename MakeGet>
+static RunResult runReaders(const Options& opts, const std::vector<std::vector<int>>& seqs, MakeGet makeGet) {
+    RunResult result;
+    std::vector<RunResult> perThread(opts.threads);
+    std::vector<std::thread> workers;
+    uint64_t start = monotonicNs();
+    for (int t = 0; t < opts.threads; ++t) {
+        workers.emplace_back([&, t]() {
+            auto get = makeGet(perThread[t]);
+            std::string value;
+            for (int i : seqs[t]) {
+                std::string key = keyName(i);
+                uint64_t begin = monotonicNs();
+                if (!get(key, value)) {
+                    perThread[t].ok = false;
+                    return;
+                }
+                perThread[t].latency.record(monotonicNs() - begin);
+            }
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+    result.seconds = (monotonicNs() - start) / 1e9;
+    for (auto& r : perThread) {
+        result.latency.merge(r.latency);
+        result.roundTrips += r.roundTrips;
+        result.ok = result.ok && r.ok;
+    }
+    return result;
+}
+
+static void report(const char* name, const RunResult& r, uint64_t gets) {
+    printf("  %-22s %8.0f GET/s, %llu Redis round trips\n", name, gets / r.seconds, (unsigned long long)r.roundTrips);
+    printf("    %s", r.latency.summary("latency").c_str());
+}
+
+static bool redisBench(const Options& opts, const std::vector<std::vector<int>>& seqs) {
+    struct timeval tv = {2, 0};
+    redisContext* c = opts.endpoint.connect(tv);
+    if (c == NULL || c->err) {
+        printf("Redis at %s not reachable, skipping the client-side caching run\n", opts.endpoint.toString().c_str());
+        if (c != NULL) {
+            redisFree(c);
+        }
+        return true;
+    }
+    if (!populate(c, opts)) {
+        std::cerr << "populate failed: " << c->errstr << std::endl;
+        redisFree(c);
+        return false;
+    }
+    uint64_t gets = 0;
+    for (const auto& seq : seqs) {
+        gets += seq.size();
+    }
+    printf("Redis %s: %d keys, %d threads, %llu GETs\n", opts.endpoint.toString().c_str(), opts.keys, opts.threads,
+           (unsigned long long)gets);
+
+    // 每次 GET 都访问 Redis
+    RunResult plain = runReaders(opts, seqs, [&opts](RunResult& r) {
+        std::shared_ptr<redisContext> ctx(opts.endpoint.connect(), redisFree);
+        return [ctx, &r](const std::string& key, std::string& value) {
+            redisReply* reply = (redisReply*)redisCommand(ctx.get(), "GET %b", key.data(), key.size());
+            ++r.roundTrips;
+            if (reply == NULL) {
+                return false;
+            }
+            value.assign(reply->str != NULL ? reply->str : "", reply->len);
+            freeReplyObject(reply);
+            return true;
+        };
+    });
+    report("GET every time", plain, gets);
+
+    // CachedRedis，同时有一个写线程
+    NearCache::Options nco;
+    nco.endpoint = opts.endpoint;
+    nco.cache = cacheOptions(opts, true);
+    NearCache nearCache(nco);
+    std::string error;
+    if (!nearCache.start(&error)) {
+        std::cerr << "near cache: " << error << std::endl;
+        redisFree(c);
+        return false;
+    }
+    std::atomic<bool> readersDone{false};
+    LatencyHistogram invalidationLag;
+    uint64_t writes = 0;
+    std::thread writer([&]() {
+        if (opts.writeRate == 0) {
+            return;
+        }
+        std::mt19937_64 rng(99);
+        uint64_t interval = 1000000000ULL / opts.writeRate;
+        uint64_t next = monotonicNs();
+        std::string cached;
+        while (!readersDone.load()) {
+            // 写热 key：从读线程的序列里挑，写之前先确认它在缓存里
+            const std::vector<int>& seq = seqs[rng() % seqs.size()];
+            int i = seq[rng() % seq.size()];
+            std::string key = keyName(i);
+            bool wasCached = nearCache.cache().get(key, &cached) == ShardedCache::Lookup::Hit;
+            std::string value = valueOf(i, ++writes, opts.valueBytes);
+            redisReply* reply = (redisReply*)redisCommand(c, "SET %b %b", key.data(), key.size(), value.data(),
+                                                          value.size());
+            if (reply == NULL) {
+                return;
+            }
+            freeReplyObject(reply);
+            uint64_t written = monotonicNs();
+            // 写之前在缓存里的，等到本地副本不再是旧值 (被失效删掉，或者已经被读线程重新填充成新值)
+            while (wasCached && nearCache.cache().get(key, &cached) == ShardedCache::Lookup::Hit && cached != value) {
+                if (monotonicNs() - written > 1000000000ULL) {
+                    std::cerr << "key " << key << " still stale after 1 s" << std::endl;
+                    break;
+                }
+            }
+            if (wasCached) {
+                invalidationLag.record(monotonicNs() - written);
+            }
+            next += interval;
+            uint64_t now = monotonicNs();
+            if (next > now) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(next - now));
+            }
+        }
+    });
+    RunResult cached = runReaders(opts, seqs, [&nearCache](RunResult& r) {
+        std::shared_ptr<CachedRedis> client(new CachedRedis(nearCache));
+        return [client, &r](const std::string& key, std::string& value) {
+            bool found;
+            uint64_t before = client->roundTrips();
+            bool ok = client->get(key, value, found);
+            r.roundTrips += client->roundTrips() - before;
+            return ok;
+        };
+    });
+    readersDone = true;
+    writer.join();
+    report("CachedRedis", cached, gets);
+    NearCache::Stats s = nearCache.stats();
+    printf("    hits %llu, negative hits %llu, misses %llu, fills %llu (%llu dropped by a racing invalidation),"
+           " rejected %llu, evictions %llu\n",
+           (unsigned long long)s.cache.hits, (unsigned long long)s.cache.negativeHits,
+           (unsigned long long)s.cache.misses, (unsigned long long)s.cache.fills,
+           (unsigned long long)s.cache.fillsDropped, (unsigned long long)s.cache.rejected,
+           (unsigned long long)s.cache.evictions);
+    printf("    %llu writes, %llu invalidation messages for %llu keys, %llu entries invalidated\n",
+           (unsigned long long)writes, (unsigned long long)s.messages, (unsigned long long)s.keys,
+           (unsigned long long)s.cache.invalidations);
+    if (invalidationLag.count() > 0) {
+        printf("    %s", invalidationLag.summary("write -> local copy gone").c_str());
+    }
+
+    // 等最后的通知处理完，再逐个核对缓存里剩下的 key
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    uint64_t checked = 0;
+    uint64_t stale = 0;
+    std::string local;
+    for (int i = 0; i < opts.keys; ++i) {
+        std::string key = keyName(i);
+        if (nearCache.cache().get(key, &local) != ShardedCache::Lookup::Hit) {
+            continue;
+        }
+        ++checked;
+        redisReply* reply = (redisReply*)redisCommand(c, "GET %b", key.data(), key.size());
+        if (reply == NULL) {
+            break;
+        }
+        if (reply->type != REDIS_REPLY_STRING || local != std::string(reply->str, reply->len)) {
+            ++stale;
+        }
+        freeReplyObject(reply);
+    }
+    printf("    consistency: %llu cached keys checked against Redis, %llu stale\n", (unsigned long long)checked,
+           (unsigned long long)stale);
+    nearCache.stop();
+    redisFree(c);
+    return plain.ok && cached.ok && stale == 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::vector<std::vector<int>> seqs = zipfSequences(opts);
+    localBench(opts, seqs);
+    bool ok = opts.local || redisBench(opts, seqs);
+    if (!ok) {
+        std::cerr << "Near cache check failed" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+#ifndef AIAPP_PENDING_ACKS_H
+#define AIAPP_PENDING_ACKS_H
+
+#include <stdint.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "rbtree.h"
+
+/**
+ * 已经发出、还没有确认送达的消息，按序号排序
+ *
+ * 聊天客户端发出一条消息时 add()，从订阅连接上收到自己的这条消息 (回环) 时 confirm()，发送失败时 remove()；
+ * 最老的一条在缓存的最左结点上，oldestNs() 是 O(1) 的，状态栏可以每帧显示 "最久未确认的消息已经等了多久"
+ *
+ * 结点来自一个只增不减的空闲链表，稳定之后 add / confirm 都不分配内存；
+ * 积压超过 capacity 条时最老的一条被当作丢失 (例如订阅端队列满时丢掉了回环的消息)，保证内存有界
+ *
+ * 发送 (UI 线程)、确认 (接收线程) 和失败 (写线程) 在不同线程里调用，用一把锁保护，临界区只有一次树操作
+*/
+class PendingAcks
+{
+public:
+    explicit PendingAcks(size_t capacity = 65536) : m_capacity(capacity > 0 ? capacity : 1), m_free(NULL), m_lost(0) {}
+
+    PendingAcks(const PendingAcks&) = delete;
+    PendingAcks& operator=(const PendingAcks&) = delete;
+
+    void add(uint64_t seq, uint64_t sendNs)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_tree.size() >= m_capacity)
+        {
+            Entry* oldest = m_tree.first();
+            m_tree.erase(oldest);
+            release(oldest);
+            ++m_lost;
+        }
+        Entry* entry = acquire();
+        entry->seq = seq;
+        entry->sendNs = sendNs;
+        m_tree.insert(entry);
+    }
+
+    // 确认送达，返回这条消息从发出到确认的纳秒数；不在等待中 (重复的回环、已经被当作丢失) 时返回 0
+    uint64_t confirm(uint64_t seq, uint64_t nowNs)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Entry* entry = find(seq);
+        if (entry == NULL)
+        {
+            return 0;
+        }
+        uint64_t latency = nowNs > entry->sendNs ? nowNs - entry->sendNs : 0;
+        m_tree.erase(entry);
+        release(entry);
+        return latency;
+    }
+
+    // 发送失败的消息不会再有回环，直接移除
+    bool remove(uint64_t seq)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Entry* entry = find(seq);
+        if (entry == NULL)
+        {
+            return false;
+        }
+        m_tree.erase(entry);
+        release(entry);
+        return true;
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_tree.size();
+    }
+
+    // 最老的一条未确认消息的发送时间，没有时返回 0
+    uint64_t oldestNs()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Entry* oldest = m_tree.first();
+        return oldest != NULL ? oldest->sendNs : 0;
+    }
+
+    // 因为积压超过 capacity 而被当作丢失的消息数
+    uint64_t lost()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_lost;
+    }
+
+private:
+    struct Entry
+    {
+        RbNode node;
+        uint64_t seq;
+        uint64_t sendNs;
+        Entry* nextFree;
+    };
+
+    struct SeqLess
+    {
+        bool operator()(const Entry& a, const Entry& b) const { return a.seq < b.seq; }
+    };
+
+    Entry* find(uint64_t seq) const
+    {
+        return m_tree.find(seq, [](uint64_t key, const Entry& e) { return key < e.seq ? -1 : (key > e.seq ? 1 : 0); });
+    }
+
+    Entry* acquire()
+    {
+        if (m_free == NULL)
+        {
+            // 按块分配，块本身一直保留到对象析构
+            const size_t BLOCK = 256;
+            m_blocks.emplace_back(new Entry[BLOCK]);
+            Entry* block = m_blocks.back().get();
+            for (size_t i = 0; i < BLOCK; ++i)
+            {
+                block[i].nextFree = m_free;
+                m_free = &block[i];
+            }
+        }
+        Entry* entry = m_free;
+        m_free = entry->nextFree;
+        return entry;
+    }
+
+    void release(Entry* entry)
+    {
+        entry->nextFree = m_free;
+        m_free = entry;
+    }
+
+    std::mutex m_mutex;
+    RbTree<Entry, &Entry::node, SeqLess> m_tree;
+    size_t m_capacity;
+    std::vector<std::unique_ptr<Entry[]>> m_blocks;
+    Entry* m_free;
+    uint64_t m_lost;
+};
+
+#endif
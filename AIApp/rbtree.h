@@ -0,0 +1,785 @@
+#ifndef AIAPP_RBTREE_H
+#define AIAPP_RBTREE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * 侵入式红黑树，照着 Linux 内核的 lib/rbtree.c 和 include/linux/rbtree_augmented.h 实现 (见 LearningRedis/LinuxEpoll.md 和 Fig/rbtree)
+ *
+ * - 结点 RbNode 嵌在使用者自己的结构体里，树只负责把结点链起来，插入和删除都不分配内存
+ * - 与内核一样，父结点指针和颜色放在同一个字 parentColor 里：结点至少按 4 字节对齐，指针最低位用来存颜色
+ * - RbRootCached 额外缓存最左边 (最小) 的结点，取最小值是 O(1)，适合定时器、按序号排列的待确认消息这类总是从最小值开始处理的场景
+ * - 增强 (augmented) 回调：与内核的 struct rb_augment_callbacks 相同，由 propagate / copy / rotate 三个函数在旋转和删除时
+ *   维护每个结点上 "整棵子树" 的汇总值；这里用模板参数传入，不使用增强时 RbNoAugment 的空函数会被完全内联掉
+ *
+ * 底层接口 (rbLinkNode / rbInsertColor / rbErase / rbNext ...) 与内核一一对应，使用者自己写查找插入位置的循环；
+ * 大多数情况下直接用上层的 RbTree 模板，它相当于内核的 rb_add_cached / rb_find / rb_erase_cached
+*/
+struct RbNode
+{
+    uintptr_t parentColor;
+    RbNode* right;
+    RbNode* left;
+};
+
+struct RbRoot
+{
+    RbNode* node = NULL;
+};
+
+struct RbRootCached
+{
+    RbRoot root;
+    RbNode* leftmost = NULL;
+};
+
+enum
+{
+    RB_RED = 0,
+    RB_BLACK = 1
+};
+
+inline RbNode* rbParent(const RbNode* node) { return reinterpret_cast<RbNode*>(node->parentColor & ~(uintptr_t)3); }
+inline bool rbIsBlack(const RbNode* node) { return node->parentColor & RB_BLACK; }
+inline bool rbIsRed(const RbNode* node) { return !rbIsBlack(node); }
+
+// 与内核的 RB_EMPTY_NODE / RB_CLEAR_NODE 相同：父指针指向自己表示结点不在任何树里
+inline bool rbEmptyNode(const RbNode* node) { return node->parentColor == reinterpret_cast<uintptr_t>(node); }
+inline void rbClearNode(RbNode* node) { node->parentColor = reinterpret_cast<uintptr_t>(node); }
+
+// 把新结点挂到 parent 的 *link 位置 (parent->left 或 parent->right)，颜色为红，之后调用 rbInsertColor 恢复平衡
+inline void rbLinkNode(RbNode* node, RbNode* parent, RbNode** link)
+{
+    node->parentColor = reinterpret_cast<uintptr_t>(parent);
+    node->left = node->right = NULL;
+    *link = node;
+}
+
+namespace rbdetail
+{
+
+inline void setParent(RbNode* node, RbNode* parent)
+{
+    node->parentColor = (node->parentColor & 1) | reinterpret_cast<uintptr_t>(parent);
+}
+
+inline void setParentColor(RbNode* node, RbNode* parent, int color)
+{
+    node->parentColor = reinterpret_cast<uintptr_t>(parent) | (uintptr_t)color;
+}
+
+inline void setBlack(RbNode* node) { node->parentColor |= RB_BLACK; }
+
+// 红色结点的颜色位是 0，parentColor 直接就是父结点指针
+inline RbNode* redParent(RbNode* red) { return reinterpret_cast<RbNode*>(red->parentColor); }
+
+inline void changeChild(RbNode* oldChild, RbNode* newChild, RbNode* parent, RbRoot* root)
+{
+    if (parent != NULL)
+    {
+        if (parent->left == oldChild)
+        {
+            parent->left = newChild;
+        }
+        else
+        {
+            parent->right = newChild;
+        }
+    }
+    else
+    {
+        root->node = newChild;
+    }
+}
+
+// 旋转之后 newNode 接替 oldNode 的位置和颜色，oldNode 成为 newNode 的子结点并设为 color
+inline void rotateSetParents(RbNode* oldNode, RbNode* newNode, RbRoot* root, int color)
+{
+    RbNode* parent = rbParent(oldNode);
+    newNode->parentColor = oldNode->parentColor;
+    setParentColor(oldNode, newNode, color);
+    changeChild(oldNode, newNode, parent, root);
+}
+
+// 对应内核的 __rb_insert
+template <typename Augment>
+inline void insert(RbNode* node, RbRoot* root)
+{
+    RbNode* parent = redParent(node);
+    RbNode* gparent;
+    RbNode* tmp;
+
+    while (true)
+    {
+        // 循环不变式：node 是红色
+        if (parent == NULL)
+        {
+            // 插入的是根结点，或者向上一直修正到了根，根总是黑色
+            setParentColor(node, NULL, RB_BLACK);
+            break;
+        }
+        if (rbIsBlack(parent))
+        {
+            break;
+        }
+
+        gparent = redParent(parent);
+        tmp = gparent->right;
+        if (parent != tmp)
+        {
+            // parent 是 gparent 的左子结点
+            if (tmp != NULL && rbIsRed(tmp))
+            {
+                // 叔结点也是红色：父、叔变黑，祖父变红，继续向上
+                setParentColor(tmp, gparent, RB_BLACK);
+                setParentColor(parent, gparent, RB_BLACK);
+                node = gparent;
+                parent = rbParent(node);
+                setParentColor(node, parent, RB_RED);
+                continue;
+            }
+
+            tmp = parent->right;
+            if (node == tmp)
+            {
+                // node 是右子结点，先在 parent 上左旋，变成下面的情况
+                tmp = node->left;
+                parent->right = tmp;
+                node->left = parent;
+                if (tmp != NULL)
+                {
+                    setParentColor(tmp, parent, RB_BLACK);
+                }
+                setParentColor(parent, node, RB_RED);
+                Augment::rotate(parent, node);
+                parent = node;
+                tmp = node->right;
+            }
+
+            // 在 gparent 上右旋
+            gparent->left = tmp;
+            parent->right = gparent;
+            if (tmp != NULL)
+            {
+                setParentColor(tmp, gparent, RB_BLACK);
+            }
+            rotateSetParents(gparent, parent, root, RB_RED);
+            Augment::rotate(gparent, parent);
+            break;
+        }
+        else
+        {
+            // 与上面对称
+            tmp = gparent->left;
+            if (tmp != NULL && rbIsRed(tmp))
+            {
+                setParentColor(tmp, gparent, RB_BLACK);
+                setParentColor(parent, gparent, RB_BLACK);
+                node = gparent;
+                parent = rbParent(node);
+                setParentColor(node, parent, RB_RED);
+                continue;
+            }
+
+            tmp = parent->left;
+            if (node == tmp)
+            {
+                tmp = node->right;
+                parent->left = tmp;
+                node->right = parent;
+                if (tmp != NULL)
+                {
+                    setParentColor(tmp, parent, RB_BLACK);
+                }
+                setParentColor(parent, node, RB_RED);
+                Augment::rotate(parent, node);
+                parent = node;
+                tmp = node->left;
+            }
+
+            gparent->right = tmp;
+            parent->left = gparent;
+            if (tmp != NULL)
+            {
+                setParentColor(tmp, gparent, RB_BLACK);
+            }
+            rotateSetParents(gparent, parent, root, RB_RED);
+            Augment::rotate(gparent, parent);
+            break;
+        }
+    }
+}
+
+// 对应内核的 ____rb_erase_color：删除了一个黑色结点之后，从 parent 开始修正少掉的那一个黑高
+template <typename Augment>
+inline void eraseColor(RbNode* parent, RbRoot* root)
+{
+    RbNode* node = NULL;
+    RbNode* sibling;
+    RbNode* tmp1;
+    RbNode* tmp2;
+
+    while (true)
+    {
+        // 循环不变式：所有经过 parent 到 node 这一侧的路径比另一侧少一个黑色结点，node 是黑色或者为空
+        sibling = parent->right;
+        if (node != sibling)
+        {
+            // node 是 parent 的左子结点
+            if (rbIsRed(sibling))
+            {
+                // 兄弟是红色：在 parent 上左旋，换一个黑色的兄弟
+                tmp1 = sibling->left;
+                parent->right = tmp1;
+                sibling->left = parent;
+                setParentColor(tmp1, parent, RB_BLACK);
+                rotateSetParents(parent, sibling, root, RB_RED);
+                Augment::rotate(parent, sibling);
+                sibling = tmp1;
+            }
+            tmp1 = sibling->right;
+            if (tmp1 == NULL || rbIsBlack(tmp1))
+            {
+                tmp2 = sibling->left;
+                if (tmp2 == NULL || rbIsBlack(tmp2))
+                {
+                    // 兄弟的两个子结点都是黑色：兄弟变红，问题交给上一层
+                    setParentColor(sibling, parent, RB_RED);
+                    if (rbIsRed(parent))
+                    {
+                        setBlack(parent);
+                    }
+                    else
+                    {
+                        node = parent;
+                        parent = rbParent(node);
+                        if (parent != NULL)
+                        {
+                            continue;
+                        }
+                    }
+                    break;
+                }
+                // 兄弟的左子结点是红色：在 sibling 上右旋
+                tmp1 = tmp2->right;
+                sibling->left = tmp1;
+                tmp2->right = sibling;
+                parent->right = tmp2;
+                if (tmp1 != NULL)
+                {
+                    setParentColor(tmp1, sibling, RB_BLACK);
+                }
+                Augment::rotate(sibling, tmp2);
+                tmp1 = sibling;
+                sibling = tmp2;
+            }
+            // 兄弟的右子结点是红色：在 parent 上左旋，修正结束
+            tmp2 = sibling->left;
+            parent->right = tmp2;
+            sibling->left = parent;
+            setParentColor(tmp1, sibling, RB_BLACK);
+            if (tmp2 != NULL)
+            {
+                setParent(tmp2, parent);
+            }
+            rotateSetParents(parent, sibling, root, RB_BLACK);
+            Augment::rotate(parent, sibling);
+            break;
+        }
+        else
+        {
+            // 与上面对称
+            sibling = parent->left;
+            if (rbIsRed(sibling))
+            {
+                tmp1 = sibling->right;
+                parent->left = tmp1;
+                sibling->right = parent;
+                setParentColor(tmp1, parent, RB_BLACK);
+                rotateSetParents(parent, sibling, root, RB_RED);
+                Augment::rotate(parent, sibling);
+                sibling = tmp1;
+            }
+            tmp1 = sibling->left;
+            if (tmp1 == NULL || rbIsBlack(tmp1))
+            {
+                tmp2 = sibling->right;
+                if (tmp2 == NULL || rbIsBlack(tmp2))
+                {
+                    setParentColor(sibling, parent, RB_RED);
+                    if (rbIsRed(parent))
+                    {
+                        setBlack(parent);
+                    }
+                    else
+                    {
+                        node = parent;
+                        parent = rbParent(node);
+                        if (parent != NULL)
+                        {
+                            continue;
+                        }
+                    }
+                    break;
+                }
+                tmp1 = tmp2->left;
+                sibling->right = tmp1;
+                tmp2->left = sibling;
+                parent->left = tmp2;
+                if (tmp1 != NULL)
+                {
+                    setParentColor(tmp1, sibling, RB_BLACK);
+                }
+                Augment::rotate(sibling, tmp2);
+                tmp1 = sibling;
+                sibling = tmp2;
+            }
+            tmp2 = sibling->right;
+            parent->left = tmp2;
+            sibling->right = parent;
+            setParentColor(tmp1, sibling, RB_BLACK);
+            if (tmp2 != NULL)
+            {
+                setParent(tmp2, parent);
+            }
+            rotateSetParents(parent, sibling, root, RB_BLACK);
+            Augment::rotate(parent, sibling);
+            break;
+        }
+    }
+}
+
+// 对应内核的 __rb_erase_augmented：把结点摘下来，返回需要修正颜色的起点 (不需要时为 NULL)
+template <typename Augment>
+inline RbNode* erase(RbNode* node, RbRoot* root)
+{
+    RbNode* child = node->right;
+    RbNode* tmp = node->left;
+    RbNode* parent;
+    RbNode* rebalance;
+    uintptr_t pc;
+
+    if (tmp == NULL)
+    {
+        // 最多只有一个右子结点：直接用它顶替。如果有子结点，它一定是红色的，染成被删结点的颜色即可
+        pc = node->parentColor;
+        parent = reinterpret_cast<RbNode*>(pc & ~(uintptr_t)3);
+        changeChild(node, child, parent, root);
+        if (child != NULL)
+        {
+            child->parentColor = pc;
+            rebalance = NULL;
+        }
+        else
+        {
+            rebalance = (pc & RB_BLACK) ? parent : NULL;
+        }
+        tmp = parent;
+    }
+    else if (child == NULL)
+    {
+        // 只有一个左子结点，同上
+        tmp->parentColor = pc = node->parentColor;
+        parent = reinterpret_cast<RbNode*>(pc & ~(uintptr_t)3);
+        changeChild(node, tmp, parent, root);
+        rebalance = NULL;
+        tmp = parent;
+    }
+    else
+    {
+        // 两个子结点都在：用后继 (右子树的最左结点) 顶替被删结点的位置和颜色
+        RbNode* successor = child;
+        RbNode* child2;
+
+        tmp = child->left;
+        if (tmp == NULL)
+        {
+            // 后继就是右子结点
+            parent = successor;
+            child2 = successor->right;
+            Augment::copy(node, successor);
+        }
+        else
+        {
+            do
+            {
+                parent = successor;
+                successor = tmp;
+                tmp = tmp->left;
+            } while (tmp != NULL);
+            child2 = successor->right;
+            parent->left = child2;
+            successor->right = child;
+            setParent(child, successor);
+            Augment::copy(node, successor);
+            Augment::propagate(parent, successor);
+        }
+
+        tmp = node->left;
+        successor->left = tmp;
+        setParent(tmp, successor);
+
+        pc = node->parentColor;
+        tmp = reinterpret_cast<RbNode*>(pc & ~(uintptr_t)3);
+        changeChild(node, successor, tmp, root);
+
+        if (child2 != NULL)
+        {
+            setParentColor(child2, parent, RB_BLACK);
+            rebalance = NULL;
+        }
+        else
+        {
+            rebalance = rbIsBlack(successor) ? parent : NULL;
+        }
+        successor->parentColor = pc;
+        tmp = successor;
+    }
+
+    Augment::propagate(tmp, NULL);
+    return rebalance;
+}
+
+} // namespace rbdetail
+
+// 不维护任何汇总值时使用的空回调
+struct RbNoAugment
+{
+    static void propagate(RbNode*, RbNode*) {}
+    static void copy(RbNode*, RbNode*) {}
+    static void rotate(RbNode*, RbNode*) {}
+    static void init(RbNode*) {}
+};
+
+// 新结点已经由 rbLinkNode 挂到树上，修正颜色恢复平衡
+template <typename Augment = RbNoAugment>
+inline void rbInsertColor(RbNode* node, RbRoot* root)
+{
+    rbdetail::insert<Augment>(node, root);
+}
+
+// leftmost 为 true 表示新结点挂在了最左边 (查找插入位置的过程中一直向左走)
+template <typename Augment = RbNoAugment>
+inline void rbInsertColorCached(RbNode* node, RbRootCached* root, bool leftmost)
+{
+    if (leftmost)
+    {
+        root->leftmost = node;
+    }
+    rbdetail::insert<Augment>(node, &root->root);
+}
+
+template <typename Augment = RbNoAugment>
+inline void rbErase(RbNode* node, RbRoot* root)
+{
+    RbNode* rebalance = rbdetail::erase<Augment>(node, root);
+    if (rebalance != NULL)
+    {
+        rbdetail::eraseColor<Augment>(rebalance, root);
+    }
+}
+
+inline RbNode* rbFirst(const RbRoot* root)
+{
+    RbNode* n = root->node;
+    if (n == NULL)
+    {
+        return NULL;
+    }
+    while (n->left != NULL)
+    {
+        n = n->left;
+    }
+    return n;
+}
+
+inline RbNode* rbLast(const RbRoot* root)
+{
+    RbNode* n = root->node;
+    if (n == NULL)
+    {
+        return NULL;
+    }
+    while (n->right != NULL)
+    {
+        n = n->right;
+    }
+    return n;
+}
+
+inline RbNode* rbNext(const RbNode* node)
+{
+    if (rbEmptyNode(node))
+    {
+        return NULL;
+    }
+    // 有右子树时，后继是右子树的最左结点
+    if (node->right != NULL)
+    {
+        node = node->right;
+        while (node->left != NULL)
+        {
+            node = node->left;
+        }
+        return const_cast<RbNode*>(node);
+    }
+    // 否则向上找到第一个 "从左边上来" 的祖先
+    RbNode* parent;
+    while ((parent = rbParent(node)) != NULL && node == parent->right)
+    {
+        node = parent;
+    }
+    return parent;
+}
+
+inline RbNode* rbPrev(const RbNode* node)
+{
+    if (rbEmptyNode(node))
+    {
+        return NULL;
+    }
+    if (node->left != NULL)
+    {
+        node = node->left;
+        while (node->right != NULL)
+        {
+            node = node->right;
+        }
+        return const_cast<RbNode*>(node);
+    }
+    RbNode* parent;
+    while ((parent = rbParent(node)) != NULL && node == parent->left)
+    {
+        node = parent;
+    }
+    return parent;
+}
+
+template <typename Augment = RbNoAugment>
+inline void rbEraseCached(RbNode* node, RbRootCached* root)
+{
+    if (root->leftmost == node)
+    {
+        root->leftmost = rbNext(node);
+    }
+    rbErase<Augment>(node, &root->root);
+}
+
+inline RbNode* rbFirstCached(const RbRootCached* root) { return root->leftmost; }
+
+// 用 newNode 原地替换树里的 victim，两者的键必须相同，不需要重新平衡
+inline void rbReplaceNode(RbNode* victim, RbNode* newNode, RbRoot* root)
+{
+    RbNode* parent = rbParent(victim);
+    *newNode = *victim;
+    if (victim->left != NULL)
+    {
+        rbdetail::setParent(victim->left, newNode);
+    }
+    if (victim->right != NULL)
+    {
+        rbdetail::setParent(victim->right, newNode);
+    }
+    rbdetail::changeChild(victim, newNode, parent, root);
+}
+
+// 内核的 container_of：由嵌在 T 里的成员 Member 的地址得到 T 的地址
+template <typename T, RbNode T::*Member>
+inline T* rbEntry(const RbNode* node)
+{
+    // 在一个非空的假地址上取成员偏移，避免对空指针做成员访问
+    const uintptr_t base = 0x1000;
+    uintptr_t offset = reinterpret_cast<uintptr_t>(&(reinterpret_cast<T*>(base)->*Member)) - base;
+    return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(node) - offset);
+}
+
+/**
+ * 与内核的 RB_DECLARE_CALLBACKS_MAX 相同：每个结点的 (T::*Max) 记录整棵子树里 Compute(结点) 的最大值，
+ * 例如区间树里子树的最大右端点，用于查询时剪枝
+*/
+template <typename T, RbNode T::*Member, typename V, V T::*Max, V (*Compute)(const T*)>
+struct RbAugmentMax
+{
+    // 重新计算 node 的汇总值，exit 为 true 且值没有变化时返回 true，说明上面的祖先也不用再算了
+    static bool computeMax(T* node, bool exit)
+    {
+        V max = Compute(node);
+        RbNode* rb = &(node->*Member);
+        if (rb->left != NULL)
+        {
+            V child = rbEntry<T, Member>(rb->left)->*Max;
+            if (child > max)
+            {
+                max = child;
+            }
+        }
+        if (rb->right != NULL)
+        {
+            V child = rbEntry<T, Member>(rb->right)->*Max;
+            if (child > max)
+            {
+                max = child;
+            }
+        }
+        if (exit && node->*Max == max)
+        {
+            return true;
+        }
+        node->*Max = max;
+        return false;
+    }
+
+    static void propagate(RbNode* rb, RbNode* stop)
+    {
+        while (rb != stop)
+        {
+            T* node = rbEntry<T, Member>(rb);
+            if (computeMax(node, true))
+            {
+                break;
+            }
+            rb = rbParent(rb);
+        }
+    }
+
+    static void copy(RbNode* oldNode, RbNode* newNode)
+    {
+        rbEntry<T, Member>(newNode)->*Max = rbEntry<T, Member>(oldNode)->*Max;
+    }
+
+    static void rotate(RbNode* oldNode, RbNode* newNode)
+    {
+        T* o = rbEntry<T, Member>(oldNode);
+        rbEntry<T, Member>(newNode)->*Max = o->*Max;
+        computeMax(o, false);
+    }
+
+    // 刚挂上去的叶子结点：汇总值就是它自己的值
+    static void init(RbNode* rb)
+    {
+        T* node = rbEntry<T, Member>(rb);
+        node->*Max = Compute(node);
+    }
+};
+
+/**
+ * 按 Less 排序的侵入式有序容器，相当于内核的 rb_add_cached / rb_find / rb_erase_cached 加上一个元素计数
+ *
+ * T 里嵌一个 RbNode 成员 (Member)，容器不拥有元素，也不分配内存；元素在树里的时候不能修改参与排序的字段，
+ * 需要修改时先 erase，改完再 insert (例如定时器重新设置触发时间)
+ * 键相同的元素按插入顺序排列 (新插入的排在后面)
+*/
+template <typename T, RbNode T::*Member, typename Less, typename Augment = RbNoAugment>
+class RbTree
+{
+public:
+    RbTree() : m_size(0) {}
+
+    RbTree(const RbTree&) = delete;
+    RbTree& operator=(const RbTree&) = delete;
+
+    // 插入后成为最小的元素时返回 true
+    bool insert(T* item)
+    {
+        RbNode** link = &m_root.root.node;
+        RbNode* parent = NULL;
+        bool leftmost = true;
+        Less less;
+        while (*link != NULL)
+        {
+            parent = *link;
+            if (less(*item, *entry(parent)))
+            {
+                link = &parent->left;
+            }
+            else
+            {
+                link = &parent->right;
+                leftmost = false;
+            }
+        }
+        RbNode* node = &(item->*Member);
+        rbLinkNode(node, parent, link);
+        Augment::init(node);
+        if (parent != NULL)
+        {
+            Augment::propagate(parent, NULL);
+        }
+        rbInsertColorCached<Augment>(node, &m_root, leftmost);
+        ++m_size;
+        return leftmost;
+    }
+
+    void erase(T* item)
+    {
+        RbNode* node = &(item->*Member);
+        rbEraseCached<Augment>(node, &m_root);
+        rbClearNode(node);
+        --m_size;
+    }
+
+    // 查找 cmp(key, 元素) 返回 0 的元素，cmp 的语义与 memcmp 相同；有多个时返回其中任意一个
+    template <typename K, typename Cmp>
+    T* find(const K& key, Cmp cmp) const
+    {
+        RbNode* node = m_root.root.node;
+        while (node != NULL)
+        {
+            int c = cmp(key, *entry(node));
+            if (c < 0)
+            {
+                node = node->left;
+            }
+            else if (c > 0)
+            {
+                node = node->right;
+            }
+            else
+            {
+                return entry(node);
+            }
+        }
+        return NULL;
+    }
+
+    // 最小的元素，O(1)
+    T* first() const { return m_root.leftmost != NULL ? entry(m_root.leftmost) : NULL; }
+    T* last() const
+    {
+        RbNode* node = rbLast(&m_root.root);
+        return node != NULL ? entry(node) : NULL;
+    }
+    T* next(const T* item) const
+    {
+        RbNode* node = rbNext(&(item->*Member));
+        return node != NULL ? entry(node) : NULL;
+    }
+    T* prev(const T* item) const
+    {
+        RbNode* node = rbPrev(&(item->*Member));
+        return node != NULL ? entry(node) : NULL;
+    }
+
+    // 元素是否在某棵树里，需要元素的结点初始化时调用过 rbClearNode
+    static bool linked(const T* item) { return !rbEmptyNode(&(item->*Member)); }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const RbRootCached& root() const { return m_root; }
+
+    // 只是忘掉所有元素，元素本身由使用者释放
+    void clear()
+    {
+        m_root = RbRootCached();
+        m_size = 0;
+    }
+
+private:
+    static T* entry(const RbNode* node) { return rbEntry<T, Member>(node); }
+
+    RbRootCached m_root;
+    size_t m_size;
+};
+
+#endif
@@ -0,0 +1,370 @@
+#include <iostream>
+#include <map>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include "latency.h"
+#include "rbtree.h"
+
+// 侵入式红黑树 (rbtree.h) 与 std::map 的对比，三种负载都是客户端里实际出现的用法：
+// 1. random：随机键插入 N 个再按随机顺序全部删除
+// 2. timers：定时器队列，N 个定时器，反复取出最早到期的一个、推迟一段随机时间后重新排队 (EventLoop 的 processTimeEvents)
+// 3. acks：待确认消息，序号递增地加入，确认时大体按顺序、在一个小窗口内乱序 (PendingAcks)
+// std::map 有两种写法：erase + emplace，以及 C++17 的 extract + insert (复用结点，不分配)
+// 分配次数通过替换全局 operator new 统计
+
+static uint64_t g_allocs = 0;
+
+void* operator new(size_t size) {
+    ++g_allocs;
+    void* p = malloc(size ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+struct Options {
+    int items = 100000;    // 树里的元素个数
+    int ops = 2000000;     // timers / acks 负载的操作次数
+    int window = 32;       // acks 负载的乱序窗口
+    int rounds = 3;        // 每种模式重复的次数，取最快的一次
+};
+
+// 键相同时按 id 区分，与 EventLoop 的 (触发时间, ID) 一致
+struct Item {
+    RbNode node;
+    uint64_t key;
+    uint64_t id;
+};
+
+struct ItemLess {
+    bool operator()(const Item& a, const Item& b) const {
+        return a.key < b.key || (a.key == b.key && a.id < b.id);
+    }
+};
+
+typedef RbTree<Item, &Item::node, ItemLess> Tree;
+typedef std::map<std::pair<uint64_t, uint64_t>, Item*> Map;
+
+struct RunResult {
+    double seconds = 0.0;
+    uint64_t allocs = 0;
+    uint64_t checksum = 0;  // 各模式应当得到相同的值
+};
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--items N] [--ops N] [--window N] [--rounds N]" << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        int value = atoi(argv[++i]);
+        if (strcmp(arg, "--items") == 0) {
+            opts.items = value;
+        } else if (strcmp(arg, "--ops") == 0) {
+            opts.ops = value;
+        } else if (strcmp(arg, "--window") == 0) {
+            opts.window = value;
+        } else if (strcmp(arg, "--rounds") == 0) {
+            opts.rounds = value;
+        } else {
+            return false;
+        }
+    }
+    return opts.items > 0 && opts.ops > 0 && opts.window > 0 && opts.rounds > 0;
+}
+
+// ---- random ----
+
+static RunResult randomTree(const std::vector<uint64_t>& keys, const std::vector<int>& eraseOrder) {
+    RunResult r;
+    std::vector<Item> items(keys.size());
+    uint64_t allocs = g_allocs;
+    uint64_t start = monotonicNs();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        items[i].key = keys[i];
+        items[i].id = i;
+    }
+    Tree tree;
+    for (auto& item : items) {
+        tree.insert(&item);
+    }
+    r.checksum = tree.first()->key;
+    for (int i : eraseOrder) {
+        tree.erase(&items[i]);
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    r.allocs = g_allocs - allocs;
+    return r;
+}
+
+static RunResult randomMap(const std::vector<uint64_t>& keys, const std::vector<int>& eraseOrder) {
+    RunResult r;
+    std::vector<Item> items(keys.size());
+    uint64_t allocs = g_allocs;
+    uint64_t start = monotonicNs();
+    Map map;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        items[i].key = keys[i];
+        items[i].id = i;
+        map.emplace(std::make_pair(keys[i], (uint64_t)i), &items[i]);
+    }
+    r.checksum = map.begin()->first.first;
+    for (int i : eraseOrder) {
+        map.erase(std::make_pair(items[i].key, items[i].id));
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    r.allocs = g_allocs - allocs;
+    return r;
+}
+
+// ---- timers ----
+
+// 推迟的时间由 (id, 当前时间) 决定，三种写法得到的序列完全相同
+static uint64_t delayFor(uint64_t id, uint64_t now) {
+    uint64_t x = (id * 0x9E3779B97F4A7C15ULL) ^ now;
+    x ^= x >> 29;
+    return 1 + x % 1000;
+}
+
+static RunResult timersTree(const Options& opts) {
+    RunResult r;
+    std::vector<Item> items((size_t)opts.items);
+    Tree tree;
+    for (size_t i = 0; i < items.size(); ++i) {
+        items[i].key = delayFor(i, 0);
+        items[i].id = i;
+        tree.insert(&items[i]);
+    }
+    uint64_t allocs = g_allocs;
+    uint64_t start = monotonicNs();
+    for (int op = 0; op < opts.ops; ++op) {
+        Item* due = tree.first();
+        tree.erase(due);
+        r.checksum += due->id;
+        due->key += delayFor(due->id, due->key);
+        tree.insert(due);
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    r.allocs = g_allocs - allocs;
+    return r;
+}
+
+static RunResult timersMap(const Options& opts, bool extract) {
+    RunResult r;
+    std::vector<Item> items((size_t)opts.items);
+    Map map;
+    for (size_t i = 0; i < items.size(); ++i) {
+        items[i].key = delayFor(i, 0);
+        items[i].id = i;
+        map.emplace(std::make_pair(items[i].key, (uint64_t)i), &items[i]);
+    }
+    uint64_t allocs = g_allocs;
+    uint64_t start = monotonicNs();
+    for (int op = 0; op < opts.ops; ++op) {
+        Item* due = map.begin()->second;
+        r.checksum += due->id;
+        if (extract) {
+            auto node = map.extract(map.begin());
+            due->key += delayFor(due->id, due->key);
+            node.key() = std::make_pair(due->key, due->id);
+            map.insert(std::move(node));
+        } else {
+            map.erase(map.begin());
+            due->key += delayFor(due->id, due->key);
+            map.emplace(std::make_pair(due->key, due->id), due);
+        }
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    r.allocs = g_allocs - allocs;
+    return r;
+}
+
+// ---- acks ----
+
+// 第 op 次确认的是哪个序号：序号在大小为 window 的块内打乱，块与块之间按顺序
+static std::vector<uint64_t> ackOrder(const Options& opts) {
+    std::vector<uint64_t> order((size_t)opts.ops);
+    std::mt19937_64 rng(7);
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    for (size_t i = 0; i < order.size(); i += (size_t)opts.window) {
+        std::shuffle(order.begin() + i, order.begin() + std::min(order.size(), i + (size_t)opts.window), rng);
+    }
+    return order;
+}
+
+// 一直保持 items 条在途：发出第 op + items 条的同时确认 order[op]
+static RunResult acksTree(const Options& opts, const std::vector<uint64_t>& order) {
+    RunResult r;
+    std::vector<Item> items((size_t)opts.ops + (size_t)opts.items);
+    Tree tree;
+    auto cmp = [](uint64_t seq, const Item& item) { return seq < item.key ? -1 : (seq > item.key ? 1 : 0); };
+    uint64_t allocs = g_allocs;
+    uint64_t start = monotonicNs();
+    for (int i = 0; i < opts.items; ++i) {
+        items[i].key = items[i].id = (uint64_t)i;
+        tree.insert(&items[i]);
+    }
+    for (int op = 0; op < opts.ops; ++op) {
+        Item* next = &items[(size_t)op + (size_t)opts.items];
+        next->key = next->id = (uint64_t)op + (uint64_t)opts.items;
+        tree.insert(next);
+        Item* acked = tree.find(order[op], cmp);
+        if (acked != NULL) {
+            tree.erase(acked);
+        }
+        r.checksum += tree.first()->key;
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    r.allocs = g_allocs - allocs;
+    return r;
+}
+
+static RunResult acksMap(const Options& opts, const std::vector<uint64_t>& order) {
+    RunResult r;
+    std::vector<Item> items((size_t)opts.ops + (size_t)opts.items);
+    std::map<uint64_t, Item*> map;
+    uint64_t allocs = g_allocs;
+    uint64_t start = monotonicNs();
+    for (int i = 0; i < opts.items; ++i) {
+        items[i].key = items[i].id = (uint64_t)i;
+        map.emplace(items[i].key, &items[i]);
+    }
+    for (int op = 0; op < opts.ops; ++op) {
+        Item* next = &items[(size_t)op + (size_t)opts.items];
+        next->key = next->id = (uint64_t)op + (uint64_t)opts.items;
+        map.emplace(next->key, next);
+        map.erase(order[op]);
+        r.checksum += map.begin()->first;
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    r.allocs = g_allocs - allocs;
+    return r;
+}
+
+// ---- min lookup ----
+
+// 树里有 items 个元素时反复取最小值，tree 是缓存的最左结点，rbFirst 是不带缓存、从根向左走到底
+static RunResult minLookup(const Options& opts, int mode) {
+    RunResult r;
+    std::vector<Item> items((size_t)opts.items);
+    Tree tree;
+    Map map;
+    for (size_t i = 0; i < items.size(); ++i) {
+        items[i].key = delayFor(i, 1);
+        items[i].id = i;
+        tree.insert(&items[i]);
+        map.emplace(std::make_pair(items[i].key, (uint64_t)i), &items[i]);
+    }
+    uint64_t start = monotonicNs();
+    for (int op = 0; op < opts.ops; ++op) {
+        const Item* item;
+        if (mode == 0) {
+            item = tree.first();
+        } else if (mode == 1) {
+            item = rbEntry<Item, &Item::node>(rbFirst(&tree.root().root));
+        } else {
+            item = map.begin()->second;
+        }
+        r.checksum += item->key;
+        // 防止编译器把循环不变的查找提到循环外面
+        asm volatile("" : : "r"(item) : "memory");
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    return r;
+}
+
+template <typename F>
+static RunResult best(int rounds, F run) {
+    RunResult result;
+    for (int round = 0; round < rounds; ++round) {
+        RunResult r = run();
+        if (round == 0 || r.seconds < result.seconds) {
+            result = r;
+        }
+    }
+    return result;
+}
+
+static void report(const char* name, const RunResult& r, double count) {
+    printf("  %-22s ns/op=%.1f allocs/op=%.3f checksum=%llu\n", name, r.seconds * 1e9 / count, r.allocs / count,
+           (unsigned long long)r.checksum);
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    bool ok = true;
+
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> keys((size_t)opts.items);
+    for (auto& key : keys) {
+        key = rng() % ((uint64_t)opts.items * 4);
+    }
+    std::vector<int> eraseOrder((size_t)opts.items);
+    for (int i = 0; i < opts.items; ++i) {
+        eraseOrder[i] = i;
+    }
+    std::shuffle(eraseOrder.begin(), eraseOrder.end(), rng);
+
+    std::cout << "random: insert " << opts.items << " random keys, then erase all (ns per insert+erase)" << std::endl;
+    RunResult rt = best(opts.rounds, [&]() { return randomTree(keys, eraseOrder); });
+    RunResult rm = best(opts.rounds, [&]() { return randomMap(keys, eraseOrder); });
+    report("rbtree", rt, opts.items);
+    report("std::map", rm, opts.items);
+    ok = ok && rt.checksum == rm.checksum;
+
+    std::cout << "timers: " << opts.items << " timers, " << opts.ops << " pop-min + reschedule" << std::endl;
+    RunResult tt = best(opts.rounds, [&]() { return timersTree(opts); });
+    RunResult tm = best(opts.rounds, [&]() { return timersMap(opts, false); });
+    RunResult tx = best(opts.rounds, [&]() { return timersMap(opts, true); });
+    report("rbtree", tt, opts.ops);
+    report("std::map erase+emplace", tm, opts.ops);
+    report("std::map extract", tx, opts.ops);
+    ok = ok && tt.checksum == tm.checksum && tt.checksum == tx.checksum;
+
+    std::cout << "acks: " << opts.items << " in flight, " << opts.ops << " send + confirm (reorder window "
+              << opts.window << "), oldest read every op" << std::endl;
+    std::vector<uint64_t> order = ackOrder(opts);
+    RunResult at = best(opts.rounds, [&]() { return acksTree(opts, order); });
+    RunResult am = best(opts.rounds, [&]() { return acksMap(opts, order); });
+    report("rbtree", at, opts.ops);
+    report("std::map", am, opts.ops);
+    ok = ok && at.checksum == am.checksum;
+
+    std::cout << "min: " << opts.ops << " lookups of the smallest of " << opts.items << std::endl;
+    RunResult mc = best(opts.rounds, [&]() { return minLookup(opts, 0); });
+    RunResult mw = best(opts.rounds, [&]() { return minLookup(opts, 1); });
+    RunResult mm = best(opts.rounds, [&]() { return minLookup(opts, 2); });
+    report("rbtree cached", mc, opts.ops);
+    report("rbtree walk (rbFirst)", mw, opts.ops);
+    report("std::map begin()", mm, opts.ops);
+    ok = ok && mc.checksum == mw.checksum && mc.checksum == mm.checksum;
+
+    if (!ok) {
+        std::cerr << "Mismatch between rbtree and std::map results" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,957 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "latency.h"
+#include "crc64.h"
+#include "lzf.h"
+#include "rio.h"
+#include "rdb_reader.h"
+
+// RDB 读取器 (rdb_reader.h) 的基准和自检：
+// 先生成一个合成的 dump (RDB 11)，覆盖读取器支持的所有编码：三种整数字符串和 LZF、旧的链表/集合/哈希/有序集合 (文本和二进制分数)、
+// zipmap、ziplist、intset、listpack (包括元素个数饱和到 65535 的)、quicklist 1 和 2 (带 PLAIN 节点)、stream v3、模块值、
+// 函数库和模块辅助数据，以及秒/毫秒过期时间、LRU / LFU
+// 生成时按逻辑内容 (key 和展开后的元素文本) 算一个与顺序无关的摘要，每种读法读完都要得到同样的摘要、key 数、元素数和过期 key 数
+//
+// 对比：
+// 1. read() 整个文件 (页缓存的拷贝速度) 和 mmap 之后算 CRC-64，是"读盘速度"的上限
+// 2. 只统计 (onKey 返回 false)：每个 key 只读长度和容器头部
+// 3. 完整解码每个元素，单线程和 --threads 个线程 (按字节数分段，以及按数据库分段)
+
+struct Options {
+    int keys = 300000;        // key 的数量
+    int dbs = 4;              // 分布在多少个数据库里
+    int threads = 4;          // 并行解析的线程数
+    int rounds = 3;           // 每种方式重复的次数，取最快的一次
+    size_t chunkMb = 8;       // 按字节数分段时每段的大小
+    const char* file = NULL;  // 默认写到 /tmp 下的临时文件，结束时删除
+};
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--keys N] [--dbs N] [--threads N] [--rounds N] [--chunk-mb N] [--file PATH]"
+              << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--keys") == 0) {
+            opts.keys = atoi(value);
+        } else if (strcmp(arg, "--dbs") == 0) {
+            opts.dbs = atoi(value);
+        } else if (strcmp(arg, "--threads") == 0) {
+            opts.threads = atoi(value);
+        } else if (strcmp(arg, "--rounds") == 0) {
+            opts.rounds = atoi(value);
+        } else if (strcmp(arg, "--chunk-mb") == 0) {
+            opts.chunkMb = (size_t)atol(value);
+        } else if (strcmp(arg, "--file") == 0) {
+            opts.file = value;
+        } else {
+            return false;
+        }
+    }
+    return opts.keys > 0 && opts.dbs > 0 && opts.threads > 0 && opts.rounds > 0 && opts.chunkMb > 0;
+}
+
+// ---- 摘要：每个 key 一个 FNV-1a，key 之间相加，与读取顺序和线程数无关 ----
+
+struct Digest {
+    uint64_t keys = 0;
+    uint64_t elements = 0;
+    uint64_t expiring = 0;
+    uint64_t sum = 0;
+
+    void add(const Digest& other) {
+        keys += other.keys;
+        elements += other.elements;
+        expiring += other.expiring;
+        sum += other.sum;
+    }
+
+    bool operator==(const Digest& other) const {
+        return keys == other.keys && elements == other.elements && expiring == other.expiring && sum == other.sum;
+    }
+};
+
+static uint64_t fnv(uint64_t h, std::string_view s, uint8_t sep) {
+    for (unsigned char c : s) {
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    return (h ^ sep) * 1099511628211ULL;
+}
+
+// 每个 key 的摘要：key，然后依次是每个元素的 a 和 b
+struct KeyDigest {
+    uint64_t h = 14695981039346656037ULL;
+
+    void begin(std::string_view key) {
+        h = fnv(14695981039346656037ULL, key, 0xfd);
+    }
+
+    void element(std::string_view a, std::string_view b) {
+        h = fnv(fnv(h, a, 0xfe), b, 0xff);
+    }
+};
+
+// ---- RDB 的写法，与 rdb.c 相同 ----
+
+static void saveLen(Rio& rio, uint64_t len) {
+    uint8_t buf[9];
+    if (len < (1 << 6)) {
+        buf[0] = (uint8_t)len;
+        rio.write(buf, 1);
+    } else if (len < (1 << 14)) {
+        buf[0] = (uint8_t)(0x40 | (len >> 8));
+        buf[1] = (uint8_t)len;
+        rio.write(buf, 2);
+    } else if (len <= UINT32_MAX) {
+        buf[0] = 0x80;
+        for (int i = 0; i < 4; ++i) {
+            buf[1 + i] = (uint8_t)(len >> (24 - 8 * i));
+        }
+        rio.write(buf, 5);
+    } else {
+        buf[0] = 0x81;
+        for (int i = 0; i < 8; ++i) {
+            buf[1 + i] = (uint8_t)(len >> (56 - 8 * i));
+        }
+        rio.write(buf, 9);
+    }
+}
+
+// 字符串是规范的十进制整数 (没有前导 0 和 +，转回去完全一样) 时返回 true
+static bool toInt(std::string_view s, int64_t& v) {
+    if (s.empty() || s.size() > 20) {
+        return false;
+    }
+    char buf[32];
+    memcpy(buf, s.data(), s.size());
+    buf[s.size()] = '\0';
+    char* end;
+    errno = 0;
+    long long x = strtoll(buf, &end, 10);
+    if (errno != 0 || *end != '\0' || std::to_string(x) != s) {
+        return false;
+    }
+    v = x;
+    return true;
+}
+
+// rdbSaveRawString：能放进 int32 的整数用整数编码，长于 20 字节且压缩后至少省 4 个字节的用 LZF
+static void saveString(Rio& rio, std::string_view s) {
+    int64_t v;
+    if (s.size() <= 11 && toInt(s, v) && v >= INT32_MIN && v <= INT32_MAX) {
+        uint8_t buf[5];
+        if (v >= INT8_MIN && v <= INT8_MAX) {
+            buf[0] = 0xc0;
+            buf[1] = (uint8_t)v;
+            rio.write(buf, 2);
+        } else if (v >= INT16_MIN && v <= INT16_MAX) {
+            int16_t x = (int16_t)v;
+            buf[0] = 0xc1;
+            memcpy(buf + 1, &x, 2);
+            rio.write(buf, 3);
+        } else {
+            int32_t x = (int32_t)v;
+            buf[0] = 0xc2;
+            memcpy(buf + 1, &x, 4);
+            rio.write(buf, 5);
+        }
+        return;
+    }
+    if (s.size() > 20) {
+        std::string out(s.size() - 4, '\0');
+        size_t clen = Lzf::compress(s.data(), s.size(), &out[0], out.size());
+        if (clen > 0) {
+            uint8_t enc = 0xc3;
+            rio.write(&enc, 1);
+            saveLen(rio, clen);
+            saveLen(rio, s.size());
+            rio.write(out.data(), clen);
+            return;
+        }
+    }
+    saveLen(rio, s.size());
+    rio.write(s);
+}
+
+static void saveType(Rio& rio, uint8_t type) {
+    rio.write(&type, 1);
+}
+
+static void putLe(std::string& out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out += (char)(uint8_t)(v >> (8 * i));
+    }
+}
+
+// listpack：元素能按整数编码的就用最短的整数编码，否则按长度选字符串编码，每个元素后面是 backlen
+static std::string makeListpack(const std::vector<std::string>& elements) {
+    std::string lp(6, '\0');
+    for (const auto& e : elements) {
+        size_t start = lp.size();
+        int64_t v;
+        if (toInt(e, v)) {
+            if (v >= 0 && v <= 127) {
+                lp += (char)v;
+            } else if (v >= -4096 && v <= 4095) {
+                uint64_t u = (uint64_t)v & 0x1fff;
+                lp += (char)(0xc0 | (u >> 8));
+                lp += (char)(uint8_t)u;
+            } else if (v >= INT16_MIN && v <= INT16_MAX) {
+                lp += (char)0xf1;
+                putLe(lp, (uint64_t)v, 2);
+            } else if (v >= -(1 << 23) && v < (1 << 23)) {
+                lp += (char)0xf2;
+                putLe(lp, (uint64_t)v, 3);
+            } else if (v >= INT32_MIN && v <= INT32_MAX) {
+                lp += (char)0xf3;
+                putLe(lp, (uint64_t)v, 4);
+            } else {
+                lp += (char)0xf4;
+                putLe(lp, (uint64_t)v, 8);
+            }
+        } else if (e.size() < 64) {
+            lp += (char)(0x80 | e.size());
+            lp += e;
+        } else if (e.size() < 4096) {
+            lp += (char)(0xe0 | (e.size() >> 8));
+            lp += (char)(uint8_t)e.size();
+            lp += e;
+        } else {
+            lp += (char)0xf0;
+            putLe(lp, e.size(), 4);
+            lp += e;
+        }
+        size_t l = lp.size() - start;
+        int n = l <= 127 ? 1 : l < 16383 ? 2 : l < 2097151 ? 3 : l < 268435455 ? 4 : 5;
+        for (int i = 0; i < n; ++i) {
+            uint8_t b = (uint8_t)((l >> (7 * (n - 1 - i))) & 127);
+            lp += (char)(i > 0 ? b | 128 : b);
+        }
+    }
+    lp += (char)0xff;
+    uint32_t total = (uint32_t)lp.size();
+    uint16_t count = (uint16_t)std::min<size_t>(elements.size(), 65535);
+    memcpy(&lp[0], &total, 4);
+    memcpy(&lp[4], &count, 2);
+    return lp;
+}
+
+// ziplist：prevlen + 编码，整数有 0~12 的立即数和 8/16/24/32/64 位，字符串长度是大端
+static std::string makeZiplist(const std::vector<std::string>& elements) {
+    std::string zl(10, '\0');
+    size_t prevLen = 0;
+    size_t tail = 10;
+    for (const auto& e : elements) {
+        size_t start = zl.size();
+        tail = start;
+        if (prevLen < 254) {
+            zl += (char)prevLen;
+        } else {
+            zl += (char)0xfe;
+            putLe(zl, prevLen, 4);
+        }
+        int64_t v;
+        if (toInt(e, v)) {
+            if (v >= 0 && v <= 12) {
+                zl += (char)(0xf1 + v);
+            } else if (v >= INT8_MIN && v <= INT8_MAX) {
+                zl += (char)0xfe;
+                putLe(zl, (uint64_t)v, 1);
+            } else if (v >= INT16_MIN && v <= INT16_MAX) {
+                zl += (char)0xc0;
+                putLe(zl, (uint64_t)v, 2);
+            } else if (v >= -(1 << 23) && v < (1 << 23)) {
+                zl += (char)0xf0;
+                putLe(zl, (uint64_t)v, 3);
+            } else if (v >= INT32_MIN && v <= INT32_MAX) {
+                zl += (char)0xd0;
+                putLe(zl, (uint64_t)v, 4);
+            } else {
+                zl += (char)0xe0;
+                putLe(zl, (uint64_t)v, 8);
+            }
+        } else if (e.size() < 64) {
+            zl += (char)e.size();
+            zl += e;
+        } else if (e.size() < 16384) {
+            zl += (char)(0x40 | (e.size() >> 8));
+            zl += (char)(uint8_t)e.size();
+            zl += e;
+        } else {
+            zl += (char)0x80;
+            for (int i = 0; i < 4; ++i) {
+                zl += (char)(uint8_t)(e.size() >> (24 - 8 * i));
+            }
+            zl += e;
+        }
+        prevLen = zl.size() - start;
+    }
+    zl += (char)0xff;
+    uint32_t total = (uint32_t)zl.size();
+    uint32_t tailOffset = (uint32_t)tail;
+    uint16_t count = (uint16_t)std::min<size_t>(elements.size(), 65535);
+    memcpy(&zl[0], &total, 4);
+    memcpy(&zl[4], &tailOffset, 4);
+    memcpy(&zl[8], &count, 2);
+    return zl;
+}
+
+// intset：按从小到大排好的整数，宽度取能放下所有元素的最小值
+static std::string makeIntset(std::vector<int64_t> values) {
+    std::sort(values.begin(), values.end());
+    uint32_t enc = 2;
+    for (int64_t v : values) {
+        if (v < INT32_MIN || v > INT32_MAX) {
+            enc = 8;
+        } else if ((v < INT16_MIN || v > INT16_MAX) && enc < 4) {
+            enc = 4;
+        }
+    }
+    std::string is;
+    putLe(is, enc, 4);
+    putLe(is, values.size(), 4);
+    for (int64_t v : values) {
+        putLe(is, (uint64_t)v, (int)enc);
+    }
+    return is;
+}
+
+static std::string makeZipmap(const std::vector<std::string>& elements) {
+    std::string zm;
+    zm += (char)std::min<size_t>(elements.size() / 2, 254);
+    auto putLen = [&zm](size_t len) {
+        if (len < 254) {
+            zm += (char)len;
+        } else {
+            zm += (char)254;
+            putLe(zm, len, 4);
+        }
+    };
+    for (size_t i = 0; i + 1 < elements.size(); i += 2) {
+        putLen(elements[i].size());
+        zm += elements[i];
+        putLen(elements[i + 1].size());
+        zm += (char)0; // free
+        zm += elements[i + 1];
+    }
+    zm += (char)0xff;
+    return zm;
+}
+
+// ---- 生成数据 ----
+
+static const char* const WORDS[] = {
+    "user", "session", "cart", "profile", "room", "message", "token", "avatar", "status", "online",
+    "chat", "history", "unread", "member", "owner", "invite", "muted", "banned", "theme", "locale",
+};
+
+class Generator {
+public:
+    Generator(Rio& rio, Digest& expect) : m_rio(rio), m_expect(expect), m_rng(20250416) {}
+
+    void header() {
+        m_rio.write("REDIS0011", 9);
+        aux("redis-ver", "7.2.7");
+        aux("redis-bits", "64");
+        aux("ctime", "1744766896");
+        aux("used-mem", "7714208");
+        aux("aof-base", "0");
+        // 模块辅助数据：module id、when 的类型标记和值，然后是模块自己的值
+        saveType(m_rio, 247);
+        saveLen(m_rio, 0x1234567890ULL);
+        saveLen(m_rio, 2);
+        saveLen(m_rio, 2);
+        moduleValue();
+        saveType(m_rio, 245);
+        saveString(m_rio, "#!lua name=chatlib\nredis.register_function('touch', function(keys) return 1 end)");
+    }
+
+    void database(int db, int keys) {
+        saveType(m_rio, 254);
+        saveLen(m_rio, (uint64_t)db);
+        saveType(m_rio, 251);
+        saveLen(m_rio, (uint64_t)keys);
+        saveLen(m_rio, (uint64_t)keys / 10);
+        for (int i = 0; i < keys; ++i) {
+            key(db, i);
+        }
+    }
+
+    void finish() {
+        saveType(m_rio, 255);
+        uint64_t crc = m_rio.checksum();
+        m_rio.write(&crc, sizeof(crc));
+        m_rio.flush();
+    }
+
+private:
+    void aux(const char* key, const char* value) {
+        saveType(m_rio, 250);
+        saveString(m_rio, key);
+        saveString(m_rio, value);
+    }
+
+    void moduleValue() {
+        saveLen(m_rio, 2); // UINT
+        saveLen(m_rio, 42);
+        saveLen(m_rio, 5); // STRING
+        saveString(m_rio, "module payload");
+        saveLen(m_rio, 4); // DOUBLE
+        double d = 3.25;
+        m_rio.write(&d, 8);
+        saveLen(m_rio, 0); // EOF
+    }
+
+    size_t pick(size_t n) { return (size_t)(m_rng() % n); }
+
+    // 聊天应用里常见的值：单词拼起来的文本 (长的能被 LZF 压缩)、各种宽度的整数
+    std::string value(size_t maxWords) {
+        switch (pick(8)) {
+            case 0:
+                return std::to_string((int64_t)pick(100));
+            case 1:
+                return std::to_string((int64_t)pick(70000) - 35000);
+            case 2:
+                return std::to_string((int64_t)pick(1u << 30) * (pick(2) ? 1 : -1));
+            case 3:
+                return std::to_string((int64_t)m_rng() << 20);
+            default: {
+                std::string s;
+                size_t n = 1 + pick(maxWords);
+                for (size_t i = 0; i < n; ++i) {
+                    s += WORDS[pick(sizeof(WORDS) / sizeof(WORDS[0]))];
+                    s += i + 1 < n ? ":" : "";
+                }
+                return s;
+            }
+        }
+    }
+
+    std::vector<std::string> values(size_t n, size_t maxWords) {
+        std::vector<std::string> out;
+        out.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            out.push_back(value(maxWords));
+        }
+        return out;
+    }
+
+    // 互不相同的成员 (集合、哈希字段、有序集合成员)
+    std::vector<std::string> members(size_t n, bool numeric) {
+        std::vector<std::string> out;
+        out.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            out.push_back(numeric ? std::to_string((int64_t)i * 37 - 500) : "m" + std::to_string(i) + ":" + value(2));
+        }
+        return out;
+    }
+
+    void key(int db, int i) {
+        // 过期时间、LRU / LFU 写在 key 前面
+        size_t r = pick(100);
+        if (r < 8) {
+            saveType(m_rio, 252);
+            int64_t ms = 1900000000000LL + (int64_t)pick(1000000);
+            m_rio.write(&ms, 8);
+            ++m_expect.expiring;
+        } else if (r < 10) {
+            saveType(m_rio, 253);
+            int32_t s = 1900000000 + (int32_t)pick(1000);
+            m_rio.write(&s, 4);
+            ++m_expect.expiring;
+        }
+        if (pick(4) == 0) {
+            saveType(m_rio, 248);
+            saveLen(m_rio, pick(100000));
+        } else if (pick(4) == 0) {
+            saveType(m_rio, 249);
+            uint8_t freq = (uint8_t)pick(256);
+            m_rio.write(&freq, 1);
+        }
+
+        std::string name = "db" + std::to_string(db) + ":" + WORDS[i % 20] + ":" + std::to_string(i);
+        KeyDigest d;
+        d.begin(name);
+        uint64_t elements = 0;
+        auto each = [&](const std::vector<std::string>& list) {
+            for (const auto& e : list) {
+                d.element(e, std::string_view());
+            }
+            elements += list.size();
+        };
+        auto pairs = [&](const std::vector<std::string>& list) {
+            for (size_t k = 0; k + 1 < list.size(); k += 2) {
+                d.element(list[k], list[k + 1]);
+            }
+            elements += list.size() / 2;
+        };
+
+        // 大部分是字符串和小容器，与真实的 dump 相近；偶尔出现各种旧编码和大 key
+        size_t kind = pick(1000);
+        if (kind < 600) {
+            saveType(m_rio, RDB_TYPE_STRING);
+            saveString(m_rio, name);
+            std::string v = pick(10) == 0 ? value(400) : value(12);
+            saveString(m_rio, v);
+            each({v});
+        } else if (kind < 680) {
+            // 哈希，listpack
+            std::vector<std::string> fv;
+            for (const auto& f : members(1 + pick(20), false)) {
+                fv.push_back(f);
+                fv.push_back(value(6));
+            }
+            saveType(m_rio, RDB_TYPE_HASH_LISTPACK);
+            saveString(m_rio, name);
+            saveString(m_rio, makeListpack(fv));
+            pairs(fv);
+        } else if (kind < 730) {
+            // 列表，quicklist 2：若干 listpack 节点，偶尔一个 PLAIN 的大元素
+            saveType(m_rio, RDB_TYPE_LIST_QUICKLIST_2);
+            saveString(m_rio, name);
+            size_t nodes = 1 + pick(4);
+            saveLen(m_rio, nodes);
+            for (size_t n = 0; n < nodes; ++n) {
+                if (pick(8) == 0) {
+                    std::string big = value(3) + std::string(9000 + pick(1000), 'x');
+                    saveLen(m_rio, 1);
+                    saveString(m_rio, big);
+                    each({big});
+                } else {
+                    std::vector<std::string> list = values(1 + pick(128), 5);
+                    saveLen(m_rio, 2);
+                    saveString(m_rio, makeListpack(list));
+                    each(list);
+                }
+            }
+        } else if (kind < 770) {
+            std::vector<std::string> set = members(1 + pick(64), false);
+            saveType(m_rio, RDB_TYPE_SET_LISTPACK);
+            saveString(m_rio, name);
+            saveString(m_rio, makeListpack(set));
+            each(set);
+        } else if (kind < 800) {
+            std::vector<int64_t> ints;
+            std::vector<std::string> text;
+            size_t n = 1 + pick(200);
+            int64_t scale = pick(3) == 0 ? (1LL << 36) : pick(2) == 0 ? 100000 : 7;
+            for (size_t k = 0; k < n; ++k) {
+                ints.push_back(((int64_t)k - (int64_t)n / 2) * scale);
+            }
+            std::vector<int64_t> sorted = ints;
+            std::sort(sorted.begin(), sorted.end());
+            for (int64_t v : sorted) {
+                text.push_back(std::to_string(v));
+            }
+            saveType(m_rio, RDB_TYPE_SET_INTSET);
+            saveString(m_rio, name);
+            saveString(m_rio, makeIntset(ints));
+            each(text);
+        } else if (kind < 840) {
+            // 有序集合，listpack：成员和整数分数
+            std::vector<std::string> ms;
+            for (const auto& m : members(1 + pick(64), false)) {
+                ms.push_back(m);
+                ms.push_back(std::to_string((int64_t)pick(1000000)));
+            }
+            saveType(m_rio, RDB_TYPE_ZSET_LISTPACK);
+            saveString(m_rio, name);
+            saveString(m_rio, makeListpack(ms));
+            pairs(ms);
+        } else if (kind < 860) {
+            // 有序集合，跳表：二进制 double 分数
+            size_t n = 1 + pick(300);
+            saveType(m_rio, RDB_TYPE_ZSET_2);
+            saveString(m_rio, name);
+            saveLen(m_rio, n);
+            std::vector<std::string> ms;
+            for (const auto& m : members(n, false)) {
+                double score = (double)pick(1 << 20) / 7.0;
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%.17g", score);
+                saveString(m_rio, m);
+                m_rio.write(&score, 8);
+                ms.push_back(m);
+                ms.push_back(buf);
+            }
+            pairs(ms);
+        } else if (kind < 880) {
+            // 哈希，哈希表
+            size_t n = 1 + pick(600);
+            saveType(m_rio, RDB_TYPE_HASH);
+            saveString(m_rio, name);
+            saveLen(m_rio, n);
+            std::vector<std::string> fv;
+            for (const auto& f : members(n, false)) {
+                fv.push_back(f);
+                fv.push_back(value(8));
+                saveString(m_rio, fv[fv.size() - 2]);
+                saveString(m_rio, fv.back());
+            }
+            pairs(fv);
+        } else if (kind < 895) {
+            // 集合和列表，RDB 里逐个元素保存的旧格式
+            std::vector<std::string> list = pick(2) == 0 ? members(1 + pick(500), pick(2) == 0) : values(1 + pick(50), 4);
+            saveType(m_rio, list[0][0] == 'm' || isdigit((unsigned char)list[0][0]) || list[0][0] == '-'
+                                ? RDB_TYPE_SET
+                                : RDB_TYPE_LIST);
+            saveString(m_rio, name);
+            saveLen(m_rio, list.size());
+            for (const auto& e : list) {
+                saveString(m_rio, e);
+            }
+            each(list);
+        } else if (kind < 905) {
+            // 有序集合，旧的文本分数
+            size_t n = 1 + pick(40);
+            saveType(m_rio, RDB_TYPE_ZSET);
+            saveString(m_rio, name);
+            saveLen(m_rio, n);
+            std::vector<std::string> ms;
+            for (const auto& m : members(n, false)) {
+                std::string score = std::to_string(pick(1000)) + ".5";
+                saveString(m_rio, m);
+                uint8_t len = (uint8_t)score.size();
+                m_rio.write(&len, 1);
+                m_rio.write(score);
+                ms.push_back(m);
+                ms.push_back(score);
+            }
+            pairs(ms);
+        } else if (kind < 925) {
+            // ziplist 时代的编码 (Redis 6 及以前的 dump)：列表、哈希、有序集合
+            size_t which = pick(3);
+            std::vector<std::string> list;
+            if (which == 0) {
+                list = values(1 + pick(100), 4);
+            } else {
+                for (const auto& m : members(1 + pick(30), false)) {
+                    list.push_back(m);
+                    list.push_back(which == 1 ? value(30) : std::to_string((int64_t)pick(1u << 31) - (1LL << 30)));
+                }
+            }
+            saveType(m_rio, which == 0 ? RDB_TYPE_LIST_ZIPLIST : which == 1 ? RDB_TYPE_HASH_ZIPLIST : RDB_TYPE_ZSET_ZIPLIST);
+            saveString(m_rio, name);
+            saveString(m_rio, makeZiplist(list));
+            if (which == 0) {
+                each(list);
+            } else {
+                pairs(list);
+            }
+        } else if (kind < 935) {
+            // quicklist 1：ziplist 节点
+            size_t nodes = 1 + pick(3);
+            saveType(m_rio, RDB_TYPE_LIST_QUICKLIST);
+            saveString(m_rio, name);
+            saveLen(m_rio, nodes);
+            for (size_t n = 0; n < nodes; ++n) {
+                std::vector<std::string> list = values(1 + pick(100), 3);
+                saveString(m_rio, makeZiplist(list));
+                each(list);
+            }
+        } else if (kind < 940) {
+            std::vector<std::string> fv;
+            for (const auto& f : members(1 + pick(10), false)) {
+                fv.push_back(f);
+                fv.push_back(pick(20) == 0 ? std::string(300, 'z') : value(3));
+            }
+            saveType(m_rio, RDB_TYPE_HASH_ZIPMAP);
+            saveString(m_rio, name);
+            saveString(m_rio, makeZipmap(fv));
+            pairs(fv);
+        } else if (kind < 945) {
+            streamKey(name, elements);
+        } else if (kind < 948) {
+            saveType(m_rio, RDB_TYPE_MODULE_2);
+            saveString(m_rio, name);
+            saveLen(m_rio, 0x1234567890ULL);
+            moduleValue();
+            elements = 1;
+        } else if (kind < 949 && !m_bigDone) {
+            // 元素多到 listpack 头部的个数饱和，只能展开数
+            m_bigDone = true;
+            std::vector<std::string> set = members(70000, true);
+            saveType(m_rio, RDB_TYPE_SET_LISTPACK);
+            saveString(m_rio, name);
+            saveString(m_rio, makeListpack(set));
+            each(set);
+        } else {
+            // 整数编码的字符串值和长字符串值
+            std::string v = pick(2) == 0 ? std::to_string((int64_t)pick(1u << 31) - (1LL << 30))
+                                         : std::string(4096 + pick(20000), "abcdefgh"[pick(8)]) + value(8);
+            saveType(m_rio, RDB_TYPE_STRING);
+            saveString(m_rio, name);
+            saveString(m_rio, v);
+            each({v});
+        }
+        ++m_expect.keys;
+        m_expect.elements += elements;
+        m_expect.sum += d.h;
+    }
+
+    // stream v3：一个 listpack 节点 (内容不展开)，一个消费组，PEL 和消费者各一项
+    void streamKey(const std::string& name, uint64_t& elements) {
+        uint64_t length = 1 + pick(1000);
+        saveType(m_rio, RDB_TYPE_STREAM_LISTPACKS_3);
+        saveString(m_rio, name);
+        saveLen(m_rio, 1);
+        std::string id(16, '\0');
+        saveString(m_rio, id);
+        saveString(m_rio, makeListpack(values(20, 3)));
+        saveLen(m_rio, length);
+        saveLen(m_rio, 1744766896000ULL); // last_id
+        saveLen(m_rio, 3);
+        saveLen(m_rio, 1744766800000ULL); // first_id
+        saveLen(m_rio, 0);
+        saveLen(m_rio, 0); // max_deleted_entry_id
+        saveLen(m_rio, 0);
+        saveLen(m_rio, length); // entries_added
+        saveLen(m_rio, 1);      // 消费组
+        saveString(m_rio, "readers");
+        saveLen(m_rio, 1744766896000ULL);
+        saveLen(m_rio, 3);
+        saveLen(m_rio, length); // entries_read
+        saveLen(m_rio, 1);      // PEL
+        m_rio.write(id.data(), 16);
+        int64_t deliveryTime = 1744766896123LL;
+        m_rio.write(&deliveryTime, 8);
+        saveLen(m_rio, 2);
+        saveLen(m_rio, 1); // 消费者
+        saveString(m_rio, "consumer-1");
+        m_rio.write(&deliveryTime, 8); // seen_time
+        m_rio.write(&deliveryTime, 8); // active_time
+        saveLen(m_rio, 1);
+        m_rio.write(id.data(), 16);
+        elements = length;
+    }
+
+    Rio& m_rio;
+    Digest& m_expect;
+    std::mt19937_64 m_rng;
+    bool m_bigDone = false;
+};
+
+// ---- 读取 ----
+
+class DigestVisitor : public RdbVisitor {
+public:
+    explicit DigestVisitor(bool decode) : m_decode(decode) {}
+
+    bool onKey(const RdbEntry& entry) override {
+        ++m_digest.keys;
+        m_digest.elements += entry.elements;
+        m_digest.expiring += entry.expireMs >= 0 ? 1 : 0;
+        if (!m_decode) {
+            return false;
+        }
+        m_key.begin(entry.key);
+        return true;
+    }
+
+    void onElement(const RdbEntry&, std::string_view a, std::string_view b) override { m_key.element(a, b); }
+    void onKeyEnd(const RdbEntry&) override { m_digest.sum += m_key.h; }
+
+    const Digest& digest() const { return m_digest; }
+
+private:
+    bool m_decode;
+    Digest m_digest;
+    KeyDigest m_key;
+};
+
+struct RunResult {
+    double seconds = 0.0;
+    Digest digest;
+    uint64_t segments = 0;
+    bool ok = false;
+};
+
+template <typename F>
+static RunResult best(int rounds, F run) {
+    RunResult result;
+    for (int round = 0; round < rounds; ++round) {
+        RunResult r = run();
+        if (round == 0 || r.seconds < result.seconds) {
+            result = r;
+        }
+        if (!r.ok) {
+            return r;
+        }
+    }
+    return result;
+}
+
+static RunResult runReader(const char* path, bool decode, int threads, RdbReader::Split split, size_t chunkBytes) {
+    RunResult r;
+    uint64_t start = monotonicNs();
+    RdbReader reader;
+    std::string error;
+    if (!reader.open(path, &error)) {
+        std::cerr << error << std::endl;
+        return r;
+    }
+    std::vector<DigestVisitor> visitors(threads, DigestVisitor(decode));
+    std::vector<RdbVisitor*> pointers;
+    for (auto& v : visitors) {
+        pointers.push_back(&v);
+    }
+    RdbReader::Options opts;
+    opts.split = split;
+    opts.chunkBytes = chunkBytes;
+    RdbReader::Result result;
+    r.ok = reader.parseParallel(pointers, opts, result, &error) && result.checksumPresent;
+    r.seconds = (monotonicNs() - start) / 1e9;
+    if (!r.ok) {
+        std::cerr << "parse: " << error << std::endl;
+    }
+    for (const auto& v : visitors) {
+        r.digest.add(v.digest());
+    }
+    r.segments = result.segments;
+    return r;
+}
+
+// 读盘速度的参考：read() 整个文件，以及 mmap 之后只算 CRC-64
+static RunResult runRead(const char* path) {
+    RunResult r;
+    uint64_t start = monotonicNs();
+    int fd = open(path, O_RDONLY);
+    std::vector<char> buf(1 << 20);
+    ssize_t n;
+    uint64_t bytes = 0;
+    while ((n = read(fd, buf.data(), buf.size())) > 0) {
+        bytes += (uint64_t)n;
+    }
+    close(fd);
+    r.seconds = (monotonicNs() - start) / 1e9;
+    r.ok = bytes > 0;
+    return r;
+}
+
+static RunResult runCrc(const char* path) {
+    RunResult r;
+    uint64_t start = monotonicNs();
+    int fd = open(path, O_RDONLY);
+    off_t size = lseek(fd, 0, SEEK_END);
+    void* p = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return r;
+    }
+    madvise(p, (size_t)size, MADV_SEQUENTIAL);
+    uint64_t crc = Crc64::update(0, p, (size_t)size - 8);
+    uint64_t stored;
+    memcpy(&stored, static_cast<char*>(p) + size - 8, 8);
+    munmap(p, (size_t)size);
+    r.seconds = (monotonicNs() - start) / 1e9;
+    r.ok = crc == stored;
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    char tmpl[] = "/tmp/rdb_bench.XXXXXX";
+    std::string path;
+    int fd;
+    if (opts.file != NULL) {
+        path = opts.file;
+        fd = open(opts.file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    } else {
+        fd = mkstemp(tmpl);
+        path = tmpl;
+    }
+    if (fd < 0) {
+        std::cerr << "cannot create " << path << std::endl;
+        return 1;
+    }
+
+    Digest expect;
+    uint64_t start = monotonicNs();
+    {
+        RioFd rio(fd);
+        rio.enableChecksum(true);
+        Generator gen(rio, expect);
+        gen.header();
+        for (int db = 0; db < opts.dbs; ++db) {
+            int keys = opts.keys / opts.dbs + (db < opts.keys % opts.dbs ? 1 : 0);
+            gen.database(db * 3, keys); // 数据库编号不连续，与真实的 dump 一样
+        }
+        gen.finish();
+        if (rio.writeError()) {
+            std::cerr << "write failed" << std::endl;
+            return 1;
+        }
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    close(fd);
+    double mb = size / 1e6;
+    printf("generated %s: %.1f MB, %llu keys, %llu elements, %llu expiring, %.1f s\n", path.c_str(), mb,
+           (unsigned long long)expect.keys, (unsigned long long)expect.elements, (unsigned long long)expect.expiring,
+           (monotonicNs() - start) / 1e9);
+
+    bool ok = true;
+    auto report = [&](const char* name, const RunResult& r, bool checkSum, bool checkDigest) {
+        bool good = r.ok;
+        if (checkDigest) {
+            good = good && (checkSum ? r.digest == expect
+                                     : r.digest.keys == expect.keys && r.digest.elements == expect.elements
+                                           && r.digest.expiring == expect.expiring);
+        }
+        printf("%-34s %8.1f ms %8.0f MB/s", name, r.seconds * 1e3, mb / r.seconds);
+        if (r.segments > 1) {
+            printf("  %llu segments", (unsigned long long)r.segments);
+        }
+        printf("%s\n", good ? "" : "  MISMATCH");
+        ok = ok && good;
+    };
+
+    const char* file = path.c_str();
+    size_t chunk = opts.chunkMb << 20;
+    report("read() whole file", best(opts.rounds, [&]() { return runRead(file); }), false, false);
+    report("mmap + CRC-64", best(opts.rounds, [&]() { return runCrc(file); }), false, false);
+    report("count only, 1 thread", best(opts.rounds, [&]() {
+               return runReader(file, false, 1, RdbReader::Split::KeyRange, chunk);
+           }), false, true);
+    report("decode all, 1 thread", best(opts.rounds, [&]() {
+               return runReader(file, true, 1, RdbReader::Split::KeyRange, chunk);
+           }), true, true);
+    std::string name = "count only, " + std::to_string(opts.threads) + " threads, range";
+    report(name.c_str(), best(opts.rounds, [&]() {
+               return runReader(file, false, opts.threads, RdbReader::Split::KeyRange, chunk);
+           }), false, true);
+    name = "decode all, " + std::to_string(opts.threads) + " threads, range";
+    report(name.c_str(), best(opts.rounds, [&]() {
+               return runReader(file, true, opts.threads, RdbReader::Split::KeyRange, chunk);
+           }), true, true);
+    name = "decode all, " + std::to_string(opts.threads) + " threads, by db";
+    report(name.c_str(), best(opts.rounds, [&]() {
+               return runReader(file, true, opts.threads, RdbReader::Split::Database, chunk);
+           }), true, true);
+
+    if (opts.file == NULL) {
+        unlink(file);
+    }
+    if (!ok) {
+        std::cerr << "RDB check failed" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,1827 @@
+#ifndef AIAPP_RDB_READER_H
+#define AIAPP_RDB_READER_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "crc64.h"
+#include "lzf.h"
+
+/**
+ * 不依赖 Redis 的 RDB 文件读取器 (对应 Redis 的 rdb.c / redis-check-rdb)，用来离线分析 key 的大小、从 dump.rdb 预热客户端缓存
+ *
+ * - 整个文件 mmap，按 Redis 7.2 (RDB 11) 的格式顺序解码：辅助字段、SELECTDB / RESIZEDB、过期时间 (秒和毫秒)、LRU / LFU、
+ *   函数库、模块辅助数据，以及所有对象类型：字符串、旧的链表/集合/有序集合/哈希、zipmap、ziplist、intset、listpack、
+ *   quicklist (1 和 2)、stream (1 ~ 3)、模块 (只跳过，模块数据自带类型标记)
+ * - 字符串的三种整数编码和 LZF 压缩 (lzf.h) 都会还原；ziplist / listpack / intset / zipmap 展开成一个个元素
+ * - 每个 key 先只读长度和容器头部算出 RdbEntry (元素个数、在文件里占多少字节)，交给 RdbVisitor::onKey；
+ *   它返回 true 时才解码值里的每个元素，只做统计时大字符串直接跳过，压缩过的容器只解压开头几个字节读元素个数
+ * - 末尾的 CRC-64 (rdbchecksum yes) 在另一个线程里与解析同时计算，校验和为 0 表示保存时关闭了校验
+ * - 并行：RDB 是一个连续的流，不解析就找不到 key 的边界。一个扫描线程按跳过模式往前走 (只读长度，几乎只是缺页读盘)，
+ *   按数据库 (Split::Database，每个 SELECTDB 一段) 或者按字节数 (Split::KeyRange，每 chunkBytes 在 key 的边界处切一段)
+ *   切出分段放进队列，工作线程各自用自己的 visitor 完整解析分段；扫描和解析同时进行，大文件基本上以读盘的速度处理
+ *
+ * 解析出的 std::string_view 都只在回调期间有效
+*/
+
+// 文件里的对象类型编号，与 rdb.h 相同
+enum RdbType : uint8_t
+{
+    RDB_TYPE_STRING = 0,
+    RDB_TYPE_LIST = 1,
+    RDB_TYPE_SET = 2,
+    RDB_TYPE_ZSET = 3,
+    RDB_TYPE_HASH = 4,
+    RDB_TYPE_ZSET_2 = 5,
+    RDB_TYPE_MODULE_PRE_GA = 6,
+    RDB_TYPE_MODULE_2 = 7,
+    RDB_TYPE_HASH_ZIPMAP = 9,
+    RDB_TYPE_LIST_ZIPLIST = 10,
+    RDB_TYPE_SET_INTSET = 11,
+    RDB_TYPE_ZSET_ZIPLIST = 12,
+    RDB_TYPE_HASH_ZIPLIST = 13,
+    RDB_TYPE_LIST_QUICKLIST = 14,
+    RDB_TYPE_STREAM_LISTPACKS = 15,
+    RDB_TYPE_HASH_LISTPACK = 16,
+    RDB_TYPE_ZSET_LISTPACK = 17,
+    RDB_TYPE_LIST_QUICKLIST_2 = 18,
+    RDB_TYPE_STREAM_LISTPACKS_2 = 19,
+    RDB_TYPE_SET_LISTPACK = 20,
+    RDB_TYPE_STREAM_LISTPACKS_3 = 21
+};
+
+// 与编码无关的逻辑类型
+enum class RdbKind : uint8_t
+{
+    String,
+    List,
+    Set,
+    Zset,
+    Hash,
+    Stream,
+    Module
+};
+
+inline const char* rdbKindName(RdbKind kind)
+{
+    switch (kind)
+    {
+        case RdbKind::String: return "string";
+        case RdbKind::List: return "list";
+        case RdbKind::Set: return "set";
+        case RdbKind::Zset: return "zset";
+        case RdbKind::Hash: return "hash";
+        case RdbKind::Stream: return "stream";
+        case RdbKind::Module: return "module";
+    }
+    return "unknown";
+}
+
+struct RdbEntry
+{
+    int db = 0;
+    uint8_t type = 0;
+    RdbKind kind = RdbKind::String;
+    std::string_view key;
+    int64_t expireMs = -1;      // 绝对时间 (unix 毫秒)，-1 表示不过期
+    int64_t lruIdle = -1;       // maxmemory-policy 是 LRU 时保存的空闲秒数
+    int lfuFreq = -1;           // LFU 时保存的访问频率
+    uint64_t offset = 0;        // 这个 key (包括前面的过期时间等) 在文件里的起始位置
+    uint64_t serializedBytes = 0;
+    uint64_t elements = 0;      // 字符串为 1；列表/集合为元素数，哈希为字段数，有序集合为成员数，stream 为消息数
+};
+
+class RdbVisitor
+{
+public:
+    virtual ~RdbVisitor() = default;
+
+    virtual void onAux(std::string_view key, std::string_view value) { (void)key, (void)value; }
+    // RESIZEDB 给出的 key 数和带过期时间的 key 数，只是提示
+    virtual void onResizeDb(int db, uint64_t keys, uint64_t expires) { (void)db, (void)keys, (void)expires; }
+    virtual void onFunction(std::string_view code) { (void)code; }
+    // 返回 true 时接着用 onElement 交出值里的每个元素，最后调用 onKeyEnd
+    virtual bool onKey(const RdbEntry& entry) { (void)entry; return false; }
+    /**
+     * 字符串：a 是值；列表/集合：a 是元素；哈希：a 是字段、b 是值；有序集合：a 是成员、b 是分数 (%.17g 的文本)
+     * stream 和模块的值不展开
+    */
+    virtual void onElement(const RdbEntry& entry, std::string_view a, std::string_view b) { (void)entry, (void)a, (void)b; }
+    virtual void onKeyEnd(const RdbEntry& entry) { (void)entry; }
+};
+
+class RdbReader
+{
+public:
+    enum class Split
+    {
+        Database,
+        KeyRange
+    };
+
+    struct Options
+    {
+        bool verifyChecksum = true;
+        Split split = Split::KeyRange;
+        size_t chunkBytes = 64 * 1024 * 1024; // KeyRange 时每段的大小
+    };
+
+    struct Result
+    {
+        uint64_t keys = 0;
+        uint64_t segments = 0;
+        bool checksumPresent = false; // 文件末尾的校验和不为 0
+        bool checksumOk = false;
+    };
+
+    RdbReader() = default;
+    ~RdbReader() { close(); }
+
+    RdbReader(const RdbReader&) = delete;
+    RdbReader& operator=(const RdbReader&) = delete;
+
+    bool open(const char* path, std::string* error)
+    {
+        close();
+        int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return fail(error, std::string("open ") + path + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)HEADER_SIZE + 1)
+        {
+            ::close(fd);
+            return fail(error, std::string(path) + ": too short for an RDB file");
+        }
+        void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+        {
+            return fail(error, std::string("mmap ") + path + ": " + strerror(errno));
+        }
+        m_data = static_cast<const uint8_t*>(p);
+        m_size = (size_t)st.st_size;
+        madvise(p, m_size, MADV_SEQUENTIAL);
+        if (memcmp(m_data, "REDIS", 5) != 0)
+        {
+            close();
+            return fail(error, std::string(path) + ": bad magic");
+        }
+        m_version = 0;
+        for (int i = 5; i < 9; ++i)
+        {
+            if (m_data[i] < '0' || m_data[i] > '9')
+            {
+                close();
+                return fail(error, std::string(path) + ": bad version");
+            }
+            m_version = m_version * 10 + (m_data[i] - '0');
+        }
+        if (m_version < 1 || m_version > MAX_VERSION)
+        {
+            close();
+            return fail(error, std::string(path) + ": unsupported RDB version " + std::to_string(m_version));
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if (m_data != NULL)
+        {
+            munmap(const_cast<uint8_t*>(m_data), m_size);
+            m_data = NULL;
+            m_size = 0;
+        }
+    }
+
+    int version() const { return m_version; }
+    size_t size() const { return m_size; }
+
+    // 单线程解析整个文件
+    bool parse(RdbVisitor& visitor, const Options& opts, Result& result, std::string* error)
+    {
+        std::vector<RdbVisitor*> visitors(1, &visitor);
+        return parseParallel(visitors, opts, result, error);
+    }
+
+    /**
+     * 每个 visitor 一个工作线程，visitors 只有一个时不启动扫描线程，直接顺序解析
+     * 同一个 visitor 只会在一个线程里被调用；分段的处理顺序不确定，需要按顺序的用法 (例如生成命令流) 用单线程
+    */
+    bool parseParallel(const std::vector<RdbVisitor*>& visitors, const Options& opts, Result& result, std::string* error)
+    {
+        result = Result();
+        if (m_data == NULL || visitors.empty())
+        {
+            return fail(error, "no file open");
+        }
+        std::thread crcThread;
+        uint64_t crc = 0;
+        if (opts.verifyChecksum && m_version >= 5)
+        {
+            crcThread = std::thread([this, &crc]() { crc = Crc64::update(0, m_data, m_size - CHECKSUM_SIZE); });
+        }
+
+        State state;
+        bool ok;
+        if (visitors.size() == 1)
+        {
+            Cursor cur(m_data, HEADER_SIZE, m_size, m_version);
+            ok = runSegment(cur, 0, visitors[0], state, NULL);
+            result.segments = 1;
+        }
+        else
+        {
+            ok = runParallel(visitors, opts, state, result);
+        }
+        if (crcThread.joinable())
+        {
+            crcThread.join();
+        }
+        result.keys = state.keys.load();
+        if (!ok)
+        {
+            return fail(error, state.error);
+        }
+
+        if (m_version >= 5)
+        {
+            if (state.eofOffset + 1 + CHECKSUM_SIZE != m_size)
+            {
+                return fail(error, "file does not end with EOF and checksum");
+            }
+            uint64_t stored;
+            memcpy(&stored, m_data + state.eofOffset + 1, sizeof(stored));
+            result.checksumPresent = stored != 0;
+            result.checksumOk = !result.checksumPresent || !opts.verifyChecksum || stored == crc;
+            if (!result.checksumOk)
+            {
+                return fail(error, "CRC64 mismatch");
+            }
+        }
+        else
+        {
+            result.checksumOk = true;
+        }
+        return true;
+    }
+
+private:
+    static const size_t HEADER_SIZE = 9; // "REDIS" + 4 位版本号
+    static const size_t CHECKSUM_SIZE = 8;
+    static const int MAX_VERSION = 12;
+
+    enum Opcode : uint8_t
+    {
+        OP_FUNCTION2 = 245,
+        OP_FUNCTION_PRE_GA = 246,
+        OP_MODULE_AUX = 247,
+        OP_IDLE = 248,
+        OP_FREQ = 249,
+        OP_AUX = 250,
+        OP_RESIZEDB = 251,
+        OP_EXPIRETIME_MS = 252,
+        OP_EXPIRETIME = 253,
+        OP_SELECTDB = 254,
+        OP_EOF = 255
+    };
+
+    // 长度编码的前两位
+    static const int LEN_6BIT = 0;
+    static const int LEN_14BIT = 1;
+    static const uint8_t LEN_32BIT = 0x80;
+    static const uint8_t LEN_64BIT = 0x81;
+    static const int ENC_INT8 = 0;
+    static const int ENC_INT16 = 1;
+    static const int ENC_INT32 = 2;
+    static const int ENC_LZF = 3;
+
+    // 模块值里的类型标记
+    enum ModuleOpcode
+    {
+        MODULE_OPCODE_EOF = 0,
+        MODULE_OPCODE_SINT = 1,
+        MODULE_OPCODE_UINT = 2,
+        MODULE_OPCODE_FLOAT = 3,
+        MODULE_OPCODE_DOUBLE = 4,
+        MODULE_OPCODE_STRING = 5
+    };
+
+    // 各线程共享的解析状态
+    struct State
+    {
+        std::atomic<uint64_t> keys{0};
+        std::atomic<bool> failed{false};
+        std::mutex mutex;
+        std::string error;
+        uint64_t eofOffset = 0;
+
+        void setError(const std::string& what)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!failed.exchange(true))
+            {
+                error = what;
+            }
+        }
+    };
+
+    /**
+     * 在 [pos, end) 上读取 RDB 编码的基本单元，所有读取都检查边界，出错后 ok() 为 false
+     * 解码出的字符串放在调用方给的 scratch 里，或者直接指向 mmap
+    */
+    class Cursor
+    {
+    public:
+        static const uint64_t MAX_LZF_RATIO = 88;
+
+        Cursor(const uint8_t* base, size_t pos, size_t end, int version)
+            : m_base(base), m_pos(pos), m_end(end), m_version(version)
+        {
+        }
+
+        bool ok() const { return m_error.empty(); }
+        const std::string& error() const { return m_error; }
+        size_t pos() const { return m_pos; }
+        void seek(size_t pos) { m_pos = pos; }
+        int version() const { return m_version; }
+
+        bool fail(const char* what)
+        {
+            if (m_error.empty())
+            {
+                m_error = std::string(what) + " at offset " + std::to_string(m_pos);
+            }
+            return false;
+        }
+
+        bool raw(size_t n, const uint8_t*& p)
+        {
+            if (m_end - m_pos < n)
+            {
+                return fail("unexpected end of file");
+            }
+            p = m_base + m_pos;
+            m_pos += n;
+            return true;
+        }
+
+        bool byte(uint8_t& b)
+        {
+            const uint8_t* p = NULL;
+            if (!raw(1, p))
+            {
+                return false;
+            }
+            b = *p;
+            return true;
+        }
+
+        template <typename T>
+        bool little(T& value)
+        {
+            const uint8_t* p = NULL;
+            if (!raw(sizeof(T), p))
+            {
+                return false;
+            }
+            memcpy(&value, p, sizeof(T));
+            return true;
+        }
+
+        // rdbLoadLenByRef：encoded 为 true 时 len 是字符串的特殊编码 (ENC_*)
+        bool length(uint64_t& len, bool* encoded = NULL)
+        {
+            uint8_t b;
+            if (!byte(b))
+            {
+                return false;
+            }
+            if (encoded != NULL)
+            {
+                *encoded = false;
+            }
+            int type = b >> 6;
+            if (type == 3)
+            {
+                if (encoded == NULL)
+                {
+                    return fail("unexpected encoded length");
+                }
+                *encoded = true;
+                len = b & 0x3f;
+                return true;
+            }
+            if (type == LEN_6BIT)
+            {
+                len = b & 0x3f;
+                return true;
+            }
+            if (type == LEN_14BIT)
+            {
+                uint8_t lo;
+                if (!byte(lo))
+                {
+                    return false;
+                }
+                len = ((uint64_t)(b & 0x3f) << 8) | lo;
+                return true;
+            }
+            const uint8_t* p = NULL;
+            if (b == LEN_32BIT)
+            {
+                if (!raw(4, p))
+                {
+                    return false;
+                }
+                len = (uint64_t)p[0] << 24 | (uint64_t)p[1] << 16 | (uint64_t)p[2] << 8 | p[3];
+                return true;
+            }
+            if (b == LEN_64BIT)
+            {
+                if (!raw(8, p))
+                {
+                    return false;
+                }
+                len = 0;
+                for (int i = 0; i < 8; ++i)
+                {
+                    len = len << 8 | p[i];
+                }
+                return true;
+            }
+            return fail("bad length encoding");
+        }
+
+        /**
+         * 读一个字符串对象 (rdbGenericLoadStringObject)，整数编码转成十进制文本，LZF 解压到 scratch
+        */
+        bool string(std::string_view& out, std::string& scratch)
+        {
+            uint64_t len;
+            bool encoded;
+            if (!length(len, &encoded))
+            {
+                return false;
+            }
+            const uint8_t* p = NULL;
+            if (!encoded)
+            {
+                if (!raw(len, p))
+                {
+                    return false;
+                }
+                out = std::string_view(reinterpret_cast<const char*>(p), len);
+                return true;
+            }
+            int64_t value;
+            switch ((int)len)
+            {
+                case ENC_INT8:
+                {
+                    int8_t v;
+                    if (!little(v))
+                    {
+                        return false;
+                    }
+                    value = v;
+                    break;
+                }
+                case ENC_INT16:
+                {
+                    int16_t v;
+                    if (!little(v))
+                    {
+                        return false;
+                    }
+                    value = v;
+                    break;
+                }
+                case ENC_INT32:
+                {
+                    int32_t v;
+                    if (!little(v))
+                    {
+                        return false;
+                    }
+                    value = v;
+                    break;
+                }
+                case ENC_LZF:
+                {
+                    uint64_t clen, ulen;
+                    if (!length(clen) || !length(ulen) || !raw(clen, p))
+                    {
+                        return false;
+                    }
+                    // 一条 3 字节的引用最多展开成 264 字节，超过这个比例的长度一定是坏的，不要按它分配内存
+                    if (ulen / MAX_LZF_RATIO > clen)
+                    {
+                        return fail("corrupt LZF length");
+                    }
+                    scratch.resize(ulen);
+                    if (ulen > 0 && Lzf::decompress(p, clen, &scratch[0], ulen) != ulen)
+                    {
+                        return fail("corrupt LZF string");
+                    }
+                    out = scratch;
+                    return true;
+                }
+                default:
+                    return fail("unknown string encoding");
+            }
+            scratch = std::to_string(value);
+            out = scratch;
+            return true;
+        }
+
+        /**
+         * 跳过一个字符串，不解压；prefix 非空时把还原后的开头 prefixLen 个字节放进去 (容器的头部)
+        */
+        bool skipString(uint8_t* prefix = NULL, size_t prefixLen = 0)
+        {
+            uint64_t len;
+            bool encoded;
+            if (!length(len, &encoded))
+            {
+                return false;
+            }
+            const uint8_t* p = NULL;
+            if (!encoded)
+            {
+                if (!raw(len, p))
+                {
+                    return false;
+                }
+                if (prefix != NULL)
+                {
+                    if (len < prefixLen)
+                    {
+                        return fail("container too short");
+                    }
+                    memcpy(prefix, p, prefixLen);
+                }
+                return true;
+            }
+            if (prefix != NULL && len != ENC_LZF)
+            {
+                return fail("integer-encoded container");
+            }
+            switch ((int)len)
+            {
+                case ENC_INT8:
+                    return raw(1, p);
+                case ENC_INT16:
+                    return raw(2, p);
+                case ENC_INT32:
+                    return raw(4, p);
+                case ENC_LZF:
+                {
+                    uint64_t clen, ulen;
+                    if (!length(clen) || !length(ulen) || !raw(clen, p))
+                    {
+                        return false;
+                    }
+                    if (prefix != NULL
+                        && (ulen < prefixLen || Lzf::decompress(p, clen, prefix, prefixLen, true) != prefixLen))
+                    {
+                        return fail("corrupt LZF container");
+                    }
+                    return true;
+                }
+                default:
+                    return fail("unknown string encoding");
+            }
+        }
+
+        // 旧格式 ZSET 的分数：1 字节长度的文本，253/254/255 表示 nan/+inf/-inf
+        bool textDouble(std::string_view& out, std::string& scratch)
+        {
+            uint8_t len;
+            if (!byte(len))
+            {
+                return false;
+            }
+            switch (len)
+            {
+                case 253: out = "nan"; return true;
+                case 254: out = "inf"; return true;
+                case 255: out = "-inf"; return true;
+            }
+            const uint8_t* p = NULL;
+            if (!raw(len, p))
+            {
+                return false;
+            }
+            scratch.assign(reinterpret_cast<const char*>(p), len);
+            out = scratch;
+            return true;
+        }
+
+    private:
+        const uint8_t* m_base;
+        size_t m_pos;
+        size_t m_end;
+        int m_version;
+        std::string m_error;
+    };
+
+    // 一个分段：从 begin 开始 (顶层操作码的位置)，当前数据库是 db，到 end 之前的 key 都属于它
+    struct Segment
+    {
+        size_t begin;
+        size_t end;
+        int db;
+    };
+
+    // 每个线程自己的解码缓冲区
+    struct Scratch
+    {
+        std::string key;
+        std::string a;
+        std::string b;
+        std::string blob;
+        char number[2][32];
+    };
+
+    static bool fail(std::string* error, const std::string& what)
+    {
+        if (error != NULL)
+        {
+            *error = what;
+        }
+        return false;
+    }
+
+    static RdbKind kindOf(uint8_t type)
+    {
+        switch (type)
+        {
+            case RDB_TYPE_STRING:
+                return RdbKind::String;
+            case RDB_TYPE_LIST:
+            case RDB_TYPE_LIST_ZIPLIST:
+            case RDB_TYPE_LIST_QUICKLIST:
+            case RDB_TYPE_LIST_QUICKLIST_2:
+                return RdbKind::List;
+            case RDB_TYPE_SET:
+            case RDB_TYPE_SET_INTSET:
+            case RDB_TYPE_SET_LISTPACK:
+                return RdbKind::Set;
+            case RDB_TYPE_ZSET:
+            case RDB_TYPE_ZSET_2:
+            case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_ZSET_LISTPACK:
+                return RdbKind::Zset;
+            case RDB_TYPE_HASH:
+            case RDB_TYPE_HASH_ZIPMAP:
+            case RDB_TYPE_HASH_ZIPLIST:
+            case RDB_TYPE_HASH_LISTPACK:
+                return RdbKind::Hash;
+            case RDB_TYPE_STREAM_LISTPACKS:
+            case RDB_TYPE_STREAM_LISTPACKS_2:
+            case RDB_TYPE_STREAM_LISTPACKS_3:
+                return RdbKind::Stream;
+            default:
+                return RdbKind::Module;
+        }
+    }
+
+    static bool isObjectType(uint8_t type)
+    {
+        return type <= RDB_TYPE_STREAM_LISTPACKS_3 && type != 8 && type != RDB_TYPE_MODULE_PRE_GA;
+    }
+
+    // ---- 顶层循环 ----
+
+    /**
+     * 从 cur 的位置解析到 EOF 操作码，或者 (stopAt 非空时) 解析到 *stopAt 处的 key 边界
+     * visitor 为空时是扫描模式：只跳过，不回调
+    */
+    bool runSegment(Cursor& cur, int db, RdbVisitor* visitor, State& state, const size_t* stopAt,
+                    std::function<void(size_t pos, int db, bool newDb)>* boundary = nullptr)
+    {
+        Scratch scratch;
+        RdbEntry entry;
+        entry.db = db;
+        size_t keyStart = cur.pos();
+        while (!state.failed.load(std::memory_order_relaxed))
+        {
+            if (stopAt != NULL && cur.pos() >= *stopAt && keyStart == cur.pos())
+            {
+                return true;
+            }
+            uint8_t op;
+            if (!cur.byte(op))
+            {
+                break;
+            }
+            switch (op)
+            {
+                case OP_EOF:
+                    state.eofOffset = cur.pos() - 1;
+                    return true;
+                case OP_SELECTDB:
+                {
+                    uint64_t n;
+                    if (!cur.length(n))
+                    {
+                        break;
+                    }
+                    entry.db = (int)n;
+                    keyStart = cur.pos();
+                    if (boundary != nullptr)
+                    {
+                        (*boundary)(keyStart, entry.db, true);
+                    }
+                    continue;
+                }
+                case OP_RESIZEDB:
+                {
+                    uint64_t keys, expires;
+                    if (cur.length(keys) && cur.length(expires) && visitor != NULL)
+                    {
+                        visitor->onResizeDb(entry.db, keys, expires);
+                    }
+                    keyStart = cur.pos();
+                    continue;
+                }
+                case OP_AUX:
+                {
+                    std::string_view key, value;
+                    if (cur.string(key, scratch.key) && cur.string(value, scratch.a) && visitor != NULL)
+                    {
+                        visitor->onAux(key, value);
+                    }
+                    keyStart = cur.pos();
+                    continue;
+                }
+                case OP_FUNCTION2:
+                {
+                    std::string_view code;
+                    if (cur.string(code, scratch.a) && visitor != NULL)
+                    {
+                        visitor->onFunction(code);
+                    }
+                    keyStart = cur.pos();
+                    continue;
+                }
+                case OP_MODULE_AUX:
+                {
+                    uint64_t moduleId, when, whenOpcode;
+                    if (cur.length(moduleId) && cur.length(whenOpcode) && cur.length(when))
+                    {
+                        skipModuleValue(cur);
+                    }
+                    keyStart = cur.pos();
+                    continue;
+                }
+                case OP_FUNCTION_PRE_GA:
+                    cur.fail("pre-GA function format is not supported");
+                    break;
+                case OP_EXPIRETIME:
+                {
+                    int32_t seconds;
+                    if (cur.little(seconds))
+                    {
+                        entry.expireMs = (int64_t)seconds * 1000;
+                    }
+                    continue;
+                }
+                case OP_EXPIRETIME_MS:
+                {
+                    int64_t ms;
+                    if (cur.little(ms))
+                    {
+                        entry.expireMs = ms;
+                    }
+                    continue;
+                }
+                case OP_IDLE:
+                {
+                    uint64_t idle;
+                    if (cur.length(idle))
+                    {
+                        entry.lruIdle = (int64_t)idle;
+                    }
+                    continue;
+                }
+                case OP_FREQ:
+                {
+                    uint8_t freq;
+                    if (cur.byte(freq))
+                    {
+                        entry.lfuFreq = freq;
+                    }
+                    continue;
+                }
+                default:
+                    if (!isObjectType(op))
+                    {
+                        cur.fail("unknown opcode or object type");
+                        break;
+                    }
+                    if (!readKey(cur, op, keyStart, entry, visitor, scratch))
+                    {
+                        break;
+                    }
+                    state.keys.fetch_add(1, std::memory_order_relaxed);
+                    entry.expireMs = -1;
+                    entry.lruIdle = -1;
+                    entry.lfuFreq = -1;
+                    keyStart = cur.pos();
+                    if (boundary != nullptr)
+                    {
+                        (*boundary)(keyStart, entry.db, false);
+                    }
+                    continue;
+            }
+            if (!cur.ok())
+            {
+                break;
+            }
+        }
+        if (!cur.ok())
+        {
+            state.setError(cur.error());
+        }
+        return false;
+    }
+
+    // 先跳过一遍得到元素个数，visitor 要元素时回到值的开头再解码一遍
+    bool readKey(Cursor& cur, uint8_t type, size_t keyStart, RdbEntry& entry, RdbVisitor* visitor, Scratch& scratch)
+    {
+        if (!cur.string(entry.key, scratch.key))
+        {
+            return false;
+        }
+        entry.type = type;
+        entry.kind = kindOf(type);
+        entry.offset = keyStart;
+        size_t valueStart = cur.pos();
+        if (!skipValue(cur, type, entry.elements))
+        {
+            return false;
+        }
+        entry.serializedBytes = cur.pos() - keyStart;
+        if (visitor == NULL || !visitor->onKey(entry))
+        {
+            return true;
+        }
+        size_t valueEnd = cur.pos();
+        cur.seek(valueStart);
+        if (!decodeValue(cur, type, entry, *visitor, scratch))
+        {
+            return false;
+        }
+        cur.seek(valueEnd);
+        visitor->onKeyEnd(entry);
+        return true;
+    }
+
+    // ---- 跳过模式：只读长度和容器头部 ----
+
+    bool skipValue(Cursor& cur, uint8_t type, uint64_t& elements)
+    {
+        uint64_t n = 0;
+        elements = 0;
+        switch (type)
+        {
+            case RDB_TYPE_STRING:
+                elements = 1;
+                return cur.skipString();
+            case RDB_TYPE_LIST:
+            case RDB_TYPE_SET:
+                if (!cur.length(n))
+                {
+                    return false;
+                }
+                elements = n;
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    if (!cur.skipString())
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            case RDB_TYPE_ZSET:
+            case RDB_TYPE_ZSET_2:
+            case RDB_TYPE_HASH:
+            {
+                if (!cur.length(n))
+                {
+                    return false;
+                }
+                elements = n;
+                std::string_view ignored;
+                std::string scratch;
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    if (!cur.skipString())
+                    {
+                        return false;
+                    }
+                    const uint8_t* p = NULL;
+                    bool ok = type == RDB_TYPE_HASH ? cur.skipString()
+                              : type == RDB_TYPE_ZSET_2 ? cur.raw(8, p)
+                                                        : cur.textDouble(ignored, scratch);
+                    if (!ok)
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            case RDB_TYPE_HASH_ZIPMAP:
+            case RDB_TYPE_LIST_ZIPLIST:
+            case RDB_TYPE_SET_INTSET:
+            case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_HASH_ZIPLIST:
+            case RDB_TYPE_HASH_LISTPACK:
+            case RDB_TYPE_ZSET_LISTPACK:
+            case RDB_TYPE_SET_LISTPACK:
+                return skipContainer(cur, type, elements);
+            case RDB_TYPE_LIST_QUICKLIST:
+            case RDB_TYPE_LIST_QUICKLIST_2:
+            {
+                if (!cur.length(n))
+                {
+                    return false;
+                }
+                uint8_t inner = type == RDB_TYPE_LIST_QUICKLIST ? RDB_TYPE_LIST_ZIPLIST : RDB_TYPE_SET_LISTPACK;
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    uint64_t container = QUICKLIST_PACKED;
+                    if (type == RDB_TYPE_LIST_QUICKLIST_2 && !cur.length(container))
+                    {
+                        return false;
+                    }
+                    uint64_t count = 1;
+                    bool ok = container == QUICKLIST_PLAIN ? cur.skipString() : skipContainer(cur, inner, count);
+                    if (!ok)
+                    {
+                        return false;
+                    }
+                    elements += count;
+                }
+                return true;
+            }
+            case RDB_TYPE_STREAM_LISTPACKS:
+            case RDB_TYPE_STREAM_LISTPACKS_2:
+            case RDB_TYPE_STREAM_LISTPACKS_3:
+                return skipStream(cur, type, elements);
+            case RDB_TYPE_MODULE_2:
+            {
+                uint64_t moduleId;
+                elements = 1;
+                return cur.length(moduleId) && skipModuleValue(cur);
+            }
+        }
+        return cur.fail("unsupported object type");
+    }
+
+    static const uint64_t QUICKLIST_PLAIN = 1;
+    static const uint64_t QUICKLIST_PACKED = 2;
+
+    // 跳过一个 ziplist / listpack / intset / zipmap，元素个数从头部读；头部里的个数已经饱和 (65535) 时只能展开数一遍
+    bool skipContainer(Cursor& cur, uint8_t type, uint64_t& elements)
+    {
+        uint8_t header[10];
+        size_t start = cur.pos();
+        if (!cur.skipString(header, containerHeaderSize(type)))
+        {
+            return false;
+        }
+        if (containerCount(type, header, elements))
+        {
+            return true;
+        }
+        size_t end = cur.pos();
+        cur.seek(start);
+        std::string scratch;
+        std::string_view blob;
+        if (!cur.string(blob, scratch))
+        {
+            return false;
+        }
+        cur.seek(end);
+        return countContainer(cur, type, blob, elements);
+    }
+
+    static size_t containerHeaderSize(uint8_t type)
+    {
+        switch (type)
+        {
+            case RDB_TYPE_HASH_ZIPMAP: return 1;
+            case RDB_TYPE_SET_INTSET: return 8;
+            case RDB_TYPE_LIST_ZIPLIST:
+            case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_HASH_ZIPLIST: return 10;
+            default: return 6; // listpack
+        }
+    }
+
+    // 从容器头部读出元素个数 (成对存储的按对数)，头部里的计数已经饱和时返回 false
+    static bool containerCount(uint8_t type, const uint8_t* header, uint64_t& elements)
+    {
+        uint64_t n;
+        switch (type)
+        {
+            case RDB_TYPE_HASH_ZIPMAP:
+                if (header[0] >= 254)
+                {
+                    return false;
+                }
+                elements = header[0];
+                return true;
+            case RDB_TYPE_SET_INTSET:
+            {
+                uint32_t len;
+                memcpy(&len, header + 4, 4);
+                elements = len;
+                return true;
+            }
+            case RDB_TYPE_LIST_ZIPLIST:
+            case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_HASH_ZIPLIST:
+            {
+                uint16_t len;
+                memcpy(&len, header + 8, 2);
+                n = len;
+                break;
+            }
+            default:
+            {
+                uint16_t len;
+                memcpy(&len, header + 4, 2);
+                n = len;
+                break;
+            }
+        }
+        if (n == UINT16_MAX)
+        {
+            return false;
+        }
+        bool pairs = type == RDB_TYPE_ZSET_ZIPLIST || type == RDB_TYPE_HASH_ZIPLIST || type == RDB_TYPE_HASH_LISTPACK
+                     || type == RDB_TYPE_ZSET_LISTPACK;
+        elements = pairs ? n / 2 : n;
+        return true;
+    }
+
+    bool countContainer(Cursor& cur, uint8_t type, std::string_view blob, uint64_t& elements)
+    {
+        uint64_t n = 0;
+        if (!walkContainer(cur, type, blob, [&n](std::string_view) { ++n; }))
+        {
+            return false;
+        }
+        bool pairs = type != RDB_TYPE_LIST_ZIPLIST && type != RDB_TYPE_SET_INTSET && type != RDB_TYPE_SET_LISTPACK;
+        elements = pairs ? n / 2 : n;
+        return true;
+    }
+
+    bool skipStream(Cursor& cur, uint8_t type, uint64_t& elements)
+    {
+        uint64_t n, v;
+        const uint8_t* p = NULL;
+        if (!cur.length(n))
+        {
+            return false;
+        }
+        for (uint64_t i = 0; i < n; ++i)
+        {
+            // 主 ID (16 字节的字符串) 和 listpack
+            if (!cur.skipString() || !cur.skipString())
+            {
+                return false;
+            }
+        }
+        // 消息数、last_id
+        if (!cur.length(elements) || !cur.length(v) || !cur.length(v))
+        {
+            return false;
+        }
+        if (type >= RDB_TYPE_STREAM_LISTPACKS_2)
+        {
+            // first_id、max_deleted_entry_id、entries_added
+            for (int i = 0; i < 5; ++i)
+            {
+                if (!cur.length(v))
+                {
+                    return false;
+                }
+            }
+        }
+        uint64_t groups;
+        if (!cur.length(groups))
+        {
+            return false;
+        }
+        for (uint64_t g = 0; g < groups; ++g)
+        {
+            if (!cur.skipString() || !cur.length(v) || !cur.length(v))
+            {
+                return false;
+            }
+            if (type >= RDB_TYPE_STREAM_LISTPACKS_2 && !cur.length(v))
+            {
+                return false;
+            }
+            uint64_t pel;
+            if (!cur.length(pel))
+            {
+                return false;
+            }
+            for (uint64_t k = 0; k < pel; ++k)
+            {
+                // 16 字节的 ID、8 字节的投递时间、投递次数
+                if (!cur.raw(16 + 8, p) || !cur.length(v))
+                {
+                    return false;
+                }
+            }
+            uint64_t consumers;
+            if (!cur.length(consumers))
+            {
+                return false;
+            }
+            for (uint64_t c = 0; c < consumers; ++c)
+            {
+                // 名字、seen_time，v3 多一个 active_time
+                size_t times = type >= RDB_TYPE_STREAM_LISTPACKS_3 ? 16 : 8;
+                if (!cur.skipString() || !cur.raw(times, p) || !cur.length(pel))
+                {
+                    return false;
+                }
+                if (!cur.raw(pel * 16, p))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // 模块值由一串 (类型标记, 值) 组成，以 EOF 标记结束，不需要模块本身就能跳过
+    bool skipModuleValue(Cursor& cur)
+    {
+        while (true)
+        {
+            uint64_t opcode = 0, v = 0;
+            const uint8_t* p = NULL;
+            if (!cur.length(opcode))
+            {
+                return false;
+            }
+            switch ((int)opcode)
+            {
+                case MODULE_OPCODE_EOF:
+                    return true;
+                case MODULE_OPCODE_SINT:
+                case MODULE_OPCODE_UINT:
+                    if (!cur.length(v))
+                    {
+                        return false;
+                    }
+                    break;
+                case MODULE_OPCODE_FLOAT:
+                    if (!cur.raw(4, p))
+                    {
+                        return false;
+                    }
+                    break;
+                case MODULE_OPCODE_DOUBLE:
+                    if (!cur.raw(8, p))
+                    {
+                        return false;
+                    }
+                    break;
+                case MODULE_OPCODE_STRING:
+                    if (!cur.skipString())
+                    {
+                        return false;
+                    }
+                    break;
+                default:
+                    return cur.fail("bad module value opcode");
+            }
+        }
+    }
+
+    // ---- 解码模式 ----
+
+    // 容器里的整数元素很多，不用 snprintf；buf 至少 32 字节，数字从末尾往前写
+    static std::string_view formatInt(int64_t v, char* buf)
+    {
+        char* end = buf + 32;
+        char* p = end;
+        uint64_t u = v < 0 ? 0 - (uint64_t)v : (uint64_t)v;
+        do
+        {
+            *--p = (char)('0' + u % 10);
+            u /= 10;
+        } while (u != 0);
+        if (v < 0)
+        {
+            *--p = '-';
+        }
+        return std::string_view(p, (size_t)(end - p));
+    }
+
+    static std::string_view formatDouble(double d, char* buf)
+    {
+        int n = snprintf(buf, 32, "%.17g", d);
+        return std::string_view(buf, (size_t)n);
+    }
+
+    // 成对存储的容器 (哈希、有序集合) 把相邻两个元素合成一次回调
+    template <typename F>
+    struct Pairer
+    {
+        F& f;
+        std::string& first;
+        bool haveFirst = false;
+
+        void operator()(std::string_view element)
+        {
+            if (!haveFirst)
+            {
+                first.assign(element.data(), element.size());
+                haveFirst = true;
+                return;
+            }
+            f(std::string_view(first), element);
+            haveFirst = false;
+        }
+    };
+
+    bool decodeValue(Cursor& cur, uint8_t type, const RdbEntry& entry, RdbVisitor& visitor, Scratch& scratch)
+    {
+        auto single = [&](std::string_view a) { visitor.onElement(entry, a, std::string_view()); };
+        auto pair = [&](std::string_view a, std::string_view b) { visitor.onElement(entry, a, b); };
+        std::string_view a, b;
+        uint64_t n;
+        switch (type)
+        {
+            case RDB_TYPE_STRING:
+                if (!cur.string(a, scratch.a))
+                {
+                    return false;
+                }
+                single(a);
+                return true;
+            case RDB_TYPE_LIST:
+            case RDB_TYPE_SET:
+                if (!cur.length(n))
+                {
+                    return false;
+                }
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    if (!cur.string(a, scratch.a))
+                    {
+                        return false;
+                    }
+                    single(a);
+                }
+                return true;
+            case RDB_TYPE_ZSET:
+            case RDB_TYPE_ZSET_2:
+            case RDB_TYPE_HASH:
+                if (!cur.length(n))
+                {
+                    return false;
+                }
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    if (!cur.string(a, scratch.a))
+                    {
+                        return false;
+                    }
+                    bool ok;
+                    if (type == RDB_TYPE_HASH)
+                    {
+                        ok = cur.string(b, scratch.b);
+                    }
+                    else if (type == RDB_TYPE_ZSET_2)
+                    {
+                        double score = 0.0;
+                        ok = cur.little(score);
+                        b = formatDouble(score, scratch.number[0]);
+                    }
+                    else
+                    {
+                        ok = cur.textDouble(b, scratch.b);
+                    }
+                    if (!ok)
+                    {
+                        return false;
+                    }
+                    pair(a, b);
+                }
+                return true;
+            case RDB_TYPE_HASH_ZIPMAP:
+            case RDB_TYPE_LIST_ZIPLIST:
+            case RDB_TYPE_SET_INTSET:
+            case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_HASH_ZIPLIST:
+            case RDB_TYPE_HASH_LISTPACK:
+            case RDB_TYPE_ZSET_LISTPACK:
+            case RDB_TYPE_SET_LISTPACK:
+            {
+                std::string_view blob;
+                if (!cur.string(blob, scratch.blob))
+                {
+                    return false;
+                }
+                if (type == RDB_TYPE_LIST_ZIPLIST || type == RDB_TYPE_SET_INTSET || type == RDB_TYPE_SET_LISTPACK)
+                {
+                    return walkContainer(cur, type, blob, single);
+                }
+                Pairer<decltype(pair)> pairer{pair, scratch.a};
+                return walkContainer(cur, type, blob, [&pairer](std::string_view e) { pairer(e); });
+            }
+            case RDB_TYPE_LIST_QUICKLIST:
+            case RDB_TYPE_LIST_QUICKLIST_2:
+            {
+                if (!cur.length(n))
+                {
+                    return false;
+                }
+                for (uint64_t i = 0; i < n; ++i)
+                {
+                    uint64_t container = QUICKLIST_PACKED;
+                    if (type == RDB_TYPE_LIST_QUICKLIST_2 && !cur.length(container))
+                    {
+                        return false;
+                    }
+                    std::string_view blob;
+                    if (!cur.string(blob, scratch.blob))
+                    {
+                        return false;
+                    }
+                    if (container == QUICKLIST_PLAIN)
+                    {
+                        single(blob);
+                        continue;
+                    }
+                    uint8_t inner = type == RDB_TYPE_LIST_QUICKLIST ? RDB_TYPE_LIST_ZIPLIST : RDB_TYPE_SET_LISTPACK;
+                    if (!walkContainer(cur, inner, blob, single))
+                    {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            default:
+                // stream 和模块不展开
+                return true;
+        }
+    }
+
+    // 按容器类型逐个交出元素；整数元素转成十进制文本
+    template <typename F>
+    bool walkContainer(Cursor& cur, uint8_t type, std::string_view blob, F f)
+    {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(blob.data());
+        size_t len = blob.size();
+        switch (type)
+        {
+            case RDB_TYPE_SET_INTSET:
+                return walkIntset(cur, p, len, f);
+            case RDB_TYPE_HASH_ZIPMAP:
+                return walkZipmap(cur, p, len, f);
+            case RDB_TYPE_LIST_ZIPLIST:
+            case RDB_TYPE_ZSET_ZIPLIST:
+            case RDB_TYPE_HASH_ZIPLIST:
+                return walkZiplist(cur, p, len, f);
+            default:
+                return walkListpack(cur, p, len, f);
+        }
+    }
+
+    template <typename F>
+    static bool walkIntset(Cursor& cur, const uint8_t* p, size_t len, F& f)
+    {
+        uint32_t enc, count;
+        if (len < 8)
+        {
+            return cur.fail("intset too short");
+        }
+        memcpy(&enc, p, 4);
+        memcpy(&count, p + 4, 4);
+        if ((enc != 2 && enc != 4 && enc != 8) || len != 8 + (size_t)enc * count)
+        {
+            return cur.fail("corrupt intset");
+        }
+        char buf[32];
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            const uint8_t* q = p + 8 + (size_t)i * enc;
+            int64_t v;
+            if (enc == 2)
+            {
+                int16_t x;
+                memcpy(&x, q, 2);
+                v = x;
+            }
+            else if (enc == 4)
+            {
+                int32_t x;
+                memcpy(&x, q, 4);
+                v = x;
+            }
+            else
+            {
+                memcpy(&v, q, 8);
+            }
+            f(formatInt(v, buf));
+        }
+        return true;
+    }
+
+    // zipmap：<zmlen> (<len> key <len> <free> value [free 个空字节])... 0xff
+    template <typename F>
+    static bool walkZipmap(Cursor& cur, const uint8_t* p, size_t len, F& f)
+    {
+        size_t i = 1;
+        auto readLen = [&](uint32_t& out) -> bool {
+            if (i >= len)
+            {
+                return false;
+            }
+            if (p[i] < 254)
+            {
+                out = p[i++];
+                return true;
+            }
+            if (p[i] != 254 || i + 5 > len)
+            {
+                return false;
+            }
+            memcpy(&out, p + i + 1, 4);
+            i += 5;
+            return true;
+        };
+        while (i < len && p[i] != 0xff)
+        {
+            uint32_t klen, vlen;
+            if (!readLen(klen) || i + klen > len)
+            {
+                return cur.fail("corrupt zipmap");
+            }
+            std::string_view key(reinterpret_cast<const char*>(p + i), klen);
+            i += klen;
+            if (!readLen(vlen) || i + 1 + vlen > len)
+            {
+                return cur.fail("corrupt zipmap");
+            }
+            uint8_t free = p[i++];
+            f(key);
+            f(std::string_view(reinterpret_cast<const char*>(p + i), vlen));
+            i += vlen + free;
+        }
+        return i < len ? true : cur.fail("corrupt zipmap");
+    }
+
+    template <typename F>
+    static bool walkZiplist(Cursor& cur, const uint8_t* p, size_t len, F& f)
+    {
+        if (len < 11)
+        {
+            return cur.fail("ziplist too short");
+        }
+        size_t i = 10;
+        char buf[32];
+        while (i < len && p[i] != 0xff)
+        {
+            // prevlen：1 字节，或者 0xfe 加 4 字节
+            i += p[i] < 254 ? 1 : 5;
+            if (i >= len)
+            {
+                return cur.fail("corrupt ziplist");
+            }
+            uint8_t enc = p[i];
+            size_t slen = 0;
+            size_t header = 0;
+            int64_t v = 0;
+            bool isInt = true;
+            switch (enc >> 6)
+            {
+                case 0:
+                    slen = enc & 0x3f;
+                    header = 1;
+                    isInt = false;
+                    break;
+                case 1:
+                    if (i + 2 > len)
+                    {
+                        return cur.fail("corrupt ziplist");
+                    }
+                    slen = (size_t)(enc & 0x3f) << 8 | p[i + 1];
+                    header = 2;
+                    isInt = false;
+                    break;
+                case 2:
+                    if (i + 5 > len)
+                    {
+                        return cur.fail("corrupt ziplist");
+                    }
+                    slen = (size_t)p[i + 1] << 24 | (size_t)p[i + 2] << 16 | (size_t)p[i + 3] << 8 | p[i + 4];
+                    header = 5;
+                    isInt = false;
+                    break;
+                default:
+                {
+                    size_t width;
+                    switch (enc)
+                    {
+                        case 0xc0: width = 2; break;
+                        case 0xd0: width = 4; break;
+                        case 0xe0: width = 8; break;
+                        case 0xf0: width = 3; break;
+                        case 0xfe: width = 1; break;
+                        default:
+                            if (enc < 0xf1 || enc > 0xfd)
+                            {
+                                return cur.fail("bad ziplist encoding");
+                            }
+                            width = 0;
+                            v = (enc & 0x0f) - 1;
+                            break;
+                    }
+                    if (i + 1 + width > len)
+                    {
+                        return cur.fail("corrupt ziplist");
+                    }
+                    const uint8_t* q = p + i + 1;
+                    if (width == 1)
+                    {
+                        v = (int8_t)q[0];
+                    }
+                    else if (width == 2)
+                    {
+                        int16_t x;
+                        memcpy(&x, q, 2);
+                        v = x;
+                    }
+                    else if (width == 3)
+                    {
+                        // 24 位有符号整数：放在 int32 的高 24 位再算术右移
+                        int32_t x = (int32_t)((uint32_t)q[0] << 8 | (uint32_t)q[1] << 16 | (uint32_t)q[2] << 24);
+                        v = x >> 8;
+                    }
+                    else if (width == 4)
+                    {
+                        int32_t x;
+                        memcpy(&x, q, 4);
+                        v = x;
+                    }
+                    else if (width == 8)
+                    {
+                        memcpy(&v, q, 8);
+                    }
+                    header = 1;
+                    slen = width;
+                    break;
+                }
+            }
+            if (i + header + slen > len)
+            {
+                return cur.fail("corrupt ziplist");
+            }
+            if (isInt)
+            {
+                f(formatInt(v, buf));
+            }
+            else
+            {
+                f(std::string_view(reinterpret_cast<const char*>(p + i + header), slen));
+            }
+            i += header + slen;
+        }
+        return i < len ? true : cur.fail("corrupt ziplist");
+    }
+
+    template <typename F>
+    static bool walkListpack(Cursor& cur, const uint8_t* p, size_t len, F& f)
+    {
+        if (len < 7)
+        {
+            return cur.fail("listpack too short");
+        }
+        size_t i = 6;
+        char buf[32];
+        while (i < len && p[i] != 0xff)
+        {
+            uint8_t enc = p[i];
+            size_t header, slen;
+            bool isInt = false;
+            int64_t v = 0;
+            if ((enc & 0x80) == 0)
+            {
+                // 7 位无符号整数
+                isInt = true;
+                v = enc & 0x7f;
+                header = 1;
+                slen = 0;
+            }
+            else if ((enc & 0xc0) == 0x80)
+            {
+                header = 1;
+                slen = enc & 0x3f;
+            }
+            else if ((enc & 0xe0) == 0xc0)
+            {
+                if (i + 2 > len)
+                {
+                    return cur.fail("corrupt listpack");
+                }
+                // 13 位有符号整数
+                uint64_t u = (uint64_t)(enc & 0x1f) << 8 | p[i + 1];
+                v = u >= (1u << 12) ? (int64_t)u - (1 << 13) : (int64_t)u;
+                isInt = true;
+                header = 2;
+                slen = 0;
+            }
+            else if ((enc & 0xf0) == 0xe0)
+            {
+                if (i + 2 > len)
+                {
+                    return cur.fail("corrupt listpack");
+                }
+                header = 2;
+                slen = (size_t)(enc & 0x0f) << 8 | p[i + 1];
+            }
+            else if (enc == 0xf0)
+            {
+                if (i + 5 > len)
+                {
+                    return cur.fail("corrupt listpack");
+                }
+                uint32_t l;
+                memcpy(&l, p + i + 1, 4);
+                header = 5;
+                slen = l;
+            }
+            else
+            {
+                size_t width;
+                switch (enc)
+                {
+                    case 0xf1: width = 2; break;
+                    case 0xf2: width = 3; break;
+                    case 0xf3: width = 4; break;
+                    case 0xf4: width = 8; break;
+                    default: return cur.fail("bad listpack encoding");
+                }
+                if (i + 1 + width > len)
+                {
+                    return cur.fail("corrupt listpack");
+                }
+                // 小端的有符号整数，先拼成无符号数再按宽度做符号扩展
+                uint64_t u = 0;
+                for (size_t k = 0; k < width; ++k)
+                {
+                    u |= (uint64_t)p[i + 1 + k] << (8 * k);
+                }
+                int shift = (int)(64 - 8 * width);
+                v = (int64_t)(u << shift) >> shift;
+                isInt = true;
+                header = 1 + width;
+                slen = 0;
+            }
+            if (i + header + slen > len)
+            {
+                return cur.fail("corrupt listpack");
+            }
+            if (isInt)
+            {
+                f(formatInt(v, buf));
+            }
+            else
+            {
+                f(std::string_view(reinterpret_cast<const char*>(p + i + header), slen));
+            }
+            // 每个元素后面是 backlen：编码加数据的长度，每字节 7 位
+            size_t entry = header + slen;
+            i += entry + (entry <= 127 ? 1 : entry < 16383 ? 2 : entry < 2097151 ? 3 : entry < 268435455 ? 4 : 5);
+        }
+        return i < len ? true : cur.fail("corrupt listpack");
+    }
+
+    // ---- 并行 ----
+
+    bool runParallel(const std::vector<RdbVisitor*>& visitors, const Options& opts, State& state, Result& result)
+    {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::deque<Segment> queue;
+        bool done = false;
+        // 同时排队的分段不超过线程数的两倍，扫描线程不会跑得太远
+        const size_t maxQueued = visitors.size() * 2;
+
+        std::vector<std::thread> workers;
+        for (RdbVisitor* visitor : visitors)
+        {
+            workers.emplace_back([&, visitor]() {
+                while (true)
+                {
+                    Segment seg;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        cond.wait(lock, [&]() { return !queue.empty() || done; });
+                        if (queue.empty())
+                        {
+                            return;
+                        }
+                        seg = queue.front();
+                        queue.pop_front();
+                    }
+                    cond.notify_all();
+                    Cursor cur(m_data, seg.begin, m_size, m_version);
+                    State local;
+                    if (!runSegment(cur, seg.db, visitor, local, &seg.end))
+                    {
+                        state.setError(local.error.empty() ? cur.error() : local.error);
+                    }
+                    state.keys.fetch_add(local.keys.load(), std::memory_order_relaxed);
+                }
+            });
+        }
+
+        // 扫描线程 (就是当前线程)：跳过模式往前走，在 key 边界处切段
+        size_t segBegin = HEADER_SIZE;
+        int segDb = 0;
+        uint64_t segments = 0;
+        auto push = [&](size_t end, int db) {
+            if (end > segBegin)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&]() { return queue.size() < maxQueued || state.failed.load(); });
+                queue.push_back(Segment{segBegin, end, segDb});
+                ++segments;
+            }
+            cond.notify_all();
+            segBegin = end;
+            segDb = db;
+        };
+        std::function<void(size_t, int, bool)> boundary = [&](size_t pos, int db, bool newDb) {
+            bool cut = opts.split == Split::Database ? newDb : pos - segBegin >= opts.chunkBytes;
+            if (cut)
+            {
+                // 新数据库从 SELECTDB 之后开始，segDb 是它的编号
+                push(pos, db);
+            }
+        };
+        State scanState;
+        Cursor cur(m_data, HEADER_SIZE, m_size, m_version);
+        bool scanned = runSegment(cur, 0, NULL, scanState, NULL, &boundary);
+        if (scanned)
+        {
+            // 最后一段到 EOF 操作码为止，工作线程解析到这里正好停下
+            push(scanState.eofOffset, segDb);
+            state.eofOffset = scanState.eofOffset;
+        }
+        else
+        {
+            state.setError(scanState.error);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        cond.notify_all();
+        for (auto& t : workers)
+        {
+            t.join();
+        }
+        // 扫描时数过的 key 不算，工作线程各自数过一遍
+        result.segments = segments;
+        return scanned && !state.failed.load();
+    }
+
+    const uint8_t* m_data = NULL;
+    size_t m_size = 0;
+    int m_version = 0;
+};
+
+#endif
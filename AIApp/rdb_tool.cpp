@@ -0,0 +1,413 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <queue>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include "latency.h"
+#include "rdb_reader.h"
+
+// 离线读 dump.rdb (不需要 Redis 在跑)：
+// - 默认打印统计：每个数据库和每种类型的 key 数、元素数、占用字节，带过期时间的 key 数，最大的 --top 个 key，校验和
+// - --resp：把 key 转成 RESP 命令写到标准输出 (SET / RPUSH / SADD / HSET / ZADD，带过期时间的再加 PEXPIREAT)，
+//   已经过期的 key 跳过；可以用 redis-cli --pipe 灌进另一个实例，或者由客户端读进本地缓存预热
+//   stream 和模块没有对应的命令，只计数
+// - --prefix 只处理 key 以它开头的部分，--db 只处理一个数据库
+// - --threads N 并行解析，--split 选择按字节数 (range) 还是按数据库 (db) 分段；--resp 时输出要按顺序，只用一个线程
+//
+// 例：./rdb_tool --top 20 dump.rdb
+//     ./rdb_tool --resp --prefix room: dump.rdb | redis-cli --pipe
+
+struct Options {
+    int threads = 1;
+    RdbReader::Split split = RdbReader::Split::KeyRange;
+    size_t chunkMb = 64;
+    bool check = true;       // 校验末尾的 CRC-64
+    int top = 10;            // 列出最大的 key 的个数
+    bool resp = false;
+    int db = -1;             // -1 表示所有数据库
+    const char* prefix = ""; // 只处理以此开头的 key
+    const char* path = NULL;
+};
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog
+              << " [--threads N] [--split db|range] [--chunk-mb N] [--no-check] [--top N] [--resp] [--db N]"
+                 " [--prefix P] dump.rdb"
+              << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "--no-check") == 0) {
+            opts.check = false;
+            continue;
+        }
+        if (strcmp(arg, "--resp") == 0) {
+            opts.resp = true;
+            continue;
+        }
+        if (arg[0] != '-') {
+            opts.path = arg;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--threads") == 0) {
+            opts.threads = atoi(value);
+        } else if (strcmp(arg, "--split") == 0) {
+            if (strcmp(value, "db") == 0) {
+                opts.split = RdbReader::Split::Database;
+            } else if (strcmp(value, "range") == 0) {
+                opts.split = RdbReader::Split::KeyRange;
+            } else {
+                return false;
+            }
+        } else if (strcmp(arg, "--chunk-mb") == 0) {
+            opts.chunkMb = (size_t)atol(value);
+        } else if (strcmp(arg, "--top") == 0) {
+            opts.top = atoi(value);
+        } else if (strcmp(arg, "--db") == 0) {
+            opts.db = atoi(value);
+        } else if (strcmp(arg, "--prefix") == 0) {
+            opts.prefix = value;
+        } else {
+            return false;
+        }
+    }
+    if (opts.resp) {
+        opts.threads = 1;
+    }
+    return opts.path != NULL && opts.threads > 0 && opts.chunkMb > 0 && opts.top >= 0;
+}
+
+struct Counter {
+    uint64_t keys = 0;
+    uint64_t elements = 0;
+    uint64_t bytes = 0;
+    uint64_t expiring = 0;
+
+    void add(const RdbEntry& entry) {
+        ++keys;
+        elements += entry.elements;
+        bytes += entry.serializedBytes;
+        expiring += entry.expireMs >= 0 ? 1 : 0;
+    }
+
+    void add(const Counter& other) {
+        keys += other.keys;
+        elements += other.elements;
+        bytes += other.bytes;
+        expiring += other.expiring;
+    }
+};
+
+struct BigKey {
+    uint64_t bytes;
+    uint64_t elements;
+    int db;
+    RdbKind kind;
+    std::string key;
+
+    bool operator>(const BigKey& other) const { return bytes > other.bytes; }
+};
+
+// 一个线程的统计；最大的 key 用小顶堆，只保留 top 个
+class StatsVisitor : public RdbVisitor {
+public:
+    StatsVisitor(const Options& opts) : m_opts(opts) {}
+
+    void onAux(std::string_view key, std::string_view value) override { m_aux.emplace_back(key, value); }
+
+    bool onKey(const RdbEntry& entry) override {
+        if (!selected(entry)) {
+            return false;
+        }
+        m_dbs[entry.db].add(entry);
+        m_kinds[(int)entry.kind].add(entry);
+        if (m_opts.top > 0 && (m_top.size() < (size_t)m_opts.top || entry.serializedBytes > m_top.top().bytes)) {
+            m_top.push(BigKey{entry.serializedBytes, entry.elements, entry.db, entry.kind, std::string(entry.key)});
+            if (m_top.size() > (size_t)m_opts.top) {
+                m_top.pop();
+            }
+        }
+        return false;
+    }
+
+    bool selected(const RdbEntry& entry) const {
+        return (m_opts.db < 0 || entry.db == m_opts.db) && entry.key.substr(0, strlen(m_opts.prefix)) == m_opts.prefix;
+    }
+
+    void merge(StatsVisitor& other) {
+        m_aux.insert(m_aux.end(), other.m_aux.begin(), other.m_aux.end());
+        for (const auto& it : other.m_dbs) {
+            m_dbs[it.first].add(it.second);
+        }
+        for (int i = 0; i < KINDS; ++i) {
+            m_kinds[i].add(other.m_kinds[i]);
+        }
+        while (!other.m_top.empty()) {
+            m_top.push(other.m_top.top());
+            other.m_top.pop();
+            if (m_top.size() > (size_t)m_opts.top) {
+                m_top.pop();
+            }
+        }
+    }
+
+    void print(FILE* out) {
+        for (const auto& aux : m_aux) {
+            fprintf(out, "aux %s = %s\n", aux.first.c_str(), aux.second.c_str());
+        }
+        Counter total;
+        for (const auto& it : m_dbs) {
+            const Counter& c = it.second;
+            fprintf(out, "db%-3d %10llu keys %10llu expiring %12.1f MB\n", it.first, (unsigned long long)c.keys,
+                    (unsigned long long)c.expiring, c.bytes / 1e6);
+            total.add(c);
+        }
+        for (int i = 0; i < KINDS; ++i) {
+            const Counter& c = m_kinds[i];
+            if (c.keys > 0) {
+                fprintf(out, "%-8s %10llu keys %12llu elements %12.1f MB\n", rdbKindName((RdbKind)i),
+                        (unsigned long long)c.keys, (unsigned long long)c.elements, c.bytes / 1e6);
+            }
+        }
+        fprintf(out, "total    %10llu keys %12llu elements %12.1f MB, %llu expiring\n", (unsigned long long)total.keys,
+                (unsigned long long)total.elements, total.bytes / 1e6, (unsigned long long)total.expiring);
+
+        std::vector<BigKey> top;
+        while (!m_top.empty()) {
+            top.push_back(m_top.top());
+            m_top.pop();
+        }
+        if (!top.empty()) {
+            fprintf(out, "biggest keys:\n");
+        }
+        for (auto it = top.rbegin(); it != top.rend(); ++it) {
+            fprintf(out, "%12llu bytes %10llu elements  db%d %-6s %.*s\n", (unsigned long long)it->bytes,
+                    (unsigned long long)it->elements, it->db, rdbKindName(it->kind), (int)std::min<size_t>(it->key.size(), 80),
+                    it->key.data());
+        }
+    }
+
+private:
+    static const int KINDS = (int)RdbKind::Module + 1;
+
+    const Options& m_opts;
+    std::vector<std::pair<std::string, std::string>> m_aux;
+    std::map<int, Counter> m_dbs;
+    Counter m_kinds[KINDS];
+    std::priority_queue<BigKey, std::vector<BigKey>, std::greater<BigKey>> m_top;
+};
+
+/**
+ * 生成 RESP 命令：容器每 BATCH 个元素一条命令，输出攒到 64KB 再写
+ * 切换数据库时先输出 SELECT
+*/
+class RespVisitor : public StatsVisitor {
+public:
+    RespVisitor(const Options& opts, FILE* out) : StatsVisitor(opts), m_out(out) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        m_nowMs = (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    }
+
+    ~RespVisitor() { flush(); }
+
+    bool onKey(const RdbEntry& entry) override {
+        StatsVisitor::onKey(entry);
+        if (!selected(entry)) {
+            return false;
+        }
+        if (entry.expireMs >= 0 && entry.expireMs <= m_nowMs) {
+            ++m_expired;
+            return false;
+        }
+        if (entry.kind == RdbKind::Stream || entry.kind == RdbKind::Module) {
+            ++m_skipped;
+            return false;
+        }
+        if (entry.db != m_db) {
+            m_db = entry.db;
+            std::string db = std::to_string(m_db);
+            command(2, "SELECT", db);
+        }
+        m_args.clear();
+        return true;
+    }
+
+    void onElement(const RdbEntry& entry, std::string_view a, std::string_view b) override {
+        switch (entry.kind) {
+            case RdbKind::String:
+                command(3, "SET", entry.key, a);
+                return;
+            case RdbKind::Zset:
+                // ZADD 的参数是分数在前
+                m_args.emplace_back(b);
+                m_args.emplace_back(a);
+                break;
+            case RdbKind::Hash:
+                m_args.emplace_back(a);
+                m_args.emplace_back(b);
+                break;
+            default:
+                m_args.emplace_back(a);
+                break;
+        }
+        if (m_args.size() >= BATCH) {
+            flushArgs(entry);
+        }
+    }
+
+    void onKeyEnd(const RdbEntry& entry) override {
+        flushArgs(entry);
+        if (entry.expireMs >= 0) {
+            std::string ms = std::to_string(entry.expireMs);
+            command(3, "PEXPIREAT", entry.key, ms);
+        }
+        ++m_written;
+    }
+
+    void flush() {
+        if (!m_buf.empty()) {
+            fwrite(m_buf.data(), 1, m_buf.size(), m_out);
+            m_buf.clear();
+        }
+        fflush(m_out);
+    }
+
+    uint64_t written() const { return m_written; }
+    uint64_t expired() const { return m_expired; }
+    uint64_t skipped() const { return m_skipped; }
+
+private:
+    static const size_t BATCH = 128;
+
+    void flushArgs(const RdbEntry& entry) {
+        if (m_args.empty()) {
+            return;
+        }
+        const char* name = entry.kind == RdbKind::List ? "RPUSH"
+                           : entry.kind == RdbKind::Set ? "SADD"
+                           : entry.kind == RdbKind::Hash ? "HSET"
+                                                         : "ZADD";
+        header(2 + m_args.size());
+        bulk(name);
+        bulk(entry.key);
+        for (const auto& arg : m_args) {
+            bulk(arg);
+        }
+        m_args.clear();
+        maybeFlush();
+    }
+
+    template <typename... Args>
+    void command(size_t argc, Args... args) {
+        header(argc);
+        (bulk(std::string_view(args)), ...);
+        maybeFlush();
+    }
+
+    void header(size_t argc) {
+        m_buf += '*';
+        m_buf += std::to_string(argc);
+        m_buf += "\r\n";
+    }
+
+    void bulk(std::string_view s) {
+        m_buf += '$';
+        m_buf += std::to_string(s.size());
+        m_buf += "\r\n";
+        m_buf.append(s.data(), s.size());
+        m_buf += "\r\n";
+    }
+
+    void maybeFlush() {
+        if (m_buf.size() >= 64 * 1024) {
+            fwrite(m_buf.data(), 1, m_buf.size(), m_out);
+            m_buf.clear();
+        }
+    }
+
+    FILE* m_out;
+    int64_t m_nowMs;
+    int m_db = -1;
+    std::vector<std::string> m_args;
+    std::string m_buf;
+    uint64_t m_written = 0;
+    uint64_t m_expired = 0;
+    uint64_t m_skipped = 0;
+};
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    uint64_t start = monotonicNs();
+    RdbReader reader;
+    std::string error;
+    if (!reader.open(opts.path, &error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+
+    RdbReader::Options readOpts;
+    readOpts.verifyChecksum = opts.check;
+    readOpts.split = opts.split;
+    readOpts.chunkBytes = opts.chunkMb << 20;
+    RdbReader::Result result;
+
+    // --resp 时命令写标准输出，统计写标准错误
+    FILE* report = opts.resp ? stderr : stdout;
+    std::vector<std::unique_ptr<StatsVisitor>> visitors;
+    RespVisitor* resp = NULL;
+    if (opts.resp) {
+        resp = new RespVisitor(opts, stdout);
+        visitors.emplace_back(resp);
+    } else {
+        for (int i = 0; i < opts.threads; ++i) {
+            visitors.emplace_back(new StatsVisitor(opts));
+        }
+    }
+    std::vector<RdbVisitor*> pointers;
+    for (auto& v : visitors) {
+        pointers.push_back(v.get());
+    }
+    bool ok = reader.parseParallel(pointers, readOpts, result, &error);
+    if (resp != NULL) {
+        resp->flush();
+    }
+    double seconds = (monotonicNs() - start) / 1e9;
+
+    for (size_t i = 1; i < visitors.size(); ++i) {
+        visitors[0]->merge(*visitors[i]);
+    }
+    fprintf(report, "%s: RDB version %d, %.1f MB\n", opts.path, reader.version(), reader.size() / 1e6);
+    visitors[0]->print(report);
+    if (resp != NULL) {
+        fprintf(report, "resp: %llu keys written, %llu already expired, %llu streams/modules skipped\n",
+                (unsigned long long)resp->written(), (unsigned long long)resp->expired(),
+                (unsigned long long)resp->skipped());
+    }
+    const char* checksum = !opts.check ? "not checked" : !result.checksumPresent ? "disabled when saved" : "ok";
+    fprintf(report, "checksum %s, %llu segments, %d thread(s), %.1f ms, %.0f MB/s\n", ok ? checksum : "-",
+            (unsigned long long)result.segments, opts.threads, seconds * 1e3, reader.size() / 1e6 / seconds);
+    if (!ok) {
+        std::cerr << "error: " << error << std::endl;
+        return 1;
+    }
+    return 0;
+}
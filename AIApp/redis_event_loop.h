@@ -0,0 +1,92 @@
+#ifndef AIAPP_REDIS_EVENT_LOOP_H
+#define AIAPP_REDIS_EVENT_LOOP_H
+
+#include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+#include "event_loop.h"
+
+// 把 hiredis 的 redisAsyncContext 挂到 EventLoop 上的适配器
+// 写法和 hiredis 自带的 adapters/ae.h 一样：hiredis 通过 ev 里的几个钩子告诉我们什么时候关注读/写事件，
+// 事件就绪时再回调 redisAsyncHandleRead / redisAsyncHandleWrite
+
+typedef struct redisEventLoopEvents
+{
+    redisAsyncContext* context;
+    EventLoop* loop;
+    int fd;
+} redisEventLoopEvents;
+
+static void redisEventLoopReadWrite(EventLoop* loop, int fd, void* privdata, int mask)
+{
+    ((void)loop);
+    ((void)fd);
+    redisEventLoopEvents* e = (redisEventLoopEvents*)privdata;
+    if (mask & EventLoop::READABLE)
+    {
+        redisAsyncHandleRead(e->context);
+    }
+    else
+    {
+        redisAsyncHandleWrite(e->context);
+    }
+}
+
+static void redisEventLoopAddRead(void* privdata)
+{
+    redisEventLoopEvents* e = (redisEventLoopEvents*)privdata;
+    e->loop->setFileMask(e->fd, e->loop->getFileMask(e->fd) | EventLoop::READABLE);
+}
+
+static void redisEventLoopDelRead(void* privdata)
+{
+    redisEventLoopEvents* e = (redisEventLoopEvents*)privdata;
+    e->loop->setFileMask(e->fd, e->loop->getFileMask(e->fd) & ~EventLoop::READABLE);
+}
+
+static void redisEventLoopAddWrite(void* privdata)
+{
+    redisEventLoopEvents* e = (redisEventLoopEvents*)privdata;
+    e->loop->setFileMask(e->fd, e->loop->getFileMask(e->fd) | EventLoop::WRITABLE);
+}
+
+static void redisEventLoopDelWrite(void* privdata)
+{
+    redisEventLoopEvents* e = (redisEventLoopEvents*)privdata;
+    e->loop->setFileMask(e->fd, e->loop->getFileMask(e->fd) & ~EventLoop::WRITABLE);
+}
+
+// 连接被释放时 hiredis 会调用 cleanup，这里把 fd 从 epoll 里摘掉
+static void redisEventLoopCleanup(void* privdata)
+{
+    redisEventLoopEvents* e = (redisEventLoopEvents*)privdata;
+    e->loop->deleteFileEvent(e->fd);
+    delete e;
+}
+
+// 必须在循环线程里调用 (或者在循环线程启动之前调用)
+static int redisEventLoopAttach(EventLoop* loop, redisAsyncContext* ac)
+{
+    if (ac->ev.data != NULL)
+    {
+        return REDIS_ERR;
+    }
+    redisEventLoopEvents* e = new redisEventLoopEvents;
+    e->context = ac;
+    e->loop = loop;
+    e->fd = ac->c.fd;
+    if (!loop->createFileEvent(e->fd, EventLoop::NONE, redisEventLoopReadWrite, e))
+    {
+        delete e;
+        return REDIS_ERR;
+    }
+
+    ac->ev.addRead = redisEventLoopAddRead;
+    ac->ev.delRead = redisEventLoopDelRead;
+    ac->ev.addWrite = redisEventLoopAddWrite;
+    ac->ev.delWrite = redisEventLoopDelWrite;
+    ac->ev.cleanup = redisEventLoopCleanup;
+    ac->ev.data = e;
+    return REDIS_OK;
+}
+
+#endif
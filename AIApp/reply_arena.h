@@ -0,0 +1,284 @@
+#ifndef AIAPP_REPLY_ARENA_H
+#define AIAPP_REPLY_ARENA_H
+
+#include <hiredis/hiredis.h>
+#include <hiredis/read.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string_view>
+#include <vector>
+
+/**
+ * 在 arena 上构造的回复对象，字段含义与 redisReply 相同，type 也使用 REDIS_REPLY_* 常量
+ * 只能由 ReplyArena 创建，不能交给 freeReplyObject
+*/
+struct ArenaReply
+{
+    int type;
+    long long integer;     // INTEGER，BOOL 也存在这里
+    double dval;           // DOUBLE
+    size_t len;
+    const char* str;       // STRING / STATUS / ERROR / VERB / BIGNUM / DOUBLE 的原始文本，以 '\0' 结尾
+    size_t elements;
+    ArenaReply** element;  // ARRAY / MAP / SET / PUSH
+
+    std::string_view view() const { return std::string_view(str, len); }
+};
+
+/**
+ * 订阅连接专用的回复对象分配器，通过 hiredis 的 redisReplyObjectFunctions 接入
+ *
+ * 默认的分配器每收到一条 pub/sub 消息都要 malloc 一个数组、三个字符串对象和三份字符串内容，
+ * 用完再逐个 free。这里改成在一块块预先分配的内存上顺序分配 (bump)，freeObject 什么都不做，
+ * 调用方处理完读缓冲区里所有完整的回复之后 reset() 一次，整批一起 "释放"
+ *
+ * 字符串内容会拷贝进 arena：hiredis 在 redisReaderGetReply 返回之前就可能把已经消费的读缓冲区移走，
+ * 指向读缓冲区的指针在拿到回复时已经不可靠，所以不能直接引用。拷贝是一次 memcpy 到连续内存上，不涉及分配
+ *
+ * 得到的 ArenaReply 和其中的字符串在下一次 reset() 之前一直有效
+ * 只能在一个线程里使用，与所属的 redisContext 相同
+*/
+class ReplyArena
+{
+public:
+    static const size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+    explicit ReplyArena(size_t blockSize = DEFAULT_BLOCK_SIZE)
+        : m_blockSize(blockSize), m_current(0), m_offset(0)
+    {
+    }
+
+    ~ReplyArena()
+    {
+        for (Block& block : m_blocks)
+        {
+            free(block.data);
+        }
+    }
+
+    ReplyArena(const ReplyArena&) = delete;
+    ReplyArena& operator=(const ReplyArena&) = delete;
+
+    // 让 reader 之后产生的所有回复都在这个 arena 上分配
+    // 调用前 reader 里不能有尚未取走的默认回复对象
+    void attach(redisReader* reader)
+    {
+        reader->fn = functions();
+        reader->privdata = this;
+    }
+
+    void attach(redisContext* context) { attach(context->reader); }
+
+    // reader 没有解析到一半的回复时才能重置，否则半成品的数组会指向已经被复用的内存
+    static bool idle(const redisReader* reader) { return reader->ridx == -1; }
+
+    bool resetIfIdle(const redisReader* reader)
+    {
+        if (!idle(reader))
+        {
+            return false;
+        }
+        reset();
+        return true;
+    }
+
+    // 回收所有分配，已经分配出去的回复全部失效
+    // 普通大小的块留着下次复用，单独为大字符串分配的块直接释放
+    void reset()
+    {
+        size_t kept = 0;
+        for (Block& block : m_blocks)
+        {
+            if (block.size == m_blockSize)
+            {
+                m_blocks[kept++] = block;
+            }
+            else
+            {
+                free(block.data);
+            }
+        }
+        m_blocks.resize(kept);
+        m_current = 0;
+        m_offset = 0;
+    }
+
+    void* allocate(size_t size, size_t align = alignof(max_align_t))
+    {
+        if (size > m_blockSize / 4)
+        {
+            // 比较大的对象单独分配一块，插在当前块之前，不浪费当前块剩下的空间，reset() 时释放
+            char* data = (char*)malloc(size);
+            if (data == NULL)
+            {
+                return NULL;
+            }
+            m_blocks.insert(m_blocks.begin() + m_current, Block{data, size});
+            ++m_current;
+            return data;
+        }
+        while (m_current < m_blocks.size())
+        {
+            Block& block = m_blocks[m_current];
+            size_t start = (m_offset + align - 1) & ~(align - 1);
+            if (start + size <= block.size)
+            {
+                m_offset = start + size;
+                return block.data + start;
+            }
+            ++m_current;
+            m_offset = 0;
+        }
+        char* data = (char*)malloc(m_blockSize);
+        if (data == NULL)
+        {
+            return NULL;
+        }
+        m_blocks.push_back(Block{data, m_blockSize});
+        m_current = m_blocks.size() - 1;
+        m_offset = size;
+        return data;
+    }
+
+    // 当前占用的内存，包括还没用完的块
+    size_t reservedBytes() const
+    {
+        size_t total = 0;
+        for (const Block& block : m_blocks)
+        {
+            total += block.size;
+        }
+        return total;
+    }
+
+private:
+    struct Block
+    {
+        char* data;
+        size_t size;
+    };
+
+    static ReplyArena* arenaOf(const redisReadTask* task) { return static_cast<ReplyArena*>(task->privdata); }
+
+    // 创建一个对象并挂到父数组对应的位置上，与 hiredis 默认的 createXxxObject 做法一致
+    static ArenaReply* create(const redisReadTask* task, int type)
+    {
+        ArenaReply* r = static_cast<ArenaReply*>(arenaOf(task)->allocate(sizeof(ArenaReply), alignof(ArenaReply)));
+        if (r == NULL)
+        {
+            return NULL;
+        }
+        memset(r, 0, sizeof(*r));
+        r->type = type;
+        if (task->parent)
+        {
+            ArenaReply* parent = static_cast<ArenaReply*>(task->parent->obj);
+            parent->element[task->idx] = r;
+        }
+        return r;
+    }
+
+    static bool copyString(const redisReadTask* task, ArenaReply* r, const char* str, size_t len)
+    {
+        char* copy = static_cast<char*>(arenaOf(task)->allocate(len + 1, 1));
+        if (copy == NULL)
+        {
+            return false;
+        }
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+        r->str = copy;
+        r->len = len;
+        return true;
+    }
+
+    static void* createString(const redisReadTask* task, char* str, size_t len)
+    {
+        ArenaReply* r = create(task, task->type);
+        if (r == NULL || !copyString(task, r, str, len))
+        {
+            return NULL;
+        }
+        return r;
+    }
+
+    static void* createArray(const redisReadTask* task, size_t elements)
+    {
+        ArenaReply* r = create(task, task->type);
+        if (r == NULL)
+        {
+            return NULL;
+        }
+        if (elements > 0)
+        {
+            r->element = static_cast<ArenaReply**>(arenaOf(task)->allocate(elements * sizeof(ArenaReply*), alignof(ArenaReply*)));
+            if (r->element == NULL)
+            {
+                return NULL;
+            }
+            memset(r->element, 0, elements * sizeof(ArenaReply*));
+        }
+        r->elements = elements;
+        return r;
+    }
+
+    static void* createInteger(const redisReadTask* task, long long value)
+    {
+        ArenaReply* r = create(task, REDIS_REPLY_INTEGER);
+        if (r != NULL)
+        {
+            r->integer = value;
+        }
+        return r;
+    }
+
+    static void* createDouble(const redisReadTask* task, double value, char* str, size_t len)
+    {
+        ArenaReply* r = create(task, REDIS_REPLY_DOUBLE);
+        if (r == NULL || !copyString(task, r, str, len))
+        {
+            return NULL;
+        }
+        r->dval = value;
+        return r;
+    }
+
+    static void* createNil(const redisReadTask* task)
+    {
+        return create(task, REDIS_REPLY_NIL);
+    }
+
+    static void* createBool(const redisReadTask* task, int value)
+    {
+        ArenaReply* r = create(task, REDIS_REPLY_BOOL);
+        if (r != NULL)
+        {
+            r->integer = value != 0;
+        }
+        return r;
+    }
+
+    // 回复对象随 arena 一起回收，hiredis 出错或者 redisFree 时调用到这里也不需要做任何事
+    static void freeObject(void*)
+    {
+    }
+
+    static redisReplyObjectFunctions* functions()
+    {
+        static redisReplyObjectFunctions fn = {
+            &ReplyArena::createString, &ReplyArena::createArray, &ReplyArena::createInteger,
+            &ReplyArena::createDouble, &ReplyArena::createNil, &ReplyArena::createBool,
+            &ReplyArena::freeObject,
+        };
+        return &fn;
+    }
+
+    size_t m_blockSize;
+    std::vector<Block> m_blocks;
+    size_t m_current; // 正在使用的块
+    size_t m_offset;  // 当前块里已经用掉的字节数
+};
+
+#endif
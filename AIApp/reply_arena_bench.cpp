@@ -0,0 +1,224 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <hiredis/hiredis.h>
+#include <hiredis/read.h>
+#include <hiredis/alloc.h>
+#include "latency.h"
+#include "chat_envelope.h"
+#include "reply_arena.h"
+
+// 订阅端回复解析的微基准：默认的 redisReply 分配器 vs ReplyArena
+// 预先构造一段包含 N 条 pub/sub 消息的 RESP 数据，按 --chunk 字节一段段喂给 redisReader，
+// 模拟从 socket 读到的数据，然后像订阅线程那样取出每条回复并解析消息信封
+// 通过 hiredisSetAllocators 统计 hiredis 内部的 malloc/free 次数，两种模式都包含 redisReaderFeed 自己的分配
+
+struct Options {
+    int messages = 1000000;  // 消息条数
+    int payload = 64;        // 正文长度
+    int chunk = 16384;       // 每次喂给 reader 的字节数，相当于一次 read() 读到的数据
+    int rounds = 5;          // 每种模式重复的次数，取最快的一次
+};
+
+// hiredis 内部的分配次数，基准是单线程的，普通计数器就够了
+static uint64_t g_allocs = 0;
+static uint64_t g_frees = 0;
+
+static void* countingMalloc(size_t size) {
+    ++g_allocs;
+    return malloc(size);
+}
+
+static void* countingCalloc(size_t count, size_t size) {
+    ++g_allocs;
+    return calloc(count, size);
+}
+
+static void* countingRealloc(void* ptr, size_t size) {
+    ++g_allocs;
+    return realloc(ptr, size);
+}
+
+static char* countingStrdup(const char* str) {
+    ++g_allocs;
+    return strdup(str);
+}
+
+static void countingFree(void* ptr) {
+    if (ptr) {
+        ++g_frees;
+    }
+    free(ptr);
+}
+
+// 一轮解析的结果
+struct RunResult {
+    double seconds = 0.0;
+    uint64_t messages = 0;
+    uint64_t checksum = 0;  // 所有信封序号之和，用来确认两种模式解析出了同样的内容
+    uint64_t allocs = 0;
+    uint64_t frees = 0;
+    bool ok = true;
+};
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--messages N] [--payload BYTES] [--chunk BYTES] [--rounds N]" << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        int value = atoi(argv[++i]);
+        if (strcmp(arg, "--messages") == 0) {
+            opts.messages = value;
+        } else if (strcmp(arg, "--payload") == 0) {
+            opts.payload = value;
+        } else if (strcmp(arg, "--chunk") == 0) {
+            opts.chunk = value;
+        } else if (strcmp(arg, "--rounds") == 0) {
+            opts.rounds = value;
+        } else {
+            return false;
+        }
+    }
+    return opts.messages > 0 && opts.payload >= 0 && opts.chunk > 0 && opts.rounds > 0;
+}
+
+// 构造 N 条 ["message", "chat", 信封] 的 RESP 数据
+static std::string buildInput(const Options& opts) {
+    std::string body(opts.payload, 'x');
+    std::string out;
+    for (int i = 0; i < opts.messages; ++i) {
+        std::string envelope = encodeEnvelope(1, (uint64_t)i, monotonicNs(), ENVELOPE_FLAG_TEXT, body);
+        out += "*3\r\n$7\r\nmessage\r\n$4\r\nchat\r\n$";
+        out += std::to_string(envelope.size());
+        out += "\r\n";
+        out += envelope;
+        out += "\r\n";
+    }
+    return out;
+}
+
+// 对一条消息做的处理：与订阅线程一样在回复的缓冲区上直接解析信封
+static bool consume(const char* data, size_t len, RunResult& result) {
+    Envelope envelope;
+    if (!decodeEnvelope(data, len, envelope)) {
+        return false;
+    }
+    result.checksum += envelope.seq;
+    ++result.messages;
+    return true;
+}
+
+static RunResult runDefault(const std::string& input, const Options& opts) {
+    RunResult result;
+    redisReader* reader = redisReaderCreate();
+    uint64_t allocs = g_allocs, frees = g_frees;
+    uint64_t start = monotonicNs();
+    for (size_t pos = 0; pos < input.size() && result.ok; pos += (size_t)opts.chunk) {
+        redisReaderFeed(reader, input.data() + pos, std::min((size_t)opts.chunk, input.size() - pos));
+        while (true) {
+            void* reply = NULL;
+            if (redisReaderGetReply(reader, &reply) != REDIS_OK) {
+                result.ok = false;
+                break;
+            }
+            if (reply == NULL) {
+                break;
+            }
+            redisReply* r = static_cast<redisReply*>(reply);
+            if (r->type != REDIS_REPLY_ARRAY || r->elements != 3 || !consume(r->element[2]->str, r->element[2]->len, result)) {
+                result.ok = false;
+            }
+            freeReplyObject(r);
+        }
+    }
+    result.seconds = (monotonicNs() - start) / 1e9;
+    result.allocs = g_allocs - allocs;
+    result.frees = g_frees - frees;
+    redisReaderFree(reader);
+    return result;
+}
+
+static RunResult runArena(const std::string& input, const Options& opts) {
+    RunResult result;
+    redisReader* reader = redisReaderCreate();
+    ReplyArena arena;
+    arena.attach(reader);
+    uint64_t allocs = g_allocs, frees = g_frees;
+    uint64_t start = monotonicNs();
+    for (size_t pos = 0; pos < input.size() && result.ok; pos += (size_t)opts.chunk) {
+        redisReaderFeed(reader, input.data() + pos, std::min((size_t)opts.chunk, input.size() - pos));
+        while (true) {
+            void* reply = NULL;
+            if (redisReaderGetReply(reader, &reply) != REDIS_OK) {
+                result.ok = false;
+                break;
+            }
+            if (reply == NULL) {
+                break;
+            }
+            ArenaReply* r = static_cast<ArenaReply*>(reply);
+            if (r->type != REDIS_REPLY_ARRAY || r->elements != 3 || !consume(r->element[2]->str, r->element[2]->len, result)) {
+                result.ok = false;
+            }
+        }
+        // 这一段里的完整回复都处理完了，整批回收
+        arena.resetIfIdle(reader);
+    }
+    result.seconds = (monotonicNs() - start) / 1e9;
+    result.allocs = g_allocs - allocs;
+    result.frees = g_frees - frees;
+    redisReaderFree(reader);
+    return result;
+}
+
+static void report(const char* name, const RunResult& r) {
+    double n = r.messages > 0 ? (double)r.messages : 1.0;
+    printf("%-8s %s messages=%llu ns/msg=%.1f msg/s=%.0f allocs/msg=%.3f frees/msg=%.3f checksum=%llu\n",
+           name, r.ok ? "ok" : "FAILED", (unsigned long long)r.messages, r.seconds * 1e9 / n,
+           r.seconds > 0 ? r.messages / r.seconds : 0.0, r.allocs / n, r.frees / n, (unsigned long long)r.checksum);
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    hiredisAllocFuncs counting = {countingMalloc, countingCalloc, countingRealloc, countingStrdup, countingFree};
+    hiredisSetAllocators(&counting);
+
+    std::string input = buildInput(opts);
+    std::cout << "input: " << opts.messages << " messages, " << input.size() << " bytes, chunk " << opts.chunk << std::endl;
+
+    // 两种模式交替运行，各取最快的一轮，减少 CPU 频率和缓存状态带来的偏差
+    RunResult bestDefault, bestArena;
+    for (int round = 0; round < opts.rounds; ++round) {
+        RunResult d = runDefault(input, opts);
+        RunResult a = runArena(input, opts);
+        if (round == 0 || d.seconds < bestDefault.seconds) {
+            bestDefault = d;
+        }
+        if (round == 0 || a.seconds < bestArena.seconds) {
+            bestArena = a;
+        }
+    }
+    report("default", bestDefault);
+    report("arena", bestArena);
+    if (bestArena.seconds > 0) {
+        printf("speedup: %.2fx\n", bestDefault.seconds / bestArena.seconds);
+    }
+
+    bool ok = bestDefault.ok && bestArena.ok && bestDefault.checksum == bestArena.checksum;
+    if (!ok) {
+        std::cerr << "Mismatch between default and arena results" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
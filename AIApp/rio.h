@@ -0,0 +1,307 @@
+#ifndef AIAPP_RIO_H
+#define AIAPP_RIO_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string_view>
+#include "crc64.h"
+#include "sds.h"
+
+/**
+ * 仿照 Redis rio.h / rio.c (见 LearningRedis/RedisRio.md) 的流式 I/O 抽象：上层只管 write / read，不关心数据去了哪里
+ *
+ * 与 Redis 相同的部分：
+ * - 三种后端：内存缓冲区 (RioBuffer，Redis 里是 sds)、stdio 文件 (RioFile)、文件描述符 (RioFd，自己攒一个缓冲区再 write)
+ * - 运行校验和：打开 checksum 之后每次读写都累积 CRC-64 (crc64.h)，RDB 末尾的校验和就是这样算出来的；
+ *   上层也可以 setChecksum(0) 之后只对一段数据求校验
+ * - maxProcessingChunk：大块读写拆成小块，每块之间更新校验和和已处理字节数
+ * - 自动 fsync：RioFile / RioFd 每写入 autosync 字节就 fdatasync 一次，与 rioSetAutoSync 一样，
+ *   避免写大文件时脏页在内核里越积越多，最后一次性 fsync 卡很久
+ * - 出错后记下 readError / writeError，之后的操作都直接失败，上层可以在最后统一检查
+ *
+ * 不同的是这里用虚函数代替 Redis 的函数指针表，读写返回 bool
+*/
+class Rio
+{
+public:
+    virtual ~Rio() = default;
+
+    bool write(const void* buf, size_t len)
+    {
+        if (m_writeError)
+        {
+            return false;
+        }
+        const char* p = static_cast<const char*>(buf);
+        while (len > 0)
+        {
+            size_t chunk = m_maxChunk > 0 && m_maxChunk < len ? m_maxChunk : len;
+            if (m_checksumEnabled)
+            {
+                m_checksum = Crc64::update(m_checksum, p, chunk);
+            }
+            if (!doWrite(p, chunk))
+            {
+                m_writeError = true;
+                return false;
+            }
+            p += chunk;
+            len -= chunk;
+            m_processed += chunk;
+        }
+        return true;
+    }
+
+    bool write(std::string_view data) { return write(data.data(), data.size()); }
+
+    template <typename T>
+    bool writeValue(const T& value)
+    {
+        return write(&value, sizeof(value));
+    }
+
+    bool read(void* buf, size_t len)
+    {
+        if (m_readError)
+        {
+            return false;
+        }
+        char* p = static_cast<char*>(buf);
+        while (len > 0)
+        {
+            size_t chunk = m_maxChunk > 0 && m_maxChunk < len ? m_maxChunk : len;
+            if (!doRead(p, chunk))
+            {
+                m_readError = true;
+                return false;
+            }
+            if (m_checksumEnabled)
+            {
+                m_checksum = Crc64::update(m_checksum, p, chunk);
+            }
+            p += chunk;
+            len -= chunk;
+            m_processed += chunk;
+        }
+        return true;
+    }
+
+    template <typename T>
+    bool readValue(T& value)
+    {
+        return read(&value, sizeof(value));
+    }
+
+    // 当前位置 (已经交给这个 rio 的字节数，包括还在缓冲区里的)
+    off_t tell() { return doTell(); }
+
+    // 把缓冲的数据交给内核，不等待落盘
+    bool flush()
+    {
+        if (m_writeError)
+        {
+            return false;
+        }
+        if (!doFlush())
+        {
+            m_writeError = true;
+            return false;
+        }
+        return true;
+    }
+
+    // flush 之后 fdatasync，返回时数据已经落盘；内存缓冲区没有落盘的概念，等同于 flush
+    bool sync()
+    {
+        if (!flush())
+        {
+            return false;
+        }
+        if (!doSync())
+        {
+            m_writeError = true;
+            return false;
+        }
+        return true;
+    }
+
+    void enableChecksum(bool on) { m_checksumEnabled = on; }
+    uint64_t checksum() const { return m_checksum; }
+    void setChecksum(uint64_t crc) { m_checksum = crc; }
+
+    size_t processedBytes() const { return m_processed; }
+    void setMaxProcessingChunk(size_t bytes) { m_maxChunk = bytes; }
+
+    bool readError() const { return m_readError; }
+    bool writeError() const { return m_writeError; }
+    void clearErrors() { m_readError = m_writeError = false; }
+
+protected:
+    virtual bool doWrite(const char* buf, size_t len) = 0;
+    virtual bool doRead(char* buf, size_t len) = 0;
+    virtual off_t doTell() = 0;
+    virtual bool doFlush() = 0;
+    virtual bool doSync() { return true; }
+
+    // 写满 autosync 字节 (0 表示不自动) 就 fdatasync 一次，RioFile 和 RioFd 共用
+    bool autosync(int fd, size_t len)
+    {
+        if (m_autosync == 0)
+        {
+            return true;
+        }
+        m_unsynced += len;
+        if (m_unsynced < m_autosync)
+        {
+            return true;
+        }
+        m_unsynced = 0;
+        return doFlush() && fdatasync(fd) == 0;
+    }
+
+    size_t m_autosync = 0;
+    size_t m_unsynced = 0;
+
+private:
+    uint64_t m_checksum = 0;
+    bool m_checksumEnabled = false;
+    size_t m_processed = 0;
+    size_t m_maxChunk = 0;
+    bool m_readError = false;
+    bool m_writeError = false;
+};
+
+// 内存缓冲区：写入追加到 Sds 末尾，读取从 pos 开始顺序读；可以先写好再整块交给别人，也可以包装一段已有的数据来读
+class RioBuffer : public Rio
+{
+public:
+    RioBuffer() : m_pos(0) {}
+    explicit RioBuffer(std::string_view data) : m_buf(data), m_pos(0) {}
+
+    const Sds& buffer() const { return m_buf; }
+    Sds& buffer() { return m_buf; }
+
+protected:
+    bool doWrite(const char* buf, size_t len) override
+    {
+        // 与 Redis 相同，写入总是追加在末尾；pos 跟着走到末尾
+        m_buf.append(buf, len);
+        m_pos = m_buf.size();
+        return true;
+    }
+
+    bool doRead(char* buf, size_t len) override
+    {
+        if (m_buf.size() - m_pos < len)
+        {
+            return false;
+        }
+        memcpy(buf, m_buf.data() + m_pos, len);
+        m_pos += len;
+        return true;
+    }
+
+    off_t doTell() override { return (off_t)m_pos; }
+    bool doFlush() override { return true; }
+
+private:
+    Sds m_buf;
+    size_t m_pos;
+};
+
+// stdio 文件：缓冲交给 FILE，不拥有 fp
+class RioFile : public Rio
+{
+public:
+    RioFile(FILE* fp, size_t autosyncBytes = 0) : m_fp(fp) { m_autosync = autosyncBytes; }
+
+protected:
+    bool doWrite(const char* buf, size_t len) override
+    {
+        return fwrite(buf, len, 1, m_fp) == 1 && autosync(fileno(m_fp), len);
+    }
+
+    bool doRead(char* buf, size_t len) override { return fread(buf, len, 1, m_fp) == 1; }
+    off_t doTell() override { return ftello(m_fp); }
+    bool doFlush() override { return fflush(m_fp) == 0; }
+    bool doSync() override { return fdatasync(fileno(m_fp)) == 0; }
+
+private:
+    FILE* m_fp;
+};
+
+/**
+ * 文件描述符：写入先攒在缓冲区里，超过 BUFFER_LIMIT 或者 flush 时才 write，短写和 EINTR 都会重试，不拥有 fd
+ * 与 Redis 的 rioFd 一样只用于写，read 总是失败
+*/
+class RioFd : public Rio
+{
+public:
+    static const size_t BUFFER_LIMIT = 64 * 1024;
+
+    RioFd(int fd, size_t autosyncBytes = 0) : m_fd(fd), m_pos(lseek(fd, 0, SEEK_CUR)) { m_autosync = autosyncBytes; }
+
+protected:
+    bool doWrite(const char* buf, size_t len) override
+    {
+        m_pos += (off_t)len;
+        if (m_buf.size() + len < BUFFER_LIMIT)
+        {
+            m_buf.append(buf, len);
+            return autosync(m_fd, len);
+        }
+        // 缓冲区放不下：先写出已经攒着的，大块数据直接写，不再拷贝一次
+        if (!doFlush())
+        {
+            return false;
+        }
+        return writeAll(buf, len) && autosync(m_fd, len);
+    }
+
+    bool doRead(char*, size_t) override { return false; }
+    off_t doTell() override { return m_pos; }
+
+    bool doFlush() override
+    {
+        if (!writeAll(m_buf.data(), m_buf.size()))
+        {
+            return false;
+        }
+        m_buf.clear();
+        return true;
+    }
+
+    bool doSync() override { return fdatasync(m_fd) == 0; }
+
+private:
+    bool writeAll(const char* p, size_t len)
+    {
+        while (len > 0)
+        {
+            ssize_t n = ::write(m_fd, p, len);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            p += n;
+            len -= (size_t)n;
+        }
+        return true;
+    }
+
+    int m_fd;
+    off_t m_pos;
+    Sds m_buf;
+};
+
+#endif
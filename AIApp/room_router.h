@@ -0,0 +1,339 @@
+#ifndef AIAPP_ROOM_ROUTER_H
+#define AIAPP_ROOM_ROUTER_H
+
+#include <stddef.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// 收到的一条房间消息，三个字段都直接指向 redisReply 里的缓冲区，只在回调期间有效
+struct RoomMessage
+{
+    std::string_view room;    // 订阅时使用的房间名 (频道名或者模式)
+    std::string_view channel; // 消息实际所在的频道
+    std::string_view payload;
+};
+
+// Redis 风格的 glob 匹配，支持 * ? [abc] [a-z] [^a] 和 \ 转义，语义与 Redis 的 stringmatchlen 一致
+static inline bool globMatch(const char* pattern, size_t plen, const char* str, size_t slen)
+{
+    while (plen > 0 && slen > 0)
+    {
+        switch (pattern[0])
+        {
+        case '*':
+            while (plen > 1 && pattern[1] == '*')
+            {
+                ++pattern;
+                --plen;
+            }
+            if (plen == 1)
+            {
+                return true;
+            }
+            while (slen > 0)
+            {
+                if (globMatch(pattern + 1, plen - 1, str, slen))
+                {
+                    return true;
+                }
+                ++str;
+                --slen;
+            }
+            return globMatch(pattern + 1, plen - 1, str, 0);
+        case '?':
+            ++str;
+            --slen;
+            break;
+        case '[':
+        {
+            ++pattern;
+            --plen;
+            bool negate = plen > 0 && pattern[0] == '^';
+            if (negate)
+            {
+                ++pattern;
+                --plen;
+            }
+            bool matched = false;
+            while (plen > 0 && pattern[0] != ']')
+            {
+                if (pattern[0] == '\\' && plen >= 2)
+                {
+                    ++pattern;
+                    --plen;
+                    matched |= pattern[0] == str[0];
+                }
+                else if (plen >= 3 && pattern[1] == '-')
+                {
+                    char lo = std::min(pattern[0], pattern[2]);
+                    char hi = std::max(pattern[0], pattern[2]);
+                    matched |= str[0] >= lo && str[0] <= hi;
+                    pattern += 2;
+                    plen -= 2;
+                }
+                else
+                {
+                    matched |= pattern[0] == str[0];
+                }
+                ++pattern;
+                --plen;
+            }
+            if (plen == 0)
+            {
+                // 没有找到结尾的 ']'，退回一格，让下面统一的 ++pattern 停在模式末尾
+                --pattern;
+                ++plen;
+            }
+            if (matched == negate)
+            {
+                return false;
+            }
+            ++str;
+            --slen;
+            break;
+        }
+        case '\\':
+            if (plen >= 2)
+            {
+                ++pattern;
+                --plen;
+            }
+            // 转义之后按普通字符处理
+            [[fallthrough]];
+        default:
+            if (pattern[0] != str[0])
+            {
+                return false;
+            }
+            ++str;
+            --slen;
+            break;
+        }
+        ++pattern;
+        --plen;
+    }
+    while (plen > 0 && pattern[0] == '*')
+    {
+        ++pattern;
+        --plen;
+    }
+    return plen == 0 && slen == 0;
+}
+
+/**
+ * 客户端本地的房间路由表
+ *
+ * 所有房间共用一个订阅连接：普通房间用 SUBSCRIBE，房间名里带通配符的用 PSUBSCRIBE
+ * 收到消息时按下面的方式找到房间的处理函数：
+ * - message：按频道名在哈希表里查找，O(频道名长度)，与房间数量无关
+ * - pmessage：Redis 会带上命中的模式，同样按模式字符串在哈希表里查找
+ * - 来源不带模式信息时 (例如被一个更宽的模式覆盖，或者由本地中继转发过来的消息)，
+ *   用字典树查找所有可能命中的模式：模式按通配符之前的字面前缀插入字典树，
+ *   查找时沿着频道名走一遍字典树，只对路径上挂着的模式做 glob 匹配
+ *
+ * 不是线程安全的，应当只在订阅连接所在的线程 (事件循环线程) 里使用
+*/
+class RoomRouter
+{
+public:
+    typedef std::function<void(const RoomMessage&)> Handler;
+
+    // 只有没被转义的 *?[ 才算通配符；只带反斜杠的房间 (例如 "a\b") 是普通房间，按原样 SUBSCRIBE，
+    // 当成模式 PSUBSCRIBE 的话 glob 里的 "\b" 匹配的是 "ab" 而不是 "a\b"
+    static bool isPattern(std::string_view room)
+    {
+        for (size_t i = 0; i < room.size(); ++i)
+        {
+            char c = room[i];
+            if (c == '\\')
+            {
+                ++i;
+            }
+            else if (c == '*' || c == '?' || c == '[')
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 加入一个房间，返回 true 表示这是一个新房间，调用方需要发送 (P)SUBSCRIBE
+    bool join(const std::string& room, Handler handler)
+    {
+        bool pattern = isPattern(room);
+        auto& table = pattern ? m_patterns : m_channels;
+        auto it = table.find(room);
+        if (it != table.end())
+        {
+            it->second->handler = std::move(handler);
+            return false;
+        }
+        std::unique_ptr<Room> entry(new Room{room, std::move(handler)});
+        Room* raw = entry.get();
+        // 哈希表的键直接引用 Room 里的字符串，Room 的地址在删除前不会变化
+        table.emplace(std::string_view(raw->name), std::move(entry));
+        if (pattern)
+        {
+            trieInsert(raw);
+        }
+        return true;
+    }
+
+    // 离开一个房间，返回 true 表示确实删除了，调用方需要发送 (P)UNSUBSCRIBE
+    bool leave(const std::string& room)
+    {
+        bool pattern = isPattern(room);
+        auto& table = pattern ? m_patterns : m_channels;
+        auto it = table.find(room);
+        if (it == table.end())
+        {
+            return false;
+        }
+        if (pattern)
+        {
+            trieErase(it->second.get());
+        }
+        table.erase(it);
+        return true;
+    }
+
+    bool contains(std::string_view room) const
+    {
+        return (isPattern(room) ? m_patterns : m_channels).count(room) > 0;
+    }
+
+    size_t size() const { return m_channels.size() + m_patterns.size(); }
+
+    // 处理 ["message", channel, payload]，返回调用的处理函数个数
+    size_t dispatchMessage(std::string_view channel, std::string_view payload) const
+    {
+        auto it = m_channels.find(channel);
+        if (it == m_channels.end())
+        {
+            return 0;
+        }
+        const Room* room = it->second.get();
+        room->handler(RoomMessage{room->name, channel, payload});
+        return 1;
+    }
+
+    // 处理 ["pmessage", pattern, channel, payload]
+    size_t dispatchPMessage(std::string_view pattern, std::string_view channel, std::string_view payload) const
+    {
+        auto it = m_patterns.find(pattern);
+        if (it == m_patterns.end())
+        {
+            return 0;
+        }
+        const Room* room = it->second.get();
+        room->handler(RoomMessage{room->name, channel, payload});
+        return 1;
+    }
+
+    // 不知道消息是通过哪个订阅到达时使用：精确匹配的房间加上所有匹配的模式房间都会收到
+    size_t route(std::string_view channel, std::string_view payload) const
+    {
+        size_t n = dispatchMessage(channel, payload);
+        const TrieNode* node = &m_root;
+        size_t depth = 0;
+        while (node != NULL)
+        {
+            for (const Room* room : node->patterns)
+            {
+                // 字面前缀已经沿着字典树匹配过了，只需要匹配剩下的部分
+                const std::string& p = room->name;
+                if (globMatch(p.data() + depth, p.size() - depth, channel.data() + depth, channel.size() - depth))
+                {
+                    room->handler(RoomMessage{room->name, channel, payload});
+                    ++n;
+                }
+            }
+            if (depth == channel.size())
+            {
+                break;
+            }
+            node = node->child((unsigned char)channel[depth]);
+            ++depth;
+        }
+        return n;
+    }
+
+private:
+    struct Room
+    {
+        std::string name;
+        Handler handler;
+    };
+
+    struct TrieNode
+    {
+        // 子节点按字符排序，房间名通常比较短、分叉也少，有序数组比 256 路的指针表省内存得多
+        std::vector<std::pair<unsigned char, std::unique_ptr<TrieNode>>> children;
+        std::vector<const Room*> patterns;
+
+        TrieNode* child(unsigned char c) const
+        {
+            auto it = std::lower_bound(children.begin(), children.end(), c,
+                                       [](const std::pair<unsigned char, std::unique_ptr<TrieNode>>& e, unsigned char key) { return e.first < key; });
+            return it != children.end() && it->first == c ? it->second.get() : NULL;
+        }
+
+        TrieNode* childOrCreate(unsigned char c)
+        {
+            auto it = std::lower_bound(children.begin(), children.end(), c,
+                                       [](const std::pair<unsigned char, std::unique_ptr<TrieNode>>& e, unsigned char key) { return e.first < key; });
+            if (it != children.end() && it->first == c)
+            {
+                return it->second.get();
+            }
+            it = children.emplace(it, c, std::unique_ptr<TrieNode>(new TrieNode));
+            return it->second.get();
+        }
+    };
+
+    // 模式里第一个通配符之前的部分是字面前缀
+    static size_t literalPrefix(const std::string& pattern)
+    {
+        size_t n = pattern.find_first_of("*?[\\");
+        return n == std::string::npos ? pattern.size() : n;
+    }
+
+    void trieInsert(const Room* room)
+    {
+        TrieNode* node = &m_root;
+        size_t prefix = literalPrefix(room->name);
+        for (size_t i = 0; i < prefix; ++i)
+        {
+            node = node->childOrCreate((unsigned char)room->name[i]);
+        }
+        node->patterns.push_back(room);
+    }
+
+    void trieErase(const Room* room)
+    {
+        // 空的中间节点不回收，房间名的前缀通常会被反复使用
+        TrieNode* node = &m_root;
+        size_t prefix = literalPrefix(room->name);
+        for (size_t i = 0; i < prefix && node != NULL; ++i)
+        {
+            node = node->child((unsigned char)room->name[i]);
+        }
+        if (node != NULL)
+        {
+            auto& v = node->patterns;
+            v.erase(std::remove(v.begin(), v.end(), room), v.end());
+        }
+    }
+
+    std::unordered_map<std::string_view, std::unique_ptr<Room>> m_channels;
+    std::unordered_map<std::string_view, std::unique_ptr<Room>> m_patterns;
+    TrieNode m_root;
+};
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef AIAPP_SDS_H
+#define AIAPP_SDS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// 与 Redis 的 sdsalloc.h 一样，分配函数可以在包含本文件之前替换 (例如压测程序里统计分配次数)
+#ifndef SDS_MALLOC
+#define SDS_MALLOC malloc
+#define SDS_REALLOC realloc
+#define SDS_FREE free
+#endif
+
+/**
+ * 仿照 Redis sds (见 LearningRedis/RedisSds.md) 的动态字符串
+ *
+ * 内存布局与 Redis 相同：[紧凑的头部 len | alloc | flags][字符串内容][\0]，对象本身只是一个指向内容开头的指针
+ * - 头部按容量选择 8 / 16 / 32 / 64 位的 len 和 alloc，最短的头部只有 3 个字节；flags 的低 3 位是头部类型，
+ *   通过 m_buf[-1] 就能找到头部，取长度是 O(1)
+ * - 二进制安全：长度记录在头部里，内容可以包含 \0；末尾总是多留一个 \0，c_str() 可以直接交给 C 接口
+ * - 预分配：追加时空间不够，新长度小于 1MB 时按两倍分配，否则每次多分配 1MB，与 Redis 的 sdsMakeRoomFor 相同；
+ *   头部类型需要变大时重新分配并拷贝，否则直接 realloc
+ * - 没有 Redis 的 sdshdr5：它没有记录剩余空间，只适合不再修改的短字符串，这里的字符串都是用来追加的
+ *
+ * 默认构造的空字符串不分配内存 (m_buf 为 NULL)；view() 返回 std::string_view，不拷贝
+*/
+class Sds
+{
+public:
+    static const size_t MAX_PREALLOC = 1024 * 1024;
+
+    Sds() : m_buf(NULL) {}
+    // 从已有内容构造时按实际长度分配，不预留空间 (与 sdsnewlen 相同)
+    Sds(const char* data, size_t len) : m_buf(NULL) { init(data, len); }
+    Sds(std::string_view text) : m_buf(NULL) { init(text.data(), text.size()); }
+    Sds(const char* text) : m_buf(NULL) { init(text, strlen(text)); }
+
+    Sds(const Sds& other) : m_buf(NULL) { init(other.data(), other.size()); }
+    Sds(Sds&& other) noexcept : m_buf(other.m_buf) { other.m_buf = NULL; }
+
+    Sds& operator=(const Sds& other)
+    {
+        if (this != &other)
+        {
+            assign(other.data(), other.size());
+        }
+        return *this;
+    }
+
+    Sds& operator=(Sds&& other) noexcept
+    {
+        std::swap(m_buf, other.m_buf);
+        return *this;
+    }
+
+    ~Sds()
+    {
+        if (m_buf != NULL)
+        {
+            SDS_FREE(m_buf - headerSize(type()));
+        }
+    }
+
+    size_t size() const
+    {
+        if (m_buf == NULL)
+        {
+            return 0;
+        }
+        switch (type())
+        {
+            case TYPE_8: return header<Header8>()->len;
+            case TYPE_16: return header<Header16>()->len;
+            case TYPE_32: return header<Header32>()->len;
+            default: return header<Header64>()->len;
+        }
+    }
+
+    size_t length() const { return size(); }
+    bool empty() const { return size() == 0; }
+
+    // 不重新分配时最多能容纳的长度
+    size_t capacity() const
+    {
+        if (m_buf == NULL)
+        {
+            return 0;
+        }
+        switch (type())
+        {
+            case TYPE_8: return header<Header8>()->alloc;
+            case TYPE_16: return header<Header16>()->alloc;
+            case TYPE_32: return header<Header32>()->alloc;
+            default: return header<Header64>()->alloc;
+        }
+    }
+
+    // 这个字符串向分配器申请的字节数 (头部 + 容量 + 结尾的 \0)，不包括对象本身的一个指针
+    size_t allocSize() const { return m_buf == NULL ? 0 : headerSize(type()) + capacity() + 1; }
+
+    const char* data() const { return m_buf != NULL ? m_buf : ""; }
+    char* data() { return m_buf; }
+    const char* c_str() const { return data(); }
+    std::string_view view() const { return std::string_view(data(), size()); }
+    operator std::string_view() const { return view(); }
+    std::string str() const { return std::string(data(), size()); }
+
+    char operator[](size_t i) const { return m_buf[i]; }
+    char& operator[](size_t i) { return m_buf[i]; }
+
+    Sds& append(const char* data, size_t len)
+    {
+        if (len == 0)
+        {
+            return *this;
+        }
+        size_t cur = size();
+        makeRoomFor(len);
+        memcpy(m_buf + cur, data, len);
+        setLength(cur + len);
+        return *this;
+    }
+
+    Sds& append(std::string_view text) { return append(text.data(), text.size()); }
+
+    Sds& append(char c)
+    {
+        size_t cur = size();
+        makeRoomFor(1);
+        m_buf[cur] = c;
+        setLength(cur + 1);
+        return *this;
+    }
+
+    // 追加十进制整数，不经过 snprintf (对应 Redis 的 sdsfromlonglong / ll2str)
+    Sds& appendNumber(long long value)
+    {
+        char buf[24];
+        char* end = buf + sizeof(buf);
+        char* p = end;
+        unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+        do
+        {
+            *--p = (char)('0' + v % 10);
+            v /= 10;
+        } while (v != 0);
+        if (value < 0)
+        {
+            *--p = '-';
+        }
+        return append(p, (size_t)(end - p));
+    }
+
+    Sds& operator+=(std::string_view text) { return append(text); }
+    Sds& operator+=(char c) { return append(c); }
+
+    void assign(const char* data, size_t len)
+    {
+        clear();
+        append(data, len);
+    }
+
+    // 长度清零，保留已经分配的空间 (对应 sdsclear)，用于反复构造消息的缓冲区
+    void clear()
+    {
+        if (m_buf != NULL)
+        {
+            setLength(0);
+        }
+    }
+
+    // 保证至少能容纳 n 个字符而不再分配，不做预分配
+    void reserve(size_t n)
+    {
+        size_t cur = size();
+        if (n > cur)
+        {
+            makeRoomFor(n - cur, false);
+        }
+    }
+
+    // 直接修改长度，n 不超过 capacity()；配合 reserve 和 data() 使用，例如让 read 直接写进缓冲区
+    void setLength(size_t n)
+    {
+        switch (type())
+        {
+            case TYPE_8: header<Header8>()->len = (uint8_t)n; break;
+            case TYPE_16: header<Header16>()->len = (uint16_t)n; break;
+            case TYPE_32: header<Header32>()->len = (uint32_t)n; break;
+            default: header<Header64>()->len = (uint64_t)n; break;
+        }
+        m_buf[n] = '\0';
+    }
+
+    // 释放多余的空间，头部也换成能容纳当前长度的最小类型 (对应 sdsRemoveFreeSpace)
+    void shrinkToFit()
+    {
+        if (m_buf == NULL)
+        {
+            return;
+        }
+        size_t len = size();
+        if (len == capacity())
+        {
+            return;
+        }
+        Sds shrunk(m_buf, len);
+        *this = std::move(shrunk);
+    }
+
+    bool operator==(std::string_view other) const { return view() == other; }
+    bool operator!=(std::string_view other) const { return view() != other; }
+
+private:
+    enum
+    {
+        TYPE_8 = 1,
+        TYPE_16 = 2,
+        TYPE_32 = 3,
+        TYPE_64 = 4,
+        TYPE_MASK = 7
+    };
+
+    struct __attribute__((__packed__)) Header8
+    {
+        uint8_t len;
+        uint8_t alloc;
+        unsigned char flags;
+    };
+    struct __attribute__((__packed__)) Header16
+    {
+        uint16_t len;
+        uint16_t alloc;
+        unsigned char flags;
+    };
+    struct __attribute__((__packed__)) Header32
+    {
+        uint32_t len;
+        uint32_t alloc;
+        unsigned char flags;
+    };
+    struct __attribute__((__packed__)) Header64
+    {
+        uint64_t len;
+        uint64_t alloc;
+        unsigned char flags;
+    };
+
+    int type() const { return (unsigned char)m_buf[-1] & TYPE_MASK; }
+
+    template <typename H>
+    H* header() const { return reinterpret_cast<H*>(m_buf - sizeof(H)); }
+
+    static size_t headerSize(int type)
+    {
+        switch (type)
+        {
+            case TYPE_8: return sizeof(Header8);
+            case TYPE_16: return sizeof(Header16);
+            case TYPE_32: return sizeof(Header32);
+            default: return sizeof(Header64);
+        }
+    }
+
+    // 能记录容量 alloc 的最小头部类型
+    static int typeFor(size_t alloc)
+    {
+        if (alloc < 0x100)
+        {
+            return TYPE_8;
+        }
+        if (alloc < 0x10000)
+        {
+            return TYPE_16;
+        }
+        if (alloc <= 0xffffffffULL)
+        {
+            return TYPE_32;
+        }
+        return TYPE_64;
+    }
+
+    // 按 type 把头部写在 mem 开头，返回内容的起始位置
+    static char* initHeader(void* mem, int type, size_t len, size_t alloc)
+    {
+        char* p = static_cast<char*>(mem);
+        switch (type)
+        {
+            case TYPE_8: *reinterpret_cast<Header8*>(p) = Header8{(uint8_t)len, (uint8_t)alloc, (unsigned char)type}; break;
+            case TYPE_16: *reinterpret_cast<Header16*>(p) = Header16{(uint16_t)len, (uint16_t)alloc, (unsigned char)type}; break;
+            case TYPE_32: *reinterpret_cast<Header32*>(p) = Header32{(uint32_t)len, (uint32_t)alloc, (unsigned char)type}; break;
+            default: *reinterpret_cast<Header64*>(p) = Header64{(uint64_t)len, (uint64_t)alloc, (unsigned char)type}; break;
+        }
+        return p + headerSize(type);
+    }
+
+    void init(const char* data, size_t len)
+    {
+        if (len > 0)
+        {
+            allocate(len);
+            memcpy(m_buf, data, len);
+            setLength(len);
+        }
+    }
+
+    // 替换为一块容量为 alloc 的空字符串
+    void allocate(size_t alloc)
+    {
+        int t = typeFor(alloc);
+        void* mem = SDS_MALLOC(headerSize(t) + alloc + 1);
+        if (mem == NULL)
+        {
+            abort();
+        }
+        if (m_buf != NULL)
+        {
+            SDS_FREE(m_buf - headerSize(type()));
+        }
+        m_buf = initHeader(mem, t, 0, alloc);
+        m_buf[0] = '\0';
+    }
+
+    // 保证还能再追加 addlen 个字符，greedy 时按 Redis 的策略预分配
+    void makeRoomFor(size_t addlen, bool greedy = true)
+    {
+        size_t len = size();
+        size_t alloc = capacity();
+        if (m_buf != NULL && alloc - len >= addlen)
+        {
+            return;
+        }
+        size_t newlen = len + addlen;
+        if (greedy)
+        {
+            newlen = newlen < MAX_PREALLOC ? newlen * 2 : newlen + MAX_PREALLOC;
+        }
+        if (m_buf == NULL)
+        {
+            allocate(newlen);
+            return;
+        }
+        int oldType = type();
+        int newType = typeFor(newlen);
+        if (newType == oldType)
+        {
+            void* mem = SDS_REALLOC(m_buf - headerSize(oldType), headerSize(oldType) + newlen + 1);
+            if (mem == NULL)
+            {
+                abort();
+            }
+            m_buf = static_cast<char*>(mem) + headerSize(oldType);
+        }
+        else
+        {
+            // 头部变大了，内容整体后移，realloc 省不了拷贝，直接分配新的
+            void* mem = SDS_MALLOC(headerSize(newType) + newlen + 1);
+            if (mem == NULL)
+            {
+                abort();
+            }
+            char* buf = initHeader(mem, newType, len, newlen);
+            memcpy(buf, m_buf, len + 1);
+            SDS_FREE(m_buf - headerSize(oldType));
+            m_buf = buf;
+        }
+        switch (type())
+        {
+            case TYPE_8: header<Header8>()->alloc = (uint8_t)newlen; break;
+            case TYPE_16: header<Header16>()->alloc = (uint16_t)newlen; break;
+            case TYPE_32: header<Header32>()->alloc = (uint32_t)newlen; break;
+            default: header<Header64>()->alloc = (uint64_t)newlen; break;
+        }
+    }
+
+    char* m_buf; // 指向内容开头，头部在它前面
+};
+
+#endif
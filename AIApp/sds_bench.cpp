@@ -0,0 +1,235 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <malloc.h>
+
+// Sds 的分配都经过这几个函数，统计次数；std::string 的分配通过替换全局 operator new 统计
+static uint64_t g_sdsAllocs = 0;
+static uint64_t g_newAllocs = 0;
+
+static void* countingMalloc(size_t size) {
+    ++g_sdsAllocs;
+    return malloc(size);
+}
+
+static void* countingRealloc(void* ptr, size_t size) {
+    ++g_sdsAllocs;
+    return realloc(ptr, size);
+}
+
+#define SDS_MALLOC countingMalloc
+#define SDS_REALLOC countingRealloc
+#define SDS_FREE free
+#include "sds.h"
+#include "latency.h"
+
+void* operator new(size_t size) {
+    ++g_newAllocs;
+    void* p = malloc(size ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// Sds 与 std::string 的对比
+// 1. 构造消息：像 chat_gateway / simulate_clients 那样把用户名、序号、时间戳和正文拼成一条消息，
+//    分别测每条消息新建一个字符串和反复使用同一个缓冲区 (clear 之后接着追加) 两种用法
+// 2. 输出缓冲区：不断向一个大缓冲区追加消息 (相当于服务器给一个连接积攒的回复)，比较扩容的次数和耗时
+// 3. 短消息的内存占用：保留大量短字符串 (历史消息、用户名) 时，每个字符串实际占用的堆内存加上对象本身的大小
+
+struct Options {
+    int messages = 2000000;  // 构造消息的条数
+    int payload = 48;        // 消息正文长度
+    size_t bufferMb = 64;    // 输出缓冲区测试追加的总量
+    int strings = 1000000;   // 内存占用测试保留的字符串个数
+    int rounds = 3;          // 每种模式重复的次数，取最快的一次
+};
+
+struct RunResult {
+    double seconds = 0.0;
+    uint64_t allocs = 0;
+    uint64_t checksum = 0;   // 所有消息的长度之和，确认各模式构造出了同样的内容
+};
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--messages N] [--payload BYTES] [--buffer MB] [--strings N] [--rounds N]" << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        int value = atoi(argv[++i]);
+        if (strcmp(arg, "--messages") == 0) {
+            opts.messages = value;
+        } else if (strcmp(arg, "--payload") == 0) {
+            opts.payload = value;
+        } else if (strcmp(arg, "--buffer") == 0) {
+            opts.bufferMb = (size_t)value;
+        } else if (strcmp(arg, "--strings") == 0) {
+            opts.strings = value;
+        } else if (strcmp(arg, "--rounds") == 0) {
+            opts.rounds = value;
+        } else {
+            return false;
+        }
+    }
+    return opts.messages > 0 && opts.payload >= 0 && opts.bufferMb > 0 && opts.strings > 0 && opts.rounds > 0;
+}
+
+static uint64_t allocCount() {
+    return g_sdsAllocs + g_newAllocs;
+}
+
+// "[user42] #seq @ts: payload"，数字部分用各自的整数追加方式
+static void buildMessage(std::string& out, int user, long long seq, long long ts, const std::string& payload) {
+    out += "[user";
+    out += std::to_string(user);
+    out += "] #";
+    out += std::to_string(seq);
+    out += " @";
+    out += std::to_string(ts);
+    out += ": ";
+    out += payload;
+}
+
+static void buildMessage(Sds& out, int user, long long seq, long long ts, const std::string& payload) {
+    out.append("[user", 5);
+    out.appendNumber(user);
+    out.append("] #", 3);
+    out.appendNumber(seq);
+    out.append(" @", 2);
+    out.appendNumber(ts);
+    out.append(": ", 2);
+    out.append(payload);
+}
+
+template <typename S>
+static RunResult runBuild(const Options& opts, const std::string& payload, bool reuse) {
+    RunResult result;
+    S reused;
+    uint64_t allocs = allocCount();
+    uint64_t start = monotonicNs();
+    for (int i = 0; i < opts.messages; ++i) {
+        long long ts = 1700000000000LL + i;
+        if (reuse) {
+            reused.clear();
+            buildMessage(reused, i % 1000, i, ts, payload);
+            result.checksum += reused.size();
+        } else {
+            S message;
+            buildMessage(message, i % 1000, i, ts, payload);
+            result.checksum += message.size();
+        }
+    }
+    result.seconds = (monotonicNs() - start) / 1e9;
+    result.allocs = allocCount() - allocs;
+    return result;
+}
+
+template <typename S>
+static RunResult runBuffer(const Options& opts, const std::string& payload) {
+    RunResult result;
+    size_t total = opts.bufferMb * 1024 * 1024;
+    uint64_t allocs = allocCount();
+    uint64_t start = monotonicNs();
+    S buffer;
+    while ((size_t)buffer.size() < total) {
+        buffer.append(payload.data(), payload.size());
+        buffer.append("\r\n", 2);
+    }
+    result.checksum = buffer.size();
+    result.seconds = (monotonicNs() - start) / 1e9;
+    result.allocs = allocCount() - allocs;
+    return result;
+}
+
+// 跑 rounds 轮取最快的一轮
+template <typename F>
+static RunResult best(int rounds, F run) {
+    RunResult result;
+    for (int round = 0; round < rounds; ++round) {
+        RunResult r = run();
+        if (round == 0 || r.seconds < result.seconds) {
+            result = r;
+        }
+    }
+    return result;
+}
+
+static void report(const char* name, const RunResult& r, double count) {
+    printf("  %-16s ns/op=%.1f allocs/op=%.3f checksum=%llu\n", name, r.seconds * 1e9 / count, r.allocs / count,
+           (unsigned long long)r.checksum);
+}
+
+// 保留 n 个长度为 len 的字符串，返回平均每个占用的字节数 (堆上的增量加上对象本身)
+template <typename S>
+static double footprint(int n, size_t len) {
+    std::string text(len, 'm');
+    std::vector<S> keep;
+    keep.reserve((size_t)n);
+    size_t before = mallinfo2().uordblks;
+    for (int i = 0; i < n; ++i) {
+        keep.emplace_back(text.data(), text.size());
+    }
+    size_t after = mallinfo2().uordblks;
+    return (double)(after - before) / n + sizeof(S);
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    std::string payload((size_t)opts.payload, 'x');
+    bool ok = true;
+
+    std::cout << "build: " << opts.messages << " messages, payload " << opts.payload << " bytes" << std::endl;
+    RunResult stringFresh = best(opts.rounds, [&]() { return runBuild<std::string>(opts, payload, false); });
+    RunResult sdsFresh = best(opts.rounds, [&]() { return runBuild<Sds>(opts, payload, false); });
+    RunResult stringReuse = best(opts.rounds, [&]() { return runBuild<std::string>(opts, payload, true); });
+    RunResult sdsReuse = best(opts.rounds, [&]() { return runBuild<Sds>(opts, payload, true); });
+    report("string fresh", stringFresh, opts.messages);
+    report("sds fresh", sdsFresh, opts.messages);
+    report("string reuse", stringReuse, opts.messages);
+    report("sds reuse", sdsReuse, opts.messages);
+    ok = ok && stringFresh.checksum == sdsFresh.checksum && stringReuse.checksum == sdsReuse.checksum;
+
+    std::cout << "buffer: append " << opts.payload + 2 << "-byte lines up to " << opts.bufferMb << " MB" << std::endl;
+    double lines = (double)(opts.bufferMb * 1024 * 1024) / (opts.payload + 2);
+    RunResult stringBuffer = best(opts.rounds, [&]() { return runBuffer<std::string>(opts, payload); });
+    RunResult sdsBuffer = best(opts.rounds, [&]() { return runBuffer<Sds>(opts, payload); });
+    report("string", stringBuffer, lines);
+    report("sds", sdsBuffer, lines);
+    printf("  (allocs for the whole buffer: string=%llu sds=%llu)\n", (unsigned long long)stringBuffer.allocs,
+           (unsigned long long)sdsBuffer.allocs);
+    ok = ok && stringBuffer.checksum == sdsBuffer.checksum;
+
+    std::cout << "footprint: " << opts.strings << " strings kept alive, bytes per string (heap + object)" << std::endl;
+    const size_t lengths[] = {8, 16, 32, 64, 200, 300};
+    for (size_t len : lengths) {
+        printf("  len=%-4zu string=%.1f sds=%.1f\n", len, footprint<std::string>(opts.strings, len),
+               footprint<Sds>(opts.strings, len));
+    }
+
+    if (!ok) {
+        std::cerr << "Mismatch between std::string and Sds results" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,441 @@
+#ifndef AIAPP_SHARDED_CACHE_H
+#define AIAPP_SHARDED_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "latency.h"
+
+/**
+ * 进程内的 key -> value 缓存，供 near_cache.h 把热 key 的 GET 变成本地内存查找
+ *
+ * - 按 key 的哈希分成若干个分片，每个分片一把锁、一个哈希表和一条 LRU 链表，多个线程同时读不同的 key 时互不影响
+ * - 容量按字节计 (key + value + 固定开销)，每个分片各占 1/shards
+ * - TinyLFU 准入：每个分片一个 Count-Min Sketch (4 行，4 位计数器，样本数到达 10 倍宽度时整体减半，让旧的热度逐渐衰减)，
+ *   查找和填充都会计数；分片满了要淘汰时，新 key 的估计频率必须高于 LRU 尾部的 key 才能替换它，
+ *   否则新 key 不进缓存 —— 扫一遍冷数据不会把热 key 挤出去
+ * - 负缓存：source 里不存在的 key 也可以缓存 ("确定没有")，可以单独设置一个较短的 TTL
+ * - 填充的竞态：从 source 读值之前先 reserve() 拿一个票据，读回来以后 fill() 只在票据仍然有效时才写入；
+ *   这期间 key 被 invalidate() 或者整个缓存被 clear() 都会作废票据，避免把失效之前读到的旧值放回缓存
+ * - generation：每次 clear() 加一，reserve() 时传入调用方认定的 generation，不一致就拒绝，
+ *   near_cache.h 用它保证只有跟踪 (CLIENT TRACKING) 状态有效的连接才能填充
+ *
+ * value 返回时拷贝出去，不会持有分片的锁
+*/
+class ShardedCache
+{
+public:
+    struct Options
+    {
+        size_t capacityBytes = 64 * 1024 * 1024;
+        size_t shards = 16;             // 向上取整为 2 的幂
+        uint64_t ttlMs = 0;             // 正常条目的最长存活时间，0 表示只靠失效通知
+        uint64_t negativeTtlMs = 0;     // 负缓存条目的存活时间，0 表示只靠失效通知
+        size_t maxValueBytes = 1 << 20; // 更大的 value 不缓存
+        bool admission = true;          // 关闭时是普通的 LRU
+    };
+
+    enum class Lookup
+    {
+        Miss,
+        Hit,
+        NegativeHit // 缓存了 "不存在"
+    };
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t negativeHits = 0;
+        uint64_t misses = 0;
+        uint64_t fills = 0;
+        uint64_t fillsDropped = 0; // 票据已经作废 (期间有失效) 的填充
+        uint64_t rejected = 0;     // 没有通过 TinyLFU 准入
+        uint64_t evictions = 0;
+        uint64_t expired = 0;
+        uint64_t invalidations = 0; // 因为失效通知删掉的条目
+        uint64_t clears = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+    explicit ShardedCache(const Options& opts) : m_opts(opts)
+    {
+        size_t shards = 1;
+        while (shards < opts.shards)
+        {
+            shards <<= 1;
+        }
+        m_mask = shards - 1;
+        size_t perShard = opts.capacityBytes / shards;
+        // 按平均每个条目 128 字节估计条目数，sketch 的宽度取它的 2 倍
+        size_t width = 64;
+        while (width < perShard / 64)
+        {
+            width <<= 1;
+        }
+        m_shards.reset(new Shard[shards]);
+        for (size_t i = 0; i < shards; ++i)
+        {
+            m_shards[i].capacity = perShard;
+            m_shards[i].sketch.init(width);
+        }
+    }
+
+    ShardedCache(const ShardedCache&) = delete;
+    ShardedCache& operator=(const ShardedCache&) = delete;
+
+    // 命中时把值拷贝到 value (value 可以为空)
+    Lookup get(std::string_view key, std::string* value)
+    {
+        uint64_t h = hash(key);
+        Shard& shard = shardOf(h);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.sketch.increment(h);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end())
+        {
+            ++shard.stats.misses;
+            return Lookup::Miss;
+        }
+        Entry* e = it->second.get();
+        if (e->expireNs != 0 && monotonicNs() >= e->expireNs)
+        {
+            ++shard.stats.expired;
+            ++shard.stats.misses;
+            shard.erase(e);
+            return Lookup::Miss;
+        }
+        shard.touch(e);
+        if (e->negative)
+        {
+            ++shard.stats.negativeHits;
+            return Lookup::NegativeHit;
+        }
+        ++shard.stats.hits;
+        if (value != NULL)
+        {
+            value->assign(e->value);
+        }
+        return Lookup::Hit;
+    }
+
+    uint64_t generation() const { return m_generation.load(std::memory_order_acquire); }
+
+    /**
+     * 准备从 source 读取 key，返回票据；generation 与当前的不一致时返回 0，表示这次读到的值不能缓存
+     * 同一个 key 的新票据会作废旧票据
+    */
+    uint64_t reserve(std::string_view key, uint64_t generation)
+    {
+        Shard& shard = shardOf(hash(key));
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (generation != m_generation.load(std::memory_order_acquire))
+        {
+            return 0;
+        }
+        uint64_t ticket = m_nextTicket.fetch_add(1, std::memory_order_relaxed);
+        shard.pending[std::string(key)] = ticket;
+        return ticket;
+    }
+
+    // source 读取失败，放弃票据
+    void cancel(std::string_view key, uint64_t ticket)
+    {
+        if (ticket == 0)
+        {
+            return;
+        }
+        Shard& shard = shardOf(hash(key));
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.pending.find(std::string(key));
+        if (it != shard.pending.end() && it->second == ticket)
+        {
+            shard.pending.erase(it);
+        }
+    }
+
+    /**
+     * 把从 source 读到的值放进缓存，value 为空表示 key 不存在 (负缓存)
+     * 票据已经作废、value 太大或者没有通过准入时不放，返回 false
+    */
+    bool fill(std::string_view key, uint64_t ticket, const std::string_view* value)
+    {
+        if (ticket == 0)
+        {
+            return false;
+        }
+        uint64_t h = hash(key);
+        Shard& shard = shardOf(h);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto pending = shard.pending.find(std::string(key));
+        if (pending == shard.pending.end() || pending->second != ticket)
+        {
+            ++shard.stats.fillsDropped;
+            return false;
+        }
+        shard.pending.erase(pending);
+        if (value != NULL && value->size() > m_opts.maxValueBytes)
+        {
+            return false;
+        }
+
+        auto it = shard.map.find(key);
+        if (it != shard.map.end())
+        {
+            shard.erase(it->second.get());
+        }
+        size_t charge = ENTRY_OVERHEAD + key.size() + (value != NULL ? value->size() : 0);
+        if (charge > shard.capacity)
+        {
+            return false;
+        }
+        while (shard.used + charge > shard.capacity)
+        {
+            Entry* victim = shard.lru.prev;
+            if (m_opts.admission && shard.sketch.estimate(h) <= shard.sketch.estimate(victim->hash))
+            {
+                ++shard.stats.rejected;
+                return false;
+            }
+            ++shard.stats.evictions;
+            shard.erase(victim);
+        }
+
+        std::unique_ptr<Entry> e(new Entry);
+        e->key.assign(key.data(), key.size());
+        e->hash = h;
+        e->negative = value == NULL;
+        if (value != NULL)
+        {
+            e->value.assign(value->data(), value->size());
+        }
+        uint64_t ttlMs = e->negative ? m_opts.negativeTtlMs : m_opts.ttlMs;
+        e->expireNs = ttlMs > 0 ? monotonicNs() + ttlMs * 1000000 : 0;
+        e->charge = charge;
+        shard.insert(std::move(e));
+        ++shard.stats.fills;
+        return true;
+    }
+
+    // 删除一个 key，并作废它正在进行的填充
+    void invalidate(std::string_view key)
+    {
+        Shard& shard = shardOf(hash(key));
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.pending.erase(std::string(key));
+        auto it = shard.map.find(key);
+        if (it != shard.map.end())
+        {
+            ++shard.stats.invalidations;
+            shard.erase(it->second.get());
+        }
+    }
+
+    /**
+     * 清空所有分片，作废所有票据，generation 加一，返回新的 generation
+     * 先加 generation 再逐个清空：清空之前在某个分片上 reserve 成功的票据会被清掉，之后的 reserve 会因为 generation 不一致失败
+    */
+    uint64_t clear()
+    {
+        uint64_t generation = m_generation.fetch_add(1, std::memory_order_acq_rel) + 1;
+        for (size_t i = 0; i <= m_mask; ++i)
+        {
+            Shard& shard = m_shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.pending.clear();
+            while (shard.lru.next != &shard.lru)
+            {
+                shard.erase(shard.lru.next);
+            }
+        }
+        m_clears.fetch_add(1, std::memory_order_relaxed);
+        return generation;
+    }
+
+    Stats stats() const
+    {
+        Stats total;
+        for (size_t i = 0; i <= m_mask; ++i)
+        {
+            Shard& shard = m_shards[i];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            const Stats& s = shard.stats;
+            total.hits += s.hits;
+            total.negativeHits += s.negativeHits;
+            total.misses += s.misses;
+            total.fills += s.fills;
+            total.fillsDropped += s.fillsDropped;
+            total.rejected += s.rejected;
+            total.evictions += s.evictions;
+            total.expired += s.expired;
+            total.invalidations += s.invalidations;
+            total.entries += shard.map.size();
+            total.bytes += shard.used;
+        }
+        total.clears = m_clears.load(std::memory_order_relaxed);
+        return total;
+    }
+
+private:
+    // 每个条目在 key 和 value 之外的大致开销：Entry 本身、哈希表节点和桶
+    static const size_t ENTRY_OVERHEAD = 128;
+
+    struct Entry
+    {
+        Entry* prev = this;
+        Entry* next = this;
+        std::string key;
+        std::string value;
+        uint64_t hash = 0;
+        uint64_t expireNs = 0;
+        size_t charge = 0;
+        bool negative = false;
+    };
+
+    // Count-Min Sketch：4 行 4 位计数器，用一个 64 位哈希的 4 段分别定位
+    class Sketch
+    {
+    public:
+        void init(size_t width)
+        {
+            m_width = width;
+            m_rows.assign(4 * width / 2, 0);
+            m_sampleLimit = width * 10;
+            m_samples = 0;
+        }
+
+        void increment(uint64_t h)
+        {
+            bool added = false;
+            for (int row = 0; row < 4; ++row)
+            {
+                size_t i = index(h, row);
+                uint8_t& byte = m_rows[i / 2];
+                int shift = (i & 1) * 4;
+                if (((byte >> shift) & 0x0f) < 15)
+                {
+                    byte = (uint8_t)(byte + (1 << shift));
+                    added = true;
+                }
+            }
+            if (added && ++m_samples >= m_sampleLimit)
+            {
+                age();
+            }
+        }
+
+        int estimate(uint64_t h) const
+        {
+            int min = 15;
+            for (int row = 0; row < 4; ++row)
+            {
+                size_t i = index(h, row);
+                int v = (m_rows[i / 2] >> ((i & 1) * 4)) & 0x0f;
+                min = v < min ? v : min;
+            }
+            return min;
+        }
+
+    private:
+        size_t index(uint64_t h, int row) const
+        {
+            // 每一行用哈希的不同 16 位再混一次，行之间的碰撞互相独立
+            uint64_t x = ((h >> (16 * row)) & 0xffff) * 0x9E3779B97F4A7C15ULL + h;
+            return (size_t)(row * m_width + ((x >> 32) & (m_width - 1)));
+        }
+
+        // 所有计数器减半，一个字节里的两个 4 位计数器同时右移
+        void age()
+        {
+            for (uint8_t& byte : m_rows)
+            {
+                byte = (uint8_t)((byte >> 1) & 0x77);
+            }
+            m_samples /= 2;
+        }
+
+        std::vector<uint8_t> m_rows;
+        size_t m_width = 0;
+        size_t m_sampleLimit = 0;
+        size_t m_samples = 0;
+    };
+
+    // 独占缓存行，不同分片的锁不会互相干扰
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;
+        // key 指向 Entry 自己的 key，查找时不用构造 std::string
+        std::unordered_map<std::string_view, std::unique_ptr<Entry>> map;
+        std::unordered_map<std::string, uint64_t> pending; // 正在从 source 读取的 key 和票据
+        Entry lru;                                         // 哨兵，next 是最近使用的
+        size_t used = 0;
+        size_t capacity = 0;
+        Sketch sketch;
+        Stats stats;
+
+        void touch(Entry* e)
+        {
+            unlink(e);
+            pushFront(e);
+        }
+
+        void insert(std::unique_ptr<Entry> e)
+        {
+            Entry* raw = e.get();
+            used += raw->charge;
+            pushFront(raw);
+            map.emplace(std::string_view(raw->key), std::move(e));
+        }
+
+        void erase(Entry* e)
+        {
+            unlink(e);
+            used -= e->charge;
+            // 先找到节点再删，删除时会释放 e，key 不能再被用到
+            map.erase(map.find(std::string_view(e->key)));
+        }
+
+        void unlink(Entry* e)
+        {
+            e->prev->next = e->next;
+            e->next->prev = e->prev;
+        }
+
+        void pushFront(Entry* e)
+        {
+            e->next = lru.next;
+            e->prev = &lru;
+            lru.next->prev = e;
+            lru.next = e;
+        }
+    };
+
+    static uint64_t hash(std::string_view key)
+    {
+        // std::hash 在 libstdc++ 里是 murmur，低位和高位都可以用；再混一次保证 sketch 的 4 段哈希分布均匀
+        uint64_t h = std::hash<std::string_view>()(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    Shard& shardOf(uint64_t h) { return m_shards[h & m_mask]; }
+
+    Options m_opts;
+    size_t m_mask;
+    std::unique_ptr<Shard[]> m_shards;
+    std::atomic<uint64_t> m_generation{1};
+    std::atomic<uint64_t> m_nextTicket{1};
+    std::atomic<uint64_t> m_clears{0};
+};
+
+#endif
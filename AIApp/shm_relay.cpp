@@ -0,0 +1,164 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <sys/socket.h>
+#include <hiredis/hiredis.h>
+#include "latency.h"
+#include "redis_endpoint.h"
+#include "reply_arena.h"
+#include "shm_ring.h"
+
+// 本机的订阅中继
+// 用一个连接订阅 Redis 的频道，把收到的每条消息原样写进共享内存环形缓冲区 (shm_ring.h)，
+// 同一台机器上的聊天进程 (ChatCore 设置了 shmRing，testAppMultThread 的 CHAT_SHM_RING 环境变量，fanout_bench --shm)
+// 各自从环里读取，不再各自订阅：Redis 每条消息只向这台机器发送一次，本机的扇出只是每个读端一次 memcpy
+//
+// 共享内存在 /dev/shm 下，relay 退出时不删除，重启之后接着原来的位置写，读端不需要重新打开；
+// 需要删除时用 --unlink，或者直接 rm /dev/shm/<name>
+//
+// 用法：shm_relay --channel chat --name /chat_ring，然后 CHAT_SHM_RING=/chat_ring ./testAppMultThread
+
+struct Options {
+    const char* channel = "chat";
+    const char* name = "/chat_ring";
+    size_t sizeMb = 64;       // 环的大小，读端最多可以落后这么多数据
+    bool unlinkOnExit = false;
+    RedisEndpoint endpoint = RedisEndpoint::fromEnv();
+};
+
+// 信号处理函数里关闭订阅连接的读写，让阻塞在 read 上的主循环返回错误并退出
+static volatile int g_fd = -1;
+static volatile sig_atomic_t g_stop = 0;
+
+static void onSignal(int) {
+    g_stop = 1;
+    if (g_fd >= 0) {
+        shutdown(g_fd, SHUT_RDWR);
+    }
+}
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--channel NAME] [--name /SHM_NAME] [--size MB] [--unlink 0|1]"
+              << " [--endpoint HOST:PORT|unix:PATH]" << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--channel") == 0) {
+            opts.channel = value;
+        } else if (strcmp(arg, "--name") == 0) {
+            opts.name = value;
+        } else if (strcmp(arg, "--size") == 0) {
+            opts.sizeMb = (size_t)atol(value);
+        } else if (strcmp(arg, "--unlink") == 0) {
+            opts.unlinkOnExit = atoi(value) != 0;
+        } else if (strcmp(arg, "--endpoint") == 0) {
+            if (!RedisEndpoint::parse(value, opts.endpoint)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    // shm_open 的名字必须以 / 开头
+    return opts.name[0] == '/' && opts.sizeMb > 0;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    ShmRingWriter ring;
+    if (!ring.open(opts.name, opts.sizeMb * 1024 * 1024)) {
+        return 1;
+    }
+
+    redisContext* context = opts.endpoint.connect();
+    if (context == NULL || context->err) {
+        std::cerr << "Error: " << (context ? context->errstr : "can't allocate redis context") << std::endl;
+        if (context) {
+            redisFree(context);
+        }
+        return 1;
+    }
+    redisReply* reply = (redisReply*)redisCommand(context, "SUBSCRIBE %s", opts.channel);
+    if (reply == NULL) {
+        std::cerr << "Error: " << context->errstr << std::endl;
+        redisFree(context);
+        return 1;
+    }
+    freeReplyObject(reply);
+
+    g_fd = context->fd;
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    std::cerr << "Relaying " << opts.channel << " from " << opts.endpoint.toString() << " into " << opts.name
+              << " (" << ring.capacity() / 1048576 << " MB)" << std::endl;
+
+    // 与 ChatCore 的接收线程一样：回复在 arena 上解析，读缓冲区里的消息全部写进环之后只唤醒一次读端
+    ReplyArena arena;
+    arena.attach(context);
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    uint64_t oversized = 0;
+    uint64_t lastMessages = 0;
+    uint64_t lastBytes = 0;
+    uint64_t lastReportNs = monotonicNs();
+
+    while (!g_stop) {
+        void* r = NULL;
+        if (redisGetReply(context, &r) != REDIS_OK) {
+            break;
+        }
+        while (r != NULL) {
+            ArenaReply* message = static_cast<ArenaReply*>(r);
+            if (message->type == REDIS_REPLY_ARRAY && message->elements == 3 && message->element[2]->type == REDIS_REPLY_STRING) {
+                const ArenaReply* body = message->element[2];
+                if (ring.publish(body->str, body->len)) {
+                    ++messages;
+                    bytes += body->len;
+                } else {
+                    ++oversized;
+                }
+            }
+            r = NULL;
+            if (redisGetReplyFromReader(context, &r) != REDIS_OK) {
+                r = NULL;
+                break;
+            }
+        }
+        ring.notify();
+        arena.resetIfIdle(context->reader);
+
+        uint64_t now = monotonicNs();
+        double seconds = (now - lastReportNs) / 1e9;
+        if (seconds >= 1.0) {
+            printf("messages/s=%.0f MB/s=%.2f total=%llu oversized=%llu\n", (messages - lastMessages) / seconds,
+                   (bytes - lastBytes) / 1048576.0 / seconds, (unsigned long long)messages, (unsigned long long)oversized);
+            fflush(stdout);
+            lastMessages = messages;
+            lastBytes = bytes;
+            lastReportNs = now;
+        }
+    }
+    if (!g_stop) {
+        std::cerr << "Subscriber error: " << context->errstr << std::endl;
+    }
+    std::cerr << "Relayed " << messages << " messages (" << oversized << " too large for the ring)" << std::endl;
+
+    g_fd = -1;
+    redisFree(context);
+    if (opts.unlinkOnExit) {
+        ShmRingWriter::unlink(opts.name);
+    }
+    return g_stop ? 0 : 1;
+}
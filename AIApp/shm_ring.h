@@ -0,0 +1,516 @@
+#ifndef AIAPP_SHM_RING_H
+#define AIAPP_SHM_RING_H
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * 放在共享内存 (shm_open + mmap) 里的单写者、多读者环形缓冲区，用于同一台机器上的多个聊天进程共享一个 Redis 订阅
+ *
+ * 写端 (shm_relay) 订阅 Redis，把每条消息作为一条变长记录追加进环里；读端 (ChatCore) 各自维护自己的读位置，互不影响
+ * - 写端从不等待读端：环满了就直接覆盖最老的记录，读得太慢的读端会检测到被覆盖 (overrun)，跳到最新位置并统计丢失的条数
+ * - 检测方式与 seqlock 相同：写端先公布 "将要写到哪里" (m_header->reserve)，再写数据；
+ *   读端先拷贝记录，再检查 reserve，如果写端已经开始覆盖这段位置就丢弃刚才的拷贝
+ * - 没有新消息时读端在 futexWord 上睡眠 (跨进程的 futex，不能用 FUTEX_PRIVATE_FLAG)，
+ *   写端每批消息调用一次 notify()，只有确实有读端在睡眠时才会进入内核
+ *
+ * 位置都是只增不减的 64 位字节偏移，与容量 (2 的幂) 取模得到在数据区里的位置；记录按 8 字节对齐，
+ * 放不下的记录不会折返，而是在末尾写一条填充记录，从数据区开头重新开始
+ * - 写端换了容量重新启动时不会改变旧段的大小 (还映射着旧段的读端会在访问文件末尾之外时收到 SIGBUS)，
+ *   而是把旧段标记为 retired、删除名字，另建一个同名的新段；读端读完旧段之后看到 retired，自己改读新段
+*/
+class ShmRing
+{
+public:
+    ShmRing() : m_fd(-1), m_base(NULL), m_header(NULL), m_data(NULL), m_capacity(0), m_mapSize(0) {}
+    ~ShmRing() { close(); }
+
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    void close()
+    {
+        if (m_base != NULL)
+        {
+            munmap(m_base, m_mapSize);
+            m_base = NULL;
+            m_header = NULL;
+            m_data = NULL;
+        }
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+    }
+
+    size_t capacity() const { return m_capacity; }
+    // 单条消息的长度上限，保证一条记录 (加上可能的填充) 不会占满整个环
+    size_t maxMessage() const { return m_capacity / 4; }
+
+protected:
+    static const uint64_t MAGIC = 0x31474e4952534843ULL; // "CHSRING1"
+    static const uint32_t VERSION = 1;
+    // 头部单独占一页，数据区从页边界开始
+    static const size_t HEADER_SIZE = 4096;
+    static const uint32_t FLAG_PAD = 1;
+
+    struct Header
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t capacity;
+        std::atomic<int32_t> writerPid;  // 写端的进程号，写端退出时清零
+        std::atomic<uint32_t> retired;   // 写端已经换了同名的新段，这个段不会再有新数据
+        // 写端修改的位置和读端修改的等待计数放在不同的缓存行上
+        alignas(64) std::atomic<uint64_t> reserve;   // 写端正在写 (或者已经写完) 的最远位置
+        std::atomic<uint64_t> writePos;              // 已经写完、读端可以读取的位置
+        std::atomic<uint64_t> published;             // 已经写入的消息数，写端重启后接着编号
+        alignas(64) std::atomic<uint32_t> futexWord; // 每次 notify 加一，读端在上面睡眠
+        std::atomic<uint32_t> waiters;               // 正在睡眠 (或者准备睡眠) 的读端数量
+    };
+
+    // 每条记录的头部，seq 是写端给消息的连续编号，读端据此计算被覆盖丢失的条数
+    struct Record
+    {
+        uint64_t seq;
+        uint32_t len;
+        uint32_t flags;
+    };
+
+    static_assert(sizeof(Header) <= HEADER_SIZE, "shm ring header must fit in one page");
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32-bit integer");
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared atomics must be lock-free");
+
+    static size_t recordSize(size_t len) { return (sizeof(Record) + len + 7) & ~(size_t)7; }
+
+    static long futex(std::atomic<uint32_t>* word, int op, uint32_t value, const struct timespec* timeout)
+    {
+        return syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, value, timeout, NULL, 0);
+    }
+
+    bool map(size_t capacity)
+    {
+        m_mapSize = HEADER_SIZE + capacity;
+        void* base = mmap(NULL, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (base == MAP_FAILED)
+        {
+            std::cerr << "mmap failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        m_base = base;
+        m_header = static_cast<Header*>(base);
+        m_data = static_cast<char*>(base) + HEADER_SIZE;
+        m_capacity = capacity;
+        return true;
+    }
+
+    int m_fd;
+    void* m_base;
+    Header* m_header;
+    char* m_data;
+    size_t m_capacity;
+    size_t m_mapSize;
+};
+
+class ShmRingWriter : public ShmRing
+{
+public:
+    ShmRingWriter() : m_pos(0), m_seq(0) {}
+
+    ~ShmRingWriter()
+    {
+        if (m_header != NULL)
+        {
+            m_header->writerPid.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // 创建 (或者接管已有的) 共享内存段，capacity 向上取整为 2 的幂，最小 64KB
+    // 已有的段容量相同时接着原来的位置和编号继续写，写端重启时读端不需要重新打开
+    bool open(const char* name, size_t capacity)
+    {
+        size_t cap = 64 * 1024;
+        while (cap < capacity)
+        {
+            cap <<= 1;
+        }
+        m_fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (m_fd < 0)
+        {
+            std::cerr << "shm_open " << name << " failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        // 同一个环只能有一个写端，用文件锁保证，写端进程退出时锁自动释放
+        if (flock(m_fd, LOCK_EX | LOCK_NB) != 0)
+        {
+            std::cerr << "Another writer holds " << name << std::endl;
+            close();
+            return false;
+        }
+        struct stat st;
+        if (fstat(m_fd, &st) != 0)
+        {
+            close();
+            return false;
+        }
+        bool reuse = (size_t)st.st_size == HEADER_SIZE + cap;
+        // 容量变了的旧段可能还有上一次运行的读端映射着，不能原地改大小；够不上一个头部的段读端不会打开，可以直接截断
+        if (!reuse && (size_t)st.st_size > HEADER_SIZE && !replace(name))
+        {
+            close();
+            return false;
+        }
+        if (!reuse && ftruncate(m_fd, (off_t)(HEADER_SIZE + cap)) != 0)
+        {
+            std::cerr << "ftruncate " << name << " failed: " << strerror(errno) << std::endl;
+            close();
+            return false;
+        }
+        if (!map(cap))
+        {
+            close();
+            return false;
+        }
+        if (reuse && m_header->magic == MAGIC && m_header->version == VERSION && m_header->capacity == cap)
+        {
+            m_pos = m_header->writePos.load(std::memory_order_relaxed);
+            m_seq = m_header->published.load(std::memory_order_relaxed);
+        }
+        else
+        {
+            // 新建的段全部是 0；magic 最后写入，读端看到 magic 时其余字段都已经就绪
+            m_header->magic = 0;
+            m_header->version = VERSION;
+            m_header->capacity = cap;
+            m_header->reserve.store(0, std::memory_order_relaxed);
+            m_header->writePos.store(0, std::memory_order_relaxed);
+            m_header->published.store(0, std::memory_order_relaxed);
+            m_header->futexWord.store(0, std::memory_order_relaxed);
+            m_header->waiters.store(0, std::memory_order_relaxed);
+            m_header->retired.store(0, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            m_header->magic = MAGIC;
+        }
+        m_header->writerPid.store((int32_t)getpid(), std::memory_order_relaxed);
+        return true;
+    }
+
+    // 追加一条消息，不唤醒读端 (一批消息写完之后调用 notify)；消息超过 maxMessage() 时返回 false
+    bool publish(const char* data, size_t len)
+    {
+        if (len > maxMessage())
+        {
+            return false;
+        }
+        size_t recLen = recordSize(len);
+        size_t offset = m_pos & (m_capacity - 1);
+        size_t rest = m_capacity - offset;
+        size_t pad = rest < recLen ? rest : 0;
+        uint64_t end = m_pos + pad + recLen;
+
+        // 先公布要覆盖到哪里，再动数据：读端拷贝完之后检查 reserve，就知道拷贝期间有没有被覆盖
+        m_header->reserve.store(end, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        // 剩下的空间不够一个记录头时读端会自己跳过，不需要填充记录
+        if (pad >= sizeof(Record))
+        {
+            Record padding = {0, 0, FLAG_PAD};
+            memcpy(m_data + offset, &padding, sizeof(padding));
+        }
+        char* dst = m_data + ((m_pos + pad) & (m_capacity - 1));
+        Record record = {m_seq, (uint32_t)len, 0};
+        memcpy(dst, &record, sizeof(record));
+        memcpy(dst + sizeof(record), data, len);
+
+        m_pos = end;
+        ++m_seq;
+        m_header->published.store(m_seq, std::memory_order_relaxed);
+        m_header->writePos.store(m_pos, std::memory_order_release);
+        return true;
+    }
+
+    // 唤醒正在等待的读端，只有确实有读端在睡眠时才调用 futex
+    void notify()
+    {
+        m_header->futexWord.fetch_add(1, std::memory_order_seq_cst);
+        if (m_header->waiters.load(std::memory_order_seq_cst) > 0)
+        {
+            futex(&m_header->futexWord, FUTEX_WAKE, INT_MAX, NULL);
+        }
+    }
+
+    uint64_t published() const { return m_seq; }
+
+    // 删除共享内存的名字，已经映射了的进程不受影响
+    static void unlink(const char* name) { shm_unlink(name); }
+
+private:
+    // 把 m_fd 指向的旧段标记为 retired 并唤醒睡眠的读端，然后删除名字，m_fd 换成一个新建的同名空段
+    bool replace(const char* name)
+    {
+        void* old = mmap(NULL, HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (old == MAP_FAILED)
+        {
+            std::cerr << "mmap " << name << " failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        Header* header = static_cast<Header*>(old);
+        if (header->magic == MAGIC)
+        {
+            header->retired.store(1, std::memory_order_release);
+            header->futexWord.fetch_add(1, std::memory_order_seq_cst);
+            futex(&header->futexWord, FUTEX_WAKE, INT_MAX, NULL);
+        }
+        munmap(old, HEADER_SIZE);
+        shm_unlink(name);
+        // O_EXCL：删除名字之后有别的写端抢先建了同名的段，就让给它
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) != 0)
+        {
+            std::cerr << "Another writer took over " << name << std::endl;
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            return false;
+        }
+        // 关闭旧段同时释放它上面的锁
+        ::close(m_fd);
+        m_fd = fd;
+        return true;
+    }
+
+    uint64_t m_pos;  // 写端自己的写位置，与 m_header->writePos 相同
+    uint64_t m_seq;
+};
+
+class ShmRingReader : public ShmRing
+{
+public:
+    ShmRingReader() : m_pos(0), m_expected(0), m_lost(0), m_overruns(0), m_reattaches(0) {}
+
+    // 打开写端已经创建好的环，从当前的最新位置开始读 (只读之后的新消息)
+    bool open(const char* name)
+    {
+        m_name = name;
+        return attach(false);
+    }
+
+    bool readable() const { return m_header->writePos.load(std::memory_order_seq_cst) != m_pos; }
+
+    // 取出最多 maxMessages 条消息交给 fn(const char* data, size_t len)，返回取出的条数
+    // data 指向读端自己的缓冲区，只在 fn 调用期间有效
+    template <typename Fn>
+    size_t poll(size_t maxMessages, Fn&& fn)
+    {
+        size_t delivered = 0;
+        while (delivered < maxMessages)
+        {
+            uint64_t end = m_header->writePos.load(std::memory_order_acquire);
+            if (m_pos == end)
+            {
+                // 旧段已经读完，写端换了新段：改读新段 (新段还没建好就下次再试)
+                if (m_header->retired.load(std::memory_order_acquire) && attach(true))
+                {
+                    ++m_reattaches;
+                    continue;
+                }
+                break;
+            }
+            if (end - m_pos > m_capacity)
+            {
+                resync();
+                continue;
+            }
+            size_t offset = m_pos & (m_capacity - 1);
+            size_t rest = m_capacity - offset;
+            if (rest < sizeof(Record))
+            {
+                m_pos += rest;
+                continue;
+            }
+            Record record;
+            memcpy(&record, m_data + offset, sizeof(record));
+            if (record.flags & FLAG_PAD)
+            {
+                if (!intact())
+                {
+                    resync();
+                    continue;
+                }
+                m_pos += rest;
+                continue;
+            }
+            // 长度不合理只可能是读到了正在被覆盖的记录
+            if (record.len > maxMessage() || recordSize(record.len) > rest)
+            {
+                resync();
+                continue;
+            }
+            memcpy(&m_scratch[0], m_data + offset + sizeof(record), record.len);
+            if (!intact())
+            {
+                resync();
+                continue;
+            }
+            if (record.seq > m_expected)
+            {
+                m_lost += record.seq - m_expected;
+            }
+            m_expected = record.seq + 1;
+            m_pos += recordSize(record.len);
+            ++delivered;
+            fn(m_scratch.data(), (size_t)record.len);
+        }
+        return delivered;
+    }
+
+    // 没有新消息时睡眠最多 timeoutMs 毫秒，返回是否有新消息可读
+    bool wait(int timeoutMs)
+    {
+        // 先记下 futexWord 再检查位置：检查之后写端的 notify 会改变 futexWord，futex 等待会立即返回，不会错过唤醒
+        uint32_t word = m_header->futexWord.load(std::memory_order_seq_cst);
+        if (readable())
+        {
+            return true;
+        }
+        m_header->waiters.fetch_add(1, std::memory_order_seq_cst);
+        if (!readable())
+        {
+            struct timespec timeout;
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = (long)(timeoutMs % 1000) * 1000000L;
+            futex(&m_header->futexWord, FUTEX_WAIT, word, &timeout);
+        }
+        m_header->waiters.fetch_sub(1, std::memory_order_seq_cst);
+        return readable();
+    }
+
+    bool writerAlive() const
+    {
+        int32_t pid = m_header->writerPid.load(std::memory_order_relaxed);
+        return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+    }
+
+    // 因为读得太慢被写端覆盖、没有读到的消息数
+    uint64_t lost() const { return m_lost; }
+    // 发生覆盖、跳到最新位置的次数
+    uint64_t overruns() const { return m_overruns; }
+    // 写端换了新段之后改读新段的次数
+    uint64_t reattaches() const { return m_reattaches; }
+
+private:
+    // 打开 m_name 当前指向的段，失败时原来映射的段 (如果有) 保持不变
+    // 第一次打开时从最新位置开始读；旧段 retired 之后改读的新段是写端从零开始写的，从头读，一条也不漏
+    // (写端已经绕了一圈的话，poll 会按覆盖处理并统计丢失)
+    bool attach(bool reattach)
+    {
+        bool verbose = !reattach;
+        int fd = shm_open(m_name.c_str(), O_RDWR | O_CLOEXEC, 0);
+        if (fd < 0)
+        {
+            if (verbose)
+            {
+                std::cerr << "shm_open " << m_name << " failed: " << strerror(errno) << " (is shm_relay running?)" << std::endl;
+            }
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size <= HEADER_SIZE)
+        {
+            if (verbose)
+            {
+                std::cerr << "Shared memory " << m_name << " is not initialized" << std::endl;
+            }
+            ::close(fd);
+            return false;
+        }
+        size_t mapSize = (size_t)st.st_size;
+        void* base = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+        {
+            if (verbose)
+            {
+                std::cerr << "mmap failed: " << strerror(errno) << std::endl;
+            }
+            ::close(fd);
+            return false;
+        }
+        Header* header = static_cast<Header*>(base);
+        uint64_t magic = header->magic;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // 已经 retired 的段只会在写端删除名字之前的一瞬间被打开到，当作还没建好
+        if (magic != MAGIC || header->version != VERSION || header->capacity != mapSize - HEADER_SIZE
+            || header->retired.load(std::memory_order_acquire))
+        {
+            if (verbose)
+            {
+                std::cerr << "Shared memory " << m_name << " is not a chat ring" << std::endl;
+            }
+            munmap(base, mapSize);
+            ::close(fd);
+            return false;
+        }
+        close();
+        m_fd = fd;
+        m_base = base;
+        m_mapSize = mapSize;
+        m_header = header;
+        m_data = static_cast<char*>(base) + HEADER_SIZE;
+        m_capacity = mapSize - HEADER_SIZE;
+        m_scratch.resize(maxMessage());
+        if (reattach)
+        {
+            m_pos = 0;
+            m_expected = 0;
+            return true;
+        }
+        // published 在 writePos 之前更新，读到的值可能比 m_pos 处的下一条记录的编号多一，
+        // 只影响 "还没读到任何一条就被覆盖" 时丢失条数的统计 (最多少算一条)
+        m_pos = m_header->writePos.load(std::memory_order_acquire);
+        m_expected = m_header->published.load(std::memory_order_relaxed);
+        return true;
+    }
+
+    // 拷贝完一段数据之后调用：写端还没有开始覆盖 m_pos 开始的这条记录时返回 true
+    bool intact() const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return m_header->reserve.load(std::memory_order_relaxed) - m_pos <= m_capacity;
+    }
+
+    // 被覆盖之后跳到最新位置，丢失的条数在读到下一条记录时根据编号补上
+    void resync()
+    {
+        ++m_overruns;
+        m_pos = m_header->writePos.load(std::memory_order_acquire);
+    }
+
+    uint64_t m_pos;
+    uint64_t m_expected; // 下一条记录应有的编号
+    uint64_t m_lost;
+    uint64_t m_overruns;
+    uint64_t m_reattaches;
+    std::string m_name;
+    std::vector<char> m_scratch;
+};
+
+#endif
@@ -2,11 +2,175 @@
 #include <thread>
 #include <vector>
 #include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
 #include <hiredis/hiredis.h>
+#include "latency.h"
+#include "format.h"
+#include "chat_envelope.h"
+#include "redis_endpoint.h"
+
+// 发送模式
+// sync     : 每条消息一次阻塞的 redisCommand，测出来的基本是 RTT
+// pipeline : 使用 redisAppendCommand 维持一个深度为 pipelineDepth 的滑动窗口
+// multi    : 每 batchSize 条消息包在一个 MULTI/EXEC 事务里，整批一起发出
+enum class SendMode {
+    Sync,
+    Pipeline,
+    Multi
+};
+
+struct Options {
+    SendMode mode = SendMode::Sync;
+    int numClients = 100;   // 并发客户端数量
+    int numMessages = 2000; // 每个客户端发送的消息数量
+    int pipelineDepth = 64; // pipeline 模式下允许同时在途的命令数量
+    int batchSize = 100;    // multi 模式下每个事务包含的 PUBLISH 数量
+    RedisEndpoint endpoint = RedisEndpoint::fromEnv();
+    // 设置了 --compare 时，同样的负载先在 endpoint 上跑一遍，再在 compareEndpoint 上跑一遍，然后对比
+    bool compare = false;
+    RedisEndpoint compareEndpoint;
+};
+
+// 每个客户端线程的统计结果，由各自的线程写入，主线程在 join 之后读取
+// latency 的含义随模式不同：sync 是每条命令的往返，pipeline 是每条命令从写进输出缓冲区到读到回复，multi 是整个事务
+struct ClientStats {
+    int sent = 0;
+    bool ok = true;
+    double seconds = 0.0;
+    LatencyHistogram latency;
+};
+
+// 一次完整负载的汇总结果
+struct WorkloadResult {
+    double seconds = 0.0;  // 墙上时间
+    long long sent = 0;
+    double sumRate = 0.0;  // 各客户端速率之和
+    int failed = 0;
+    LatencyHistogram latency;
+};
+
+static const char* modeName(SendMode mode) {
+    switch (mode) {
+        case SendMode::Sync: return "sync";
+        case SendMode::Pipeline: return "pipeline";
+        case SendMode::Multi: return "multi";
+    }
+    return "unknown";
+}
+
+// 读取一条回复，出错时打印错误信息并返回 false
+static bool readReply(redisContext* context, int clientId) {
+    redisReply* reply = nullptr;
+    if (redisGetReply(context, (void**)&reply) != REDIS_OK) {
+        std::cerr << "Client " << clientId << " error: " << context->errstr << std::endl;
+        return false;
+    }
+    bool ok = reply->type != REDIS_REPLY_ERROR;
+    if (!ok) {
+        std::cerr << "Client " << clientId << " error reply: " << reply->str << std::endl;
+    }
+    freeReplyObject(reply);
+    return ok;
+}
+
+// 消息缓冲区的大小，正文很短，加上信封头部也远远用不完
+static const size_t MESSAGE_CAP = 128;
+
+// 构造一条消息信封：发送者 ID 就是 clientId，序号就是消息下标，订阅端据此计算延迟和丢失/乱序
+// 正文和信封都直接写进调用方栈上的缓冲区，不分配内存，返回信封的长度
+// 正文用 format.h 格式化，格式串在编译期解析，比 snprintf 快约三倍 (见 format_bench)
+static size_t buildMessage(char* buf, int clientId, int i) {
+    char body[64];
+    size_t bodyLen = formatTo(body, FMT("Client {} Message {}"), clientId, i);
+    return encodeEnvelope(buf, MESSAGE_CAP, (uint64_t)clientId, (uint64_t)i, monotonicNs(), ENVELOPE_FLAG_TEXT, body, bodyLen);
+}
+
+static bool sendSync(redisContext* context, int clientId, const Options& opts, ClientStats& stats) {
+    for (int i = 0; i < opts.numMessages; ++i) {
+        char message[MESSAGE_CAP];
+        size_t len = buildMessage(message, clientId, i);
+        uint64_t startNs = monotonicNs();
+        redisReply* reply = (redisReply*)redisCommand(context, "PUBLISH chat %b", message, len);
+        if (reply == NULL) {
+            std::cerr << "Client " << clientId << " error: " << context->errstr << std::endl;
+            return false;
+        }
+        stats.latency.record(monotonicNs() - startNs);
+        freeReplyObject(reply);
+        ++stats.sent;
+    }
+    return true;
+}
+
+// 滑动窗口式的 pipeline：
+// redisAppendCommand 只把命令写进 context 的输出缓冲区，真正的 write 发生在 redisGetReply 需要读取网络数据的时候
+// 所以当在途命令达到 pipelineDepth 时才读一条回复，输出缓冲区里积累的命令会被合并成一次写入
+// 回复按发送顺序返回，每条在途命令的发送时间放在一个环形数组里，读到回复时取出最老的一个计算延迟
+static bool sendPipeline(redisContext* context, int clientId, const Options& opts, ClientStats& stats) {
+    std::vector<uint64_t> sendNs(opts.pipelineDepth);
+    size_t head = 0; // 下一条命令的发送时间写在这里
+    size_t tail = 0; // 下一条回复对应的发送时间
+    int inflight = 0;
+    auto receiveOne = [&]() {
+        if (!readReply(context, clientId)) {
+            return false;
+        }
+        stats.latency.record(monotonicNs() - sendNs[tail]);
+        tail = (tail + 1) % sendNs.size();
+        --inflight;
+        ++stats.sent;
+        return true;
+    };
+    for (int i = 0; i < opts.numMessages; ++i) {
+        char message[MESSAGE_CAP];
+        size_t len = buildMessage(message, clientId, i);
+        if (redisAppendCommand(context, "PUBLISH chat %b", message, len) != REDIS_OK) {
+            std::cerr << "Client " << clientId << " error: " << context->errstr << std::endl;
+            return false;
+        }
+        sendNs[head] = monotonicNs();
+        head = (head + 1) % sendNs.size();
+        if (++inflight == opts.pipelineDepth && !receiveOne()) {
+            return false;
+        }
+    }
+    // 把窗口里剩下的回复收完
+    while (inflight > 0) {
+        if (!receiveOne()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// MULTI/EXEC 批量模式：一个事务对应 1 (MULTI) + n (QUEUED) + 1 (EXEC) 条回复
+static bool sendMulti(redisContext* context, int clientId, const Options& opts, ClientStats& stats) {
+    for (int i = 0; i < opts.numMessages; i += opts.batchSize) {
+        int n = std::min(opts.batchSize, opts.numMessages - i);
+        uint64_t startNs = monotonicNs();
+        redisAppendCommand(context, "MULTI");
+        for (int j = 0; j < n; ++j) {
+            char message[MESSAGE_CAP];
+            size_t len = buildMessage(message, clientId, i + j);
+            redisAppendCommand(context, "PUBLISH chat %b", message, len);
+        }
+        redisAppendCommand(context, "EXEC");
+        for (int j = 0; j < n + 2; ++j) {
+            if (!readReply(context, clientId)) {
+                return false;
+            }
+        }
+        stats.latency.record(monotonicNs() - startNs);
+        stats.sent += n;
+    }
+    return true;
+}
 
 // 发送消息的函数
-void sendMessage(int clientId, int numMessages) {
-    redisContext* context = redisConnect("127.0.0.1", 6379);
+void sendMessage(int clientId, const Options& opts, const RedisEndpoint& endpoint, ClientStats& stats) {
+    redisContext* context = endpoint.connect();
     if (context == NULL || context->err) {
         if (context) {
             std::cerr << "Error: " << context->errstr << std::endl;
@@ -14,29 +178,88 @@ void sendMessage(int clientId, int numMessages) {
         } else {
             std::cerr << "Can't allocate redis context" << std::endl;
         }
+        stats.ok = false;
         return;
     }
-    
-    for (int i = 0; i < numMessages; ++i) {
-        std::string message = "Client " + std::to_string(clientId) + " Message " + std::to_string(i);
-        redisCommand(context, "PUBLISH chat %s", message.c_str());
+
+    // 只统计真正的发送阶段，不把建立连接的时间算进去
+    auto start = std::chrono::steady_clock::now();
+    switch (opts.mode) {
+        case SendMode::Sync:
+            stats.ok = sendSync(context, clientId, opts, stats);
+            break;
+        case SendMode::Pipeline:
+            stats.ok = sendPipeline(context, clientId, opts, stats);
+            break;
+        case SendMode::Multi:
+            stats.ok = sendMulti(context, clientId, opts, stats);
+            break;
     }
+    auto end = std::chrono::steady_clock::now();
+    stats.seconds = std::chrono::duration<double>(end - start).count();
 
     redisFree(context);
 }
 
-int main() {
-    int numClients = 100; // 并发客户端数量
-    int numMessages = 2000; // 每个客户端发送的消息数量
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--mode sync|pipeline|multi] [--clients N] [--messages N]"
+              << " [--depth N] [--batch N] [--endpoint HOST:PORT|unix:PATH] [--compare HOST:PORT|unix:PATH]" << std::endl;
+    std::cerr << "  --compare runs the same workload on --endpoint and then on the given endpoint,"
+              << " e.g. --endpoint 127.0.0.1:6379 --compare unix:/tmp/redis.sock" << std::endl;
+}
 
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--mode") == 0) {
+            if (strcmp(value, "sync") == 0) {
+                opts.mode = SendMode::Sync;
+            } else if (strcmp(value, "pipeline") == 0) {
+                opts.mode = SendMode::Pipeline;
+            } else if (strcmp(value, "multi") == 0) {
+                opts.mode = SendMode::Multi;
+            } else {
+                return false;
+            }
+        } else if (strcmp(arg, "--clients") == 0) {
+            opts.numClients = atoi(value);
+        } else if (strcmp(arg, "--messages") == 0) {
+            opts.numMessages = atoi(value);
+        } else if (strcmp(arg, "--depth") == 0) {
+            opts.pipelineDepth = atoi(value);
+        } else if (strcmp(arg, "--batch") == 0) {
+            opts.batchSize = atoi(value);
+        } else if (strcmp(arg, "--endpoint") == 0) {
+            if (!RedisEndpoint::parse(value, opts.endpoint)) {
+                return false;
+            }
+        } else if (strcmp(arg, "--compare") == 0) {
+            if (!RedisEndpoint::parse(value, opts.compareEndpoint)) {
+                return false;
+            }
+            opts.compare = true;
+        } else {
+            return false;
+        }
+    }
+    return opts.numClients > 0 && opts.numMessages > 0 && opts.pipelineDepth > 0 && opts.batchSize > 0;
+}
+
+// 在 endpoint 上跑一遍完整的负载，verbose 时打印每个客户端各自的发送速率
+static WorkloadResult runWorkload(const Options& opts, const RedisEndpoint& endpoint, bool verbose) {
     std::vector<std::thread> threads;
+    std::vector<ClientStats> stats(opts.numClients);
 
     // 记录开始时间
-    auto start = std::chrono::high_resolution_clock::now();
+    auto start = std::chrono::steady_clock::now();
 
     // 创建并启动多个线程，每个线程模拟一个客户端发送消息
-    for (int i = 0; i < numClients; ++i) {
-        threads.emplace_back(sendMessage, i, numMessages);
+    for (int i = 0; i < opts.numClients; ++i) {
+        threads.emplace_back(sendMessage, i, std::cref(opts), std::cref(endpoint), std::ref(stats[i]));
     }
 
     // 等待所有线程完成
@@ -46,10 +269,82 @@ int main() {
         }
     }
     // 记录结束时间
-    auto end = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> duration = end - start;
+    auto end = std::chrono::steady_clock::now();
 
-    std::cout << "All messages sent in " << duration.count() << " seconds." << std::endl;
+    WorkloadResult result;
+    result.seconds = std::chrono::duration<double>(end - start).count();
+    for (int i = 0; i < opts.numClients; ++i) {
+        const ClientStats& s = stats[i];
+        double rate = s.seconds > 0 ? s.sent / s.seconds : 0.0;
+        if (verbose) {
+            std::cout << "Client " << i << ": " << s.sent << " messages, " << rate << " msg/s"
+                      << (s.ok ? "" : " (FAILED)") << std::endl;
+        }
+        result.sent += s.sent;
+        result.sumRate += rate;
+        result.failed += s.ok ? 0 : 1;
+        result.latency.merge(s.latency);
+    }
+    return result;
+}
 
-    return 0;
-}
\ No newline at end of file
+static void printResult(const Options& opts, const RedisEndpoint& endpoint, const WorkloadResult& r) {
+    std::cout << "Endpoint: " << endpoint.toString() << std::endl;
+    std::cout << "All messages sent in " << r.seconds << " seconds." << std::endl;
+    std::cout << "Total: " << r.sent << " messages, " << r.sent / r.seconds << " msg/s (wall clock), "
+              << r.sumRate << " msg/s (sum of clients), " << r.sumRate / opts.numClients << " msg/s per client" << std::endl;
+    fputs(r.latency.summary(opts.mode == SendMode::Multi ? "Transaction latency" : "Command latency").c_str(), stdout);
+    fflush(stdout);
+    if (r.failed > 0) {
+        std::cout << r.failed << " client(s) failed." << std::endl;
+    }
+}
+
+// 相对于基准的变化，百分比
+static double change(double base, double value) {
+    return base > 0 ? (value - base) / base * 100.0 : 0.0;
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::cout << "Mode: " << modeName(opts.mode);
+    if (opts.mode == SendMode::Pipeline) {
+        std::cout << " (depth " << opts.pipelineDepth << ")";
+    } else if (opts.mode == SendMode::Multi) {
+        std::cout << " (batch " << opts.batchSize << ")";
+    }
+    std::cout << std::endl;
+
+    if (!opts.compare) {
+        WorkloadResult r = runWorkload(opts, opts.endpoint, true);
+        printResult(opts, opts.endpoint, r);
+        return r.failed == 0 ? 0 : 1;
+    }
+
+    // 对比模式：两次运行之间只有连接方式不同，不打印每个客户端的速率
+    WorkloadResult base = runWorkload(opts, opts.endpoint, false);
+    printResult(opts, opts.endpoint, base);
+    WorkloadResult other = runWorkload(opts, opts.compareEndpoint, false);
+    printResult(opts, opts.compareEndpoint, other);
+
+    double baseRate = base.sent / base.seconds;
+    double otherRate = other.sent / other.seconds;
+    printf("\n%-28s %14s %10s %10s %10s\n", "endpoint", "msg/s", "p50_us", "p99_us", "p99.9_us");
+    const RedisEndpoint* endpoints[2] = {&opts.endpoint, &opts.compareEndpoint};
+    const WorkloadResult* results[2] = {&base, &other};
+    for (int i = 0; i < 2; ++i) {
+        const WorkloadResult& r = *results[i];
+        printf("%-28s %14.0f %10.1f %10.1f %10.1f\n", endpoints[i]->toString().c_str(), r.sent / r.seconds,
+               r.latency.percentile(0.50) / 1000.0, r.latency.percentile(0.99) / 1000.0, r.latency.percentile(0.999) / 1000.0);
+    }
+    printf("%-28s %+13.1f%% %+9.1f%% %+9.1f%% %+9.1f%%\n", "change", change(baseRate, otherRate),
+           change((double)base.latency.percentile(0.50), (double)other.latency.percentile(0.50)),
+           change((double)base.latency.percentile(0.99), (double)other.latency.percentile(0.99)),
+           change((double)base.latency.percentile(0.999), (double)other.latency.percentile(0.999)));
+    return base.failed == 0 && other.failed == 0 ? 0 : 1;
+}
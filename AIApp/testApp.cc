@@ -1,7 +1,19 @@
 #include <wx/wx.h>
 #include <hiredis/hiredis.h>
+#include <hiredis/async.h>
 #include <thread>
 #include <iostream>
+#include <string>
+#include "event_loop.h"
+#include "redis_event_loop.h"
+#include "chat_history_view.h"
+#include "room_router.h"
+#include "chat_streams.h"
+#include "redis_endpoint.h"
+#include "chat_envelope.h"
+#include "latency.h"
+#include <random>
+#include <memory>
 
 class MyApp : public wxApp
 {
@@ -12,9 +24,17 @@ public:
 /**
  * 一个用于显示聊天相关信息的 UI 控件类
  * 
- * 包含一个文本控件，用于显示聊天信息，一个文本控件，用于显示输入消息，一个发送按钮
+ * 包含一个虚拟列表控件，用于显示聊天信息，一个文本控件，用于显示输入消息，一个发送按钮
  * 发送按钮的点击事件和输入框回车事件会触发发送消息的操作
  * 包含接收来自 Redis 的消息并显示的功能    
+ *
+ * 支持多个聊天室：所有房间共用一个订阅连接，收到的消息由本地路由表分发给对应的房间
+ * 输入框里可以使用 /join 房间名、/leave 房间名、/room 房间名 (切换发送的目标房间) 三个命令，房间名可以带通配符
+ * 设置环境变量 CHAT_MODE=streams 时改用 Redis Streams 收发消息 (见 chat_streams.h)，
+ * 晚加入或者重连的客户端可以补回错过的消息，此时房间名不支持通配符
+ *
+ * 所有的 Redis 通信 (订阅和发布) 都跑在同一个事件循环线程上，使用 hiredis 的异步接口：
+ * 一个循环线程可以同时承载多个订阅连接和发送连接，析构时通过 eventfd 唤醒循环并退出，不会卡在阻塞读上
 */
 class MyFrame : public wxFrame
 {
@@ -25,22 +45,58 @@ public:
 private:
     // 处理发送按钮点击事件和输入框回车事件
     void OnSend(wxCommandEvent& event);
-    // 接收来自 Redis 的消息并显示
-    void OnReceive();
-    // 连接到 Redis 服务器，IP:port : 127.0.0.1:6379
+    // 接收来自 Redis 的消息并显示，在事件循环线程里被调用
+    void OnReceive(redisReply* reply);
+    // 连接到 Redis 服务器，地址来自 REDIS_ENDPOINT 环境变量，默认 127.0.0.1:6379
     void ConnectToRedis();
+    // 在 UI 线程里处理一条消息的发送结果，更新状态栏
+    void OnPublishAck(bool ok, const std::string& error);
+    // 把一条房间消息显示出来，在事件循环线程里调用
+    void ShowRoomMessage(const RoomMessage& msg);
+    // 新建一个挂在事件循环上的异步连接
+    redisAsyncContext* ConnectAsync(const RedisEndpoint& endpoint);
+    // 加入 / 离开一个房间，可以在任意线程调用，实际的 (P)SUBSCRIBE 在事件循环线程里执行
+    void JoinRoom(const std::string& room);
+    void LeaveRoom(const std::string& room);
+    // 处理输入框里以 / 开头的命令，返回 false 表示不是命令
+    bool HandleCommand(const std::string& text);
 
-    // 文本控件，用于显示聊天信息
-    wxTextCtrl* m_display;
+    // hiredis 的 C 风格回调，privdata / ac->data 指向 MyFrame
+    static void OnSubscribeReply(redisAsyncContext* ac, void* reply, void* privdata);
+    static void OnPublishReply(redisAsyncContext* ac, void* reply, void* privdata);
+    static void OnConnect(const redisAsyncContext* ac, int status);
+    static void OnDisconnect(const redisAsyncContext* ac, int status);
+
+    // 虚拟列表控件，用于显示聊天信息，只保留最近的若干条
+    ChatHistoryView* m_display;
     // 文本控件，用于显示输入消息
     wxTextCtrl* m_input;
     // 发送按钮
     wxButton* m_sendButton;
 
-    // Redis 连接上下文 (context)
-    redisContext* m_redisContext;
-    // 接收消息的线程
-    std::thread m_receiveThread;
+    // 事件循环，负责所有 Redis 连接的读写
+    EventLoop m_loop;
+    // 运行事件循环的线程
+    std::thread m_loopThread;
+    // 发送消息用的异步连接，只在事件循环线程里访问
+    redisAsyncContext* m_pubContext;
+    // 订阅用的异步连接，进入订阅状态后只能执行 (P)SUBSCRIBE 一类的命令，所以和发送连接分开
+    redisAsyncContext* m_subContext;
+    // 房间路由表，只在事件循环线程里访问
+    RoomRouter m_rooms;
+    // Streams 模式下使用，不为空时不再创建上面的两个 pub/sub 连接，只在事件循环线程里访问
+    std::unique_ptr<StreamRooms> m_streams;
+    // 当前发送消息的目标房间，只在 UI 线程里访问
+    std::string m_currentRoom;
+
+    // 消息信封里的发送者 ID 和下一条消息的序号，只在 UI 线程里访问
+    uint64_t m_senderId;
+    uint64_t m_nextSeq;
+
+    // 发送统计，只在 UI 线程里读写
+    unsigned long long m_sent;
+    unsigned long long m_acked;
+    unsigned long long m_failed;
 };
 
 wxIMPLEMENT_APP(MyApp);
@@ -56,14 +112,15 @@ bool MyApp::OnInit()
 }
 
 MyFrame::MyFrame()
-    : wxFrame(NULL, wxID_ANY, "Chat Application")
+    : wxFrame(NULL, wxID_ANY, "Chat Application"), m_pubContext(NULL), m_subContext(NULL), m_currentRoom("chat"),
+      m_senderId(std::random_device()()), m_nextSeq(0), m_sent(0), m_acked(0), m_failed(0)
 {
     wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
     // wxFlexGridSizer 的四个构造参数：行数、列数、水平间隔、垂直间隔
     wxFlexGridSizer* gridSizer = new wxFlexGridSizer(2, 2, 5, 50);
 
-    // wxTE_MULTILINE 表示多行文本控件，用于显示聊天信息，同时 wxTE_READONLY 表示这个文本控件是只读的
-    m_display = new wxTextCtrl(this, wxID_ANY, "", wxDefaultPosition, wxDefaultSize, wxTE_MULTILINE | wxTE_READONLY);
+    // 聊天记录使用虚拟列表显示，只渲染可见的行，保留的条数由环境变量 CHAT_HISTORY_LIMIT 控制
+    m_display = new ChatHistoryView(this, ChatHistoryView::CapacityFromEnv());
     gridSizer->Add(m_display, 1, wxEXPAND | wxALL, 5);
 
     // wxTE_PROCESS_ENTER 表示这个文本控件会在用户按下回车键时触发一个事件，也就是，光标在这个文本控件中时用户按下回车键，就会触发一个事件
@@ -74,6 +131,8 @@ MyFrame::MyFrame()
     gridSizer->Add(m_sendButton, 0, wxALIGN_CENTER | wxALL, 5);
 
     SetSizer(gridSizer);
+    // 状态栏用来显示发送的确认情况
+    CreateStatusBar();
 
     // 给控件绑定时间对应的处理函数
     Connect(m_sendButton->GetId(), wxEVT_COMMAND_BUTTON_CLICKED, wxCommandEventHandler(MyFrame::OnSend));
@@ -81,17 +140,39 @@ MyFrame::MyFrame()
 
     // 把窗口连接到 Redis 服务器，让前端能够与后端数据库进行通信
     ConnectToRedis();
-    // 启动一个新的线程，用于监听来自 Redis 的消息并显示
-    m_receiveThread = std::thread(&MyFrame::OnReceive, this);
+    JoinRoom(m_currentRoom);
+    // 启动事件循环线程，之后所有对 Redis 连接的操作都要通过 m_loop.post() 投递到这个线程上执行
+    m_loopThread = std::thread([this]() { m_loop.run(); });
 }
 
 MyFrame::~MyFrame()
 {
-    if (m_receiveThread.joinable())
+    // 在循环线程里释放连接，然后让循环退出
+    // redisAsyncFree 会立刻关闭连接 (不等待服务器的回复)，所以退出时间是有界的
+    m_loop.post([this]() {
+        if (m_streams)
+        {
+            // 关闭时会把每个房间看到的最后一条消息 ID 写回文件，下次启动从这里继续
+            m_streams->close();
+        }
+        if (m_subContext)
+        {
+            redisAsyncContext* ac = m_subContext;
+            m_subContext = NULL;
+            redisAsyncFree(ac);
+        }
+        if (m_pubContext)
+        {
+            redisAsyncContext* ac = m_pubContext;
+            m_pubContext = NULL;
+            redisAsyncFree(ac);
+        }
+    });
+    m_loop.stop();
+    if (m_loopThread.joinable())
     {
-        m_receiveThread.join();
+        m_loopThread.join();
     }
-    redisFree(m_redisContext);
 }
 
 void MyFrame::OnSend(wxCommandEvent& event)
@@ -99,42 +180,237 @@ void MyFrame::OnSend(wxCommandEvent& event)
     wxString message = m_input->GetValue();
     if (!message.IsEmpty())
     {
-        redisCommand(m_redisContext, "PUBLISH chat %s", message.ToStdString().c_str());
+        // UI 线程只负责把消息投递给事件循环，真正的发送由循环线程完成，不会阻塞界面
+        // 同一轮事件循环里投递的多条消息会先堆在 hiredis 的输出缓冲区里，等 socket 可写时合并成一次 write
+        std::string text = message.ToStdString();
         m_input->Clear();
+        if (HandleCommand(text))
+        {
+            return;
+        }
+        if (RoomRouter::isPattern(m_currentRoom))
+        {
+            SetStatusText(wxString::Format("cannot send to pattern room %s, use /room to pick a channel", m_currentRoom.c_str()));
+            return;
+        }
+        std::string room = m_currentRoom;
+        // 正文装进二进制信封，带上发送者、序号和发送时间，接收端可以据此计算延迟和检查乱序
+        std::string payload = encodeEnvelope(m_senderId, m_nextSeq++, monotonicNs(), ENVELOPE_FLAG_TEXT, text);
+        m_loop.post([this, room, payload]() {
+            if (m_streams)
+            {
+                bool queued = m_streams->publish(room, payload, [this](bool ok, const std::string& result) {
+                    std::string error = ok ? std::string() : result;
+                    CallAfter([this, ok, error]() { OnPublishAck(ok, error); });
+                });
+                if (!queued)
+                {
+                    CallAfter([this]() { OnPublishAck(false, "not connected"); });
+                }
+            }
+            else if (m_pubContext == NULL ||
+                redisAsyncCommand(m_pubContext, &MyFrame::OnPublishReply, this, "PUBLISH %b %b",
+                                  room.data(), room.size(), payload.data(), payload.size()) != REDIS_OK)
+            {
+                CallAfter([this]() { OnPublishAck(false, "not connected"); });
+            }
+        });
+        ++m_sent;
     }
 }
 
-void MyFrame::OnReceive()
+void MyFrame::OnPublishAck(bool ok, const std::string& error)
 {
-    redisContext* subContext = redisConnect("127.0.0.1", 6379);
-    redisCommand(subContext, "SUBSCRIBE chat");
+    if (ok)
+    {
+        ++m_acked;
+        SetStatusText(wxString::Format("sent %llu | acked %llu | failed %llu", m_sent, m_acked, m_failed));
+    }
+    else
+    {
+        ++m_failed;
+        SetStatusText(wxString::Format("sent %llu | acked %llu | failed %llu | last error: %s", m_sent, m_acked, m_failed, error.c_str()));
+    }
+}
 
-    while (true)
+void MyFrame::OnPublishReply(redisAsyncContext* ac, void* reply, void* privdata)
+{
+    MyFrame* frame = static_cast<MyFrame*>(privdata);
+    redisReply* r = static_cast<redisReply*>(reply);
+    // reply 为 NULL 说明连接断开了，这条消息是否送达无法确认
+    bool ok = r != NULL && r->type == REDIS_REPLY_INTEGER;
+    std::string error;
+    if (!ok)
     {
-        redisReply* reply;
-        if (redisGetReply(subContext, (void**)&reply) == REDIS_OK)
+        error = r != NULL && r->type == REDIS_REPLY_ERROR ? std::string(r->str, r->len) : std::string(ac->errstr ? ac->errstr : "connection lost");
+    }
+    frame->CallAfter([frame, ok, error]() { frame->OnPublishAck(ok, error); });
+}
+
+bool MyFrame::HandleCommand(const std::string& text)
+{
+    if (text.empty() || text[0] != '/')
+    {
+        return false;
+    }
+    size_t space = text.find(' ');
+    std::string command = text.substr(0, space);
+    std::string room = space == std::string::npos ? std::string() : text.substr(space + 1);
+    if (room.empty())
+    {
+        SetStatusText("usage: /join ROOM | /leave ROOM | /room ROOM");
+        return true;
+    }
+    if (command == "/join")
+    {
+        JoinRoom(room);
+    }
+    else if (command == "/leave")
+    {
+        LeaveRoom(room);
+    }
+    else if (command == "/room")
+    {
+        m_currentRoom = room;
+        JoinRoom(room);
+    }
+    else
+    {
+        return false;
+    }
+    SetStatusText(wxString::Format("current room: %s", m_currentRoom.c_str()));
+    return true;
+}
+
+void MyFrame::JoinRoom(const std::string& room)
+{
+    m_loop.post([this, room]() {
+        if (m_streams)
         {
-            if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 3)
+            if (RoomRouter::isPattern(room))
             {
-                wxString message = wxString::FromUTF8(reply->element[2]->str);
-                CallAfter([this, message]() {
-                    m_display->AppendText(message + "\n");
-                });
+                CallAfter([this]() { SetStatusText("pattern rooms are not supported in streams mode"); });
+                return;
             }
-            freeReplyObject(reply);
+            m_streams->join(room, [this](const RoomMessage& msg) { ShowRoomMessage(msg); });
+            return;
         }
+        bool added = m_rooms.join(room, [this](const RoomMessage& msg) { ShowRoomMessage(msg); });
+        // 已经加入过的房间不需要重复订阅，同一个连接上的所有房间共用一次 (P)SUBSCRIBE
+        if (added && m_subContext)
+        {
+            redisAsyncCommand(m_subContext, &MyFrame::OnSubscribeReply, this,
+                              RoomRouter::isPattern(room) ? "PSUBSCRIBE %b" : "SUBSCRIBE %b", room.data(), room.size());
+        }
+    });
+}
+
+void MyFrame::LeaveRoom(const std::string& room)
+{
+    m_loop.post([this, room]() {
+        if (m_streams)
+        {
+            m_streams->leave(room);
+        }
+        else if (m_rooms.leave(room) && m_subContext)
+        {
+            redisAsyncCommand(m_subContext, &MyFrame::OnSubscribeReply, this,
+                              RoomRouter::isPattern(room) ? "PUNSUBSCRIBE %b" : "UNSUBSCRIBE %b", room.data(), room.size());
+        }
+    });
+}
+
+void MyFrame::ShowRoomMessage(const RoomMessage& msg)
+{
+    // 直接在 redisReply 的缓冲区上解析信封；不是信封格式的 (旧版本客户端发来的纯文本) 原样显示
+    std::string_view text = msg.payload;
+    Envelope envelope;
+    if (decodeEnvelope(msg.payload.data(), msg.payload.size(), envelope))
+    {
+        text = envelope.payload;
     }
+    std::string line;
+    line.reserve(msg.channel.size() + text.size() + 3);
+    line.append("[").append(msg.channel).append("] ").append(text);
+    CallAfter([this, line]() {
+        m_display->Append(line);
+    });
 }
 
-void MyFrame::ConnectToRedis()
+void MyFrame::OnReceive(redisReply* reply)
+{
+    // 订阅回复的格式为 ["message", 频道名, 消息内容] 或 ["pmessage", 模式, 频道名, 消息内容]
+    // 订阅确认 ["subscribe", 频道名, 订阅数] 之类的直接忽略
+    if (reply->type != REDIS_REPLY_ARRAY || reply->elements < 3)
+    {
+        return;
+    }
+    redisReply** e = reply->element;
+    if (reply->elements == 3 && strcmp(e[0]->str, "message") == 0)
+    {
+        m_rooms.dispatchMessage(std::string_view(e[1]->str, e[1]->len), std::string_view(e[2]->str, e[2]->len));
+    }
+    else if (reply->elements == 4 && strcmp(e[0]->str, "pmessage") == 0)
+    {
+        m_rooms.dispatchPMessage(std::string_view(e[1]->str, e[1]->len), std::string_view(e[2]->str, e[2]->len),
+                                 std::string_view(e[3]->str, e[3]->len));
+    }
+}
+
+void MyFrame::OnSubscribeReply(redisAsyncContext* ac, void* reply, void* privdata)
+{
+    // 连接被释放时，hiredis 会用 NULL 回复调用一次所有还挂着的回调
+    if (reply == NULL)
+    {
+        return;
+    }
+    static_cast<MyFrame*>(privdata)->OnReceive(static_cast<redisReply*>(reply));
+}
+
+void MyFrame::OnConnect(const redisAsyncContext* ac, int status)
+{
+    if (status != REDIS_OK)
+    {
+        // 连接失败后 hiredis 会自己释放 context，这里只需要把指针清掉
+        std::cerr << "Error: " << ac->errstr << std::endl;
+        MyFrame* frame = static_cast<MyFrame*>(ac->data);
+        if (frame->m_pubContext == ac)
+        {
+            frame->m_pubContext = NULL;
+        }
+        if (frame->m_subContext == ac)
+        {
+            frame->m_subContext = NULL;
+        }
+    }
+}
+
+void MyFrame::OnDisconnect(const redisAsyncContext* ac, int status)
 {
-    m_redisContext = redisConnect("127.0.0.1", 6379);
-    if (m_redisContext == NULL || m_redisContext->err)
+    if (status != REDIS_OK)
     {
-        if (m_redisContext)
+        std::cerr << "Disconnected: " << ac->errstr << std::endl;
+    }
+    MyFrame* frame = static_cast<MyFrame*>(ac->data);
+    if (frame->m_pubContext == ac)
+    {
+        frame->m_pubContext = NULL;
+    }
+    if (frame->m_subContext == ac)
+    {
+        frame->m_subContext = NULL;
+    }
+}
+
+redisAsyncContext* MyFrame::ConnectAsync(const RedisEndpoint& endpoint)
+{
+    redisAsyncContext* ac = endpoint.connectAsync();
+    if (ac == NULL || ac->err)
+    {
+        if (ac)
         {
-            std::cerr << "Error: " << m_redisContext->errstr << std::endl;
-            redisFree(m_redisContext);
+            std::cerr << "Error: " << ac->errstr << std::endl;
+            redisAsyncFree(ac);
         }
         else
         {
@@ -142,4 +418,36 @@ void MyFrame::ConnectToRedis()
         }
         exit(1);
     }
+    ac->data = this;
+    redisEventLoopAttach(&m_loop, ac);
+    redisAsyncSetConnectCallback(ac, &MyFrame::OnConnect);
+    redisAsyncSetDisconnectCallback(ac, &MyFrame::OnDisconnect);
+    return ac;
+}
+
+void MyFrame::ConnectToRedis()
+{
+    // 异步连接是非阻塞的，真正的连接结果会在 OnConnect 里报告
+    // 循环线程还没有启动，这里直接操作 m_loop 是安全的
+    RedisEndpoint endpoint = RedisEndpoint::fromEnv();
+    const char* mode = getenv("CHAT_MODE");
+    if (mode != NULL && strcmp(mode, "streams") == 0)
+    {
+        StreamRooms::Options opts;
+        const char* maxLen = getenv("CHAT_STREAM_MAXLEN");
+        if (maxLen != NULL && atol(maxLen) > 0)
+        {
+            opts.maxLen = (size_t)atol(maxLen);
+        }
+        const char* home = getenv("HOME");
+        opts.cursorFile = std::string(home != NULL ? home : ".") + "/.chat_stream_cursors";
+        m_streams.reset(new StreamRooms(m_loop, endpoint, opts));
+        if (!m_streams->connect())
+        {
+            exit(1);
+        }
+        return;
+    }
+    m_pubContext = ConnectAsync(endpoint);
+    m_subContext = ConnectAsync(endpoint);
 }
\ No newline at end of file
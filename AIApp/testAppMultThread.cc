@@ -3,9 +3,17 @@
 #include <thread>
 #include <iostream>
 #include <vector>
-#include <queue>
-#include <mutex>
-#include <condition_variable>
+#include <string>
+#include <atomic>
+#include <memory>
+#include "chat_core.h"
+#include "chat_history_view.h"
+#include "chat_publisher.h"
+#include "chat_envelope.h"
+#include "history_store.h"
+#include "latency.h"
+#include "pending_acks.h"
+#include <random>
 
 class MyApp : public wxApp
 {
@@ -21,38 +29,55 @@ public:
 
 private:
     void OnSend(wxCommandEvent& event);
-    void OnReceive();
     void ConnectToRedis();
-    void ProcessMessages();
+    // 打开本地聊天记录，把最近的消息先放进显示区，再连接 Redis
+    void LoadHistory();
+    void UpdateStatus();
+    // 写线程报告一条消息的发送结果
+    void OnPublishAck(const PublishAck& ack);
 
-    wxTextCtrl* m_display;
+    ChatHistoryView* m_display;
     wxTextCtrl* m_input;
     wxButton* m_sendButton;
 
-    redisContext* m_redisContext;
-    std::vector<std::thread> m_threadPool;
-    std::queue<wxString> m_messageQueue;
-    std::mutex m_queueMutex;
-    std::condition_variable m_queueCondVar;
-    bool m_running;
+    // Redis 的地址，来自 REDIS_ENDPOINT 环境变量，发送和接收两个连接共用
+    RedisEndpoint m_endpoint;
+    // 发送消息用的独立写线程，OnSend 只负责把消息交给它
+    ChatPublisher m_publisher;
+    // 消息信封里的发送者 ID 和下一条消息的序号，只在 UI 线程里访问
+    uint64_t m_senderId;
+    uint64_t m_nextSeq;
+    // 接收和分发 (订阅连接、队列、每帧批量投递) 都在 ChatCore 里，这里只负责把批次渲染出来
+    std::unique_ptr<ChatCore> m_core;
+    std::atomic<uint64_t> m_acked{0};  // 发送成功并收到 PUBLISH 回复的消息数
+    std::atomic<uint64_t> m_failed{0}; // 发送失败的消息数
+    // 自己发出、还没有从订阅连接上收到回环的消息，按序号排序
+    PendingAcks m_unconfirmed;
+    // 本地聊天记录，启动时在 UI 线程里读取，之后只在分发线程里追加；打开失败时为空
+    std::unique_ptr<HistoryStore> m_store;
 };
 
 wxIMPLEMENT_APP(MyApp);
 
 bool MyApp::OnInit()
 {
+    // 在启动接收、写线程之前选好时钟，超时和心跳都用它
+    Monotonic::init();
     MyFrame* frame = new MyFrame();
     frame->Show(true);
     return true;
 }
 
 MyFrame::MyFrame()
-    : wxFrame(NULL, wxID_ANY, "Chat Application"), m_running(true)
+    : wxFrame(NULL, wxID_ANY, "Chat Application"),
+      m_endpoint(RedisEndpoint::fromEnv()),
+      m_publisher(m_endpoint, [this](const PublishAck& ack) { OnPublishAck(ack); }),
+      m_senderId(std::random_device()()), m_nextSeq(0)
 {
     wxBoxSizer* sizer = new wxBoxSizer(wxVERTICAL);
     wxFlexGridSizer* gridSizer = new wxFlexGridSizer(2, 2, 5, 50);
 
-    m_display = new wxTextCtrl(this, wxID_ANY, "", wxDefaultPosition, wxDefaultSize, wxTE_MULTILINE | wxTE_READONLY);
+    m_display = new ChatHistoryView(this, ChatHistoryView::CapacityFromEnv());
     gridSizer->Add(m_display, 1, wxEXPAND | wxALL, 5);
 
     m_input = new wxTextCtrl(this, wxID_ANY, "", wxDefaultPosition, wxDefaultSize, wxTE_PROCESS_ENTER);
@@ -62,39 +87,22 @@ MyFrame::MyFrame()
     gridSizer->Add(m_sendButton, 0, wxALIGN_CENTER | wxALL, 5);
 
     SetSizer(gridSizer);
+    CreateStatusBar();
 
     Connect(m_sendButton->GetId(), wxEVT_COMMAND_BUTTON_CLICKED, wxCommandEventHandler(MyFrame::OnSend));
     Connect(m_input->GetId(), wxEVT_COMMAND_TEXT_ENTER, wxCommandEventHandler(MyFrame::OnSend));
 
+    LoadHistory();
     ConnectToRedis();
-
-    // 创建线程池
-    for (int i = 0; i < std::thread::hardware_concurrency(); ++i)
-    {
-        m_threadPool.emplace_back(&MyFrame::ProcessMessages, this);
-    }
-
-    // 启动一个新的线程，用于监听来自 Redis 的消息并显示
-    std::thread(&MyFrame::OnReceive, this).detach();
 }
 
 MyFrame::~MyFrame()
 {
+    if (m_core)
     {
-        std::lock_guard<std::mutex> lock(m_queueMutex);
-        m_running = false;
-    }
-    m_queueCondVar.notify_all();
-
-    for (auto& thread : m_threadPool)
-    {
-        if (thread.joinable())
-        {
-            thread.join();
-        }
+        m_core->stop();
     }
-
-    redisFree(m_redisContext);
+    m_publisher.stop();
 }
 
 void MyFrame::OnSend(wxCommandEvent& event)
@@ -102,71 +110,138 @@ void MyFrame::OnSend(wxCommandEvent& event)
     wxString message = m_input->GetValue();
     if (!message.IsEmpty())
     {
-        redisCommand(m_redisContext, "PUBLISH chat %s", message.ToStdString().c_str());
+        // 交给写线程发送，不在 UI 线程上等待 Redis 的回复；序号作为 cookie 带回，发送失败时据此移除
+        uint64_t seq = m_nextSeq++;
+        uint64_t now = monotonicNs();
+        m_unconfirmed.add(seq, now);
+        m_publisher.publish("chat", encodeEnvelope(m_senderId, seq, now, ENVELOPE_FLAG_TEXT, message.ToStdString()),
+                            reinterpret_cast<void*>((uintptr_t)seq));
         m_input->Clear();
     }
 }
 
-void MyFrame::OnReceive()
+void MyFrame::OnPublishAck(const PublishAck& ack)
 {
-    redisContext* subContext = redisConnect("127.0.0.1", 6379);
-    redisCommand(subContext, "SUBSCRIBE chat");
+    if (ack.ok)
+    {
+        m_acked.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    m_failed.fetch_add(1, std::memory_order_relaxed);
+    m_unconfirmed.remove((uintptr_t)ack.cookie);
+    // 失败时切回 UI 线程，把错误显示在状态栏上
+    std::string error = ack.error;
+    CallAfter([this, error]() {
+        SetStatusText(wxString::Format("send failed: %s", error.c_str()));
+    });
+}
 
-    while (true)
+void MyFrame::LoadHistory()
+{
+    // CHAT_HISTORY_DIR 设为空字符串时不保存聊天记录
+    const char* dir = getenv("CHAT_HISTORY_DIR");
+    if (dir != NULL && *dir == '\0')
     {
-        redisReply* reply;
-        if (redisGetReply(subContext, (void**)&reply) == REDIS_OK)
-        {
-            if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 3)
-            {
-                wxString message = wxString::FromUTF8(reply->element[2]->str);
-                {
-                    std::lock_guard<std::mutex> lock(m_queueMutex);
-                    m_messageQueue.push(message);
-                }
-                m_queueCondVar.notify_one();
-            }
-            freeReplyObject(reply);
-        }
+        return;
+    }
+    HistoryStore::Options opts;
+    opts.dir = dir != NULL ? dir : "chat_history";
+    std::unique_ptr<HistoryStore> store(new HistoryStore);
+    std::string error;
+    uint64_t start = monotonicNs();
+    if (!store->open(opts, &error))
+    {
+        std::cerr << "History: " << error << std::endl;
+        return;
     }
+    // 只取显示区放得下的最近这些条，快照里存了多少条都一样快
+    std::vector<std::string> recent;
+    recent.reserve(m_display->History().capacity());
+    store->tail(m_display->History().capacity(), [&recent](std::string_view message) {
+        recent.emplace_back(message);
+    });
+    size_t loaded = recent.size();
+    m_display->AppendBatch(recent);
+    SetStatusText(wxString::Format("history: %zu of %zu messages loaded in %.1f ms", loaded, store->size(),
+                                   (monotonicNs() - start) / 1e6));
+    m_store = std::move(store);
 }
 
 void MyFrame::ConnectToRedis()
 {
-    m_redisContext = redisConnect("127.0.0.1", 6379);
-    if (m_redisContext == NULL || m_redisContext->err)
+    // 写线程的连接失败时 start() 已经打印了错误信息
+    if (!m_publisher.start())
     {
-        if (m_redisContext)
+        exit(1);
+    }
+
+    // 聊天记录反正只显示最近的这么多条，攒着的消息超过这个数量时更老的直接丢掉
+    ChatCore::Options opts;
+    opts.endpoint = m_endpoint;
+    // 本机运行着 shm_relay 时，从它的共享内存环读取，不再单独订阅 Redis
+    const char* ring = getenv("CHAT_SHM_RING");
+    if (ring != NULL && *ring != '\0')
+    {
+        opts.shmRing = ring;
+    }
+    opts.maxPending = m_display->History().capacity();
+    // CHAT_FILTER 指向一个规则文件时，接收线程先过滤再入队，命中 drop 规则的消息不显示 (格式见 MessageFilter::loadFile)
+    const char* filterPath = getenv("CHAT_FILTER");
+    if (filterPath != NULL && *filterPath != '\0')
+    {
+        std::shared_ptr<MessageFilter> filter(new MessageFilter);
+        std::string error;
+        if (!filter->loadFile(filterPath, MessageFilter::Options(), &error))
+        {
+            std::cerr << "Filter: " << error << std::endl;
+            exit(1);
+        }
+        opts.filter = filter;
+    }
+    // 分发线程每帧交出一批，先追加进本地聊天记录 (不占用 UI 线程)，再切回 UI 线程渲染，渲染完才允许交出下一批
+    m_core.reset(new ChatCore(opts, [this](std::vector<std::string>&& batch) {
+        if (m_store && !m_store->append(batch))
         {
-            std::cerr << "Error: " << m_redisContext->errstr << std::endl;
-            redisFree(m_redisContext);
+            std::cerr << "History: append failed, no longer saving" << std::endl;
+            m_store.reset();
         }
-        else
+        CallAfter([this, batch = std::move(batch)]() mutable {
+            m_display->AppendBatch(batch);
+            UpdateStatus();
+            m_core->batchDone();
+        });
+    }));
+    // 在接收线程里确认自己发出的消息已经送达
+    m_core->setObserver([this](const Envelope& envelope) {
+        if (envelope.senderId == m_senderId)
         {
-            std::cerr << "Can't allocate redis context" << std::endl;
+            m_unconfirmed.confirm(envelope.seq, monotonicNs());
         }
+    });
+    if (!m_core->start())
+    {
         exit(1);
     }
 }
 
-void MyFrame::ProcessMessages()
+void MyFrame::UpdateStatus()
 {
-    while (m_running)
-    {
-        std::unique_lock<std::mutex> lock(m_queueMutex);
-        m_queueCondVar.wait(lock, [this]() { return !m_messageQueue.empty() || !m_running; });
-
-        while (!m_messageQueue.empty())
-        {
-            wxString message = m_messageQueue.front();
-            m_messageQueue.pop();
-            lock.unlock();
-
-            CallAfter([this, message]() {
-                m_display->AppendText(message + "\n");
-            });
-
-            lock.lock();
-        }
-    }
-}
\ No newline at end of file
+    const DispatchStats& stats = m_core->stats();
+    uint64_t oldest = m_unconfirmed.oldestNs();
+    uint64_t now = monotonicNs();
+    uint64_t oldestMs = oldest != 0 && now > oldest ? (now - oldest) / 1000000 : 0;
+    SetStatusText(wxString::Format("queue depth %zu | last batch %llu | max batch %llu | batches %llu | received %llu | dropped %llu"
+                                   " | filtered %llu | acked %llu | send failed %llu | unconfirmed %zu (oldest %llu ms) | reconnects %llu%s",
+                                   m_core->queueDepth(),
+                                   (unsigned long long)stats.lastBatch.load(std::memory_order_relaxed),
+                                   (unsigned long long)stats.maxBatch.load(std::memory_order_relaxed),
+                                   (unsigned long long)stats.batches.load(std::memory_order_relaxed),
+                                   (unsigned long long)stats.received.load(std::memory_order_relaxed),
+                                   (unsigned long long)stats.dropped.load(std::memory_order_relaxed),
+                                   (unsigned long long)stats.filtered.load(std::memory_order_relaxed),
+                                   (unsigned long long)m_acked.load(std::memory_order_relaxed),
+                                   (unsigned long long)m_failed.load(std::memory_order_relaxed),
+                                   m_unconfirmed.size(), (unsigned long long)oldestMs,
+                                   (unsigned long long)stats.reconnects.load(std::memory_order_relaxed),
+                                   m_core->disconnected() ? " | disconnected" : ""));
+}
@@ -0,0 +1,332 @@
+#ifndef AIAPP_TIMING_WHEEL_H
+#define AIAPP_TIMING_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "monotonic.h"
+
+class TimingWheel;
+
+// 定时器到期时调用，与 EventLoop 一样是 "函数指针 + clientData" 的形式；回调里可以重新 schedule 自己或者操作其他定时器
+typedef void WheelTimerProc(TimingWheel* wheel, struct WheelTimer* timer, void* clientData);
+
+struct WheelLink
+{
+    WheelLink* prev;
+    WheelLink* next;
+};
+
+/**
+ * 嵌在连接等对象里的定时器，不在轮上时 link.next 为 NULL
+ * 对象释放之前必须先 cancel (或者确认已经不在轮上)
+*/
+struct WheelTimer
+{
+    WheelLink link = {NULL, NULL}; // 必须是第一个成员，轮上的链表结点直接转换回 WheelTimer
+    uint64_t expires = 0;          // 到期的 tick
+    WheelTimerProc* proc = NULL;
+    void* clientData = NULL;
+
+    WheelTimer() = default;
+    WheelTimer(WheelTimerProc* p, void* data) : proc(p), clientData(data) {}
+
+    WheelTimer(const WheelTimer&) = delete;
+    WheelTimer& operator=(const WheelTimer&) = delete;
+
+    bool pending() const { return link.next != NULL; }
+};
+
+/**
+ * 分层时间轮，结构与 Linux 2.6 的 kernel/timer.c (tvec_base) 相同
+ *
+ * 第 0 层 256 个槽，每个槽对应一个 tick；往上 4 层各 64 个槽，每一层一个槽覆盖下一层一整圈。
+ * tick 为 1ms 时第 0 层覆盖 256ms，总共覆盖 2^32 个 tick (约 49 天)，更远的定时器按最远的位置放
+ * - schedule / cancel 都是 O(1)：算出所在的层和槽，挂到 (或摘下) 那个槽的双向链表上，不分配内存、不比较大小
+ * - 第 0 层转完一圈时把上一层的一个槽 "级联" 下来重新分配，每个定时器最多被级联 4 次；
+ *   连接的空闲超时这类定时器大多在到期之前就被重新设置或者取消了，根本走不到级联
+ * - advance(now) 逐个 tick 处理到期的槽，轮上没有定时器时直接跳到 now
+ *
+ * 到期时间向上取整到 tick，定时器不会早于设定的时间触发，最多晚一个 tick 加上调用 advance 的间隔
+ * 不是线程安全的，只在一个线程 (通常是事件循环线程) 里使用
+*/
+class TimingWheel
+{
+public:
+    static const int ROOT_BITS = 8;
+    static const int LEVEL_BITS = 6;
+    static const int LEVELS = 4;
+    static const uint64_t ROOT_SIZE = 1ULL << ROOT_BITS;
+    static const uint64_t LEVEL_SIZE = 1ULL << LEVEL_BITS;
+    static const uint64_t ROOT_MASK = ROOT_SIZE - 1;
+    static const uint64_t LEVEL_MASK = LEVEL_SIZE - 1;
+    static const uint64_t MAX_TICKS = (1ULL << (ROOT_BITS + LEVELS * LEVEL_BITS)) - 1;
+
+    explicit TimingWheel(uint64_t tickNs = 1000000, uint64_t nowNs = Monotonic::nowNs())
+        : m_tickNs(tickNs > 0 ? tickNs : 1), m_startNs(nowNs), m_tick(0), m_count(0)
+    {
+        for (auto& slot : m_root)
+        {
+            initList(&slot);
+        }
+        for (auto& level : m_levels)
+        {
+            for (auto& slot : level)
+            {
+                initList(&slot);
+            }
+        }
+    }
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    // 在 deadlineNs (Monotonic::nowNs() 的时间) 或者之后触发；已经在轮上时相当于先 cancel 再重新设置
+    void scheduleAt(WheelTimer* timer, uint64_t deadlineNs)
+    {
+        if (timer->pending())
+        {
+            unlink(timer);
+        }
+        else
+        {
+            ++m_count;
+        }
+        timer->expires = deadlineNs > m_startNs ? (deadlineNs - m_startNs + m_tickNs - 1) / m_tickNs : 0;
+        add(timer);
+    }
+
+    void schedule(WheelTimer* timer, uint64_t delayNs) { scheduleAt(timer, Monotonic::nowNs() + delayNs); }
+    void scheduleMs(WheelTimer* timer, uint64_t delayMs) { schedule(timer, delayMs * 1000000ULL); }
+
+    // 不在轮上时返回 false
+    bool cancel(WheelTimer* timer)
+    {
+        if (!timer->pending())
+        {
+            return false;
+        }
+        unlink(timer);
+        --m_count;
+        return true;
+    }
+
+    // 触发所有在 nowNs 之前到期的定时器，返回触发的个数
+    size_t advance(uint64_t nowNs = Monotonic::nowNs())
+    {
+        if (nowNs < m_startNs)
+        {
+            return 0;
+        }
+        uint64_t target = (nowNs - m_startNs) / m_tickNs;
+        size_t fired = 0;
+        while (m_tick <= target)
+        {
+            if (m_count == 0)
+            {
+                m_tick = target + 1;
+                break;
+            }
+            uint64_t index = m_tick & ROOT_MASK;
+            // 第 0 层转完一圈，从上一层取下一个槽；这一层的槽也转完一圈时再往上取，与内核的 __run_timers 相同
+            if (index == 0)
+            {
+                for (int level = 0; level < LEVELS && cascade(level, levelIndex(level)) == 0; ++level)
+                {
+                }
+            }
+            ++m_tick;
+
+            // 先把整个槽摘到局部链表上再逐个触发，回调里新设置的定时器不会在这一轮被触发
+            WheelLink work;
+            spliceInit(&m_root[index], &work);
+            while (work.next != &work)
+            {
+                WheelTimer* timer = reinterpret_cast<WheelTimer*>(work.next);
+                unlink(timer);
+                --m_count;
+                timer->proc(this, timer, timer->clientData);
+                ++fired;
+            }
+        }
+        return fired;
+    }
+
+    // 距离最早可能到期的定时器还有多少纳秒，没有定时器时返回 UINT64_MAX
+    // 只扫描第 0 层到下一次级联为止的槽；那之前没有定时器时返回到下一次级联的时间，到时候醒来一次就行
+    uint64_t nextTimeoutNs(uint64_t nowNs = Monotonic::nowNs()) const
+    {
+        if (m_count == 0)
+        {
+            return UINT64_MAX;
+        }
+        uint64_t tick = m_tick;
+        for (uint64_t i = 0; i < ROOT_SIZE; ++i, ++tick)
+        {
+            if (i > 0 && (tick & ROOT_MASK) == 0)
+            {
+                break;
+            }
+            if (m_root[tick & ROOT_MASK].next != &m_root[tick & ROOT_MASK])
+            {
+                break;
+            }
+        }
+        uint64_t deadline = m_startNs + tick * m_tickNs;
+        return deadline > nowNs ? deadline - nowNs : 0;
+    }
+
+    // 给 poll / epoll_wait 用的超时，向上取整到毫秒，最多 maxMs；没有定时器时返回 maxMs (maxMs 为 -1 表示一直等)
+    int pollTimeoutMs(uint64_t nowNs = Monotonic::nowNs(), int maxMs = -1) const
+    {
+        uint64_t ns = nextTimeoutNs(nowNs);
+        if (ns == UINT64_MAX)
+        {
+            return maxMs;
+        }
+        uint64_t ms = (ns + 999999) / 1000000;
+        if (maxMs >= 0 && ms > (uint64_t)maxMs)
+        {
+            return maxMs;
+        }
+        return ms > (uint64_t)INT32_MAX ? INT32_MAX : (int)ms;
+    }
+
+    size_t size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+    uint64_t tickNs() const { return m_tickNs; }
+
+private:
+    static void initList(WheelLink* head) { head->prev = head->next = head; }
+
+    static void linkTail(WheelLink* head, WheelLink* node)
+    {
+        node->prev = head->prev;
+        node->next = head;
+        head->prev->next = node;
+        head->prev = node;
+    }
+
+    static void unlink(WheelTimer* timer)
+    {
+        WheelLink* node = &timer->link;
+        node->prev->next = node->next;
+        node->next->prev = node->prev;
+        node->prev = node->next = NULL;
+    }
+
+    // 把 from 的所有结点移到 to (空链表) 上，from 变为空
+    static void spliceInit(WheelLink* from, WheelLink* to)
+    {
+        if (from->next == from)
+        {
+            initList(to);
+            return;
+        }
+        to->next = from->next;
+        to->prev = from->prev;
+        to->next->prev = to;
+        to->prev->next = to;
+        initList(from);
+    }
+
+    uint64_t levelIndex(int level) const
+    {
+        return (m_tick >> (ROOT_BITS + level * LEVEL_BITS)) & LEVEL_MASK;
+    }
+
+    // 对应内核的 internal_add_timer：按离现在还有多少个 tick 选择层和槽
+    void add(WheelTimer* timer)
+    {
+        uint64_t expires = timer->expires;
+        WheelLink* slot;
+        if (expires < m_tick)
+        {
+            // 已经过期，放进下一个要处理的槽
+            slot = &m_root[m_tick & ROOT_MASK];
+        }
+        else if (expires - m_tick < ROOT_SIZE)
+        {
+            slot = &m_root[expires & ROOT_MASK];
+        }
+        else
+        {
+            uint64_t delta = expires - m_tick;
+            if (delta > MAX_TICKS)
+            {
+                delta = MAX_TICKS;
+                expires = m_tick + delta;
+                timer->expires = expires;
+            }
+            int level = 0;
+            while (level < LEVELS - 1 && delta >= (1ULL << (ROOT_BITS + (level + 1) * LEVEL_BITS)))
+            {
+                ++level;
+            }
+            slot = &m_levels[level][(expires >> (ROOT_BITS + level * LEVEL_BITS)) & LEVEL_MASK];
+        }
+        linkTail(slot, &timer->link);
+    }
+
+    // 把第 level 层的 index 号槽里的定时器重新分配到更低的层，返回 index (为 0 说明这一层也转完了一圈，还要继续往上级联)
+    uint64_t cascade(int level, uint64_t index)
+    {
+        WheelLink work;
+        spliceInit(&m_levels[level][index], &work);
+        while (work.next != &work)
+        {
+            WheelTimer* timer = reinterpret_cast<WheelTimer*>(work.next);
+            unlink(timer);
+            add(timer);
+        }
+        return index;
+    }
+
+    uint64_t m_tickNs;
+    uint64_t m_startNs;
+    uint64_t m_tick;   // 下一个要处理的 tick，之前的都已经处理完
+    size_t m_count;    // 轮上的定时器个数
+    WheelLink m_root[ROOT_SIZE];
+    WheelLink m_levels[LEVELS][LEVEL_SIZE];
+};
+
+/**
+ * 重连用的指数退避：第 n 次失败之后等待 min(max, base * 2^n)，再乘上 [0.5, 1) 之间的随机因子
+ * 随机因子让同时断开的大量客户端错开重连的时间，不会在服务器恢复的那一刻一起涌上去
+*/
+class Backoff
+{
+public:
+    Backoff(uint64_t baseNs, uint64_t maxNs) : m_baseNs(baseNs), m_maxNs(maxNs), m_attempts(0)
+    {
+        m_seed = Monotonic::nowNs() ^ reinterpret_cast<uintptr_t>(this) ^ 0x9E3779B97F4A7C15ULL;
+    }
+
+    // 下一次重试之前应当等待的纳秒数，每调用一次等待时间翻倍
+    uint64_t next()
+    {
+        uint64_t delay = m_maxNs;
+        if (m_attempts < 63 && (m_baseNs << m_attempts) >> m_attempts == m_baseNs)
+        {
+            uint64_t scaled = m_baseNs << m_attempts;
+            delay = scaled < m_maxNs ? scaled : m_maxNs;
+        }
+        ++m_attempts;
+        // xorshift64，只用于打散重连时间，不需要好的随机性
+        m_seed ^= m_seed << 13;
+        m_seed ^= m_seed >> 7;
+        m_seed ^= m_seed << 17;
+        return delay / 2 + m_seed % (delay / 2 + 1);
+    }
+
+    // 连接成功之后调用，下一次失败重新从 base 开始
+    void reset() { m_attempts = 0; }
+    int attempts() const { return m_attempts; }
+
+private:
+    uint64_t m_baseNs;
+    uint64_t m_maxNs;
+    int m_attempts;
+    uint64_t m_seed;
+};
+
+#endif
@@ -0,0 +1,314 @@
+#include <iostream>
+#include <map>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include "latency.h"
+#include "rbtree.h"
+#include "timing_wheel.h"
+
+// 时间轮 (timing_wheel.h) 与红黑树 (rbtree.h)、std::multimap 做定时器队列的对比，时间单位都是 1ms 的 tick：
+// 1. idle：N 个连接各有一个空闲超时，每次操作随机选一个连接 "收到数据" 并把超时推迟 --timeout-ms；
+//    每 --ops-per-tick 次操作时间前进 1ms，到期的连接重新计时 (相当于断开后重连)。这是 UnixClient 的用法，绝大多数定时器到期之前就被推迟了
+// 2. expire：N 个定时器到期时间在 1..1000ms 之间随机，时间每次前进 1ms，到期的重新设置一个随机的延迟，每个定时器都会真正触发
+// 3. clock：Monotonic::nowNs() (TSC) 与 clock_gettime(CLOCK_MONOTONIC) 每次调用的开销
+// 三种队列的到期顺序不同，但触发的 (定时器, tick) 集合相同，checksum 应当一致
+
+struct Options {
+    int timers = 100000;     // 定时器个数
+    int ops = 5000000;       // idle 负载的推迟次数
+    int opsPerTick = 1000;   // idle 负载里每个 tick 的推迟次数
+    int timeoutMs = 5000;    // idle 负载的空闲超时
+    int ticks = 20000;       // expire 负载前进的 tick 数
+    int rounds = 3;          // 每种模式重复的次数，取最快的一次
+};
+
+static const uint64_t TICK_NS = 1000000;
+
+struct RunResult {
+    double seconds = 0.0;
+    uint64_t fired = 0;
+    uint64_t checksum = 0;
+};
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--timers N] [--ops N] [--ops-per-tick N] [--timeout-ms N] [--ticks N] [--rounds N]"
+              << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        int value = atoi(argv[++i]);
+        if (strcmp(arg, "--timers") == 0) {
+            opts.timers = value;
+        } else if (strcmp(arg, "--ops") == 0) {
+            opts.ops = value;
+        } else if (strcmp(arg, "--ops-per-tick") == 0) {
+            opts.opsPerTick = value;
+        } else if (strcmp(arg, "--timeout-ms") == 0) {
+            opts.timeoutMs = value;
+        } else if (strcmp(arg, "--ticks") == 0) {
+            opts.ticks = value;
+        } else if (strcmp(arg, "--rounds") == 0) {
+            opts.rounds = value;
+        } else {
+            return false;
+        }
+    }
+    return opts.timers > 0 && opts.ops > 0 && opts.opsPerTick > 0 && opts.timeoutMs > 0 && opts.ticks > 0
+           && opts.rounds > 0;
+}
+
+// 随机延迟由 (id, 当前 tick) 决定，三种队列得到的序列完全相同
+static uint64_t delayFor(uint64_t id, uint64_t tick) {
+    uint64_t x = (id * 0x9E3779B97F4A7C15ULL) ^ (tick * 0xBF58476D1CE4E5B9ULL);
+    x ^= x >> 29;
+    return 1 + x % 1000;
+}
+
+// ---- 三种定时器队列，接口相同：schedule(id, 到期 tick)、advance(当前 tick, 回调) ----
+
+class WheelQueue {
+public:
+    explicit WheelQueue(size_t n) : m_wheel(TICK_NS, 0), m_timers(n) {
+        for (size_t i = 0; i < n; ++i) {
+            m_timers[i].timer.proc = onExpire;
+            m_timers[i].timer.clientData = this;
+            m_timers[i].id = i;
+        }
+    }
+
+    void schedule(size_t id, uint64_t tick) { m_wheel.scheduleAt(&m_timers[id].timer, tick * TICK_NS); }
+
+    template <typename F>
+    void advance(uint64_t tick, F&& fire) {
+        m_fired.clear();
+        m_wheel.advance(tick * TICK_NS);
+        for (uint64_t id : m_fired) {
+            fire(id);
+        }
+    }
+
+private:
+    struct Timer {
+        WheelTimer timer;
+        uint64_t id;
+    };
+
+    // 回调里只记下 id，重新设置放到 advance 之后，与另外两种队列的处理顺序一致
+    static void onExpire(TimingWheel* wheel, WheelTimer* timer, void* clientData) {
+        (void)wheel;
+        static_cast<WheelQueue*>(clientData)->m_fired.push_back(reinterpret_cast<Timer*>(timer)->id);
+    }
+
+    TimingWheel m_wheel;
+    std::vector<Timer> m_timers;
+    std::vector<uint64_t> m_fired;
+};
+
+class TreeQueue {
+public:
+    explicit TreeQueue(size_t n) : m_timers(n) {
+        for (size_t i = 0; i < n; ++i) {
+            rbClearNode(&m_timers[i].node);
+            m_timers[i].id = i;
+        }
+    }
+
+    void schedule(size_t id, uint64_t tick) {
+        Timer* timer = &m_timers[id];
+        if (m_tree.linked(timer)) {
+            m_tree.erase(timer);
+        }
+        timer->when = tick;
+        m_tree.insert(timer);
+    }
+
+    template <typename F>
+    void advance(uint64_t tick, F&& fire) {
+        m_fired.clear();
+        Timer* first;
+        while ((first = m_tree.first()) != NULL && first->when <= tick) {
+            m_tree.erase(first);
+            m_fired.push_back(first->id);
+        }
+        for (uint64_t id : m_fired) {
+            fire(id);
+        }
+    }
+
+private:
+    struct Timer {
+        RbNode node;
+        uint64_t when;
+        uint64_t id;
+    };
+
+    struct TimerLess {
+        bool operator()(const Timer& a, const Timer& b) const {
+            return a.when < b.when || (a.when == b.when && a.id < b.id);
+        }
+    };
+
+    RbTree<Timer, &Timer::node, TimerLess> m_tree;
+    std::vector<Timer> m_timers;
+    std::vector<uint64_t> m_fired;
+};
+
+// 常见的写法：multimap 加上每个定时器保存自己的迭代器，推迟时 erase + insert
+class MapQueue {
+public:
+    explicit MapQueue(size_t n) : m_iters(n, m_map.end()) {}
+
+    void schedule(size_t id, uint64_t tick) {
+        if (m_iters[id] != m_map.end()) {
+            m_map.erase(m_iters[id]);
+        }
+        m_iters[id] = m_map.emplace(tick, id);
+    }
+
+    template <typename F>
+    void advance(uint64_t tick, F&& fire) {
+        m_fired.clear();
+        while (!m_map.empty() && m_map.begin()->first <= tick) {
+            uint64_t id = m_map.begin()->second;
+            m_map.erase(m_map.begin());
+            m_iters[id] = m_map.end();
+            m_fired.push_back(id);
+        }
+        for (uint64_t id : m_fired) {
+            fire(id);
+        }
+    }
+
+private:
+    std::multimap<uint64_t, uint64_t> m_map;
+    std::vector<std::multimap<uint64_t, uint64_t>::iterator> m_iters;
+    std::vector<uint64_t> m_fired;
+};
+
+// ---- 负载 ----
+
+template <typename Queue>
+static RunResult runIdle(const Options& opts, const std::vector<uint32_t>& touches) {
+    RunResult r;
+    Queue queue((size_t)opts.timers);
+    uint64_t tick = 0;
+    // 连接是陆续建立的，初始的超时分散在一个超时周期里
+    for (int i = 0; i < opts.timers; ++i) {
+        queue.schedule((size_t)i, 1 + (uint64_t)i * (uint64_t)opts.timeoutMs / (uint64_t)opts.timers);
+    }
+    uint64_t start = monotonicNs();
+    for (int op = 0; op < opts.ops; ++op) {
+        queue.schedule(touches[op], tick + (uint64_t)opts.timeoutMs);
+        if ((op + 1) % opts.opsPerTick == 0) {
+            ++tick;
+            queue.advance(tick, [&](uint64_t id) {
+                ++r.fired;
+                r.checksum += id * tick;
+                queue.schedule((size_t)id, tick + (uint64_t)opts.timeoutMs);
+            });
+        }
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    return r;
+}
+
+template <typename Queue>
+static RunResult runExpire(const Options& opts) {
+    RunResult r;
+    Queue queue((size_t)opts.timers);
+    for (int i = 0; i < opts.timers; ++i) {
+        queue.schedule((size_t)i, delayFor((uint64_t)i, 0));
+    }
+    uint64_t start = monotonicNs();
+    for (uint64_t tick = 1; tick <= (uint64_t)opts.ticks; ++tick) {
+        queue.advance(tick, [&](uint64_t id) {
+            ++r.fired;
+            r.checksum += id * tick;
+            queue.schedule((size_t)id, tick + delayFor(id, tick));
+        });
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    return r;
+}
+
+static RunResult runClock(int calls, bool tsc) {
+    RunResult r;
+    uint64_t start = monotonicNs();
+    for (int i = 0; i < calls; ++i) {
+        r.checksum += tsc ? Monotonic::nowNs() : Monotonic::clockNs();
+    }
+    r.seconds = (monotonicNs() - start) / 1e9;
+    return r;
+}
+
+template <typename F>
+static RunResult best(int rounds, F run) {
+    RunResult result;
+    for (int round = 0; round < rounds; ++round) {
+        RunResult r = run();
+        if (round == 0 || r.seconds < result.seconds) {
+            result = r;
+        }
+    }
+    return result;
+}
+
+static void report(const char* name, const RunResult& r, double count) {
+    printf("  %-18s ns/op=%.1f fired=%llu checksum=%llu\n", name, r.seconds * 1e9 / count,
+           (unsigned long long)r.fired, (unsigned long long)r.checksum);
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    bool ok = true;
+
+    std::mt19937 rng(1);
+    std::vector<uint32_t> touches((size_t)opts.ops);
+    for (auto& t : touches) {
+        t = rng() % (uint32_t)opts.timers;
+    }
+
+    std::cout << "idle: " << opts.timers << " connections, " << opts.ops << " reschedules by " << opts.timeoutMs
+              << "ms, " << opts.opsPerTick << " per 1ms tick (ns per reschedule)" << std::endl;
+    RunResult iw = best(opts.rounds, [&]() { return runIdle<WheelQueue>(opts, touches); });
+    RunResult it = best(opts.rounds, [&]() { return runIdle<TreeQueue>(opts, touches); });
+    RunResult im = best(opts.rounds, [&]() { return runIdle<MapQueue>(opts, touches); });
+    report("timing wheel", iw, opts.ops);
+    report("rbtree", it, opts.ops);
+    report("std::multimap", im, opts.ops);
+    ok = ok && iw.checksum == it.checksum && iw.checksum == im.checksum;
+
+    std::cout << "expire: " << opts.timers << " timers of 1..1000ms, " << opts.ticks
+              << " ticks, every timer fires and re-arms (ns per fire)" << std::endl;
+    RunResult ew = best(opts.rounds, [&]() { return runExpire<WheelQueue>(opts); });
+    RunResult et = best(opts.rounds, [&]() { return runExpire<TreeQueue>(opts); });
+    RunResult em = best(opts.rounds, [&]() { return runExpire<MapQueue>(opts); });
+    report("timing wheel", ew, (double)ew.fired);
+    report("rbtree", et, (double)et.fired);
+    report("std::multimap", em, (double)em.fired);
+    ok = ok && ew.checksum == et.checksum && ew.checksum == em.checksum;
+
+    const int calls = 10000000;
+    std::cout << "clock: " << calls << " reads, " << Monotonic::init() << std::endl;
+    RunResult ct = best(opts.rounds, [&]() { return runClock(calls, true); });
+    RunResult cp = best(opts.rounds, [&]() { return runClock(calls, false); });
+    printf("  %-18s ns/call=%.1f\n", "Monotonic::nowNs", ct.seconds * 1e9 / calls);
+    printf("  %-18s ns/call=%.1f\n", "clock_gettime", cp.seconds * 1e9 / calls);
+
+    if (!ok) {
+        std::cerr << "Mismatch between timer queue results" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,363 @@
+#ifndef AIAPP_URING_H
+#define AIAPP_URING_H
+
+// 没有 io_uring 头文件的系统上整个文件为空，使用方用 AIAPP_HAVE_IO_URING 判断
+#if __has_include(<linux/io_uring.h>)
+#define AIAPP_HAVE_IO_URING 1
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <iostream>
+
+/**
+ * 对 io_uring 系统调用的一层很薄的封装，不依赖 liburing
+ *
+ * - 提交队列 (SQ) 和完成队列 (CQ) 都映射到用户空间：填写 SQE 不需要系统调用，
+ *   一次 submitAndWait (io_uring_enter) 同时提交这一轮所有的 SQE 并等待完成事件
+ * - 提供缓冲区环 (provided buffer ring)：多次触发的 recv (multishot) 由内核从环里挑一块缓冲区放数据，
+ *   完成事件里带着缓冲区编号，用户处理完之后 recycleBuffer 放回去，commitBuffers 一次性对内核可见
+ *
+ * 只能在一个线程里使用 (创建时带 SINGLE_ISSUER / DEFER_TASKRUN，内核不支持时自动退回普通模式)
+*/
+class IoUring
+{
+public:
+    IoUring() : m_fd(-1), m_sqRing(NULL), m_cqRing(NULL), m_sqes(NULL), m_sqRingSize(0), m_cqRingSize(0),
+                m_sqeTail(0), m_submitted(0), m_bufRing(NULL), m_bufRingSize(0), m_buffers(NULL),
+                m_buffersSize(0), m_bufCount(0), m_bufSize(0), m_bufTail(0), m_enterCalls(0)
+    {
+    }
+
+    ~IoUring()
+    {
+        if (m_buffers != NULL)
+        {
+            munmap(m_buffers, m_buffersSize);
+        }
+        if (m_bufRing != NULL)
+        {
+            munmap(m_bufRing, m_bufRingSize);
+        }
+        if (m_sqes != NULL)
+        {
+            munmap(m_sqes, m_params.sq_entries * sizeof(struct io_uring_sqe));
+        }
+        if (m_cqRing != NULL && m_cqRing != m_sqRing)
+        {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        if (m_sqRing != NULL)
+        {
+            munmap(m_sqRing, m_sqRingSize);
+        }
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+    }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // 创建 entries 个 SQE 的环，完成队列是它的 4 倍大，容得下多次触发的 accept / recv 产生的大量完成事件
+    bool init(unsigned entries)
+    {
+        const unsigned flagSets[] = {
+            IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+            IORING_SETUP_CQSIZE,
+        };
+        for (unsigned flags : flagSets)
+        {
+            memset(&m_params, 0, sizeof(m_params));
+            m_params.flags = flags;
+            m_params.cq_entries = entries * 4;
+            m_fd = (int)syscall(__NR_io_uring_setup, entries, &m_params);
+            if (m_fd >= 0 || errno != EINVAL)
+            {
+                break;
+            }
+        }
+        if (m_fd < 0)
+        {
+            std::cerr << "io_uring_setup failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        if (!(m_params.features & IORING_FEAT_EXT_ARG) || !(m_params.features & IORING_FEAT_NODROP))
+        {
+            std::cerr << "io_uring: kernel too old (needs EXT_ARG and NODROP)" << std::endl;
+            return false;
+        }
+
+        m_sqRingSize = m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned);
+        m_cqRingSize = m_params.cq_off.cqes + m_params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = m_params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single)
+        {
+            m_sqRingSize = m_cqRingSize = m_sqRingSize > m_cqRingSize ? m_sqRingSize : m_cqRingSize;
+        }
+        m_sqRing = mapRing(m_sqRingSize, IORING_OFF_SQ_RING);
+        if (m_sqRing == NULL)
+        {
+            return false;
+        }
+        m_cqRing = single ? m_sqRing : mapRing(m_cqRingSize, IORING_OFF_CQ_RING);
+        if (m_cqRing == NULL)
+        {
+            return false;
+        }
+        void* sqes = mapRing(m_params.sq_entries * sizeof(struct io_uring_sqe), IORING_OFF_SQES);
+        if (sqes == NULL)
+        {
+            return false;
+        }
+        m_sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+        char* sq = static_cast<char*>(m_sqRing);
+        char* cq = static_cast<char*>(m_cqRing);
+        m_sqHead = reinterpret_cast<unsigned*>(sq + m_params.sq_off.head);
+        m_sqTail = reinterpret_cast<unsigned*>(sq + m_params.sq_off.tail);
+        m_sqMask = *reinterpret_cast<unsigned*>(sq + m_params.sq_off.ring_mask);
+        m_cqHead = reinterpret_cast<unsigned*>(cq + m_params.cq_off.head);
+        m_cqTail = reinterpret_cast<unsigned*>(cq + m_params.cq_off.tail);
+        m_cqMask = *reinterpret_cast<unsigned*>(cq + m_params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + m_params.cq_off.cqes);
+        // SQ 的下标数组固定为恒等映射，之后只需要移动 tail
+        unsigned* array = reinterpret_cast<unsigned*>(sq + m_params.sq_off.array);
+        for (unsigned i = 0; i < m_params.sq_entries; ++i)
+        {
+            array[i] = i;
+        }
+        m_sqeTail = *m_sqTail;
+        m_submitted = m_sqeTail;
+        return true;
+    }
+
+    // 取一个空闲的 SQE (已经清零)，SQ 满了时先把已有的提交掉
+    struct io_uring_sqe* getSqe()
+    {
+        unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if (m_sqeTail - head >= m_params.sq_entries)
+        {
+            submitAndWait(0, 0);
+            head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+            if (m_sqeTail - head >= m_params.sq_entries)
+            {
+                return NULL;
+            }
+        }
+        struct io_uring_sqe* sqe = &m_sqes[m_sqeTail & m_sqMask];
+        memset(sqe, 0, sizeof(*sqe));
+        ++m_sqeTail;
+        return sqe;
+    }
+
+    // 提交所有填好的 SQE，并等待至少 waitNr 个完成事件，最多等待 timeoutMs 毫秒 (waitNr 为 0 时不等待)
+    // 返回提交的数量，出错时返回 -errno (等待超时和被信号打断不算错误)
+    int submitAndWait(unsigned waitNr, int timeoutMs)
+    {
+        unsigned toSubmit = m_sqeTail - m_submitted;
+        __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+        m_submitted = m_sqeTail;
+
+        struct __kernel_timespec ts;
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (long long)(timeoutMs % 1000) * 1000000LL;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        // DEFER_TASKRUN 模式下完成事件只有在带 GETEVENTS 进入内核时才会产生，所以总是带上
+        unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        ++m_enterCalls;
+        int rc = (int)syscall(__NR_io_uring_enter, m_fd, toSubmit, waitNr, flags, &arg, sizeof(arg));
+        if (rc < 0)
+        {
+            return errno == ETIME || errno == EINTR ? 0 : -errno;
+        }
+        return rc;
+    }
+
+    // 依次处理所有已经到达的完成事件，fn(const io_uring_cqe&)，返回处理的数量
+    template <typename Fn>
+    unsigned forEachCqe(Fn&& fn)
+    {
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        unsigned n = 0;
+        while (head != tail)
+        {
+            fn(m_cqes[head & m_cqMask]);
+            ++head;
+            ++n;
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    // 注册一个有 count (2 的幂，最多 32768) 块、每块 size 字节的缓冲区环，所有缓冲区一开始都交给内核
+    bool setupBufferRing(uint16_t group, unsigned count, unsigned size)
+    {
+        m_bufRingSize = count * sizeof(struct io_uring_buf);
+        void* ring = mmap(NULL, m_bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        m_buffersSize = (size_t)count * size;
+        void* buffers = mmap(NULL, m_buffersSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED || buffers == MAP_FAILED)
+        {
+            std::cerr << "io_uring: buffer allocation failed" << std::endl;
+            return false;
+        }
+        m_bufRing = static_cast<struct io_uring_buf_ring*>(ring);
+        m_buffers = static_cast<char*>(buffers);
+        m_bufCount = count;
+        m_bufSize = size;
+
+        struct io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t)(uintptr_t)m_bufRing;
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+        {
+            std::cerr << "io_uring: register buffer ring failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        for (unsigned i = 0; i < count; ++i)
+        {
+            recycleBuffer((uint16_t)i);
+        }
+        commitBuffers();
+        return true;
+    }
+
+    char* buffer(uint16_t bid) { return m_buffers + (size_t)bid * m_bufSize; }
+
+    // 把一块缓冲区放回环里，commitBuffers 之后内核才能再次使用
+    void recycleBuffer(uint16_t bid)
+    {
+        // 不能用 m_bufRing->bufs：内核头文件里包着柔性数组的空结构体在 C++ 里占 1 字节，bufs 会错开 8 字节
+        struct io_uring_buf* buf = reinterpret_cast<struct io_uring_buf*>(m_bufRing) + (m_bufTail & (m_bufCount - 1));
+        buf->addr = (uint64_t)(uintptr_t)buffer(bid);
+        buf->len = m_bufSize;
+        buf->bid = bid;
+        ++m_bufTail;
+    }
+
+    void commitBuffers() { __atomic_store_n(&m_bufRing->tail, m_bufTail, __ATOMIC_RELEASE); }
+
+    // 到目前为止进入内核 (io_uring_enter) 的次数
+    uint64_t enterCalls() const { return m_enterCalls; }
+
+    // 以下几个函数填写一个 SQE，SQ 满了时返回 false
+
+    // 多次触发的 accept：提交一次，之后每个新连接产生一个完成事件，直到出错
+    bool prepMultishotAccept(int fd, uint64_t userData)
+    {
+        struct io_uring_sqe* sqe = getSqe();
+        if (sqe == NULL)
+        {
+            return false;
+        }
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = userData;
+        return true;
+    }
+
+    // 多次触发的 recv：每次收到数据时从缓冲区组 group 里取一块，直到对端关闭、出错或者缓冲区用完 (-ENOBUFS)
+    bool prepMultishotRecv(int fd, uint16_t group, uint64_t userData)
+    {
+        struct io_uring_sqe* sqe = getSqe();
+        if (sqe == NULL)
+        {
+            return false;
+        }
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = group;
+        sqe->user_data = userData;
+        return true;
+    }
+
+    bool prepSend(int fd, const void* data, size_t len, uint64_t userData)
+    {
+        struct io_uring_sqe* sqe = getSqe();
+        if (sqe == NULL)
+        {
+            return false;
+        }
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)data;
+        sqe->len = (uint32_t)len;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = userData;
+        return true;
+    }
+
+    // 取消 user_data 为 target 的请求，被取消的请求以 -ECANCELED 完成
+    bool prepCancel(uint64_t target, uint64_t userData)
+    {
+        struct io_uring_sqe* sqe = getSqe();
+        if (sqe == NULL)
+        {
+            return false;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = userData;
+        return true;
+    }
+
+private:
+    void* mapRing(size_t size, off_t offset)
+    {
+        void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        if (p == MAP_FAILED)
+        {
+            std::cerr << "io_uring: mmap failed: " << strerror(errno) << std::endl;
+            return NULL;
+        }
+        return p;
+    }
+
+    int m_fd;
+    struct io_uring_params m_params;
+    void* m_sqRing;
+    void* m_cqRing;
+    struct io_uring_sqe* m_sqes;
+    size_t m_sqRingSize;
+    size_t m_cqRingSize;
+    unsigned* m_sqHead;
+    unsigned* m_sqTail;
+    unsigned m_sqMask;
+    unsigned* m_cqHead;
+    unsigned* m_cqTail;
+    unsigned m_cqMask;
+    struct io_uring_cqe* m_cqes;
+    unsigned m_sqeTail;   // 已经填好的 SQE 的位置
+    unsigned m_submitted; // 已经交给内核的位置
+
+    struct io_uring_buf_ring* m_bufRing;
+    size_t m_bufRingSize;
+    char* m_buffers;
+    size_t m_buffersSize;
+    unsigned m_bufCount;
+    unsigned m_bufSize;
+    uint16_t m_bufTail;
+
+    uint64_t m_enterCalls;
+};
+
+#endif
+#endif
@@ -0,0 +1,652 @@
+#ifndef AIAPP_WRITE_COALESCER_H
+#define AIAPP_WRITE_COALESCER_H
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdint.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include "event_loop.h"
+#include "latency.h"
+
+class CoalescedWriter;
+
+/**
+ * 按事件循环的 tick 合并输出：一个 EventLoop 配一个 WriteCoalescer，每个连接一个 CoalescedWriter
+ *
+ * 和 Redis 处理客户端回复的方式一样 (handleClientsWithPendingWrites)：
+ * 这一轮里 write() 只是把数据挂到连接的输出队列上，连接记进待写列表；
+ * 循环进入 epoll_wait 之前 (EventLoop 的 beforeSleep) 把每个待写连接攒下的所有数据用一次 sendmsg 聚集写出，
+ * 写不完 (EAGAIN) 的部分等 WRITABLE 事件再写
+ * 另外负责 CORK 的期限：被 cork 扣在内核里的不满一个 MSS 的尾巴，到期之前主动 uncork (见 CoalescedWriter)
+ *
+ * 只在循环线程里使用；构造时占用 loop 的 beforeSleep，析构时释放
+*/
+class WriteCoalescer
+{
+public:
+    explicit WriteCoalescer(EventLoop& loop) : m_loop(loop), m_timerId(-1), m_timerWhen(0)
+    {
+        m_loop.setBeforeSleepProc(beforeSleep, this);
+    }
+
+    ~WriteCoalescer()
+    {
+        m_loop.setBeforeSleepProc(NULL, NULL);
+        if (m_timerId >= 0)
+        {
+            m_loop.deleteTimeEvent(m_timerId);
+        }
+    }
+
+    WriteCoalescer(const WriteCoalescer&) = delete;
+    WriteCoalescer& operator=(const WriteCoalescer&) = delete;
+
+    EventLoop& loop() { return m_loop; }
+
+    // 立即写出所有待写连接，不等这一轮结束
+    inline void flushAll();
+
+private:
+    friend class CoalescedWriter;
+
+    static void beforeSleep(EventLoop* loop, void* clientData)
+    {
+        ((void)loop);
+        WriteCoalescer* self = (WriteCoalescer*)clientData;
+        self->flushAll();
+        self->checkDeadlines();
+    }
+
+    static int onTimer(EventLoop* loop, long long id, void* clientData)
+    {
+        ((void)loop);
+        ((void)id);
+        WriteCoalescer* self = (WriteCoalescer*)clientData;
+        self->m_timerId = -1;
+        self->checkDeadlines();
+        return EventLoop::NOMORE;
+    }
+
+    static void erase(std::vector<CoalescedWriter*>& list, CoalescedWriter* w)
+    {
+        list.erase(std::remove(list.begin(), list.end(), w), list.end());
+    }
+
+    inline void checkDeadlines();
+
+    // 时间事件本身是纳秒精度，但 epoll_wait 的超时向上取整到毫秒，醒来可能比时间事件晚将近 1ms；
+    // 所以离期限不到这么久就算到期，现在就发，睡过去就晚了
+    static const uint64_t POLL_GRANULARITY_NS = 1000000ULL;
+
+    static bool due(uint64_t deadlineNs, uint64_t now) { return deadlineNs <= now + POLL_GRANULARITY_NS; }
+
+    // 在还没到期的 deadlineNs 变成到期 (due) 的那一刻放一个时间事件，醒来时 checkDeadlines 一定会发出去，
+    // 不会出现定时器已经触发、期限却还没算到期而反复空转的情况
+    void armTimer(uint64_t deadlineNs, uint64_t now)
+    {
+        uint64_t when = deadlineNs - POLL_GRANULARITY_NS;
+        if (m_timerId >= 0 && m_timerWhen <= when)
+        {
+            return;
+        }
+        if (m_timerId >= 0)
+        {
+            m_loop.deleteTimeEvent(m_timerId);
+        }
+        m_timerId = m_loop.createTimeEventNs(when - now, onTimer, this);
+        m_timerWhen = when;
+    }
+
+    EventLoop& m_loop;
+    std::vector<CoalescedWriter*> m_pending; // 这一轮有新数据的连接
+    std::vector<CoalescedWriter*> m_corked;  // cork 扣着尾巴、有期限的连接
+    std::vector<CoalescedWriter*> m_flushing;
+    long long m_timerId;
+    uint64_t m_timerWhen;
+};
+
+/**
+ * 一个连接的输出层：按 tick 聚集写出，并根据延迟预算在 TCP_NODELAY 和 TCP_CORK 之间切换
+ * 背景见 LearningRedis/NagleAlgo.md：Nagle 在还有未确认数据时扣住小段，和对端的延迟 ACK 叠在一起，
+ * 请求-应答式的流量会被卡住几十毫秒；直接 TCP_NODELAY 又会让每次写都变成一个小包
+ *
+ * 输出队列：小于 copyBelow 的消息拷进尾部的块里 (减少 iovec 数)，大的消息 (std::string&&) 直接移进来单独成块，不拷贝
+ * 策略 (Options::policy)：
+ * - Default：不碰 socket 选项 (系统默认开着 Nagle；hiredis 的连接默认已经是 NODELAY)
+ * - NoDelay：TCP_NODELAY，每个 tick 的数据写出就立即发出
+ * - Cork：TCP_CORK，内核只发满 MSS 的段，不满的尾巴扣住；最老的一条被扣住的消息到期 (latencyBudgetNs) 时主动 uncork
+ * - Adaptive：比较两种模式各要发多少个段，每个决策窗口 (windowNs) 决定一次
+ *   预算减去这个窗口里排队延迟 (write 到写进内核) 的 p99 是余量，也就是 cork 最多能扣住尾巴多久
+ *   NODELAY 的段数总是能算出来：每次 sendmsg 写出 w 字节就是 ceil(w / MSS) 个段
+ *   NODELAY 下预测 CORK 的段数：每段能攒到 min(MSS, max(每次写出的量, 余量内写入的量)) 字节；
+ *   CORK 下直接数：满 MSS 的段加上每次 uncork 发出的尾巴
+ *   段数能降到 1/1.5 以下时切到 CORK，降不到 1/1.2 时切回 NODELAY (写得少的时候 cork 攒不起来，只是白白等到期限；
+ *   每次已经能写出好几个 MSS 的时候省下的只是尾巴)
+ *   CORK 窗口里估算的 p99 超出预算时也切回 NODELAY，并且接下来若干个窗口不再尝试 (每违反一次翻倍，最多 64 个窗口)
+ *   epoll_wait 的超时是毫秒精度，期限提前 1ms 处理，所以 cork 实际扣住尾巴的时间是余量减去 1ms
+ *
+ * 延迟是估算出来的：消息写进内核之后，NODELAY 下认为立即发出，CORK 下按 MSS 整段计算，尾巴算到 uncork 为止；
+ * Default 也按立即发出计算，不包括 Nagle 自己扣住的时间。非 TCP 的连接 (例如 Unix 域套接字) 只做聚集写出
+ *
+ * 连接的 fd 必须已经用 createFileEvent 注册在 loop 上 (mask 可以是 NONE)，并且回调在 WRITABLE 时调用 onWritable()
+ * 构造时把 fd 设为非阻塞；析构不关闭 fd
+*/
+class CoalescedWriter
+{
+public:
+    enum class Policy
+    {
+        Default,
+        NoDelay,
+        Cork,
+        Adaptive
+    };
+
+    // socket 当前的状态
+    enum class Mode
+    {
+        Default,
+        NoDelay,
+        Cork
+    };
+
+    struct Options
+    {
+        Policy policy = Policy::Adaptive;
+        uint64_t latencyBudgetNs = 2000000; // 每条消息从 write 到离开本机的 p99 目标
+        uint64_t windowNs = 50000000;       // Adaptive 的决策周期
+        size_t copyBelow = 1024;            // 比它短的消息拷进尾部的块
+        size_t chunkBytes = 16384;          // 拷贝用的块的大小
+    };
+
+    struct Stats
+    {
+        uint64_t messages = 0;
+        uint64_t bytes = 0;
+        uint64_t writes = 0;          // sendmsg 调用次数
+        uint64_t iovecs = 0;          // 这些调用一共聚集了多少段
+        uint64_t blocked = 0;         // 写到 EAGAIN 的次数
+        uint64_t sockopts = 0;        // setsockopt 调用次数 (切换模式、uncork)
+        uint64_t deadlineFlushes = 0; // cork 的尾巴到期被主动 uncork 的次数
+        uint64_t switches = 0;        // 模式切换次数
+        uint64_t windows = 0;         // 决策窗口数
+        uint64_t corkWindows = 0;     // 其中处于 CORK 的窗口数
+        Mode mode = Mode::Default;
+        bool tcp = false;
+        int mss = 0;
+    };
+
+    CoalescedWriter(WriteCoalescer& owner, int fd, const Options& opts)
+        : m_owner(owner), m_fd(fd), m_opts(opts), m_tcp(false), m_mss(0), m_mode(Mode::Default), m_headPos(0),
+          m_appended(0), m_written(0), m_released(0), m_queuedFrom(0), m_corkBase(0), m_corkFullSegs(0), m_deadline(0),
+          m_hold(opts.latencyBudgetNs), m_scheduled(false), m_wantWritable(false), m_failed(false),
+          m_windowStart(monotonicNs()), m_windowBytes(0), m_windowMessages(0), m_windowFlushes(0), m_windowPlainSegs(0),
+          m_windowCorkSegs(0), m_cooldown(0),
+          m_penalty(1)
+    {
+        int flags = fcntl(fd, F_GETFL, 0);
+        if (flags >= 0)
+        {
+            fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+        }
+        int mss = 0;
+        socklen_t len = sizeof(mss);
+        m_tcp = getsockopt(fd, IPPROTO_TCP, TCP_MAXSEG, &mss, &len) == 0 && mss > 0;
+        m_mss = m_tcp ? mss : 0;
+        if (m_tcp && m_opts.policy != Policy::Default)
+        {
+            setOption(TCP_NODELAY, 1);
+            setMode(m_opts.policy == Policy::Cork ? Mode::Cork : Mode::NoDelay, monotonicNs());
+            m_stats.switches = 0;
+        }
+        else if (!m_tcp && m_opts.policy != Policy::Default)
+        {
+            m_mode = Mode::NoDelay;
+        }
+    }
+
+    ~CoalescedWriter()
+    {
+        WriteCoalescer::erase(m_owner.m_pending, this);
+        WriteCoalescer::erase(m_owner.m_corked, this);
+        WriteCoalescer::erase(m_owner.m_flushing, this);
+    }
+
+    CoalescedWriter(const CoalescedWriter&) = delete;
+    CoalescedWriter& operator=(const CoalescedWriter&) = delete;
+
+    // 把一条消息挂到输出队列上，这一轮结束时写出；连接已经出错时返回 false
+    bool write(const void* data, size_t len)
+    {
+        if (m_failed)
+        {
+            return false;
+        }
+        if (len >= m_opts.copyBelow)
+        {
+            return write(std::string((const char*)data, len));
+        }
+        if (m_chunks.empty() || !m_chunks.back().appendable || m_chunks.back().data.size() + len > m_opts.chunkBytes)
+        {
+            m_chunks.emplace_back();
+            m_chunks.back().data.reserve(std::max(m_opts.chunkBytes, len));
+        }
+        m_chunks.back().data.append((const char*)data, len);
+        queued(len);
+        return true;
+    }
+
+    bool write(std::string&& data)
+    {
+        if (m_failed)
+        {
+            return false;
+        }
+        size_t len = data.size();
+        if (len == 0)
+        {
+            return true;
+        }
+        m_chunks.emplace_back();
+        m_chunks.back().data = std::move(data);
+        m_chunks.back().appendable = false;
+        queued(len);
+        return true;
+    }
+
+    // 立即写出队列里的数据，直到写完或者 EAGAIN；出错时返回 false
+    bool flush()
+    {
+        if (m_failed)
+        {
+            return false;
+        }
+        uint64_t now = monotonicNs();
+        bool wrote = false;
+        while (m_written < m_appended)
+        {
+            struct iovec iov[IOV_BATCH];
+            int n = 0;
+            size_t pos = m_headPos;
+            for (auto it = m_chunks.begin(); it != m_chunks.end() && n < IOV_BATCH; ++it, pos = 0)
+            {
+                iov[n].iov_base = (void*)(it->data.data() + pos);
+                iov[n].iov_len = it->data.size() - pos;
+                ++n;
+            }
+            // 用 sendmsg 而不是 writev：一样的聚集写，但可以带 MSG_NOSIGNAL，对端关闭时得到 EPIPE 而不是 SIGPIPE
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n;
+            ssize_t w = sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+            if (w < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    ++m_stats.blocked;
+                    break;
+                }
+                return fail("sendmsg");
+            }
+            ++m_stats.writes;
+            m_stats.iovecs += (uint64_t)n;
+            if (m_tcp)
+            {
+                m_windowPlainSegs += ((uint64_t)w + (uint64_t)m_mss - 1) / (uint64_t)m_mss;
+            }
+            wrote = true;
+            consume((size_t)w);
+        }
+        setWantWritable(m_written < m_appended);
+        if (wrote)
+        {
+            ++m_windowFlushes;
+        }
+        written(now);
+        if (m_opts.policy == Policy::Adaptive && now - m_windowStart >= m_opts.windowNs)
+        {
+            decide(now);
+        }
+        return true;
+    }
+
+    // 连接的 WRITABLE 事件
+    void onWritable() { flush(); }
+
+    // 已经 write 但还没写进内核的字节数，调用方可以据此做背压
+    size_t pending() const { return (size_t)(m_appended - m_written); }
+
+    bool failed() const { return m_failed; }
+    const std::string& error() const { return m_error; }
+    int fd() const { return m_fd; }
+
+    Stats stats() const
+    {
+        Stats s = m_stats;
+        s.mode = m_mode;
+        s.tcp = m_tcp;
+        s.mss = m_mss;
+        return s;
+    }
+
+    // 每条消息从 write 到离开本机 (估算) 的延迟
+    const LatencyHistogram& latency() const { return m_latency; }
+
+private:
+    friend class WriteCoalescer;
+
+    static const int IOV_BATCH = 256;
+
+    struct Chunk
+    {
+        std::string data;
+        bool appendable = true; // 拷贝用的块；移进来的大消息不再往后追加
+    };
+
+    struct Message
+    {
+        uint64_t end; // 这条消息最后一个字节之后的偏移 (从连接建立开始累计)
+        uint64_t appendNs;
+    };
+
+    void queued(size_t len)
+    {
+        uint64_t now = monotonicNs();
+        m_appended += len;
+        m_messages.push_back(Message{m_appended, now});
+        ++m_stats.messages;
+        m_stats.bytes += len;
+        m_windowBytes += len;
+        ++m_windowMessages;
+        if (!m_scheduled)
+        {
+            m_scheduled = true;
+            m_owner.m_pending.push_back(this);
+        }
+    }
+
+    void consume(size_t n)
+    {
+        m_written += n;
+        while (n > 0)
+        {
+            Chunk& front = m_chunks.front();
+            size_t left = front.data.size() - m_headPos;
+            if (n < left)
+            {
+                m_headPos += n;
+                return;
+            }
+            n -= left;
+            m_headPos = 0;
+            m_chunks.pop_front();
+        }
+    }
+
+    // 写进内核之后：记录排队延迟，按当前模式算出哪些字节已经发出
+    void written(uint64_t now)
+    {
+        for (; m_queuedFrom < m_messages.size() && m_messages[m_queuedFrom].end <= m_written; ++m_queuedFrom)
+        {
+            m_windowQueue.record(now - m_messages[m_queuedFrom].appendNs);
+        }
+        if (m_mode != Mode::Cork)
+        {
+            release(m_written, now);
+            return;
+        }
+        uint64_t fullSegs = (m_written - m_corkBase) / (uint64_t)m_mss;
+        m_windowCorkSegs += fullSegs - m_corkFullSegs;
+        m_corkFullSegs = fullSegs;
+        release(m_corkBase + fullSegs * (uint64_t)m_mss, now);
+        if (m_released < m_written)
+        {
+            // 最老的一条被扣住的消息决定期限
+            m_deadline = m_messages.front().appendNs + m_hold;
+            if (std::find(m_owner.m_corked.begin(), m_owner.m_corked.end(), this) == m_owner.m_corked.end())
+            {
+                m_owner.m_corked.push_back(this);
+            }
+        }
+    }
+
+    void release(uint64_t boundary, uint64_t now)
+    {
+        while (!m_messages.empty() && m_messages.front().end <= boundary)
+        {
+            uint64_t delay = now - m_messages.front().appendNs;
+            m_latency.record(delay);
+            m_windowLatency.record(delay);
+            m_messages.pop_front();
+            if (m_queuedFrom > 0)
+            {
+                --m_queuedFrom;
+            }
+        }
+        m_released = std::max(m_released, std::min(boundary, m_written));
+        if (m_released == m_written)
+        {
+            m_deadline = 0;
+        }
+    }
+
+    // 把 cork 扣着的尾巴发出去，之后继续 cork
+    void uncork(uint64_t now)
+    {
+        setOption(TCP_CORK, 0);
+        if (m_mode == Mode::Cork)
+        {
+            setOption(TCP_CORK, 1);
+        }
+        releaseTail(now);
+    }
+
+    // uncork 之后扣着的尾巴作为一个段发出
+    void releaseTail(uint64_t now)
+    {
+        if (m_written > m_corkBase + m_corkFullSegs * (uint64_t)m_mss)
+        {
+            ++m_windowCorkSegs;
+        }
+        m_corkBase = m_written;
+        m_corkFullSegs = 0;
+        release(m_written, now);
+    }
+
+    void setMode(Mode mode, uint64_t now)
+    {
+        if (mode == m_mode)
+        {
+            return;
+        }
+        Mode old = m_mode;
+        m_mode = mode;
+        ++m_stats.switches;
+        if (mode == Mode::Cork)
+        {
+            setOption(TCP_CORK, 1);
+            m_corkBase = m_written;
+            m_corkFullSegs = 0;
+        }
+        else if (old == Mode::Cork)
+        {
+            // 取消 cork 时内核会把扣着的尾巴立即发出
+            setOption(TCP_CORK, 0);
+            releaseTail(now);
+        }
+    }
+
+    void decide(uint64_t now)
+    {
+        uint64_t elapsed = now - m_windowStart;
+        ++m_stats.windows;
+        if (m_mode == Mode::Cork)
+        {
+            ++m_stats.corkWindows;
+        }
+        if (m_tcp && m_windowMessages >= 8 && elapsed > 0)
+        {
+            uint64_t budget = m_opts.latencyBudgetNs;
+            uint64_t queueP99 = m_windowQueue.percentile(0.99);
+            uint64_t headroom = budget > queueP99 ? budget - queueP99 : 0;
+            double plainSegs = (double)std::max<uint64_t>(m_windowPlainSegs, 1);
+            if (m_mode == Mode::Cork)
+            {
+                if (m_windowLatency.percentile(0.99) > budget)
+                {
+                    m_cooldown = m_penalty;
+                    m_penalty = std::min(m_penalty * 2, 64);
+                    setMode(Mode::NoDelay, now);
+                }
+                else if (plainSegs < 1.2 * (double)std::max<uint64_t>(m_windowCorkSegs, 1))
+                {
+                    setMode(Mode::NoDelay, now);
+                }
+                else
+                {
+                    m_penalty = std::max(m_penalty / 2, 1);
+                }
+            }
+            else if (m_cooldown > 0)
+            {
+                --m_cooldown;
+            }
+            else
+            {
+                uint64_t hold = headroom > WriteCoalescer::POLL_GRANULARITY_NS ? headroom - WriteCoalescer::POLL_GRANULARITY_NS : 0;
+                double perFlush = m_windowFlushes > 0 ? (double)m_windowBytes / (double)m_windowFlushes : 0.0;
+                double perHold = (double)m_windowBytes * (double)hold / (double)elapsed;
+                double perSeg = std::min((double)m_mss, std::max(perFlush, perHold));
+                double corkSegs = perSeg > 0 ? (double)m_windowBytes / perSeg : plainSegs;
+                if (plainSegs >= 1.5 * corkSegs)
+                {
+                    setMode(Mode::Cork, now);
+                }
+            }
+            m_hold = headroom;
+        }
+        m_windowStart = now;
+        m_windowBytes = 0;
+        m_windowMessages = 0;
+        m_windowFlushes = 0;
+        m_windowPlainSegs = 0;
+        m_windowCorkSegs = 0;
+        m_windowQueue.reset();
+        m_windowLatency.reset();
+    }
+
+    void setOption(int option, int value)
+    {
+        ++m_stats.sockopts;
+        setsockopt(m_fd, IPPROTO_TCP, option, &value, sizeof(value));
+    }
+
+    void setWantWritable(bool want)
+    {
+        if (want == m_wantWritable)
+        {
+            return;
+        }
+        m_wantWritable = want;
+        EventLoop& loop = m_owner.loop();
+        int mask = loop.getFileMask(m_fd);
+        loop.setFileMask(m_fd, want ? (mask | EventLoop::WRITABLE) : (mask & ~EventLoop::WRITABLE));
+    }
+
+    bool fail(const char* what)
+    {
+        m_failed = true;
+        m_error = std::string(what) + ": " + strerror(errno);
+        setWantWritable(false);
+        return false;
+    }
+
+    WriteCoalescer& m_owner;
+    int m_fd;
+    Options m_opts;
+    bool m_tcp;
+    int m_mss;
+    Mode m_mode;
+    std::deque<Chunk> m_chunks;
+    size_t m_headPos;              // 第一个块里已经写出的字节数
+    std::deque<Message> m_messages; // 还没离开本机的消息：在队列里，或者被 cork 扣在内核里
+    uint64_t m_appended;           // 以下都是从连接建立开始累计的字节偏移
+    uint64_t m_written;            // 已经写进内核
+    uint64_t m_released;           // 估算已经发出
+    size_t m_queuedFrom;           // m_messages 里第一条还没有完全写进内核的消息
+    uint64_t m_corkBase;           // 最近一次 cork 或 uncork 时的 m_written，之后写进内核的字节按 MSS 整段发出
+    uint64_t m_corkFullSegs;       // m_corkBase 之后已经发出的整段数
+    uint64_t m_deadline;           // cork 扣着的尾巴最晚什么时候必须发出，0 表示没有
+    uint64_t m_hold;               // 尾巴最多扣多久
+    bool m_scheduled;              // 在 owner 的待写列表里
+    bool m_wantWritable;
+    bool m_failed;
+    std::string m_error;
+    Stats m_stats;
+    LatencyHistogram m_latency;
+    // 当前决策窗口
+    uint64_t m_windowStart;
+    uint64_t m_windowBytes;
+    uint64_t m_windowMessages;
+    uint64_t m_windowFlushes;         // 写出了数据的 flush 次数，约等于有输出的 tick 数
+    uint64_t m_windowPlainSegs;       // NODELAY 下会发出的段数
+    uint64_t m_windowCorkSegs;        // CORK 下实际发出的段数 (估算)
+    LatencyHistogram m_windowQueue;   // write 到写进内核
+    LatencyHistogram m_windowLatency; // write 到离开本机
+    int m_cooldown;                   // 还要等几个窗口才重新尝试 CORK
+    int m_penalty;
+};
+
+inline void WriteCoalescer::flushAll()
+{
+    // 写的过程中可能有连接出错被释放，先换到一个单独的列表里
+    m_flushing.swap(m_pending);
+    for (size_t i = 0; i < m_flushing.size(); ++i)
+    {
+        CoalescedWriter* w = m_flushing[i];
+        w->m_scheduled = false;
+        w->flush();
+    }
+    m_flushing.clear();
+}
+
+inline void WriteCoalescer::checkDeadlines()
+{
+    uint64_t now = monotonicNs();
+    uint64_t next = UINT64_MAX;
+    for (size_t i = 0; i < m_corked.size();)
+    {
+        CoalescedWriter* w = m_corked[i];
+        if (w->m_deadline != 0 && due(w->m_deadline, now))
+        {
+            ++w->m_stats.deadlineFlushes;
+            w->uncork(now);
+        }
+        if (w->m_deadline == 0)
+        {
+            m_corked[i] = m_corked.back();
+            m_corked.pop_back();
+            continue;
+        }
+        next = std::min(next, w->m_deadline);
+        ++i;
+    }
+    if (next != UINT64_MAX)
+    {
+        armTimer(next, now);
+    }
+}
+
+#endif
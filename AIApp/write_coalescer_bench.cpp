@@ -0,0 +1,396 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "latency.h"
+#include "event_loop.h"
+#include "write_coalescer.h"
+
+// 输出合并层 (write_coalescer.h) 的 socket 策略扫描
+// 对每个 (--sizes 里的消息长度, --rates 里的速率) 组合，依次用 Default (Nagle)、NoDelay、Cork、Adaptive 四种策略
+// 在本机回环的一条 TCP 连接上发送 --seconds 秒：
+// - 发送端：一个 EventLoop；另一个线程每 --tick-us 微秒 post() 一次，模拟不断到来的事件，
+//   循环线程每次按速率补齐该发的消息 (速率为 0 时尽量多发，积压超过 1MB 就先不发)，
+//   每条消息开头带上生成时的 monotonicNs，这一轮结束时由 WriteCoalescer 合并写出
+// - 接收端：一个线程阻塞读，按消息长度切分，记录 "生成 -> 收到" 的端到端延迟
+// 每个组合列出各策略的送达速率、延迟分位点、每条消息的 sendmsg / setsockopt 次数和发出的 TCP 段数，
+// 最后选出 p99 不超过 --p99-us 的策略里送达速率最高的一个 (相差 2% 以内时取发出的段更少的)
+// 另外检查 cork 期限的定时器：每轮只写一条不满 MSS 的小消息，等它到期被 uncork，
+// 每次到期发出应该只需要几次 epoll_wait，而不是在期限前的最后一毫秒里反复 epoll_wait(0) 空转
+//
+// 回环的 MSS 有 64KB，和真实网络差得很远；默认用 TCP_MAXSEG 把连接的 MSS 压到 --mss (1448，以太网的典型值)
+
+struct Options {
+    std::vector<int> sizes{64, 512, 4096};            // 消息长度
+    std::vector<int> rates{1000, 20000, 200000, 0};    // 每秒消息数，0 表示不限速
+    double seconds = 1.0;                              // 每个组合每种策略的发送时长
+    uint64_t budgetUs = 2000;                          // 传给 CoalescedWriter 的延迟预算
+    uint64_t p99Us = 0;                                // 选择策略时的 p99 上限，0 表示等于预算
+    int tickUs = 100;                                  // 发送端事件循环被唤醒的间隔
+    int mss = 1448;                                    // 0 表示不改
+};
+
+struct RunResult {
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    double seconds = 0.0;
+    LatencyHistogram latency;
+    CoalescedWriter::Stats stats;
+    uint64_t segments = 0; // 发出的数据段数，内核不支持时为 0
+    bool ok = true;
+};
+
+static const char* policyName(CoalescedWriter::Policy policy) {
+    switch (policy) {
+    case CoalescedWriter::Policy::Default:
+        return "Default";
+    case CoalescedWriter::Policy::NoDelay:
+        return "NoDelay";
+    case CoalescedWriter::Policy::Cork:
+        return "Cork";
+    case CoalescedWriter::Policy::Adaptive:
+        return "Adaptive";
+    }
+    return "?";
+}
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--sizes N,N,...] [--rates N,N,...] [--seconds S] [--budget-us N] [--p99-us N]"
+              << " [--tick-us N] [--mss N]"
+              << std::endl;
+}
+
+static bool parseList(const char* value, std::vector<int>& out) {
+    out.clear();
+    const char* p = value;
+    while (*p) {
+        char* end;
+        long n = strtol(p, &end, 10);
+        if (end == p || n < 0) {
+            return false;
+        }
+        out.push_back((int)n);
+        if (*end != ',' && *end != '\0') {
+            return false;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return !out.empty();
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--sizes") == 0) {
+            if (!parseList(value, opts.sizes)) {
+                return false;
+            }
+        } else if (strcmp(arg, "--rates") == 0) {
+            if (!parseList(value, opts.rates)) {
+                return false;
+            }
+        } else if (strcmp(arg, "--seconds") == 0) {
+            opts.seconds = atof(value);
+        } else if (strcmp(arg, "--budget-us") == 0) {
+            opts.budgetUs = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--p99-us") == 0) {
+            opts.p99Us = strtoull(value, NULL, 10);
+        } else if (strcmp(arg, "--tick-us") == 0) {
+            opts.tickUs = atoi(value);
+        } else if (strcmp(arg, "--mss") == 0) {
+            opts.mss = atoi(value);
+        } else {
+            return false;
+        }
+    }
+    for (int size : opts.sizes) {
+        if (size < (int)sizeof(uint64_t)) {
+            return false;
+        }
+    }
+    if (opts.p99Us == 0) {
+        opts.p99Us = opts.budgetUs;
+    }
+    return opts.seconds > 0 && opts.budgetUs > 0 && opts.tickUs > 0 && opts.mss >= 0;
+}
+
+// 建一条本机回环的 TCP 连接，client 是发送端
+static bool connectPair(int mss, int& client, int& server) {
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0
+        || getsockname(listener, (struct sockaddr*)&addr, &len) != 0) {
+        perror("listen");
+        if (listener >= 0) {
+            close(listener);
+        }
+        return false;
+    }
+    client = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (mss > 0) {
+        setsockopt(client, IPPROTO_TCP, TCP_MAXSEG, &mss, sizeof(mss));
+    }
+    if (connect(client, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("connect");
+        close(client);
+        close(listener);
+        return false;
+    }
+    server = accept(listener, NULL, NULL);
+    close(listener);
+    if (server < 0) {
+        perror("accept");
+        close(client);
+        return false;
+    }
+    return true;
+}
+
+// 连接发出的数据段数 (tcp_info.tcpi_data_segs_out，Linux 4.6 起)
+// glibc 的 netinet/tcp.h 里的 tcp_info 没有这个字段，linux/tcp.h 又不能和它一起包含，按 linux/tcp.h 的布局取偏移
+static uint64_t dataSegmentsOut(int fd) {
+    const size_t DATA_SEGS_OUT = 156;
+    unsigned char info[256] = {};
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, info, &len) != 0 || len < DATA_SEGS_OUT + sizeof(uint32_t)) {
+        return 0;
+    }
+    uint32_t segs;
+    memcpy(&segs, info + DATA_SEGS_OUT, sizeof(segs));
+    return segs;
+}
+
+// 发送端的状态，post 的任务和文件事件的 clientData
+struct Sender {
+    EventLoop* loop;
+    CoalescedWriter* writer;
+    std::string message;
+    int rate;
+    uint64_t start;
+    uint64_t end;
+    uint64_t sent = 0;
+};
+
+static const size_t MAX_BACKLOG = 1 << 20;
+
+static void onWritable(EventLoop* loop, int fd, void* clientData, int mask) {
+    ((void)loop);
+    ((void)fd);
+    if (mask & EventLoop::WRITABLE) {
+        ((Sender*)clientData)->writer->onWritable();
+    }
+}
+
+// 在循环线程里执行：补齐到现在为止该发的消息
+static void produce(Sender* s) {
+    uint64_t now = monotonicNs();
+    uint64_t due = s->rate > 0 ? (uint64_t)((now - s->start) / 1e9 * s->rate) : s->sent + 4096;
+    while (s->sent < due && s->writer->pending() < MAX_BACKLOG) {
+        memcpy(&s->message[0], &now, sizeof(now));
+        if (!s->writer->write(s->message.data(), s->message.size())) {
+            s->loop->stop();
+            return;
+        }
+        ++s->sent;
+    }
+}
+
+static RunResult runOnce(const Options& opts, int size, int rate, CoalescedWriter::Policy policy) {
+    RunResult result;
+    int client;
+    int server;
+    if (!connectPair(opts.mss, client, server)) {
+        result.ok = false;
+        return result;
+    }
+
+    std::atomic<uint64_t> lastReceive{0};
+    std::thread receiver([&]() {
+        std::vector<char> buf(1 << 16);
+        std::string partial;
+        for (;;) {
+            ssize_t n = recv(server, buf.data(), buf.size(), 0);
+            if (n <= 0) {
+                break;
+            }
+            uint64_t now = monotonicNs();
+            partial.append(buf.data(), (size_t)n);
+            size_t pos = 0;
+            for (; pos + (size_t)size <= partial.size(); pos += (size_t)size) {
+                uint64_t stamp;
+                memcpy(&stamp, partial.data() + pos, sizeof(stamp));
+                result.latency.record(now - stamp);
+                ++result.received;
+            }
+            partial.erase(0, pos);
+            lastReceive.store(now);
+        }
+    });
+
+    EventLoop loop;
+    WriteCoalescer coalescer(loop);
+    CoalescedWriter::Options wo;
+    wo.policy = policy;
+    wo.latencyBudgetNs = opts.budgetUs * 1000;
+    CoalescedWriter writer(coalescer, client, wo);
+    Sender sender;
+    sender.loop = &loop;
+    sender.writer = &writer;
+    sender.message.assign((size_t)size, 'm');
+    sender.rate = rate;
+    sender.start = monotonicNs();
+    sender.end = sender.start + (uint64_t)(opts.seconds * 1e9);
+    loop.createFileEvent(client, EventLoop::NONE, onWritable, &sender);
+    std::thread ticker([&]() {
+        while (monotonicNs() < sender.end) {
+            std::this_thread::sleep_for(std::chrono::microseconds(opts.tickUs));
+            loop.post([&sender]() { produce(&sender); });
+        }
+        loop.stop();
+    });
+    loop.run();
+    ticker.join();
+    // 把剩下的写完，再关掉写端让接收线程退出
+    while (writer.pending() > 0 && !writer.failed()) {
+        loop.processEvents(10);
+    }
+    int off = 0;
+    setsockopt(client, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    shutdown(client, SHUT_WR);
+    receiver.join();
+    result.sent = sender.sent;
+    result.seconds = (lastReceive.load() - sender.start) / 1e9;
+    result.stats = writer.stats();
+    result.segments = dataSegmentsOut(client);
+    result.ok = !writer.failed() && result.received == result.sent;
+    if (writer.failed()) {
+        std::cerr << writer.error() << std::endl;
+    }
+    loop.deleteFileEvent(client);
+    close(client);
+    close(server);
+    return result;
+}
+
+// Cork 策略下每轮写一条 5 字节的消息并等它到期发出，返回平均每次到期发出调用了几次 epoll_wait
+static bool checkDeadlineWakeups(const Options& opts, double& pollsPerFlush) {
+    const int rounds = 50;
+    int client;
+    int server;
+    if (!connectPair(opts.mss, client, server)) {
+        return false;
+    }
+    EventLoop loop;
+    WriteCoalescer coalescer(loop);
+    CoalescedWriter::Options wo;
+    wo.policy = CoalescedWriter::Policy::Cork;
+    wo.latencyBudgetNs = 2500000;
+    CoalescedWriter writer(coalescer, client, wo);
+    loop.createFileEvent(client, EventLoop::NONE, onWritable, NULL);
+    bool ok = true;
+    uint64_t polls = 0;
+    for (int i = 0; i < rounds && ok; ++i) {
+        uint64_t flushes = writer.stats().deadlineFlushes;
+        uint64_t before = loop.pollCalls();
+        ok = writer.write("tick\n", 5);
+        // 期限 2.5ms，10ms 还没发出就是定时器丢了
+        uint64_t giveUp = monotonicNs() + 10000000ULL;
+        while (ok && writer.stats().deadlineFlushes == flushes) {
+            loop.processEvents(-1);
+            ok = monotonicNs() < giveUp && !writer.failed();
+        }
+        polls += loop.pollCalls() - before;
+    }
+    loop.deleteFileEvent(client);
+    close(client);
+    close(server);
+    pollsPerFlush = (double)polls / rounds;
+    return ok;
+}
+
+static void report(CoalescedWriter::Policy policy, const RunResult& r) {
+    double rate = r.seconds > 0 ? r.received / r.seconds : 0.0;
+    double perMsg = r.received ? 1.0 / r.received : 0.0;
+    printf("  %-8s %9.0f msg/s  p50 %8.1fus  p99 %8.1fus  max %8.1fus  sendmsg/msg %.3f  sockopt/msg %.4f  segs/msg %.3f",
+           policyName(policy), rate, r.latency.percentile(0.50) / 1000.0, r.latency.percentile(0.99) / 1000.0,
+           r.latency.max() / 1000.0, r.stats.writes * perMsg, r.stats.sockopts * perMsg, r.segments * perMsg);
+    if (policy == CoalescedWriter::Policy::Adaptive) {
+        printf("  cork windows %llu/%llu, %llu switches", (unsigned long long)r.stats.corkWindows,
+               (unsigned long long)r.stats.windows, (unsigned long long)r.stats.switches);
+    }
+    if (!r.ok) {
+        printf("  FAILED (%llu sent, %llu received)", (unsigned long long)r.sent, (unsigned long long)r.received);
+    }
+    printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+    Options opts;
+    if (!parseOptions(argc, argv, opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    const CoalescedWriter::Policy policies[] = {CoalescedWriter::Policy::Default, CoalescedWriter::Policy::NoDelay,
+                                                CoalescedWriter::Policy::Cork, CoalescedWriter::Policy::Adaptive};
+    double pollsPerFlush = 0.0;
+    bool ok = checkDeadlineWakeups(opts, pollsPerFlush) && pollsPerFlush <= 4.0;
+    printf("cork deadline flush: %.1f epoll_wait calls per flush%s\n\n", pollsPerFlush, ok ? "" : "  FAILED");
+    std::vector<std::string> verdicts;
+    for (int size : opts.sizes) {
+        for (int rate : opts.rates) {
+            printf("%d-byte messages, %s, MSS %d, budget %lluus\n", size,
+                   rate > 0 ? (std::to_string(rate) + " msg/s").c_str() : "unlimited", opts.mss,
+                   (unsigned long long)opts.budgetUs);
+            int bestIndex = -1;
+            double bestRate = 0.0;
+            double bestSegments = 0.0;
+            for (int i = 0; i < 4; ++i) {
+                RunResult r = runOnce(opts, size, rate, policies[i]);
+                report(policies[i], r);
+                ok = ok && r.ok;
+                if (!r.ok || r.latency.percentile(0.99) > opts.p99Us * 1000) {
+                    continue;
+                }
+                double delivered = r.received / r.seconds;
+                double segments = (double)(r.segments ? r.segments : r.stats.writes) / r.received;
+                bool better = bestIndex < 0 || delivered > bestRate * 1.02
+                              || (delivered >= bestRate * 0.98 && segments < bestSegments);
+                if (better) {
+                    bestIndex = i;
+                    bestRate = std::max(delivered, bestRate);
+                    bestSegments = segments;
+                }
+            }
+            char line[160];
+            snprintf(line, sizeof(line), "%6d B  %10s  %s", size,
+                     rate > 0 ? std::to_string(rate).c_str() : "unlimited",
+                     bestIndex >= 0 ? policyName(policies[bestIndex]) : "(none meets the p99 bound)");
+            verdicts.push_back(line);
+        }
+    }
+    printf("best throughput with p99 <= %lluus:\n", (unsigned long long)opts.p99Us);
+    for (const auto& v : verdicts) {
+        printf("  %s\n", v.c_str());
+    }
+    if (!ok) {
+        std::cerr << "Some runs lost data or failed" << std::endl;
+    }
+    return ok ? 0 : 1;
+}
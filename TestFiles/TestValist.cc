@@ -4,6 +4,50 @@
 
 using namespace std;
 
+// 输出先攒在一个缓冲区里，满了或者格式化结束时一次 fwrite，不再每个字符调用一次 putchar
+struct OutBuf
+{
+    char data[256];
+    size_t len;
+};
+
+static void out_flush(OutBuf* out)
+{
+    fwrite(out->data, 1, out->len, stdout);
+    out->len = 0;
+}
+
+static void out_put(OutBuf* out, char c)
+{
+    if(out->len == sizeof(out->data))
+    {
+        out_flush(out);
+    }
+    out->data[out->len++] = c;
+}
+
+// 输出无符号整数的十进制；至少输出 min_digits 位，不够时前面补 0 (小数部分要用)
+static void out_uint(OutBuf* out, unsigned long long v, int min_digits)
+{
+    char buffer[24];
+    int i = 0;
+    // 从最低位开始取，一直取到 v 为 0，所以多位数和 0 都能正确处理
+    do
+    {
+        buffer[i++] = (char)(v % 10) + '0';
+        v /= 10;
+    } while(v > 0);
+    while(i < min_digits)
+    {
+        buffer[i++] = '0';
+    }
+    // 数字现在逆序保存在 buffer 中，我们逆向输出即可
+    for(int j = i-1; j >= 0; --j)
+    {
+        out_put(out, buffer[j]);
+    }
+}
+
 void my_printf(const char* fmt, ...)
 {
     // va_list 全名是 variable argument list
@@ -16,6 +60,9 @@ void my_printf(const char* fmt, ...)
     // __builtin_va_start 是 GCC 内置的一个宏，它的定义在 GCC 的源码中
     va_start(args, fmt);
 
+    OutBuf out;
+    out.len = 0;
+
     // 现在 args 对象中就保存了 fmt 之后的所有参数
     while(*fmt) 
     {
@@ -28,83 +75,86 @@ void my_printf(const char* fmt, ...)
                 case 'd': {
                     // 代表我们要取出的是一个 int 类型的参数
                     int i = va_arg(args, int);
-                    // 使用 putchar 函数进行输出
-                    putchar(i + '0');
+                    // 原来的写法是 putchar(i + '0')，只对 0 到 9 正确
+                    // 负数先输出符号再取绝对值；INT_MIN 的绝对值超出了 int 的范围，所以转成 unsigned 再取反
+                    unsigned int u = (unsigned int)i;
+                    if(i < 0)
+                    {
+                        out_put(&out, '-');
+                        u = 0u - u;
+                    }
+                    out_uint(&out, u, 1);
                     break;
                 }
                 case 'c': {
                     // 代表我们要取出的是一个 char 类型的参数
                     char c = (char)va_arg(args, int);
-                    putchar(c);
+                    out_put(&out, c);
                     break;
                 }
                 case 's': {
                     char* s = va_arg(args, char*);
                     for(; *s; ++s)
                     {
-                        putchar(*s);
+                        out_put(&out, *s);
                     }
                     break;
                 }
                 case 'f': {
                     double d = va_arg(args, double);
-                    // 获取 double 类型变量的整数部分和小数部分
-                    int int_part = (int)d;
-                    double frac_part = d-int_part;
-
-                    
-                    if(int_part == 0)
+                    // 原来的写法把整数部分和小数部分分开输出，有两个问题：
+                    // 1. 小数部分 0.05 乘以 1000000 得到 50000，直接输出成了 "50000"，丢掉了前导的 0
+                    // 2. 直接截断而不是四舍五入，0.9999999 会输出成 "0.999999"
+                    // 现在先整体乘以 10^6 并四舍五入，再拆成整数部分和 6 位小数，进位自然进到整数部分
+                    if(d != d)
                     {
-                        putchar('0');
+                        out_put(&out, 'n'); out_put(&out, 'a'); out_put(&out, 'n');
+                        break;
                     }
-                    else
+                    if(d < 0)
                     {
-                        char buffer[20];
-                        int i = 0;
-                        // buffer 是用于输出结果的缓存
-                        while(int_part > 0)
-                        {
-                            buffer[i++] = (char)(int_part % 10) + '0';
-                            int_part /= 10;
-                        }
-                        // 整数部分现在保存在了 buffer 中，我们逆向输出即可
-                        for(int j = i-1; j >= 0; --j)
-                        {
-                            putchar(buffer[j]);
-                        }
+                        out_put(&out, '-');
+                        d = -d;
                     }
-                    // 输出小数点
-                    putchar('.');
-
-                    // 处理小数部分
-                    frac_part *= 1000000; // 我们保留六位小数
-                    int frac_int = (int)frac_part;
-                    if(frac_int == 0) {
-                        putchar('0');
-                    } else {
-                        char buffer[20];
-                        int i = 0;
-                        while (frac_int > 0) {
-                            buffer[i++] = (frac_int % 10) + '0';
-                            frac_int /= 10;
-                        }
-                        for(int j = i-1; j >= 0; j--)
+                    // 乘以 10^6 之后要放得进 unsigned long long，更大的数 (以及 inf) 交给标准库
+                    if(d >= 1.8e13)
+                    {
+                        char buffer[400];
+                        int n = snprintf(buffer, sizeof(buffer), "%f", d);
+                        for(int j = 0; j < n && j < (int)sizeof(buffer) - 1; ++j)
                         {
-                            putchar(buffer[j]);
+                            out_put(&out, buffer[j]);
                         }
+                        break;
                     }
+                    unsigned long long scaled = (unsigned long long)(d * 1000000 + 0.5);
+                    // 获取整数部分和小数部分
+                    out_uint(&out, scaled / 1000000, 1);
+                    // 输出小数点
+                    out_put(&out, '.');
+                    // 小数部分固定输出六位，不足六位时前面补 0
+                    out_uint(&out, scaled % 1000000, 6);
+                    break;
+                }
+                case '%': {
+                    out_put(&out, '%');
+                    break;
                 }
                 default:
+                    // 不认识的标签原样输出
+                    out_put(&out, '%');
+                    out_put(&out, *fmt);
                     break;
             }
         }
         // 如果当前字符不是 %，则直接输出
         else
         {
-            putchar(*fmt);
+            out_put(&out, *fmt);
         }
         ++fmt;
     }
+    out_flush(&out);
     // 最后不要忘记调用 va_end 宏关闭 args
     va_end(args);
     return;
@@ -113,6 +163,13 @@ void my_printf(const char* fmt, ...)
 int main()
 {
     double value = 123.456789;
-    my_printf("%f", value);
+    my_printf("%f\n", value);
+    // 与 printf 对比，每一组两行应该完全相同
+    my_printf("%d %d %d %d\n", 0, 7, 12345, -2147483647 - 1);
+    printf("%d %d %d %d\n", 0, 7, 12345, -2147483647 - 1);
+    my_printf("%f %f %f %f\n", 0.05, 0.9999999, -3.000001, 1e20);
+    printf("%f %f %f %f\n", 0.05, 0.9999999, -3.000001, 1e20);
+    my_printf("%s %c 100%%\n", "text", 'x');
+    printf("%s %c 100%%\n", "text", 'x');
     return 0;
 }
\ No newline at end of file
@@ -2,11 +2,20 @@
 #include <sw/redis++/redis++.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include "AIApp/redis_endpoint.h"
+#include "AIApp/near_cache.h"
 
-int main() {
-    // 链接到Redis服务器，IP 为本机回环地址，端口为6379，6379 是 redis 的默认端口
+int main(int argc, char *argv[]) {
+    // 链接到Redis服务器，默认 IP 为本机回环地址，端口为6379，6379 是 redis 的默认端口
     // 回环地址的意思是，网络通信的源和目标地址都是本机，这样就可以在本机上测试网络通信是否正常，通常用来检查本机的网卡等硬件设备是否正常工作
-    redisContext *c = redisConnect("127.0.0.1", 6379);
+    // 第一个参数 (或者 REDIS_ENDPOINT 环境变量) 可以指定别的地址，例如 unix:/tmp/redis.sock 走 Unix 域套接字，不经过 TCP 协议栈
+    RedisEndpoint endpoint = RedisEndpoint::fromEnv();
+    if (argc > 1 && !RedisEndpoint::parse(argv[1], endpoint)) {
+        printf("Usage: %s [HOST:PORT|unix:PATH]\n", argv[0]);
+        exit(1);
+    }
+    redisContext *c = endpoint.connect();
     // 如果链接失败，则打印错误信息并退出程序
     if (c == NULL || c->err) {
         if (c) {
@@ -27,6 +36,32 @@ int main() {
     printf("GET foo: %s\n", reply->str);
     freeReplyObject(reply);
 
+    // 客户端缓存：第一次 GET 访问 Redis 并开启跟踪，第二次直接读本地副本
+    // 别的连接修改 foo 后 Redis 推送失效通知，下一次 GET 又会访问 Redis 拿到新值
+    NearCache::Options options;
+    options.endpoint = endpoint;
+    NearCache nearCache(options);
+    std::string error;
+    if (!nearCache.start(&error)) {
+        printf("Near cache: %s\n", error.c_str());
+    } else {
+        CachedRedis cached(nearCache);
+        std::string value;
+        bool found;
+        for (int i = 0; i < 2; ++i) {
+            if (cached.get("foo", value, found, &error)) {
+                printf("cached GET foo: %s (%llu round trips so far)\n", value.c_str(), (unsigned long long)cached.roundTrips());
+            }
+        }
+        reply = (redisReply *)redisCommand(c, "SET %s %s", "foo", "hello again");
+        freeReplyObject(reply);
+        usleep(10000);
+        if (cached.get("foo", value, found, &error)) {
+            printf("cached GET foo after SET: %s (%llu round trips so far)\n", value.c_str(), (unsigned long long)cached.roundTrips());
+        }
+        nearCache.stop();
+    }
+
     redisFree(c);
     return 0;
 }
\ No newline at end of file
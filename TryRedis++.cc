@@ -1,9 +1,30 @@
 #include <sw/redis++/redis++.h>
 #include <iostream>
+#include "AIApp/redis_endpoint.h"
 
-int main() {
+// 把 RedisEndpoint 转成 redis++ 的连接参数，Unix 域套接字只需要路径
+static sw::redis::ConnectionOptions connectionOptions(const RedisEndpoint& endpoint) {
+    sw::redis::ConnectionOptions options;
+    if (endpoint.isUnix) {
+        options.type = sw::redis::ConnectionType::UNIX;
+        options.path = endpoint.path;
+    } else {
+        options.type = sw::redis::ConnectionType::TCP;
+        options.host = endpoint.host;
+        options.port = endpoint.port;
+    }
+    return options;
+}
+
+int main(int argc, char* argv[]) {
+    // 第一个参数 (或者 REDIS_ENDPOINT 环境变量) 指定地址，例如 127.0.0.1:6379 或者 unix:/tmp/redis.sock
+    RedisEndpoint endpoint = RedisEndpoint::fromEnv();
+    if (argc > 1 && !RedisEndpoint::parse(argv[1], endpoint)) {
+        std::cerr << "Usage: " << argv[0] << " [HOST:PORT|unix:PATH]" << std::endl;
+        return 1;
+    }
     try {
-        sw::redis::Redis redis("tcp://127.0.0.1:6379");
+        sw::redis::Redis redis(connectionOptions(endpoint));
 
         redis.set("foo", "bar");
 
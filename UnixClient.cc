@@ -1,41 +1,317 @@
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <cerrno>
+#include <string>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/resource.h>
 #include <unistd.h>
+#include "AIApp/event_loop.h"
+#include "AIApp/timing_wheel.h"
 
 #define SOCKET_PATH "/tmp/test_socket"
 
-int main() {
-    int client_fd;
-    struct sockaddr_un server_addr;
+// UnixServer 的压测客户端，单线程用同一个事件循环维持大量并发连接
+// 每个连接反复做一次 "发送 size 字节 -> 等待回显 size 字节" 的往返
+// --churn N 表示每个连接做完 N 次往返后关闭并重新连接，用来测每秒建连数；为 0 时连接一直保持
+// 服务器的积压队列满时非阻塞 connect 会返回 EAGAIN，缺少的连接由时间事件每 10ms 补一次；
+// connect 失败之后按指数退避暂停补连接，成功一次就恢复
+// --timeout 是每个连接的空闲超时：这么久既没有写出也没有收到任何数据就关闭连接 (由补连接的逻辑重新连上)
+// 每个连接一个定时器挂在时间轮 (AIApp/timing_wheel.h) 上，每次收发都重新计时，上万个连接时也只是 O(1) 的链表操作
+// 每秒打印一次：当前连接数、每秒建立的连接数、每秒完成的往返数、每秒收发的字节数
 
-    // 创建套接字
-    client_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (client_fd < 0) {
-        std::cerr << "Socket creation failed" << std::endl;
-        return 1;
+struct Options {
+    const char* path = SOCKET_PATH;
+    int connections = 10000; // 目标并发连接数
+    int size = 64;           // 每次往返发送的字节数
+    int durationSeconds = 10;
+    int churn = 0;           // 每个连接做多少次往返后重连，0 表示不重连
+    int connectPerTick = 1000; // 每 10ms 最多发起的连接数，避免一次性把服务器的积压队列打满
+    int timeoutMs = 5000;    // 每个连接的空闲超时，0 表示不检查
+};
+
+struct ClientConn {
+    int fd;
+    WheelTimer idle;     // 空闲超时
+    size_t toSend = 0;   // 当前这条消息还没写出的字节数
+    size_t toRecv = 0;   // 当前这条消息还没收到回显的字节数
+    int roundTrips = 0;
+};
+
+struct ClientStats {
+    long long active = 0;
+    unsigned long long connected = 0;
+    unsigned long long connectRetries = 0; // connect 返回 EAGAIN 的次数
+    unsigned long long failed = 0;         // connect 出错或者连接被意外关闭的次数
+    unsigned long long timeouts = 0;       // 因为空闲超时被关闭的连接数
+    unsigned long long roundTrips = 0;
+    unsigned long long bytesIn = 0;
+    unsigned long long bytesOut = 0;
+};
+
+static Options g_opts;
+static std::string g_message;
+static ClientStats g_stats;
+static ClientStats g_lastReport;
+static uint64_t g_lastReportNs = 0;
+static EventLoop* g_loop = NULL;
+// 时间轮的 tick 与补连接的时间事件一样是 10ms，在 clientCron 里推进
+static TimingWheel* g_wheel = NULL;
+static Backoff g_connectBackoff(10ULL * 1000 * 1000, 1000ULL * 1000 * 1000);
+static uint64_t g_nextConnectNs = 0; // connect 失败之后，这个时间之前不再补连接
+
+static void onSignal(int) {
+    if (g_loop) {
+        g_loop->stop();
     }
+}
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--path PATH] [--connections N] [--size BYTES] [--duration SECONDS] [--churn N]"
+              << " [--connect-per-tick N] [--timeout MS]" << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], Options& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--path") == 0) {
+            opts.path = value;
+        } else if (strcmp(arg, "--connections") == 0) {
+            opts.connections = atoi(value);
+        } else if (strcmp(arg, "--size") == 0) {
+            opts.size = atoi(value);
+        } else if (strcmp(arg, "--duration") == 0) {
+            opts.durationSeconds = atoi(value);
+        } else if (strcmp(arg, "--churn") == 0) {
+            opts.churn = atoi(value);
+        } else if (strcmp(arg, "--connect-per-tick") == 0) {
+            opts.connectPerTick = atoi(value);
+        } else if (strcmp(arg, "--timeout") == 0) {
+            opts.timeoutMs = atoi(value);
+        } else {
+            return false;
+        }
+    }
+    return opts.connections > 0 && opts.size > 0 && opts.durationSeconds > 0 && opts.churn >= 0 && opts.connectPerTick > 0
+           && opts.timeoutMs >= 0;
+}
+
+static uint64_t nowNs() {
+    return Monotonic::nowNs();
+}
+
+static void raiseFileLimit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static void closeConnection(EventLoop* loop, ClientConn* conn) {
+    g_wheel->cancel(&conn->idle);
+    loop->deleteFileEvent(conn->fd);
+    close(conn->fd);
+    delete conn;
+    --g_stats.active;
+}
+
+// 连接有了进展 (写出或者收到了数据)，空闲超时从现在重新计时
+static void touch(ClientConn* conn) {
+    if (g_opts.timeoutMs > 0) {
+        g_wheel->scheduleMs(&conn->idle, (uint64_t)g_opts.timeoutMs);
+    }
+}
+
+static void onIdleTimeout(TimingWheel* wheel, WheelTimer* timer, void* clientData) {
+    (void)wheel;
+    (void)timer;
+    ++g_stats.timeouts;
+    closeConnection(g_loop, static_cast<ClientConn*>(clientData));
+}
+
+// 把当前消息剩下的部分写到 EAGAIN 或者写完，连接出错时返回 false (连接已经被关闭)
+static bool flushMessage(EventLoop* loop, ClientConn* conn) {
+    while (conn->toSend > 0) {
+        const char* data = g_message.data() + (g_message.size() - conn->toSend);
+        ssize_t n = send(conn->fd, data, conn->toSend, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->toSend -= (size_t)n;
+            g_stats.bytesOut += (unsigned long long)n;
+            touch(conn);
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            ++g_stats.failed;
+            closeConnection(loop, conn);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool startMessage(EventLoop* loop, ClientConn* conn) {
+    conn->toSend = g_message.size();
+    conn->toRecv = g_message.size();
+    return flushMessage(loop, conn);
+}
 
-    // 设置服务器地址
+static void connectionHandler(EventLoop* loop, int fd, void* clientData, int mask);
+
+// 发起一个非阻塞连接，Unix 套接字的 connect 要么立即成功，要么在积压队列满时返回 EAGAIN
+static bool connectOne(EventLoop* loop) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        ++g_stats.failed;
+        return false;
+    }
+    struct sockaddr_un server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sun_family = AF_UNIX;
-    strncpy(server_addr.sun_path, SOCKET_PATH, sizeof(server_addr.sun_path) - 1);
+    strncpy(server_addr.sun_path, g_opts.path, sizeof(server_addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        if (errno == EAGAIN) {
+            ++g_stats.connectRetries;
+        } else {
+            ++g_stats.failed;
+        }
+        close(fd);
+        g_nextConnectNs = nowNs() + g_connectBackoff.next();
+        return false;
+    }
+    g_connectBackoff.reset();
+    ClientConn* conn = new ClientConn;
+    conn->fd = fd;
+    conn->idle.proc = onIdleTimeout;
+    conn->idle.clientData = conn;
+    if (!loop->createFileEvent(fd, EventLoop::READABLE | EventLoop::WRITABLE | EventLoop::EDGE, connectionHandler, conn)) {
+        ++g_stats.failed;
+        close(fd);
+        delete conn;
+        return false;
+    }
+    ++g_stats.active;
+    ++g_stats.connected;
+    touch(conn);
+    startMessage(loop, conn);
+    return true;
+}
+
+// 读到 EAGAIN 为止，一次往返完成后开始下一次 (或者重连)
+static void readEcho(EventLoop* loop, ClientConn* conn) {
+    char buffer[16 * 1024];
+    bool progressed = false;
+    while (true) {
+        ssize_t n = recv(conn->fd, buffer, sizeof(buffer), 0);
+        if (n > 0) {
+            g_stats.bytesIn += (unsigned long long)n;
+            conn->toRecv -= std::min(conn->toRecv, (size_t)n);
+            progressed = true;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            ++g_stats.failed;
+            closeConnection(loop, conn);
+            return;
+        }
+    }
+    if (progressed) {
+        touch(conn);
+    }
+    if (conn->toRecv > 0 || conn->toSend > 0) {
+        return;
+    }
+    ++conn->roundTrips;
+    ++g_stats.roundTrips;
+    if (g_opts.churn > 0 && conn->roundTrips >= g_opts.churn) {
+        closeConnection(loop, conn);
+        connectOne(loop);
+        return;
+    }
+    startMessage(loop, conn);
+}
+
+static void connectionHandler(EventLoop* loop, int fd, void* clientData, int mask) {
+    (void)fd;
+    ClientConn* conn = static_cast<ClientConn*>(clientData);
+    if (mask & EventLoop::READABLE) {
+        readEcho(loop, conn);
+    } else {
+        flushMessage(loop, conn);
+    }
+}
 
-    // 连接服务器
-    if (connect(client_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        std::cerr << "Socket connect failed" << std::endl;
-        close(client_fd);
+// 每 10ms 执行一次：触发到期的空闲超时，补足缺少的连接，每秒打印一次统计
+static int clientCron(EventLoop* loop, long long id, void* clientData) {
+    (void)id;
+    (void)clientData;
+    uint64_t now = nowNs();
+    g_wheel->advance(now);
+    for (int i = 0; i < g_opts.connectPerTick && g_stats.active < g_opts.connections && now >= g_nextConnectNs; ++i) {
+        if (!connectOne(loop)) {
+            break;
+        }
+    }
+    // 负载很高时时间事件会被推迟，按实际经过的时间计算速率
+    double seconds = (now - g_lastReportNs) / 1e9;
+    if (seconds >= 1.0) {
+        printf("conns=%lld connects/s=%.0f retries/s=%.0f round_trips/s=%.0f in=%.2fMB/s out=%.2fMB/s failed=%llu timeouts=%llu\n",
+               g_stats.active, (g_stats.connected - g_lastReport.connected) / seconds,
+               (g_stats.connectRetries - g_lastReport.connectRetries) / seconds, (g_stats.roundTrips - g_lastReport.roundTrips) / seconds,
+               (g_stats.bytesIn - g_lastReport.bytesIn) / 1048576.0 / seconds, (g_stats.bytesOut - g_lastReport.bytesOut) / 1048576.0 / seconds,
+               g_stats.failed, g_stats.timeouts);
+        fflush(stdout);
+        g_lastReport = g_stats;
+        g_lastReportNs = now;
+    }
+    return 10;
+}
+
+static int stopTimer(EventLoop* loop, long long id, void* clientData) {
+    (void)id;
+    (void)clientData;
+    loop->stop();
+    return EventLoop::NOMORE;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parseOptions(argc, argv, g_opts)) {
+        printUsage(argv[0]);
         return 1;
     }
+    raiseFileLimit();
+    g_message.assign((size_t)g_opts.size, 'x');
+    std::cout << "Clock: " << Monotonic::init() << std::endl;
+    TimingWheel wheel(10ULL * 1000 * 1000);
+    g_wheel = &wheel;
 
-    std::cout << "Connected to server" << std::endl;
+    EventLoop loop;
+    if (!loop.ok()) {
+        std::cerr << "Event loop creation failed" << std::endl;
+        return 1;
+    }
+    g_lastReportNs = nowNs();
+    loop.createTimeEvent(0, clientCron, NULL);
+    loop.createTimeEvent((long long)g_opts.durationSeconds * 1000, stopTimer, NULL);
 
-    // 发送数据
-    const char* message = "Hello, Server!";
-    write(client_fd, message, strlen(message));
+    g_loop = &loop;
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
 
-    // 关闭连接
-    close(client_fd);
+    std::cout << "Connecting " << g_opts.connections << " clients to " << g_opts.path << std::endl;
+    loop.run();
 
+    std::cout << "Total connects " << g_stats.connected << ", round trips " << g_stats.roundTrips
+              << ", failed " << g_stats.failed << ", timeouts " << g_stats.timeouts << std::endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -1,16 +1,582 @@
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <cerrno>
+#include <string>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/resource.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <vector>
+#include "AIApp/event_loop.h"
+#include "AIApp/uring.h"
 
 #define SOCKET_PATH "/tmp/test_socket"
 
-int main() {
-    int server_fd, client_fd;
+// 基于 ae 风格事件循环 (AIApp/event_loop.h) 的多客户端 Unix 套接字回显服务器
+// - 监听套接字和所有连接都是非阻塞的，用边缘触发注册一次 (读 + 写)，之后不再调用 epoll_ctl
+//   边缘触发下每次都要读 (写) 到 EAGAIN 为止，否则剩下的数据不会再有通知
+// - 每个连接有自己的读缓冲区和写缓冲区：读到的数据先进读缓冲区，处理 (回显) 之后放进写缓冲区，
+//   写不完的部分等可写事件；写缓冲区积压超过上限时暂停读取，写完之后再继续，慢客户端不会让内存无限增长
+// - 一个 100ms 的时间事件负责统计，每秒打印一次 连接数、每秒新建/关闭的连接数、每秒收发的字节数
+// 配套的压测客户端见 UnixClient.cc
+//
+// --engine uring 时改用 io_uring (AIApp/uring.h，系统头文件里没有 io_uring 时不编译这一部分)：
+// - 监听套接字上一个多次触发的 accept，每个连接一个多次触发的 recv，数据由内核放进注册好的缓冲区环，不需要每次 read
+// - 一轮完成事件处理完之后，每个连接收到的数据合并成一个 send，这一轮所有的 send 在下一次 io_uring_enter 时一起提交
+// - 写缓冲区积压超过上限时取消这个连接的 recv，写完之后重新提交
+// 两种引擎都统计系统调用次数，每秒打印 每条消息的系统调用数 (消息大小由 --msg-size 指定，与 UnixClient --size 一致)
+//
+// 对比：UnixServer --engine epoll|uring，另一个终端 UnixClient --connections 1000 (或 10000) --size 64
+
+// 写缓冲区积压超过这个大小时暂停读取
+static const size_t MAX_OUTBUF = 1024 * 1024;
+// 每次 read 的大小
+static const size_t READ_CHUNK = 16 * 1024;
+
+struct Connection {
+    int fd;
+    std::string inbuf;    // 读缓冲区：已经读到、还没处理的数据
+    std::string outbuf;   // 写缓冲区：等待写出的数据
+    size_t outpos = 0;    // outbuf 里已经写出的字节数
+    bool readPaused = false; // 因为写缓冲区积压而暂停了读取，内核里可能还有数据
+};
+
+struct ServerStats {
+    long long active = 0;
+    unsigned long long accepted = 0;
+    unsigned long long closed = 0;
+    unsigned long long bytesIn = 0;
+    unsigned long long bytesOut = 0;
+    unsigned long long syscalls = 0; // 服务器自己发起的系统调用 (不含 epoll_wait，它由事件循环统计)
+};
+
+struct ServerOptions {
+    const char* path = SOCKET_PATH;
+    bool uring = false;
+    int msgSize = 64; // 统计每条消息的系统调用数时使用的消息大小
+};
+
+static ServerOptions g_opts;
+static ServerStats g_stats;
+static ServerStats g_lastReport;
+static uint64_t g_lastReportNs = 0;
+// 文件描述符用完时 accept 会失败，边缘触发下不会再有通知，由时间事件重试
+static bool g_acceptPending = false;
+static EventLoop* g_loop = NULL;
+static volatile sig_atomic_t g_stop = 0;
+
+static void onSignal(int) {
+    g_stop = 1;
+    if (g_loop) {
+        g_loop->stop();
+    }
+}
+
+static uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void raiseFileLimit() {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+// 每秒打印一次统计，pollCalls 是引擎自己等待事件的系统调用次数 (epoll_wait 或 io_uring_enter)
+static void reportStats(uint64_t pollCalls) {
+    uint64_t now = nowNs();
+    double seconds = (now - g_lastReportNs) / 1e9;
+    if (seconds < 1.0) {
+        return;
+    }
+    static uint64_t lastPollCalls = 0;
+    unsigned long long syscalls = g_stats.syscalls - g_lastReport.syscalls + (pollCalls - lastPollCalls);
+    double messages = (double)(g_stats.bytesIn - g_lastReport.bytesIn) / g_opts.msgSize;
+    printf("conns=%lld accepted/s=%.0f closed/s=%.0f in=%.2fMB/s out=%.2fMB/s syscalls/s=%.0f syscalls/msg=%.3f\n",
+           g_stats.active, (g_stats.accepted - g_lastReport.accepted) / seconds, (g_stats.closed - g_lastReport.closed) / seconds,
+           (g_stats.bytesIn - g_lastReport.bytesIn) / 1048576.0 / seconds, (g_stats.bytesOut - g_lastReport.bytesOut) / 1048576.0 / seconds,
+           syscalls / seconds, messages > 0 ? syscalls / messages : 0.0);
+    fflush(stdout);
+    g_lastReport = g_stats;
+    g_lastReportNs = now;
+    lastPollCalls = pollCalls;
+}
+
+static void closeConnection(EventLoop* loop, Connection* conn) {
+    loop->deleteFileEvent(conn->fd);
+    close(conn->fd);
+    g_stats.syscalls += 2;
+    delete conn;
+    --g_stats.active;
+    ++g_stats.closed;
+}
+
+// 处理读缓冲区里的数据，这里只是原样回显
+static void processInput(Connection* conn) {
+    if (conn->outpos == conn->outbuf.size()) {
+        conn->outbuf.clear();
+        conn->outpos = 0;
+    }
+    conn->outbuf.append(conn->inbuf);
+    conn->inbuf.clear();
+}
+
+// 把写缓冲区写到 EAGAIN 或者写完，连接出错时返回 false (连接已经被关闭)
+static bool flushOutput(EventLoop* loop, Connection* conn) {
+    while (conn->outpos < conn->outbuf.size()) {
+        ssize_t n = send(conn->fd, conn->outbuf.data() + conn->outpos, conn->outbuf.size() - conn->outpos, MSG_NOSIGNAL);
+        ++g_stats.syscalls;
+        if (n > 0) {
+            conn->outpos += (size_t)n;
+            g_stats.bytesOut += (unsigned long long)n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            closeConnection(loop, conn);
+            return false;
+        }
+    }
+    if (conn->outpos == conn->outbuf.size()) {
+        conn->outbuf.clear();
+        conn->outpos = 0;
+    } else if (conn->outpos > conn->outbuf.size() / 2) {
+        // 已经写出的部分超过一半时整理一次，避免缓冲区只增不减
+        conn->outbuf.erase(0, conn->outpos);
+        conn->outpos = 0;
+    }
+    return true;
+}
+
+// 读到 EAGAIN (或者写缓冲区积压太多) 为止，连接关闭时返回 false
+static bool readInput(EventLoop* loop, Connection* conn) {
+    char buffer[READ_CHUNK];
+    while (true) {
+        if (conn->outbuf.size() - conn->outpos >= MAX_OUTBUF) {
+            conn->readPaused = true;
+            return true;
+        }
+        ssize_t n = recv(conn->fd, buffer, sizeof(buffer), 0);
+        ++g_stats.syscalls;
+        if (n > 0) {
+            g_stats.bytesIn += (unsigned long long)n;
+            conn->inbuf.append(buffer, (size_t)n);
+            processInput(conn);
+            if (!flushOutput(loop, conn)) {
+                return false;
+            }
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            conn->readPaused = false;
+            return true;
+        } else {
+            // 对端关闭或者出错
+            closeConnection(loop, conn);
+            return false;
+        }
+    }
+}
+
+static void connectionHandler(EventLoop* loop, int fd, void* clientData, int mask) {
+    (void)fd;
+    Connection* conn = static_cast<Connection*>(clientData);
+    if (mask & EventLoop::READABLE) {
+        readInput(loop, conn);
+        return;
+    }
+    if (!flushOutput(loop, conn)) {
+        return;
+    }
+    // 积压降到上限以下之后，继续读之前暂停时剩在内核里的数据
+    if (conn->readPaused && conn->outbuf.size() - conn->outpos < MAX_OUTBUF) {
+        readInput(loop, conn);
+    }
+}
+
+static void acceptAll(EventLoop* loop, int server_fd) {
+    while (true) {
+        int client_fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        ++g_stats.syscalls;
+        if (client_fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                if (!g_acceptPending) {
+                    std::cerr << "Accept failed: " << strerror(errno) << ", will retry" << std::endl;
+                }
+                g_acceptPending = true;
+                return;
+            }
+            // EAGAIN：这一批已经全部接受了
+            g_acceptPending = false;
+            return;
+        }
+        Connection* conn = new Connection;
+        conn->fd = client_fd;
+        ++g_stats.syscalls;
+        if (!loop->createFileEvent(client_fd, EventLoop::READABLE | EventLoop::WRITABLE | EventLoop::EDGE, connectionHandler, conn)) {
+            close(client_fd);
+            delete conn;
+            continue;
+        }
+        ++g_stats.active;
+        ++g_stats.accepted;
+    }
+}
+
+static void acceptHandler(EventLoop* loop, int fd, void* clientData, int mask) {
+    (void)clientData;
+    (void)mask;
+    acceptAll(loop, fd);
+}
+
+// 每 100ms 执行一次：重试积压的 accept，每秒打印一次统计
+static int serverCron(EventLoop* loop, long long id, void* clientData) {
+    (void)id;
+    if (g_acceptPending) {
+        acceptAll(loop, *static_cast<int*>(clientData));
+    }
+    // 负载很高时时间事件会被推迟，按实际经过的时间计算速率
+    reportStats(loop->pollCalls());
+    return 100;
+}
+
+static int runEpoll(int server_fd) {
+    EventLoop loop;
+    if (!loop.ok() || !loop.createFileEvent(server_fd, EventLoop::READABLE | EventLoop::EDGE, acceptHandler, NULL)) {
+        std::cerr << "Event loop creation failed" << std::endl;
+        return 1;
+    }
+    loop.createTimeEvent(100, serverCron, &server_fd);
+    g_loop = &loop;
+    loop.run();
+    g_loop = NULL;
+    // 连接对象由事件循环的注册表持有，进程马上退出，不再逐个释放
+    return 0;
+}
+
+#ifdef AIAPP_HAVE_IO_URING
+
+// io_uring 引擎，user_data 的低 3 位是操作类型，其余是连接对象的地址 (new 出来的对象至少 8 字节对齐)
+enum UringOp {
+    OP_ACCEPT = 1,
+    OP_RECV = 2,
+    OP_SEND = 3,
+    OP_CANCEL = 4
+};
+
+static const uint16_t BUFFER_GROUP = 0;
+static const unsigned BUFFER_COUNT = 4096; // 缓冲区环的大小，所有连接共用
+static const unsigned BUFFER_SIZE = 4096;
+
+struct UringConn {
+    int fd;
+    std::string pending;      // 已经收到、还没有开始发送的数据
+    std::string sending;      // 正在发送的数据，同一时间每个连接只有一个 send 在途，保证顺序
+    size_t sendPos = 0;
+    bool sendInflight = false;
+    bool recvActive = false;  // 多次触发的 recv 还在内核里
+    bool recvPaused = false;  // 因为积压取消了 recv
+    bool closing = false;     // 对端关闭或出错，等在途的操作都完成之后释放
+    bool queued = false;      // 已经在本轮的待发送或者待释放列表里
+};
+
+static uint64_t userData(UringConn* conn, UringOp op) {
+    return (uint64_t)(uintptr_t)conn | (uint64_t)op;
+}
+
+class UringServer {
+public:
+    explicit UringServer(int listenFd) : m_listenFd(listenFd), m_acceptArmed(false) {}
+
+    bool init() {
+        // io_uring 对非阻塞的文件直接返回 -EAGAIN 而不是等待就绪，监听套接字要改回阻塞模式
+        int flags = fcntl(m_listenFd, F_GETFL);
+        if (flags < 0 || fcntl(m_listenFd, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+            return false;
+        }
+        return m_ring.init(4096) && m_ring.setupBufferRing(BUFFER_GROUP, BUFFER_COUNT, BUFFER_SIZE);
+    }
+
+    int run() {
+        armAccept();
+        uint64_t lastAcceptRetryNs = 0;
+        while (!g_stop) {
+            // 一次系统调用：提交上一轮准备好的 send / recv / accept，并等待新的完成事件
+            int rc = m_ring.submitAndWait(1, 100);
+            if (rc < 0) {
+                std::cerr << "io_uring_enter failed: " << strerror(-rc) << std::endl;
+                return 1;
+            }
+            m_ring.forEachCqe([this](const struct io_uring_cqe& cqe) { handle(cqe); });
+            flushSends();
+            releaseClosed();
+            m_ring.commitBuffers();
+
+            uint64_t now = nowNs();
+            if (!m_acceptArmed && now - lastAcceptRetryNs >= 100000000ULL) {
+                lastAcceptRetryNs = now;
+                armAccept();
+            }
+            reportStats(m_ring.enterCalls());
+        }
+        return 0;
+    }
+
+private:
+    void armAccept() {
+        m_acceptArmed = m_ring.prepMultishotAccept(m_listenFd, OP_ACCEPT);
+    }
+
+    void armRecv(UringConn* conn) {
+        conn->recvActive = m_ring.prepMultishotRecv(conn->fd, BUFFER_GROUP, userData(conn, OP_RECV));
+    }
+
+    void handle(const struct io_uring_cqe& cqe) {
+        UringOp op = (UringOp)(cqe.user_data & 7);
+        UringConn* conn = reinterpret_cast<UringConn*>((uintptr_t)(cqe.user_data & ~(uint64_t)7));
+        bool more = cqe.flags & IORING_CQE_F_MORE;
+        switch (op) {
+            case OP_ACCEPT:
+                onAccept(cqe.res, more);
+                break;
+            case OP_RECV:
+                onRecv(conn, cqe, more);
+                break;
+            case OP_SEND:
+                onSend(conn, cqe.res);
+                break;
+            case OP_CANCEL:
+                break;
+        }
+    }
+
+    void onAccept(int res, bool more) {
+        if (res >= 0) {
+            UringConn* conn = new UringConn;
+            conn->fd = res;
+            armRecv(conn);
+            ++g_stats.active;
+            ++g_stats.accepted;
+        } else if (res == -EMFILE || res == -ENFILE) {
+            std::cerr << "Accept failed: " << strerror(-res) << ", will retry" << std::endl;
+        }
+        if (!more) {
+            // 多次触发的 accept 结束了 (通常是文件描述符用完)，间隔一段时间后重新提交
+            m_acceptArmed = false;
+        }
+    }
+
+    void onRecv(UringConn* conn, const struct io_uring_cqe& cqe, bool more) {
+        if (cqe.res > 0 && (cqe.flags & IORING_CQE_F_BUFFER)) {
+            uint16_t bid = (uint16_t)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            // 回显：数据拷贝进连接的待发送缓冲区，缓冲区马上还给内核
+            conn->pending.append(m_ring.buffer(bid), (size_t)cqe.res);
+            m_ring.recycleBuffer(bid);
+            g_stats.bytesIn += (unsigned long long)cqe.res;
+            queueSend(conn);
+            if (conn->recvActive && !conn->recvPaused && backlog(conn) >= MAX_OUTBUF) {
+                conn->recvPaused = true;
+                m_ring.prepCancel(userData(conn, OP_RECV), OP_CANCEL);
+            }
+        }
+        if (more) {
+            return;
+        }
+        conn->recvActive = false;
+        if (cqe.res == 0 || (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED)) {
+            // 对端关闭或者出错
+            markClosing(conn);
+        } else if (cqe.res == -ECANCELED && conn->recvPaused) {
+            // 因为积压被取消，通常写完之后在 onSend 里重新提交；
+            // 但如果取消的完成事件来得比最后一个 send 晚，onSend 那时 recv 还在途，没有提交，只能在这里提交
+            if (!conn->closing && !conn->sendInflight && backlog(conn) < MAX_OUTBUF) {
+                conn->recvPaused = false;
+                armRecv(conn);
+            }
+        } else if (!conn->closing) {
+            // 缓冲区环暂时用完 (-ENOBUFS) 或者内核提前结束了多次触发，重新提交
+            conn->recvPaused = false;
+            armRecv(conn);
+        }
+        // 关闭中的连接 (例如取消还在途时 send 出错) 最后结束的是 recv，由这里交给 releaseClosed，
+        // 否则 onSend 里的 queueRelease 已经错过，连接永远不会被释放
+        if (conn->closing) {
+            queueRelease(conn);
+        }
+    }
+
+    void onSend(UringConn* conn, int res) {
+        conn->sendInflight = false;
+        if (res < 0) {
+            markClosing(conn);
+            return;
+        }
+        g_stats.bytesOut += (unsigned long long)res;
+        conn->sendPos += (size_t)res;
+        if (conn->sendPos < conn->sending.size()) {
+            // 只写出了一部分，剩下的接着发
+            submitSend(conn);
+            return;
+        }
+        conn->sending.clear();
+        conn->sendPos = 0;
+        if (!conn->pending.empty()) {
+            queueSend(conn);
+        }
+        if (conn->recvPaused && !conn->recvActive && !conn->closing && backlog(conn) < MAX_OUTBUF) {
+            conn->recvPaused = false;
+            armRecv(conn);
+        }
+        if (conn->closing) {
+            queueRelease(conn);
+        }
+    }
+
+    static size_t backlog(const UringConn* conn) {
+        return conn->pending.size() + (conn->sending.size() - conn->sendPos);
+    }
+
+    void queueSend(UringConn* conn) {
+        if (!conn->queued) {
+            conn->queued = true;
+            m_dirty.push_back(conn);
+        }
+    }
+
+    void queueRelease(UringConn* conn) {
+        if (!conn->queued) {
+            conn->queued = true;
+            m_dirty.push_back(conn);
+        }
+    }
+
+    void markClosing(UringConn* conn) {
+        if (!conn->closing) {
+            conn->closing = true;
+            // recv 还在内核里时关闭读写让它结束，否则连接永远等不到释放
+            if (conn->recvActive) {
+                shutdown(conn->fd, SHUT_RDWR);
+                ++g_stats.syscalls;
+            }
+        }
+        queueRelease(conn);
+    }
+
+    void submitSend(UringConn* conn) {
+        conn->sendInflight = m_ring.prepSend(conn->fd, conn->sending.data() + conn->sendPos,
+                                             conn->sending.size() - conn->sendPos, userData(conn, OP_SEND));
+        if (!conn->sendInflight) {
+            markClosing(conn);
+        }
+    }
+
+    // 本轮收到数据的连接，每个连接把攒下的数据合并成一个 send
+    void flushSends() {
+        for (size_t i = 0; i < m_dirty.size(); ++i) {
+            UringConn* conn = m_dirty[i];
+            if (conn->closing || conn->sendInflight || conn->pending.empty()) {
+                continue;
+            }
+            conn->sending.swap(conn->pending);
+            conn->sendPos = 0;
+            submitSend(conn);
+        }
+    }
+
+    // 在途的操作都已经完成的关闭中连接在这里释放，放到最后是因为本轮的列表里可能还有它
+    void releaseClosed() {
+        for (UringConn* conn : m_dirty) {
+            conn->queued = false;
+        }
+        std::vector<UringConn*> dirty;
+        dirty.swap(m_dirty);
+        for (UringConn* conn : dirty) {
+            if (conn->closing && !conn->recvActive && !conn->sendInflight && !conn->queued) {
+                conn->queued = true; // 防止同一个连接在列表里出现两次时重复释放
+                close(conn->fd);
+                ++g_stats.syscalls;
+                --g_stats.active;
+                ++g_stats.closed;
+                m_freed.push_back(conn);
+            }
+        }
+        for (UringConn* conn : m_freed) {
+            delete conn;
+        }
+        m_freed.clear();
+    }
+
+    IoUring m_ring;
+    int m_listenFd;
+    bool m_acceptArmed;
+    std::vector<UringConn*> m_dirty; // 本轮需要发送或者可能需要释放的连接
+    std::vector<UringConn*> m_freed;
+};
+
+#endif
+
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [--engine epoll|uring] [--msg-size BYTES] [PATH]" << std::endl;
+}
+
+static bool parseOptions(int argc, char* argv[], ServerOptions& opts) {
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            opts.path = arg;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* value = argv[++i];
+        if (strcmp(arg, "--engine") == 0) {
+            if (strcmp(value, "epoll") == 0) {
+                opts.uring = false;
+            } else if (strcmp(value, "uring") == 0) {
+                opts.uring = true;
+            } else {
+                return false;
+            }
+        } else if (strcmp(arg, "--msg-size") == 0) {
+            opts.msgSize = atoi(value);
+        } else {
+            return false;
+        }
+    }
+    return opts.msgSize > 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (!parseOptions(argc, argv, g_opts)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+#ifndef AIAPP_HAVE_IO_URING
+    if (g_opts.uring) {
+        std::cerr << "Built without io_uring support" << std::endl;
+        return 1;
+    }
+#endif
+    const char* path = g_opts.path;
+    int server_fd;
     struct sockaddr_un server_addr;
 
-    // 创建套接字
-    server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    raiseFileLimit();
+
+    // 创建非阻塞的套接字
+    server_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server_fd < 0) {
         std::cerr << "Socket creation failed" << std::endl;
         return 1;
@@ -19,47 +585,45 @@ int main() {
     // 设置服务器地址
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sun_family = AF_UNIX;
-    strncpy(server_addr.sun_path, SOCKET_PATH, sizeof(server_addr.sun_path) - 1);
+    strncpy(server_addr.sun_path, path, sizeof(server_addr.sun_path) - 1);
 
     // 绑定套接字
-    unlink(SOCKET_PATH);
+    unlink(path);
     if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
         std::cerr << "Socket bind failed" << std::endl;
         close(server_fd);
         return 1;
     }
 
-    // 监听连接
-    if (listen(server_fd, 5) < 0) {
+    // 监听连接，积压队列取系统允许的最大值，压测时大量客户端会同时连接
+    if (listen(server_fd, SOMAXCONN) < 0) {
         std::cerr << "Socket listen failed" << std::endl;
         close(server_fd);
         return 1;
     }
 
-    std::cout << "Server is listening on " << SOCKET_PATH << std::endl;
-
-    // 接受客户端连接
-    client_fd = accept(server_fd, NULL, NULL);
-    if (client_fd < 0) {
-        std::cerr << "Socket accept failed" << std::endl;
-        close(server_fd);
-        return 1;
-    }
-
-    std::cout << "Client connected" << std::endl;
+    g_lastReportNs = nowNs();
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
 
-    // 接收数据
-    char buffer[256];
-    int bytes_read = read(client_fd, buffer, sizeof(buffer) - 1);
-    if (bytes_read > 0) {
-        buffer[bytes_read] = '\0';
-        std::cout << "Received: " << buffer << std::endl;
+    std::cout << "Server is listening on " << path << " (" << (g_opts.uring ? "io_uring" : "epoll") << ")" << std::endl;
+    int rc;
+#ifdef AIAPP_HAVE_IO_URING
+    if (g_opts.uring) {
+        UringServer server(server_fd);
+        rc = server.init() ? server.run() : 1;
+    } else {
+        rc = runEpoll(server_fd);
     }
+#else
+    rc = runEpoll(server_fd);
+#endif
 
-    // 关闭连接
-    close(client_fd);
+    std::cout << "Shutting down, total accepted " << g_stats.accepted << ", in " << g_stats.bytesIn
+              << " bytes, out " << g_stats.bytesOut << " bytes" << std::endl;
+    // 连接对象随进程退出释放，这里只关闭监听套接字
     close(server_fd);
-    unlink(SOCKET_PATH);
+    unlink(path);
 
-    return 0;
-}
\ No newline at end of file
+    return rc;
+}